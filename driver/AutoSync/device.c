@@ -57,6 +57,10 @@ NTSTATUS EchoDeviceCreate(PWDFDEVICE_INIT deviceInit)
     LOG("Echo, EchoDeviceCreate\n");
 
     WDF_OBJECT_ATTRIBUTES deviceAttributes;
+    WDF_OBJECT_ATTRIBUTES requestAttributes;
+    WDF_OBJECT_ATTRIBUTES fileAttributes;
+    WDF_FILEOBJECT_CONFIG fileConfig;
+    SYSTEM_INFO systemInfo;
     PDEVICE_CONTEXT deviceContext;
     WDF_PNPPOWER_EVENT_CALLBACKS pnpPowerCallbacks;
     WDFDEVICE device;
@@ -71,9 +75,7 @@ NTSTATUS EchoDeviceCreate(PWDFDEVICE_INIT deviceInit)
     //
     pnpPowerCallbacks.EvtDeviceSelfManagedIoInit    = EchoEvtDeviceSelfManagedIoStart;
     pnpPowerCallbacks.EvtDeviceSelfManagedIoSuspend = EchoEvtDeviceSelfManagedIoSuspend;
-
-    #pragma prefast(suppress: 28024, "Function used for both Init and Restart Callbacks")
-    pnpPowerCallbacks.EvtDeviceSelfManagedIoRestart = EchoEvtDeviceSelfManagedIoStart;
+    pnpPowerCallbacks.EvtDeviceSelfManagedIoRestart = EchoEvtDeviceSelfManagedIoRestart;
 
     //
     // Register the pnp and power callbacks. Power policy related callbacks will be registered
@@ -82,6 +84,26 @@ NTSTATUS EchoDeviceCreate(PWDFDEVICE_INIT deviceInit)
     //
     WdfDeviceInitSetPnpPowerEventCallbacks(deviceInit, &pnpPowerCallbacks);
 
+    //
+    // Every request carries its arrival time and lane so that the latency
+    // can be accounted when it is completed. The arrival time is taken in
+    // EchoEvtIoInCallerContext, before the request is queued.
+    // ÿЯ䵽ʱͨԱʱͳӳ١
+    // ʱŶ֮ǰEchoEvtIoInCallerContextлȡ
+    //
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&requestAttributes, REQUEST_CONTEXT);
+    WdfDeviceInitSetRequestAttributes(deviceInit, &requestAttributes);
+
+    WdfDeviceInitSetIoInCallerContextCallback(deviceInit, EchoEvtIoInCallerContext);
+
+    //
+    // Every file object carries the shard key that routes its reads and writes.
+    // ÿļЯ·дķƬ
+    //
+    WDF_FILEOBJECT_CONFIG_INIT(&fileConfig, EchoEvtDeviceFileCreate, WDF_NO_EVENT_CALLBACK, WDF_NO_EVENT_CALLBACK);
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&fileAttributes, FILE_CONTEXT);
+    WdfDeviceInitSetFileObjectConfig(deviceInit, &fileConfig, &fileAttributes);
+
     WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&deviceAttributes, DEVICE_CONTEXT);
 
     LOG("Echo, WdfDeviceCreate\n");
@@ -101,6 +123,46 @@ NTSTATUS EchoDeviceCreate(PWDFDEVICE_INIT deviceInit)
         //
         deviceContext = WdfObjectGet_DEVICE_CONTEXT(device);
         deviceContext->PrivateDeviceData = 0;
+        deviceContext->ControlQueue = NULL;
+        deviceContext->NextShardKey = 0;
+
+        //
+        // Load the tuning parameters from the registry
+        // עصŲ
+        //
+        EchoTuningLoad(device, &deviceContext->Tuning);
+
+        //
+        // Unless configured, one shard per processor, so the shards can run
+        // on every core
+        // ãÿһƬʹƬÿ
+        //
+        if (deviceContext->Tuning.ShardCount == 0) {
+            GetSystemInfo(&systemInfo);
+            deviceContext->Tuning.ShardCount = min(systemInfo.dwNumberOfProcessors, ECHO_MAX_SHARDS);
+        }
+        if (deviceContext->Tuning.ShardCount == 0) {
+            deviceContext->Tuning.ShardCount = 1;
+        }
+        deviceContext->ShardCount = deviceContext->Tuning.ShardCount;
+
+        RtlZeroMemory(&deviceContext->Stats, sizeof(deviceContext->Stats));
+        QueryPerformanceFrequency(&deviceContext->PerfFrequency);
+        EchoHostCpu(&deviceContext->HostUserUsBase,
+                    &deviceContext->HostKernelUsBase,
+                    &deviceContext->HostCyclesBase);
+
+        status = WdfSpinLockCreate(WDF_NO_OBJECT_ATTRIBUTES, &deviceContext->StatsLock);
+        if (!NT_SUCCESS(status)) {
+            LOG("Echo, WdfSpinLockCreate failed 0x%x\n", status);
+            return status;
+        }
+
+        status = WdfWaitLockCreate(WDF_NO_OBJECT_ATTRIBUTES, &deviceContext->TuningLock);
+        if (!NT_SUCCESS(status)) {
+            LOG("Echo, WdfWaitLockCreate failed 0x%x\n", status);
+            return status;
+        }
 
         //
         // Create a device interface so that application can find and talk to us.
@@ -132,9 +194,8 @@ Function:
 
 Routine Description:
 
-	This event is called by the Framework when the device is started
-	or restarted after a suspend operation.
-	豸ʱܻô¼ڹ
+	This event is called by the Framework when the device is started.
+	豸ʱܻô¼
 
 	This function is not marked pageable because this function is in the
 	device power up path. When a function is marked pagable and the code
@@ -159,21 +220,86 @@ NTSTATUS EchoEvtDeviceSelfManagedIoStart(IN WDFDEVICE device)
 {
     LOG("Echo, EchoEvtDeviceSelfManagedIoStart\n");
 
-    PQUEUE_CONTEXT queueContext = QueueGetContext(WdfDeviceGetDefaultQueue(device));
+    PDEVICE_CONTEXT deviceContext = WdfObjectGet_DEVICE_CONTEXT(device);
+    PQUEUE_CONTEXT queueContext;
     LARGE_INTEGER DueTime;
+    ULONG i;
 
     //
-    // Restart the queue and the periodic timer. We stopped them before going
-    // into low power state.
-    // кͶڼʱ ͹״̬֮ǰѽֹͣ
+    // Start the queue and the periodic timer of every shard.
+    // ÿƬĶкͶڼʱ
     //
-    LOG("Echo, WdfIoQueueStart\n");
-    WdfIoQueueStart(WdfDeviceGetDefaultQueue(device));
+    DueTime.QuadPart = WDF_REL_TIMEOUT_IN_MS(deviceContext->Tuning.StartDelayMs);
+
+    for (i = 0; i < deviceContext->ShardCount; i++) {
+        queueContext = QueueGetContext(deviceContext->ShardQueues[i]);
+
+        LOG("Echo, WdfIoQueueStart\n");
+        WdfIoQueueStart(deviceContext->ShardQueues[i]);
+
+        LOG("Echo, WdfTimerStart\n");
+        WdfTimerStart(queueContext->Timer,  DueTime.QuadPart);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/*
+Function:
+    EchoEvtDeviceSelfManagedIoRestart
+    豸ص
+
+Routine Description:
+
+	This event is called by the Framework when the device is restarted
+	after a suspend operation. The request parked before the suspend and
+	the echo data are still held in the queue context, so the timer is
+	armed to fire right away instead of waiting for the start delay.
+	豸ʱܻô¼ǰפͻ
+	ԱڶУ˼ʱΪǵȴӳ١
+
+	Like the start callback, this function is not marked pageable because
+	it is in the device power up path.
+	صһ˹λ豸ӵ·δΪɷҳ
+
+Arguments:
+
+	device - Handle to a framework device object.
+	         豸
 
-    DueTime.QuadPart = WDF_REL_TIMEOUT_IN_MS(100);
+Return Value:
+
+	NTSTATUS - Failures will result in the device stack being torn down.
+	           Ͻ豸ջ
+*/
+NTSTATUS EchoEvtDeviceSelfManagedIoRestart(IN WDFDEVICE device)
+{
+    LOG("Echo, EchoEvtDeviceSelfManagedIoRestart\n");
+
+    PDEVICE_CONTEXT deviceContext = WdfObjectGet_DEVICE_CONTEXT(device);
+    PQUEUE_CONTEXT queueContext;
+    ULONG i;
+
+    for (i = 0; i < deviceContext->ShardCount; i++) {
+        queueContext = QueueGetContext(deviceContext->ShardQueues[i]);
 
-    LOG("Echo, WdfTimerStart\n");
-    WdfTimerStart(queueContext->Timer,  DueTime.QuadPart);
+        //
+        // A tick of the stopped timer may still be on its way; it takes the
+        // queue lock too, so it sees either the suspended or the restarted state
+        // ֹͣʱһδ;Уͬȡ˿Ҫô
+        // ״̬Ҫô״̬
+        //
+        WdfObjectAcquireLock(deviceContext->ShardQueues[i]);
+        QueryPerformanceCounter(&queueContext->RestartTime);
+        queueContext->Suspended = FALSE;
+        WdfObjectReleaseLock(deviceContext->ShardQueues[i]);
+
+        LOG("Echo, WdfIoQueueStart\n");
+        WdfIoQueueStart(deviceContext->ShardQueues[i]);
+
+        LOG("Echo, WdfTimerStart\n");
+        WdfTimerStart(queueContext->Timer, WDF_REL_TIMEOUT_IN_MS(RESTART_DELAY));
+    }
 
     return STATUS_SUCCESS;
 }
@@ -205,36 +331,638 @@ NTSTATUS EchoEvtDeviceSelfManagedIoSuspend(IN WDFDEVICE device)
 {
     LOG("Echo, EchoEvtDeviceSelfManagedIoSuspend\n");
 
-    PQUEUE_CONTEXT queueContext = QueueGetContext(WdfDeviceGetDefaultQueue(device));
+    PDEVICE_CONTEXT deviceContext = WdfObjectGet_DEVICE_CONTEXT(device);
+    PQUEUE_CONTEXT queueContext;
+    LARGE_INTEGER startTime;
+    ULONG i;
 
     PAGED_CODE();
 
+    QueryPerformanceCounter(&startTime);
+
     //
-    // Before we stop the timer we should make sure there are no outstanding
-    // i/o. We need to do that because framework cannot suspend the device
-    // if there are requests owned by the driver. There are two ways to solve
-    // this issue: 1) We can wait for the outstanding I/O to be complete by the
-    // periodic timer 2) Register EvtIoStop callback on the queue and acknowledge
-    // the request to inform the framework that it's okay to suspend the device
-    // with outstanding I/O. In this sample we will use the 1st approach
-    // because it's pretty easy to do. We will restart the queue when the
-    // device is restarted.
-    // ֹͣʱ֮ǰӦȷûδɵI/O ҪΪӵ޷豸
-    // ַԽ⣺
+    // The framework cannot suspend the device while the driver owns requests
+    // it has not acknowledged. There are two ways to solve this issue:
+    // 1) We can wait for the outstanding I/O to be complete by the periodic
+    // timer 2) Register EvtIoStop callback on the queue and acknowledge the
+    // request to inform the framework that it's okay to suspend the device
+    // with outstanding I/O. Waiting for the timer stalls every power
+    // transition for up to a timer period, so we use the 2nd approach:
+    // EchoEvtIoStop keeps the parked request, the echo data stays in the
+    // queue context, and the queue is stopped without waiting for completions.
+    // ӵδȷϵʱ޷豸ַԽ⣺
     // 1ǿԵȴڼʱδɵI/O
     // 2ڶעEvtIoStopصȷϸ֪ͨܿʹδɵ I/O豸
-    //    ڴʾУǽʹõһַΪ 豸ǽС
+    //    ȴʱʹÿεԴתͣһʱڣʹõڶַ
+    //    EchoEvtIoStopפ󣬻ݱڶУֹͣʱȴɡ
     //
-    LOG("Echo, WdfIoQueueStopSynchronously\n");
-    WdfIoQueueStopSynchronously(WdfDeviceGetDefaultQueue(device));
+    for (i = 0; i < deviceContext->ShardCount; i++) {
+        queueContext = QueueGetContext(deviceContext->ShardQueues[i]);
+
+        //
+        // Set the flag under the queue lock the timer callback runs under, so
+        // a callback either finishes (and re-arms) before the flag is set or
+        // sees it once it gets the lock
+        // ڼʱصʱеĶλ˻صҪôλ֮ǰ
+        // ʱҪôڻ֮󿴵ñ־
+        //
+        WdfObjectAcquireLock(deviceContext->ShardQueues[i]);
+        queueContext->Suspended = TRUE;
+        WdfObjectReleaseLock(deviceContext->ShardQueues[i]);
+
+        LOG("Echo, WdfIoQueueStop\n");
+        WdfIoQueueStop(deviceContext->ShardQueues[i], NULL, NULL);
+
+        //
+        // Stop the watchdog timer without waiting for a running callback. A
+        // tick that has already fired still runs, but it sees Suspended and
+        // returns without touching the parked request or re-arming the timer.
+        // ֹͣŹʱȴеĻصѾһμʱԻУ
+        // ῴSuspendedפҲʱء
+        //
+        LOG("Echo, WdfTimerStop\n");
+        WdfTimerStop(queueContext->Timer, FALSE);
+    }
+
+    EchoStatsRecordSuspend(device, EchoElapsedUs(device, startTime.QuadPart));
+
+    return STATUS_SUCCESS;
+}
+
+/*
+Function:
+    EchoTuningValidate
+    УŲ
+
+Routine Description:
+
+    Checks that tuning parameters are within the supported bounds.
+    ŲǷֵ֧ķΧڡ
+
+Arguments:
+
+    tuning - Parameters to check.
+             ҪĲ
+
+Return Value:
+
+    BOOLEAN - TRUE if every parameter is valid.
+              вЧΪTRUE
+*/
+BOOLEAN EchoTuningValidate(IN PECHO_TUNING tuning)
+{
+    return tuning->TimerPeriodMs != 0 &&
+           tuning->TimerPeriodMs <= MAX_TIMER_PERIOD &&
+           tuning->MaxWriteLength != 0 &&
+           tuning->MaxWriteLength <= MAX_WRITE_LENGTH_CAP &&
+           tuning->PoolTag != 0 &&
+           tuning->StartDelayMs <= MAX_START_DELAY &&
+           tuning->ShardCount <= ECHO_MAX_SHARDS;
+}
+
+/*
+Function:
+    EchoTuningLoad
+    صŲEchoDeviceCreateá
+
+Routine Description:
+
+    Reads the tuning parameters from the device's registry key. The
+    defaults are written there by echoum.inx. Missing values keep the
+    compile-time defaults, and an invalid set falls back to them entirely.
+    豸עȡŲĬֵechoum.inxд롣ȱٵֵ
+    ʱĬֵЧĲȫ˵Ĭֵ
+
+Arguments:
+
+    device - Handle to a framework device object.
+             豸
+
+    tuning - Receives the parameters.
+             ղ
+
+Return Value:
+
+    VOID
+*/
+VOID EchoTuningLoad(
+    IN  WDFDEVICE    device,
+    OUT PECHO_TUNING tuning
+)
+{
+    LOG("Echo, EchoTuningLoad\n");
+
+    NTSTATUS status;
+    WDFKEY key;
+    ECHO_TUNING loaded;
+
+    DECLARE_CONST_UNICODE_STRING(timerPeriodName, L"TimerPeriod");
+    DECLARE_CONST_UNICODE_STRING(maxWriteLengthName, L"MaxWriteLength");
+    DECLARE_CONST_UNICODE_STRING(poolTagName, L"PoolTag");
+    DECLARE_CONST_UNICODE_STRING(startDelayName, L"StartDelay");
+    DECLARE_CONST_UNICODE_STRING(shardCountName, L"ShardCount");
+
+    tuning->TimerPeriodMs  = TIMER_PERIOD;
+    tuning->MaxWriteLength = MAX_WRITE_LENGTH;
+    tuning->PoolTag        = POOL_TAG;
+    tuning->StartDelayMs   = START_DELAY;
+    tuning->ShardCount     = 0;
+
+    status = WdfDeviceOpenRegistryKey(device,
+                                      PLUGPLAY_REGKEY_DEVICE,
+                                      KEY_READ,
+                                      WDF_NO_OBJECT_ATTRIBUTES,
+                                      &key);
+    if (!NT_SUCCESS(status)) {
+        LOG("Echo, WdfDeviceOpenRegistryKey failed 0x%x, using defaults\n", status);
+        return;
+    }
 
     //
-    // Stop the watchdog timer and wait for DPC to run to completion if it's already fired.
-    // ֹͣŹʱȴDPCϣ
+    // A value that cannot be read keeps its default
+    // ޷ȡֵĬֵ
     //
-    LOG("Echo, WdfTimerStop\n");
-    WdfTimerStop(queueContext->Timer, TRUE);
+    loaded = *tuning;
+    WdfRegistryQueryULong(key, &timerPeriodName, &loaded.TimerPeriodMs);
+    WdfRegistryQueryULong(key, &maxWriteLengthName, &loaded.MaxWriteLength);
+    WdfRegistryQueryULong(key, &poolTagName, &loaded.PoolTag);
+    WdfRegistryQueryULong(key, &startDelayName, &loaded.StartDelayMs);
+    WdfRegistryQueryULong(key, &shardCountName, &loaded.ShardCount);
+
+    WdfRegistryClose(key);
+
+    if (!EchoTuningValidate(&loaded)) {
+        LOG("Echo, Invalid tuning parameters in the registry, using defaults\n");
+        return;
+    }
+
+    *tuning = loaded;
+
+    LOG("Echo, Tuning TimerPeriod %d MaxWriteLength %d StartDelay %d ShardCount %d\n",
+        tuning->TimerPeriodMs, tuning->MaxWriteLength, tuning->StartDelayMs, tuning->ShardCount);
+
+    return;
+}
+
+/*
+Function:
+    EchoTuningGet
+    ȡŲ
+
+Routine Description:
+
+    Copies out the tuning parameters in use.
+    ƳʹõĵŲ
+
+Arguments:
+
+    device - Handle to a framework device object.
+             豸
+
+    tuning - Receives the parameters.
+             ղ
+
+Return Value:
+
+    VOID
+*/
+VOID EchoTuningGet(
+    IN  WDFDEVICE    device,
+    OUT PECHO_TUNING tuning
+)
+{
+    PDEVICE_CONTEXT deviceContext = WdfObjectGet_DEVICE_CONTEXT(device);
+
+    WdfWaitLockAcquire(deviceContext->TuningLock, NULL);
+    *tuning = deviceContext->Tuning;
+    WdfWaitLockRelease(deviceContext->TuningLock);
+
+    return;
+}
+
+/*
+Function:
+    EchoTuningSet
+    õŲ
+
+Routine Description:
+
+    Applies new tuning parameters on a live device. Each shard's copy is
+    replaced while holding that shard's queue presentation lock, so no
+    read, write, cancel or timer callback of the shard sees a partial
+    update. Requests already parked keep their state: a new timer period
+    takes effect when the timer re-arms itself, a new max write length
+    and pool tag apply to the next write. The shard count cannot change
+    on a live device and is ignored.
+    е豸ӦµĵŲÿƬĸڳи÷ƬĶг
+    ʱ滻˸÷ƬĶдȡʱصῴָ¡
+    פ󱣳״̬µļʱڼʱʱЧµ
+    д볤ȺͳرӦһд롣Ƭе豸ϸģԡ
+
+Arguments:
+
+    device - Handle to a framework device object.
+             豸
+
+    tuning - New parameters.
+             ²
+
+Return Value:
+
+    NTSTATUS - STATUS_INVALID_PARAMETER if a parameter is out of bounds.
+               ΧΪSTATUS_INVALID_PARAMETER
+*/
+NTSTATUS EchoTuningSet(
+    IN WDFDEVICE    device,
+    IN PECHO_TUNING tuning
+)
+{
+    LOG("Echo, EchoTuningSet\n");
+
+    PDEVICE_CONTEXT deviceContext = WdfObjectGet_DEVICE_CONTEXT(device);
+    ECHO_TUNING newTuning = *tuning;
+    ULONG i;
+
+    newTuning.ShardCount = deviceContext->ShardCount;
+
+    if (!EchoTuningValidate(&newTuning)) {
+        LOG("Echo, EchoTuningSet invalid parameters\n");
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    WdfWaitLockAcquire(deviceContext->TuningLock, NULL);
+
+    deviceContext->Tuning = newTuning;
+
+    for (i = 0; i < deviceContext->ShardCount; i++) {
+        WdfObjectAcquireLock(deviceContext->ShardQueues[i]);
+        QueueGetContext(deviceContext->ShardQueues[i])->Tuning = newTuning;
+        WdfObjectReleaseLock(deviceContext->ShardQueues[i]);
+    }
+
+    WdfWaitLockRelease(deviceContext->TuningLock);
+
+    LOG("Echo, Tuning TimerPeriod %d MaxWriteLength %d StartDelay %d\n",
+        newTuning.TimerPeriodMs, newTuning.MaxWriteLength, newTuning.StartDelayMs);
 
     return STATUS_SUCCESS;
 }
 
+/*
+Function:
+    EchoEvtDeviceFileCreate
+    ļص
+
+Routine Description:
+
+    Called when an application opens a handle to the device. Assigns the
+    new file object the next shard key, so handles are spread round-robin
+    over the shards. The application can change the key with
+    IOCTL_ECHO_SET_SHARD_KEY.
+    Ӧó豸ʱáΪµļһƬʹѯ
+    ʽֲƬϡӦóʹIOCTL_ECHO_SET_SHARD_KEYĸü
+
+Arguments:
+
+    device - Handle to a framework device object.
+             豸
+
+    request - Handle to the create request.
+              
+
+    fileObject - Handle to the new file object.
+                 ļ
+
+Return Value:
+
+    VOID
+*/
+VOID EchoEvtDeviceFileCreate(
+    IN WDFDEVICE     device,
+    IN WDFREQUEST    request,
+    IN WDFFILEOBJECT fileObject
+)
+{
+    LOG("Echo, EchoEvtDeviceFileCreate\n");
+
+    PDEVICE_CONTEXT deviceContext = WdfObjectGet_DEVICE_CONTEXT(device);
+
+    FileGetContext(fileObject)->ShardKey =
+        (ULONG)InterlockedIncrement(&deviceContext->NextShardKey) - 1;
+
+    WdfRequestComplete(request, STATUS_SUCCESS);
+
+    return;
+}
+
+/*
+Function:
+    EchoElapsedUs
+    㾭ʱ
+
+Routine Description:
+
+    Returns the microseconds elapsed since a performance counter value.
+    ĳֵܼ΢
+
+Arguments:
+
+    device - Handle to a framework device object.
+             豸
+
+    startTime - Performance counter value to measure from.
+                ʼֵܼ
+
+Return Value:
+
+    ULONGLONG - Elapsed microseconds.
+                ΢
+*/
+ULONGLONG EchoElapsedUs(
+    IN WDFDEVICE device,
+    IN LONGLONG  startTime
+)
+{
+    PDEVICE_CONTEXT deviceContext = WdfObjectGet_DEVICE_CONTEXT(device);
+    LARGE_INTEGER now;
+
+    QueryPerformanceCounter(&now);
+
+    return (ULONGLONG)(now.QuadPart - startTime) * 1000000 /
+           (ULONGLONG)deviceContext->PerfFrequency.QuadPart;
+}
+
+/*
+Function:
+    EchoStatsRecord
+    ¼ӳ
+
+Routine Description:
+
+    Accounts the arrival-to-completion time of a request in its lane.
+    Called just before the request is completed.
+    ͨͳӵﵽɵʱ䡣֮ǰá
+
+Arguments:
+
+    device - Handle to a framework device object.
+             豸
+
+    lane - Lane the request was serviced in.
+           ͨ
+
+    arrivalTime - Performance counter value taken when the request arrived.
+                  󵽴ʱȡֵܼ
+
+Return Value:
+
+    VOID
+*/
+VOID EchoStatsRecord(
+    IN WDFDEVICE device,
+    IN ECHO_LANE lane,
+    IN LONGLONG  arrivalTime
+)
+{
+    PDEVICE_CONTEXT deviceContext = WdfObjectGet_DEVICE_CONTEXT(device);
+    PECHO_LANE_STATS laneStats;
+    ULONGLONG latencyUs;
+    ULONG bucket;
+
+    latencyUs = EchoElapsedUs(device, arrivalTime);
+
+    // Bucket n holds [2^(n-1), 2^n) us
+    // Ͱn[2^(n-1), 2^n)΢
+    bucket = 0;
+    while (bucket < ECHO_LATENCY_BUCKETS - 1 && (latencyUs >> bucket) != 0) {
+        bucket++;
+    }
+
+    WdfSpinLockAcquire(deviceContext->StatsLock);
+
+    laneStats = &deviceContext->Stats.Lanes[lane];
+    laneStats->Requests++;
+    laneStats->TotalLatencyUs += latencyUs;
+    if (latencyUs > laneStats->MaxLatencyUs) {
+        laneStats->MaxLatencyUs = latencyUs;
+    }
+    laneStats->Histogram[bucket]++;
+
+    WdfSpinLockRelease(deviceContext->StatsLock);
+
+    return;
+}
+
+/*
+Function:
+    EchoHostCpu
+    ȡ̵CPU
+
+Routine Description:
+
+    Reads the user and kernel time of the driver host process and the
+    cycles it ran. A UMDF driver runs in a host process of its own, so
+    these are what the echo path costs on the driver side.
+    ȡ̵û̬ں̬ʱԼеUMDF
+    ԼУǾǻ·һĿ
+
+Arguments:
+
+    userUs - Receives the user time in microseconds.
+             û̬ʱ䣨΢룩
+
+    kernelUs - Receives the kernel time in microseconds.
+               ں̬ʱ䣨΢룩
+
+    cycles - Receives the cycles, 0 if the system does not count them.
+             ϵͳͳʱΪ0
+
+Return Value:
+
+    VOID
+*/
+VOID EchoHostCpu(
+    OUT PULONGLONG userUs,
+    OUT PULONGLONG kernelUs,
+    OUT PULONGLONG cycles
+)
+{
+    FILETIME creation, exit, kernel, user;
+    ULONG64 processCycles;
+
+    *userUs = 0;
+    *kernelUs = 0;
+    *cycles = 0;
+
+    // FILETIME counts 100 ns units
+    // FILETIME100Ϊλ
+    if (GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+        *userUs = (((ULONGLONG)user.dwHighDateTime << 32) | user.dwLowDateTime) / 10;
+        *kernelUs = (((ULONGLONG)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) / 10;
+    }
+
+    if (QueryProcessCycleTime(GetCurrentProcess(), &processCycles)) {
+        *cycles = processCycles;
+    }
+
+    return;
+}
+
+/*
+Function:
+    EchoStatsSnapshot
+    ȡͳƿ
+
+Routine Description:
+
+    Copies the current lane statistics out under the statistics lock, and
+    the host process CPU spent since the last reset.
+    ͳ¸ƵǰͨͳϢԼϴ̵CPU
+
+Arguments:
+
+    device - Handle to a framework device object.
+             豸
+
+    stats - Receives the snapshot.
+            տ
+
+Return Value:
+
+    VOID
+*/
+VOID EchoStatsSnapshot(
+    IN  WDFDEVICE   device,
+    OUT PECHO_STATS stats
+)
+{
+    PDEVICE_CONTEXT deviceContext = WdfObjectGet_DEVICE_CONTEXT(device);
+    ULONGLONG userUs, kernelUs, cycles;
+
+    EchoHostCpu(&userUs, &kernelUs, &cycles);
+
+    WdfSpinLockAcquire(deviceContext->StatsLock);
+    *stats = deviceContext->Stats;
+    stats->HostUserUs = userUs - deviceContext->HostUserUsBase;
+    stats->HostKernelUs = kernelUs - deviceContext->HostKernelUsBase;
+    stats->HostCycles = (cycles != 0) ? cycles - deviceContext->HostCyclesBase : 0;
+    WdfSpinLockRelease(deviceContext->StatsLock);
+
+    stats->ShardCount = deviceContext->ShardCount;
+
+    return;
+}
+
+/*
+Function:
+    EchoStatsReset
+    ͳ
+
+Routine Description:
+
+    Clears all lane statistics and restarts the host CPU count.
+    ͨͳϢ¿ʼͳCPU
+
+Arguments:
+
+    device - Handle to a framework device object.
+             豸
+
+Return Value:
+
+    VOID
+*/
+VOID EchoStatsReset(IN WDFDEVICE device)
+{
+    PDEVICE_CONTEXT deviceContext = WdfObjectGet_DEVICE_CONTEXT(device);
+    ULONGLONG userUs, kernelUs, cycles;
+
+    EchoHostCpu(&userUs, &kernelUs, &cycles);
+
+    WdfSpinLockAcquire(deviceContext->StatsLock);
+    RtlZeroMemory(&deviceContext->Stats, sizeof(deviceContext->Stats));
+    deviceContext->HostUserUsBase = userUs;
+    deviceContext->HostKernelUsBase = kernelUs;
+    deviceContext->HostCyclesBase = cycles;
+    WdfSpinLockRelease(deviceContext->StatsLock);
+
+    return;
+}
+
+/*
+Function:
+    EchoStatsRecordSuspend
+    ¼ʱ
+
+Routine Description:
+
+    Accounts a power transition and the time spent suspending.
+    ͳһεԴתѵʱ䡣
+
+Arguments:
+
+    device - Handle to a framework device object.
+             豸
+
+    suspendUs - Time spent in the suspend callback.
+                صѵʱ
+
+Return Value:
+
+    VOID
+*/
+VOID EchoStatsRecordSuspend(
+    IN WDFDEVICE device,
+    IN ULONGLONG suspendUs
+)
+{
+    PDEVICE_CONTEXT deviceContext = WdfObjectGet_DEVICE_CONTEXT(device);
+
+    LOG("Echo, Suspend took %llu us\n", suspendUs);
+
+    WdfSpinLockAcquire(deviceContext->StatsLock);
+    deviceContext->Stats.PowerTransitions++;
+    deviceContext->Stats.LastSuspendUs = suspendUs;
+    WdfSpinLockRelease(deviceContext->StatsLock);
+
+    return;
+}
+
+/*
+Function:
+    EchoStatsRecordResume
+    ¼ָʱ
+
+Routine Description:
+
+    Accounts the time from restart until the first timer tick, which is
+    when parked requests start completing again.
+    ͳƴһμʱפ¿ʼɣʱ䡣
+
+Arguments:
+
+    device - Handle to a framework device object.
+             豸
+
+    resumeUs - Time from restart to the first timer tick.
+               һμʱʱ
+
+Return Value:
+
+    VOID
+*/
+VOID EchoStatsRecordResume(
+    IN WDFDEVICE device,
+    IN ULONGLONG resumeUs
+)
+{
+    PDEVICE_CONTEXT deviceContext = WdfObjectGet_DEVICE_CONTEXT(device);
+
+    LOG("Echo, Resume took %llu us\n", resumeUs);
+
+    WdfSpinLockAcquire(deviceContext->StatsLock);
+    deviceContext->Stats.LastResumeUs = resumeUs;
+    WdfSpinLockRelease(deviceContext->StatsLock);
+
+    return;
+}
@@ -28,6 +28,37 @@ typedef struct _DEVICE_CONTEXT
     ULONG PrivateDeviceData;  // just a placeholder
                               // ֻһռλ
 
+    // Parallel queue for the control lane
+    // ͨĲж
+    WDFQUEUE      ControlQueue;
+
+    // Independent echo shards, each a sequential queue with its own timer
+    // ĻԷƬÿƬһԼʱĴж
+    ULONG         ShardCount;
+    WDFQUEUE      ShardQueues[ECHO_MAX_SHARDS];
+
+    // Tuning parameters in use, serialized by TuningLock. Every shard keeps
+    // its own copy in its queue context.
+    // ʹõĵŲTuningLockлÿƬбԼĸ
+    WDFWAITLOCK   TuningLock;
+    ECHO_TUNING   Tuning;
+
+    // Shard key handed to the next file object
+    // һļķƬ
+    volatile LONG NextShardKey;
+
+    // Per-lane latency statistics, protected by StatsLock
+    // ͨӳͳϢStatsLock
+    WDFSPINLOCK   StatsLock;
+    ECHO_STATS    Stats;
+    LARGE_INTEGER PerfFrequency;
+
+    // Host process counters when the statistics were last reset
+    // ϴͳʱ̵ļ
+    ULONGLONG     HostUserUsBase;
+    ULONGLONG     HostKernelUsBase;
+    ULONGLONG     HostCyclesBase;
+
 } DEVICE_CONTEXT, *PDEVICE_CONTEXT;
 
 //
@@ -38,6 +69,20 @@ typedef struct _DEVICE_CONTEXT
 //
 WDF_DECLARE_CONTEXT_TYPE(DEVICE_CONTEXT)
 
+//
+// This is the context that is placed on every file object.
+// Ƿÿļϵġ
+//
+typedef struct _FILE_CONTEXT
+{
+    // Selects the shard for reads and writes on this handle
+    // ѡþ϶дķƬ
+    ULONG ShardKey;
+
+} FILE_CONTEXT, *PFILE_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(FILE_CONTEXT, FileGetContext)
+
 //
 // Function to initialize the device and its callbacks
 // ʼ豸صĺ
@@ -50,7 +95,39 @@ NTSTATUS EchoDeviceCreate(PWDFDEVICE_INIT deviceInit);
 //
 EVT_WDF_DEVICE_SELF_MANAGED_IO_INIT EchoEvtDeviceSelfManagedIoStart;
 
+EVT_WDF_DEVICE_SELF_MANAGED_IO_RESTART EchoEvtDeviceSelfManagedIoRestart;
+
 EVT_WDF_DEVICE_SELF_MANAGED_IO_SUSPEND EchoEvtDeviceSelfManagedIoSuspend;
 
+EVT_WDF_DEVICE_FILE_CREATE EchoEvtDeviceFileCreate;
+
+//
+// Tuning parameters
+// Ų
+//
+VOID EchoTuningLoad(WDFDEVICE device, PECHO_TUNING tuning);
+
+VOID EchoTuningGet(WDFDEVICE device, PECHO_TUNING tuning);
+
+NTSTATUS EchoTuningSet(WDFDEVICE device, PECHO_TUNING tuning);
+
+//
+// Lane statistics
+// ͨͳ
+//
+ULONGLONG EchoElapsedUs(WDFDEVICE device, LONGLONG startTime);
+
+VOID EchoStatsRecord(WDFDEVICE device, ECHO_LANE lane, LONGLONG arrivalTime);
+
+VOID EchoStatsRecordSuspend(WDFDEVICE device, ULONGLONG suspendUs);
+
+VOID EchoStatsRecordResume(WDFDEVICE device, ULONGLONG resumeUs);
+
+VOID EchoHostCpu(PULONGLONG userUs, PULONGLONG kernelUs, PULONGLONG cycles);
+
+VOID EchoStatsSnapshot(WDFDEVICE device, PECHO_STATS stats);
+
+VOID EchoStatsReset(WDFDEVICE device);
+
 void LOG(const char* format, ...);
 
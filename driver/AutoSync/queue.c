@@ -14,12 +14,8 @@ Abstract:
 
 */
 
-#pragma once
-
 #include "driver.h"
 
-#define IOCTL_CODE_TEST CTL_CODE(FILE_DEVICE_UNKNOWN, 0x800, METHOD_BUFFERED, FILE_ANY_ACCESS)
-
 /*
 Function:
     EchoQueueInitialize
@@ -31,11 +27,135 @@ Routine Description:
     are configured in this function.
     ڴ˺, ÿ豸I/OȻص
 
-    A single default I/O queue is configured for serial request
-    processing, and a driver context memory allocation is created
-    to hold our structure QUEUE_CONTEXT.
-    ˵ĬϵI/Oڴһ
-    ڴǵĽṹQUEUE_CONTEXT
+    The echo state is split into ShardCount independent shards. Each
+    shard is a sequential queue with its own QUEUE_CONTEXT, timer and
+    echo buffer, synchronized by its own presentation lock, so shards
+    run on different cores at the same time. The default queue is a
+    parallel router that forwards every read and write to the shard
+    selected by the request's file object.
+    ״ֳ̬ShardCountķƬÿƬһжУӵԼ
+    QUEUE_CONTEXTʱͻԻԼĳͬ˸Ƭ
+    ͬʱڲͬĺСĬ϶һ·ɶУÿд
+    תļѡķƬ
+
+    Device control requests are routed to a second, parallel queue (the
+    control lane) so that they are never held behind the bulk reads and
+    writes waiting in the sequential queue for the timer.
+    豸·ɵڶжУͨԶᱻ
+    ڴжеȴʱд
+
+Arguments:
+
+    device - Handle to a framework device object.
+             豸
+
+Return Value:
+
+	NTSTATUS
+*/
+NTSTATUS EchoQueueInitialize(WDFDEVICE device)
+{
+    LOG("Echo, EchoQueueInitialize\n");
+
+    WDFQUEUE queue;
+    NTSTATUS status;
+    ULONG i;
+    PDEVICE_CONTEXT deviceContext = WdfObjectGet_DEVICE_CONTEXT(device);
+    WDF_IO_QUEUE_CONFIG    queueConfig;
+
+    //
+    // Configure a default queue so that requests that are not
+    // configure-fowarded using WdfDeviceConfigureRequestDispatching to goto
+    // other queues get dispatched here. It only routes requests to the
+    // shards and holds no state, so it does not need a synchronization scope.
+    // ȱʡУԱʹWdfDeviceConfigureRequestDispatchingת
+    // δתڴ˴ɡֻ·ɵƬκ״̬
+    // ˲ҪͬΧ
+    //
+    WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(
+        &queueConfig,
+        WdfIoQueueDispatchParallel
+        );
+
+    queueConfig.EvtIoDefault = EchoEvtIoRoute;
+
+    LOG("Echo, WdfIoQueueCreate router\n");
+    status = WdfIoQueueCreate(
+                 device,
+                 &queueConfig,
+                 WDF_NO_OBJECT_ATTRIBUTES,
+                 &queue
+                 );
+
+    if( !NT_SUCCESS(status) ) {
+        LOG("Echo, WdfIoQueueCreate router failed 0x%x\n",status);
+        return status;
+    }
+
+    //
+    // Create the shards
+    // Ƭ
+    //
+    for (i = 0; i < deviceContext->ShardCount; i++) {
+        status = EchoShardQueueCreate(device, &deviceContext->ShardQueues[i]);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+    }
+
+    //
+    // Create the control lane. It is a parallel queue without a
+    // synchronization scope, so IOCTLs are presented as soon as they arrive
+    // and never take the bulk queue's presentation lock. The number of
+    // requests presented at once is bounded so the bulk lane keeps its
+    // share of the host threads.
+    // ͨûͬΧĲжУIOCTLһͱ֣
+    // Զȡеĳͬʱֵ޵ģ
+    // ܱͨӦõ̡߳
+    //
+    WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchParallel);
+    queueConfig.EvtIoDeviceControl = EvtIoDeviceControl;
+    queueConfig.Settings.Parallel.NumberOfPresentedRequests = CONTROL_LANE_DEPTH;
+
+    LOG("Echo, WdfIoQueueCreate control lane\n");
+    status = WdfIoQueueCreate(
+                 device,
+                 &queueConfig,
+                 WDF_NO_OBJECT_ATTRIBUTES,
+                 &deviceContext->ControlQueue
+                 );
+
+    if( !NT_SUCCESS(status) ) {
+        LOG("Echo, WdfIoQueueCreate control lane failed 0x%x\n",status);
+        return status;
+    }
+
+    status = WdfDeviceConfigureRequestDispatching(
+                 device,
+                 deviceContext->ControlQueue,
+                 WdfRequestTypeDeviceIoControl
+                 );
+
+    if( !NT_SUCCESS(status) ) {
+        LOG("Echo, WdfDeviceConfigureRequestDispatching failed 0x%x\n",status);
+        return status;
+    }
+
+    return status;
+}
+
+/*
+Function:
+    EchoShardQueueCreate
+    ƬУEchoQueueInitializeá
+
+Routine Description:
+
+    Creates one shard: a sequential queue for serial request processing,
+    with a driver context memory allocation to hold our structure
+    QUEUE_CONTEXT, and the timer that completes its requests.
+    һƬһڴĴжУбǵĽṹ
+    QUEUE_CONTEXTڴ䣬Լļʱ
 
     This memory may be used by the driver automatically synchronized
     by the queue's presentation lock.
@@ -52,28 +172,32 @@ Arguments:
     device - Handle to a framework device object.
              豸
 
+    pQueue - Receives the shard queue.
+             շƬ
+
 Return Value:
 
 	NTSTATUS
 */
-NTSTATUS EchoQueueInitialize(WDFDEVICE device)
+NTSTATUS EchoShardQueueCreate(
+    IN  WDFDEVICE device,
+    OUT WDFQUEUE* pQueue
+    )
 {
-    LOG("Echo, EchoQueueInitialize\n");
+    LOG("Echo, EchoShardQueueCreate\n");
 
     WDFQUEUE queue;
     NTSTATUS status;
     PQUEUE_CONTEXT queueContext;
+    PDEVICE_CONTEXT deviceContext = WdfObjectGet_DEVICE_CONTEXT(device);
     WDF_IO_QUEUE_CONFIG    queueConfig;
     WDF_OBJECT_ATTRIBUTES  queueAttributes;
 
     //
-    // Configure a default queue so that requests that are not
-    // configure-fowarded using WdfDeviceConfigureRequestDispatching to goto
-    // other queues get dispatched here.
-    // ȱʡУԱʹWdfDeviceConfigureRequestDispatchingת
-    // δתڴ˴ɡ
+    // Requests reach the shard only through WdfRequestForwardToIoQueue
+    // ֻͨWdfRequestForwardToIoQueueƬ
     //
-    WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(
+    WDF_IO_QUEUE_CONFIG_INIT(
         &queueConfig,
         WdfIoQueueDispatchSequential
         );
@@ -81,7 +205,8 @@ NTSTATUS EchoQueueInitialize(WDFDEVICE device)
     // עждص
     queueConfig.EvtIoRead   = EchoEvtIoRead;
     queueConfig.EvtIoWrite  = EchoEvtIoWrite;
-    queueConfig.EvtIoDeviceControl = EvtIoDeviceControl;
+    queueConfig.EvtIoStop   = EchoEvtIoStop;
+    queueConfig.EvtIoDeviceControl = EchoEvtIoTraced;
 
     //
     // Fill in a callback for destroy, and our QUEUE_CONTEXT size
@@ -119,6 +244,9 @@ NTSTATUS EchoQueueInitialize(WDFDEVICE device)
     queueContext->Timer = NULL;
     queueContext->CurrentRequest = NULL;
     queueContext->CurrentStatus = STATUS_INVALID_DEVICE_REQUEST;
+    queueContext->Suspended = FALSE;
+    queueContext->RestartTime.QuadPart = 0;
+    queueContext->Tuning = deviceContext->Tuning;
 
     //
     // Create the queue timer
@@ -130,9 +258,171 @@ NTSTATUS EchoQueueInitialize(WDFDEVICE device)
         return status;
     }
 
+    *pQueue = queue;
+
     return status;
 }
 
+/*
+Function:
+    EchoEvtIoRoute
+    ·ɻص
+
+Routine Description:
+
+    Called for every read and write presented by the default queue, and
+    by the control lane for traced echoes. Forwards the request to the
+    shard chosen by the shard key of its file object. Requests without a
+    file object go to shard 0.
+    Ĭ϶гֵÿд󶼻ô˻صͨҲΪٻԵ
+    תļķƬѡķƬûļƬ0
+
+Arguments:
+
+    queue - Handle to the default queue.
+            Ĭ϶о
+
+    request - Handle to a framework request object.
+              
+
+Return Value:
+
+    VOID
+*/
+VOID EchoEvtIoRoute(
+    IN WDFQUEUE   queue,
+    IN WDFREQUEST request
+)
+{
+    NTSTATUS status;
+    PDEVICE_CONTEXT deviceContext = WdfObjectGet_DEVICE_CONTEXT(WdfIoQueueGetDevice(queue));
+    WDFFILEOBJECT fileObject = WdfRequestGetFileObject(request);
+    ULONG shardKey = 0;
+
+    if (fileObject != NULL) {
+        shardKey = FileGetContext(fileObject)->ShardKey;
+    }
+
+    status = WdfRequestForwardToIoQueue(
+                 request,
+                 deviceContext->ShardQueues[shardKey % deviceContext->ShardCount]
+                 );
+
+    if (!NT_SUCCESS(status)) {
+        LOG("Echo, WdfRequestForwardToIoQueue failed 0x%x\n", status);
+        EchoCompleteRequest(request, status, 0L);
+    }
+
+    return;
+}
+
+/*
+Function:
+    EchoEvtIoInCallerContext
+    󵽴ص
+
+Routine Description:
+
+    Called for every I/O request before it is queued. Stamps the arrival
+    time and lane on the request so that the queueing delay is part of the
+    latency accounted at completion, then hands the request back to the
+    framework for dispatching.
+    ÿI/OŶ֮ǰáϼ¼ʱͨԱŶӳ
+    ʱͳƵӳ٣Ȼ󽻻ܽзɡ
+
+Arguments:
+
+    device - Handle to a framework device object.
+             豸
+
+    request - Handle to a framework request object.
+              
+
+Return Value:
+
+    VOID
+*/
+VOID EchoEvtIoInCallerContext(
+    IN WDFDEVICE  device,
+    IN WDFREQUEST request
+)
+{
+    NTSTATUS status;
+    PREQUEST_CONTEXT requestContext = RequestGetContext(request);
+    WDF_REQUEST_PARAMETERS params;
+
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(request, &params);
+
+    QueryPerformanceCounter(&requestContext->ArrivalTime);
+    requestContext->Lane = (params.Type == WdfRequestTypeDeviceIoControl) ?
+                           EchoLaneControl : EchoLaneBulk;
+    requestContext->Traced = FALSE;
+
+    status = WdfDeviceEnqueueRequest(device, request);
+    if (!NT_SUCCESS(status)) {
+        LOG("Echo, WdfDeviceEnqueueRequest failed 0x%x\n", status);
+        WdfRequestComplete(request, status);
+    }
+
+    return;
+}
+
+/*
+Function:
+    EchoCompleteRequest
+    
+
+Routine Description:
+
+    Completes a request and accounts its latency in the lane it was
+    serviced in. A traced request that succeeded gets its last stamp and
+    carries all of them back in the header of its output buffer.
+    󣬲ڴͨͳӳ١ɹĸ¼һ
+    ʱͷȫʱ
+
+Arguments:
+
+    request - Handle to a framework request object.
+              
+
+    status - Completion status.
+             ״̬
+
+    information - Number of bytes transferred.
+                  ֽ
+
+Return Value:
+
+    VOID
+*/
+VOID EchoCompleteRequest(
+    IN WDFREQUEST request,
+    IN NTSTATUS   status,
+    IN ULONG_PTR  information
+)
+{
+    PREQUEST_CONTEXT requestContext = RequestGetContext(request);
+    PECHO_TRACED_HEADER header;
+
+    if (requestContext->Traced && NT_SUCCESS(status) &&
+        NT_SUCCESS(WdfRequestRetrieveOutputBuffer(request, sizeof(ECHO_TRACED_HEADER),
+                                                  (PVOID*)&header, NULL))) {
+        EchoStampRequest(request, EchoStageComplete);
+        RtlCopyMemory(header->Stamps, requestContext->Stamps, sizeof(header->Stamps));
+    }
+
+    if (requestContext->ArrivalTime.QuadPart != 0) {
+        EchoStatsRecord(WdfIoQueueGetDevice(WdfRequestGetIoQueue(request)),
+                        requestContext->Lane,
+                        requestContext->ArrivalTime.QuadPart);
+    }
+
+    WdfRequestCompleteWithInformation(request, status, information);
+
+    return;
+}
+
 /*
 Function:
     EchoEvtIoRead
@@ -190,7 +480,7 @@ VOID EchoEvtIoRead(
     // ûݿɶȡ
     //
     if ((queueContext->WriteMemory == NULL)) {
-        WdfRequestCompleteWithInformation(request, STATUS_SUCCESS, (ULONG_PTR)0L);
+        EchoCompleteRequest(request, STATUS_SUCCESS, (ULONG_PTR)0L);
         return;
     }
 
@@ -213,7 +503,7 @@ VOID EchoEvtIoRead(
     if (!NT_SUCCESS(status)) {
         LOG("Echo, EchoEvtIoRead Could not get request memory buffer 0x%x\n", status);
         WdfVerifierDbgBreakPoint();
-        WdfRequestCompleteWithInformation(request, status, 0L);
+        EchoCompleteRequest(request, status, 0L);
 
         return;
     }
@@ -227,7 +517,7 @@ VOID EchoEvtIoRead(
     );
     if (!NT_SUCCESS(status)) {
         LOG("Echo, EchoEvtIoRead: WdfMemoryCopyFromBuffer failed 0x%x\n", status);
-        WdfRequestComplete(request, status);
+        EchoCompleteRequest(request, status, 0L);
         return;
     }
 
@@ -302,10 +592,10 @@ VOID EchoEvtIoWrite(
     LOG("Echo, EchoEvtIoWrite Called! Queue 0x%p, Request 0x%p Length %d\n",
         queue, request, length);
 
-    if (length > MAX_WRITE_LENGTH) {
+    if (length > queueContext->Tuning.MaxWriteLength) {
         LOG("Echo, EchoEvtIoWrite Buffer Length to big %d, Max is %d\n",
-            length, MAX_WRITE_LENGTH);
-        WdfRequestCompleteWithInformation(request, STATUS_BUFFER_OVERFLOW, 0L);
+            length, queueContext->Tuning.MaxWriteLength);
+        EchoCompleteRequest(request, STATUS_BUFFER_OVERFLOW, 0L);
         return;
     }
 
@@ -316,7 +606,7 @@ VOID EchoEvtIoWrite(
         LOG("Echo, EchoEvtIoWrite Could not get request memory buffer 0x%x\n",
             Status);
         WdfVerifierDbgBreakPoint();
-        WdfRequestComplete(request, Status);
+        EchoCompleteRequest(request, Status, 0L);
         return;
     }
 
@@ -329,7 +619,7 @@ VOID EchoEvtIoWrite(
 
     Status = WdfMemoryCreate(WDF_NO_OBJECT_ATTRIBUTES,
         NonPagedPoolNx,
-        'sam1',
+        queueContext->Tuning.PoolTag,
         length,
         &queueContext->WriteMemory,
         &writeBuffer
@@ -337,7 +627,7 @@ VOID EchoEvtIoWrite(
 
     if (!NT_SUCCESS(Status)) {
         LOG("Echo, EchoEvtIoWrite: Could not allocate %d byte buffer\n", length);
-        WdfRequestComplete(request, STATUS_INSUFFICIENT_RESOURCES);
+        EchoCompleteRequest(request, STATUS_INSUFFICIENT_RESOURCES, 0L);
         return;
     }
 
@@ -354,7 +644,7 @@ VOID EchoEvtIoWrite(
         WdfObjectDelete(queueContext->WriteMemory);
         queueContext->WriteMemory = NULL;
 
-        WdfRequestComplete(request, Status);
+        EchoCompleteRequest(request, Status, 0L);
         return;
     }
 
@@ -384,11 +674,16 @@ VOID EvtIoDeviceControl(
 {
     LOG("Echo, EvtIoDeviceControl\n");
 
-    UNREFERENCED_PARAMETER(queue);
     UNREFERENCED_PARAMETER(outputBufferLength);
     UNREFERENCED_PARAMETER(inputBufferLength);
 
     NTSTATUS  status;
+    WDFDEVICE device = WdfIoQueueGetDevice(queue);
+    WDFFILEOBJECT fileObject;
+    PECHO_STATS stats;
+    PECHO_TUNING tuning;
+    PULONG shardKey;
+    PREQUEST_CONTEXT requestContext;
     PAGED_CODE();
 
     switch (ioControlCode)
@@ -396,19 +691,273 @@ VOID EvtIoDeviceControl(
         case IOCTL_CODE_TEST:
             LOG("Echo, EvtIoDeviceControl, IOCTL_CODE_TEST\n");
             status = STATUS_SUCCESS;
-            WdfRequestCompleteWithInformation(request, status, 0);
+            EchoCompleteRequest(request, status, 0);
+            break;
+
+        case IOCTL_ECHO_GET_STATS:
+            LOG("Echo, EvtIoDeviceControl, IOCTL_ECHO_GET_STATS\n");
+            status = WdfRequestRetrieveOutputBuffer(request, sizeof(ECHO_STATS), (PVOID*)&stats, NULL);
+            if (!NT_SUCCESS(status)) {
+                EchoCompleteRequest(request, status, 0);
+                break;
+            }
+            EchoStatsSnapshot(device, stats);
+            EchoCompleteRequest(request, status, sizeof(ECHO_STATS));
+            break;
+
+        case IOCTL_ECHO_RESET_STATS:
+            LOG("Echo, EvtIoDeviceControl, IOCTL_ECHO_RESET_STATS\n");
+            EchoStatsReset(device);
+            status = STATUS_SUCCESS;
+            EchoCompleteRequest(request, status, 0);
+            break;
+
+        case IOCTL_ECHO_SET_SHARD_KEY:
+            LOG("Echo, EvtIoDeviceControl, IOCTL_ECHO_SET_SHARD_KEY\n");
+            fileObject = WdfRequestGetFileObject(request);
+            if (fileObject == NULL) {
+                status = STATUS_INVALID_DEVICE_REQUEST;
+                EchoCompleteRequest(request, status, 0);
+                break;
+            }
+            status = WdfRequestRetrieveInputBuffer(request, sizeof(ULONG), (PVOID*)&shardKey, NULL);
+            if (NT_SUCCESS(status)) {
+                FileGetContext(fileObject)->ShardKey = *shardKey;
+            }
+            EchoCompleteRequest(request, status, 0);
+            break;
+
+        case IOCTL_ECHO_GET_TUNING:
+            LOG("Echo, EvtIoDeviceControl, IOCTL_ECHO_GET_TUNING\n");
+            status = WdfRequestRetrieveOutputBuffer(request, sizeof(ECHO_TUNING), (PVOID*)&tuning, NULL);
+            if (!NT_SUCCESS(status)) {
+                EchoCompleteRequest(request, status, 0);
+                break;
+            }
+            EchoTuningGet(device, tuning);
+            EchoCompleteRequest(request, status, sizeof(ECHO_TUNING));
+            break;
+
+        case IOCTL_ECHO_SET_TUNING:
+            LOG("Echo, EvtIoDeviceControl, IOCTL_ECHO_SET_TUNING\n");
+            status = WdfRequestRetrieveInputBuffer(request, sizeof(ECHO_TUNING), (PVOID*)&tuning, NULL);
+            if (NT_SUCCESS(status)) {
+                status = EchoTuningSet(device, tuning);
+            }
+            EchoCompleteRequest(request, status, 0);
+            break;
+
+        case IOCTL_ECHO_TRACED:
+            LOG("Echo, EvtIoDeviceControl, IOCTL_ECHO_TRACED\n");
+
+            //
+            // A traced echo is bulk work: it goes through the file's shard
+            // like a write and is accounted in the bulk lane
+            // ٻдһļڵķƬͨͳ
+            //
+            requestContext = RequestGetContext(request);
+            requestContext->Lane = EchoLaneBulk;
+            requestContext->Traced = TRUE;
+            RtlZeroMemory(requestContext->Stamps, sizeof(requestContext->Stamps));
+            requestContext->Stamps[EchoStageArrival] = requestContext->ArrivalTime.QuadPart;
+            EchoEvtIoRoute(queue, request);
             break;
 
         default:
             LOG("Echo, EvtIoDeviceControl, STATUS_INVALID_DEVICE_REQUEST\n");
             status = STATUS_INVALID_DEVICE_REQUEST;
-            WdfRequestCompleteWithInformation(request, status, 0);
+            EchoCompleteRequest(request, status, 0);
             break;
     }
 
     return;
 }
 
+/*
+Function:
+    EchoStampRequest
+    ¼׶
+
+Routine Description:
+
+    Stamps the performance counter on a traced request as it enters the
+    given stage. Untraced requests are left alone.
+    ڸ׶ʱ¼ֵܼδٵ󱣳ֲ䡣
+
+Arguments:
+
+    request - Handle to a framework request object.
+              
+
+    stage - Stage the request enters.
+            Ľ׶
+
+Return Value:
+
+    VOID
+*/
+VOID EchoStampRequest(
+    IN WDFREQUEST request,
+    IN ECHO_STAGE stage
+)
+{
+    PREQUEST_CONTEXT requestContext = RequestGetContext(request);
+    LARGE_INTEGER now;
+
+    if (requestContext->Traced) {
+        QueryPerformanceCounter(&now);
+        requestContext->Stamps[stage] = now.QuadPart;
+    }
+
+    return;
+}
+
+/*
+Function:
+    EchoEvtIoTraced
+    ٻԻص
+
+Routine Description:
+
+    Called by a shard queue for IOCTL_ECHO_TRACED, which the control lane
+    forwards here. The payload replaces the shard's echo buffer exactly as
+    a write does, then the header and the payload are written back to the
+    output buffer and the request is parked for the timer like a write.
+    The stage stamps are taken on the way and filled into the output
+    header at completion.
+    ƬΪIOCTL_ECHO_TRACEDô˻صɿͨתˡ
+    дȫһ滻ƬĻԻȻͷ͸д
+    дһפȴʱ;м¼׶ʱʱͷ
+
+    The input and output buffers of a buffered IOCTL are the same memory,
+    so the header is read before anything is written to the output.
+    IOCTLͬһڴ棬д֮ǰȶȡͷ
+
+Arguments:
+
+    queue - Handle to the shard queue.
+            Ƭо
+
+    request - Handle to a framework request object.
+              
+
+    outputBufferLength - Size of the output buffer.
+                         ĴС
+
+    inputBufferLength - Size of the input buffer.
+                        뻺ĴС
+
+    ioControlCode - I/O control code, always IOCTL_ECHO_TRACED.
+                    I/O룬IOCTL_ECHO_TRACED
+
+Return Value:
+
+    VOID
+*/
+VOID EchoEvtIoTraced(
+    IN WDFQUEUE   queue,
+    IN WDFREQUEST request,
+    IN size_t     outputBufferLength,
+    IN size_t     inputBufferLength,
+    IN ULONG      ioControlCode
+)
+{
+    LOG("Echo, EchoEvtIoTraced\n");
+
+    NTSTATUS status;
+    PQUEUE_CONTEXT queueContext = QueueGetContext(queue);
+    PDEVICE_CONTEXT deviceContext = WdfObjectGet_DEVICE_CONTEXT(WdfIoQueueGetDevice(queue));
+    PECHO_TRACED_HEADER header;
+    PVOID writeBuffer = NULL;
+    ULONGLONG requestId;
+    ULONG length;
+
+    EchoStampRequest(request, EchoStageDispatch);
+
+    if (ioControlCode != IOCTL_ECHO_TRACED) {
+        EchoCompleteRequest(request, STATUS_INVALID_DEVICE_REQUEST, 0L);
+        return;
+    }
+
+    status = WdfRequestRetrieveInputBuffer(request, sizeof(ECHO_TRACED_HEADER), (PVOID*)&header, NULL);
+    if (!NT_SUCCESS(status)) {
+        EchoCompleteRequest(request, status, 0L);
+        return;
+    }
+    requestId = header->RequestId;
+    length = header->Length;
+
+    LOG("Echo, EchoEvtIoTraced Called! Queue 0x%p, Request 0x%p Id %llu Length %d\n",
+        queue, request, requestId, length);
+
+    if (length == 0 ||
+        inputBufferLength < sizeof(ECHO_TRACED_HEADER) + length ||
+        outputBufferLength < sizeof(ECHO_TRACED_HEADER) + length) {
+        EchoCompleteRequest(request, STATUS_INVALID_PARAMETER, 0L);
+        return;
+    }
+    if (length > queueContext->Tuning.MaxWriteLength) {
+        LOG("Echo, EchoEvtIoTraced Buffer Length to big %d, Max is %d\n",
+            length, queueContext->Tuning.MaxWriteLength);
+        EchoCompleteRequest(request, STATUS_BUFFER_OVERFLOW, 0L);
+        return;
+    }
+
+    // Release previous buffer if set
+    // ͷǰһ
+    if (queueContext->WriteMemory != NULL) {
+        WdfObjectDelete(queueContext->WriteMemory);
+        queueContext->WriteMemory = NULL;
+    }
+
+    status = WdfMemoryCreate(WDF_NO_OBJECT_ATTRIBUTES,
+        NonPagedPoolNx,
+        queueContext->Tuning.PoolTag,
+        length,
+        &queueContext->WriteMemory,
+        &writeBuffer
+    );
+    if (!NT_SUCCESS(status)) {
+        LOG("Echo, EchoEvtIoTraced: Could not allocate %d byte buffer\n", length);
+        EchoCompleteRequest(request, STATUS_INSUFFICIENT_RESOURCES, 0L);
+        return;
+    }
+    RtlCopyMemory(writeBuffer, header + 1, length);
+    EchoStampRequest(request, EchoStageCopied);
+
+    //
+    // Echo the header and the payload back
+    // ͷ͸
+    //
+    status = WdfRequestRetrieveOutputBuffer(request, sizeof(ECHO_TRACED_HEADER) + length,
+                                            (PVOID*)&header, NULL);
+    if (!NT_SUCCESS(status)) {
+        EchoCompleteRequest(request, status, 0L);
+        return;
+    }
+    RtlZeroMemory(header, sizeof(ECHO_TRACED_HEADER));
+    header->RequestId = requestId;
+    header->Length = length;
+    header->Frequency = deviceContext->PerfFrequency.QuadPart;
+    RtlCopyMemory(header + 1, writeBuffer, length);
+
+    // Set transfer information
+    // ôϢ
+    WdfRequestSetInformation(request, (ULONG_PTR)(sizeof(ECHO_TRACED_HEADER) + length));
+
+    // Specify the request is cancelable
+    // ָȡ
+    EchoStampRequest(request, EchoStagePark);
+    WdfRequestMarkCancelable(request, EchoEvtRequestCancel);
+
+    // Defer the completion to another thread from the timer dpc
+    // ʱӼʱdpcƳٵһ߳
+    queueContext->CurrentRequest = request;
+    queueContext->CurrentStatus = status;
+
+    return;
+}
+
 /*
 Function:
     EchoEvtRequestCancel
@@ -450,7 +999,7 @@ VOID EchoEvtRequestCancel(IN WDFREQUEST request)
     // ڷ״̬== STATUS_CANCELLED£WdfRequestComplete
     // ɵ÷DPCͬͬɵвѵġ
     //
-    WdfRequestCompleteWithInformation(request, STATUS_CANCELLED, 0L);
+    EchoCompleteRequest(request, STATUS_CANCELLED, 0L);
 
     //
     // This book keeping is synchronized by the common
@@ -462,6 +1011,74 @@ VOID EchoEvtRequestCancel(IN WDFREQUEST request)
     return;
 }
 
+/*
+Function:
+    EchoEvtIoStop
+    ֹͣص
+
+Routine Description:
+
+    Called by the framework for the request parked in the queue context
+    when the queue is being stopped for a power transition or purged.
+    This callback is synchronized with the other queue callbacks by the
+    queue presentation lock.
+    Դתֹͣʱܻפڶе
+    ô˻صûصͨглصͬ
+
+    On suspend the request is acknowledged without requeueing it, so the
+    driver keeps owning it and the framework can power down without
+    waiting for the timer to complete it. The request stays parked (and
+    cancelable) and is completed by the first timer tick after restart.
+    On purge it is cancelled.
+    ʱȷϸŶӣӵȴ
+    ʱ󼴿ɶϵ硣󱣳פҿȡ
+    һμʱɡʱȡ
+
+Arguments:
+
+    queue - Handle to the framework queue object.
+            ܶж
+
+    request - Handle to the request owned by the driver.
+              ӵе
+
+    actionFlags - WDF_REQUEST_STOP_ACTION_FLAGS describing the transition.
+                  תWDF_REQUEST_STOP_ACTION_FLAGS
+
+Return Value:
+
+    VOID
+*/
+VOID EchoEvtIoStop(
+    IN WDFQUEUE   queue,
+    IN WDFREQUEST request,
+    IN ULONG      actionFlags
+)
+{
+    LOG("Echo, EchoEvtIoStop\n");
+
+    PQUEUE_CONTEXT queueContext = QueueGetContext(queue);
+
+    LOG("Echo, EchoEvtIoStop Request 0x%p ActionFlags 0x%x\n", request, actionFlags);
+
+    if (actionFlags & WdfRequestStopActionSuspend) {
+        WdfRequestStopAcknowledge(request, FALSE);
+    }
+    else if (actionFlags & WdfRequestStopActionPurge) {
+
+        //
+        // If the cancel routine is already running it completes the request
+        // ȡУ
+        //
+        if (WdfRequestUnmarkCancelable(request) != STATUS_CANCELLED) {
+            queueContext->CurrentRequest = NULL;
+            EchoCompleteRequest(request, STATUS_CANCELLED, 0L);
+        }
+    }
+
+    return;
+}
+
 /*
 Function:
     EchoEvtIoQueueContextDestroy
@@ -604,6 +1221,28 @@ VOID EchoEvtTimerFunc(IN WDFTIMER timer)
     queue = WdfTimerGetParentObject(timer);
     queueContext = QueueGetContext(queue);
 
+    //
+    // A tick that fired before the suspend stopped the timer leaves the
+    // parked request to the first tick after the restart, and does not re-arm
+    // ڹֹͣʱ֮ǰѴһμʱפĵһ
+    // Ҳʱ
+    //
+    if (queueContext->Suspended) {
+        LOG("Echo, EchoEvtTimerFunc ignoring a tick while suspended\n");
+        return;
+    }
+
+    //
+    // The first tick after a restart marks the end of the resume
+    // ĵһδ־Żָ
+    //
+    if (queueContext->RestartTime.QuadPart != 0) {
+        EchoStatsRecordResume(WdfIoQueueGetDevice(queue),
+                              EchoElapsedUs(WdfIoQueueGetDevice(queue),
+                                            queueContext->RestartTime.QuadPart));
+        queueContext->RestartTime.QuadPart = 0;
+    }
+
     //
     // DPC is automatically synchronized to the queue lock,
     // so this is race free without explicit driver managed locking.
@@ -626,11 +1265,12 @@ VOID EchoEvtTimerFunc(IN WDFTIMER timer)
         if( Status != STATUS_CANCELLED ) {
 
             queueContext->CurrentRequest = NULL;
+            EchoStampRequest(Request, EchoStagePickup);
             Status = queueContext->CurrentStatus;
 
             LOG("Echo, CustomTimerDPC Completing request 0x%p, Status 0x%x \n", Request, Status);
 
-            WdfRequestComplete(Request, Status);
+            EchoCompleteRequest(Request, Status, WdfRequestGetInformation(Request));
         }
         else {
             LOG("Echo, CustomTimerDPC Request 0x%p is STATUS_CANCELLED, not completing\n", Request);
@@ -639,10 +1279,12 @@ VOID EchoEvtTimerFunc(IN WDFTIMER timer)
 
     //
     // Restart the timer since WDF does not allow periodic timer
-    // with autosynchronization at passive level
-    // WDFԼʱڱԶͬʱ
+    // with autosynchronization at passive level. Suspended only changes
+    // under the queue lock held here, so it is still clear.
+    // WDFԼʱڱԶͬʱ
+    // Suspendedֻڴ˴еĶ¸ı䣬δλ
     //
-    WdfTimerStart(timer, WDF_REL_TIMEOUT_IN_MS(TIMER_PERIOD));
+    WdfTimerStart(timer, WDF_REL_TIMEOUT_IN_MS(queueContext->Tuning.TimerPeriodMs));
 
     return;
 }
@@ -16,6 +16,14 @@ Abstract:
 
 #pragma once
 
+//
+// Defaults for the tuning parameters. The values in use are loaded from the
+// device's registry key (see echoum.inx) and can be changed on a live device
+// with IOCTL_ECHO_SET_TUNING.
+// ŲĬֵʵʹõֵ豸עأμechoum.inx
+// е豸ͨIOCTL_ECHO_SET_TUNINGġ
+//
+
 // Set max write length for testing
 // д볤Խв
 #define MAX_WRITE_LENGTH  1024*40
@@ -24,6 +32,31 @@ Abstract:
 // ԺΪλüʱ
 #define TIMER_PERIOD  1000*2
 
+// Delay in ms before the first timer tick after the device starts
+// 豸һμʱ֮ǰӳ٣룩
+#define START_DELAY  100
+
+// Pool tag of the echo buffers
+// Իĳر
+#define POOL_TAG  ((ULONG)'s' << 24 | (ULONG)'a' << 16 | (ULONG)'m' << 8 | (ULONG)'1')
+
+// Upper bounds accepted for the tuning parameters
+// Ųɽܵ
+#define MAX_TIMER_PERIOD      60*1000
+#define MAX_START_DELAY       60*1000
+#define MAX_WRITE_LENGTH_CAP  16*1024*1024
+
+// Delay in ms before the first timer tick after a restart. Parked requests
+// are kept across the suspend, so they are completed right away.
+// һμʱ֮ǰӳ٣룩ڼ䱣פ
+// ˻ǡ
+#define RESTART_DELAY  1
+
+// Max control requests presented at once, so that a flood of IOCTLs cannot
+// tie up every host thread and starve the bulk lane
+// ͬʱֵԷIOCTLռ̶߳ʹͨ
+#define CONTROL_LANE_DEPTH  4
+
 //
 // This is the context that can be placed per queue
 // and would contain per queue information.
@@ -44,12 +77,59 @@ typedef struct _QUEUE_CONTEXT {
     WDFREQUEST  CurrentRequest;
     NTSTATUS    CurrentStatus;
 
+    // This shard's copy of the tuning parameters, updated under the queue
+    // presentation lock
+    // ƬĵŲڶг¸
+    ECHO_TUNING Tuning;
+
+    // Set while the device is suspended, under the queue presentation lock,
+    // so a late timer tick neither completes the parked request nor re-arms
+    // 豸ڼڶгλʹٵļʱȲפ
+    // Ҳʱ
+    BOOLEAN     Suspended;
+
+    // Performance counter value when the device was restarted, cleared by
+    // the first timer tick after the restart
+    // 豸ʱֵܼĵһμʱ
+    LARGE_INTEGER RestartTime;
+
 } QUEUE_CONTEXT, *PQUEUE_CONTEXT;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(QUEUE_CONTEXT, QueueGetContext)
 
+//
+// This is the context that is placed on every request.
+// Ƿÿϵġ
+//
+typedef struct _REQUEST_CONTEXT {
+
+    // Performance counter value when the request reached the driver
+    // 󵽴ʱֵܼ
+    LARGE_INTEGER ArrivalTime;
+
+    // Lane the request is serviced in
+    // ͨ
+    ECHO_LANE     Lane;
+
+    // Set for IOCTL_ECHO_TRACED, whose stage stamps are returned to the client
+    // IOCTL_ECHO_TRACEDλ׶ʱ᷵ظͻ
+    BOOLEAN       Traced;
+    LONGLONG      Stamps[EchoStageCount];
+
+} REQUEST_CONTEXT, *PREQUEST_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(REQUEST_CONTEXT, RequestGetContext)
+
 NTSTATUS EchoQueueInitialize(WDFDEVICE hDevice);
 
+NTSTATUS EchoShardQueueCreate(WDFDEVICE hDevice, WDFQUEUE* pQueue);
+
+EVT_WDF_IO_IN_CALLER_CONTEXT EchoEvtIoInCallerContext;
+
+VOID EchoCompleteRequest(WDFREQUEST request, NTSTATUS status, ULONG_PTR information);
+
+VOID EchoStampRequest(WDFREQUEST request, ECHO_STAGE stage);
+
 EVT_WDF_IO_QUEUE_CONTEXT_DESTROY_CALLBACK EchoEvtIoQueueContextDestroy;
 
 //
@@ -58,12 +138,18 @@ EVT_WDF_IO_QUEUE_CONTEXT_DESTROY_CALLBACK EchoEvtIoQueueContextDestroy;
 //
 EVT_WDF_REQUEST_CANCEL EchoEvtRequestCancel;
 
+EVT_WDF_IO_QUEUE_IO_DEFAULT EchoEvtIoRoute;
+
 EVT_WDF_IO_QUEUE_IO_READ EchoEvtIoRead;
 
 EVT_WDF_IO_QUEUE_IO_WRITE EchoEvtIoWrite;
 
 EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL EvtIoDeviceControl;
 
+EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL EchoEvtIoTraced;
+
+EVT_WDF_IO_QUEUE_IO_STOP EchoEvtIoStop;
+
 NTSTATUS EchoTimerCreate(IN WDFTIMER* pTimer, IN WDFQUEUE Queue);
 
 EVT_WDF_TIMER EchoEvtTimerFunc;
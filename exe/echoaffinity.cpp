@@ -0,0 +1,660 @@
+/*++
+
+Module Name:
+
+    echoaffinity.cpp
+
+Abstract:
+
+    Processor topology, affinity lists and thread pinning.
+    ˡ׺б̶̹߳
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#include "echoaffinity.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mutex>
+
+#ifdef __linux__
+#include <errno.h>
+#include <sched.h>
+#endif
+
+#define LOG printf
+
+#define AFFINITY_GROUP_SIZE     64
+
+static ECHO_TOPOLOGY  AffinityTopology;
+static std::once_flag AffinityOnce;
+
+//
+// Reads the next item of a processor list such as "0,2,8-11" or "1:0-7";
+// group is left alone when the item names none. FALSE at the end of the
+// list or on a malformed item, which *cursor then points at.
+// ȡб"0,2,8-11""1:0-7"еһδָʱ޸group
+// бĩβʽʱFALSEʱ*cursorָ
+//
+static BOOLEAN AffinityNextRange(PCSTR* cursor, PULONG group, PULONG first, PULONG last)
+{
+    PCSTR text = *cursor;
+    char* end;
+    ULONG value;
+
+    while (*text == ',' || *text == ' ' || *text == '\n') {
+        text++;
+    }
+    *cursor = text;
+
+    if (*text < '0' || *text > '9') {
+        return FALSE;
+    }
+
+    value = strtoul(text, &end, 10);
+    if (*end == ':') {
+        *group = value;
+        text = end + 1;
+        if (*text < '0' || *text > '9') {
+            return FALSE;
+        }
+        value = strtoul(text, &end, 10);
+    }
+
+    *first = value;
+    *last = value;
+
+    if (*end == '-') {
+        text = end + 1;
+        if (*text < '0' || *text > '9') {
+            return FALSE;
+        }
+        *last = strtoul(text, &end, 10);
+        if (*last < *first) {
+            return FALSE;
+        }
+    }
+
+    if (*end != '\0' && *end != ',' && *end != '\n') {
+        return FALSE;
+    }
+
+    *cursor = end;
+
+    return TRUE;
+}
+
+//
+// groupڱΪnumberĴ±꣬ʱECHO_MAX_CPUS
+//
+static ULONG AffinityFind(const ECHO_TOPOLOGY* topology, ULONG group, ULONG number)
+{
+    ULONG i;
+
+    for (i = 0; i < topology->Cpus; i++) {
+        if (topology->Cpu[i].Group == group && topology->Cpu[i].Number == number) {
+            return i;
+        }
+    }
+
+    return ECHO_MAX_CPUS;
+}
+
+#ifdef _WIN32
+
+//
+// GetLogicalProcessorInformationExдڵͺ
+//
+static VOID AffinityReadSystem(PECHO_TOPOLOGY topology)
+{
+    PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX info;
+    PUCHAR buffer = NULL;
+    DWORD length = 0;
+    DWORD offset;
+    WORD groups;
+    WORD group;
+    DWORD count;
+    DWORD number;
+    WORD mask;
+    ULONG i;
+
+    groups = GetActiveProcessorGroupCount();
+    for (group = 0; group < groups; group++) {
+        count = GetActiveProcessorCount(group);
+        for (number = 0; number < count && topology->Cpus < ECHO_MAX_CPUS; number++) {
+            topology->Cpu[topology->Cpus].Group = group;
+            topology->Cpu[topology->Cpus].Number = (USHORT)number;
+            topology->Cpus++;
+        }
+    }
+
+    GetLogicalProcessorInformationEx(RelationAll, NULL, &length);
+    buffer = (PUCHAR)malloc(length);
+    if (buffer == NULL || !GetLogicalProcessorInformationEx(RelationAll,
+                                                           (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buffer,
+                                                           &length)) {
+        free(buffer);
+        return;
+    }
+
+    for (offset = 0; offset < length; offset += info->Size) {
+        info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)(buffer + offset);
+
+        for (i = 0; i < topology->Cpus; i++) {
+            PECHO_CPU_INFO cpu = &topology->Cpu[i];
+            ULONGLONG bit = 1ULL << cpu->Number;
+
+            if (info->Relationship == RelationNumaNode) {
+                if (info->NumaNode.GroupMask.Group == cpu->Group &&
+                    (info->NumaNode.GroupMask.Mask & bit) != 0) {
+                    cpu->Node = info->NumaNode.NodeNumber;
+                }
+            }
+            else if (info->Relationship == RelationProcessorCore) {
+                for (mask = 0; mask < info->Processor.GroupCount; mask++) {
+                    if (info->Processor.GroupMask[mask].Group == cpu->Group &&
+                        (info->Processor.GroupMask[mask].Mask & bit) != 0) {
+                        cpu->Core = topology->Cores;
+                    }
+                }
+            }
+        }
+
+        if (info->Relationship == RelationProcessorCore) {
+            topology->Cores++;
+        }
+    }
+
+    free(buffer);
+}
+
+#else
+
+//
+// ȡsysfsеһֵʧʱ-1
+//
+static long AffinityReadNumber(PCSTR path)
+{
+    FILE* file = fopen(path, "r");
+    long value = -1;
+
+    if (file == NULL) {
+        return -1;
+    }
+    if (fscanf(file, "%ld", &value) != 1) {
+        value = -1;
+    }
+    fclose(file);
+
+    return value;
+}
+
+//
+// sched_getaffinitysysfsдõĴڵͺ
+//
+static VOID AffinityReadSystem(PECHO_TOPOLOGY topology)
+{
+    long packages[ECHO_MAX_CPUS];
+    long cores[ECHO_MAX_CPUS];
+    char path[128];
+    char list[1024];
+    FILE* file;
+    PCSTR cursor;
+    ULONG node;
+    ULONG group;
+    ULONG first;
+    ULONG last;
+    ULONG number;
+    ULONG cpu;
+    ULONG i;
+    ULONG j;
+
+#ifdef __linux__
+    cpu_set_t allowed;
+
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (cpu = 0; cpu < CPU_SETSIZE && cpu < ECHO_MAX_CPUS; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                topology->Cpu[topology->Cpus].Group = (USHORT)(cpu / AFFINITY_GROUP_SIZE);
+                topology->Cpu[topology->Cpus].Number = (USHORT)(cpu % AFFINITY_GROUP_SIZE);
+                topology->Cpus++;
+            }
+        }
+    }
+#endif
+
+    if (topology->Cpus == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+        for (cpu = 0; cpu < (ULONG)((online > 0) ? online : 1) && cpu < ECHO_MAX_CPUS; cpu++) {
+            topology->Cpu[topology->Cpus].Group = (USHORT)(cpu / AFFINITY_GROUP_SIZE);
+            topology->Cpu[topology->Cpus].Number = (USHORT)(cpu % AFFINITY_GROUP_SIZE);
+            topology->Cpus++;
+        }
+    }
+
+    for (node = 0; node < ECHO_MAX_NODES; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+        file = fopen(path, "r");
+        if (file == NULL) {
+            continue;
+        }
+        if (fgets(list, sizeof(list), file) != NULL) {
+            cursor = list;
+            while (AffinityNextRange(&cursor, &group, &first, &last)) {
+                for (number = first; number <= last && number < ECHO_MAX_CPUS; number++) {
+                    i = AffinityFind(topology, number / AFFINITY_GROUP_SIZE, number % AFFINITY_GROUP_SIZE);
+                    if (i != ECHO_MAX_CPUS) {
+                        topology->Cpu[i].Node = node;
+                    }
+                }
+            }
+        }
+        fclose(file);
+    }
+
+    //
+    // A core is a package and core id pair; the ids repeat across packages
+    // ɷװͺıŹͬȷıڲͬװظ
+    //
+    for (i = 0; i < topology->Cpus; i++) {
+        number = topology->Cpu[i].Group * AFFINITY_GROUP_SIZE + topology->Cpu[i].Number;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/physical_package_id", number);
+        packages[i] = AffinityReadNumber(path);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/core_id", number);
+        cores[i] = AffinityReadNumber(path);
+
+        topology->Cpu[i].Core = topology->Cores;
+        if (cores[i] != -1) {
+            for (j = 0; j < i; j++) {
+                if (packages[j] == packages[i] && cores[j] == cores[i]) {
+                    topology->Cpu[i].Core = topology->Cpu[j].Core;
+                    break;
+                }
+            }
+        }
+        if (topology->Cpu[i].Core == topology->Cores) {
+            topology->Cores++;
+        }
+    }
+}
+
+#endif
+
+//
+// ȡ˲ϵͳδĲ
+//
+static VOID AffinityInit(VOID)
+{
+    PECHO_TOPOLOGY topology = &AffinityTopology;
+    ULONG i;
+
+    ZeroMemory(topology, sizeof(*topology));
+
+    AffinityReadSystem(topology);
+
+    //
+    // Without a description every processor is a core of its own
+    // ûʱÿΪһ
+    //
+    if (topology->Cores == 0) {
+        for (i = 0; i < topology->Cpus; i++) {
+            topology->Cpu[i].Core = i;
+        }
+        topology->Cores = topology->Cpus;
+    }
+
+    for (i = 0; i < topology->Cpus; i++) {
+        if (topology->Cpu[i].Node >= ECHO_MAX_NODES) {
+            topology->Cpu[i].Node = 0;
+        }
+        if (topology->Cpu[i].Node + 1 > topology->Nodes) {
+            topology->Nodes = topology->Cpu[i].Node + 1;
+        }
+        if ((ULONG)topology->Cpu[i].Group + 1 > topology->Groups) {
+            topology->Groups = topology->Cpu[i].Group + 1;
+        }
+    }
+}
+
+const ECHO_TOPOLOGY* EchoTopology(VOID)
+{
+    std::call_once(AffinityOnce, AffinityInit);
+
+    return &AffinityTopology;
+}
+
+//
+// ڵnodeĴʽΪΧб"0-7,16-23"һʱ
+//
+static VOID AffinityFormatNode(const ECHO_TOPOLOGY* topology, ULONG node, char* text, size_t size)
+{
+    size_t used = 0;
+    ULONG i = 0;
+    ULONG j;
+
+    text[0] = '\0';
+
+    while (i < topology->Cpus && used < size) {
+        if (topology->Cpu[i].Node != node) {
+            i++;
+            continue;
+        }
+
+        //
+        // Extend the range while the next processor follows in the same group
+        // һͬһұʱӳΧ
+        //
+        j = i;
+        while (j + 1 < topology->Cpus && topology->Cpu[j + 1].Node == node &&
+               topology->Cpu[j + 1].Group == topology->Cpu[i].Group &&
+               topology->Cpu[j + 1].Number == topology->Cpu[j].Number + 1) {
+            j++;
+        }
+
+        used += snprintf(text + used, size - used, "%s", (used != 0) ? "," : "");
+        if (used < size && topology->Groups > 1) {
+            used += snprintf(text + used, size - used, "%d:", topology->Cpu[i].Group);
+        }
+        if (used < size) {
+            used += (j == i) ? snprintf(text + used, size - used, "%d", topology->Cpu[i].Number) :
+                               snprintf(text + used, size - used, "%d-%d",
+                                        topology->Cpu[i].Number, topology->Cpu[j].Number);
+        }
+
+        i = j + 1;
+    }
+}
+
+VOID EchoTopologyReport(VOID)
+{
+    const ECHO_TOPOLOGY* topology = EchoTopology();
+    char list[256];
+    ULONG node;
+    ULONG count;
+    ULONG i;
+
+    LOG("Topology: %d processor%s on %d core%s in %d NUMA node%s, %d processor group%s\n",
+        topology->Cpus, (topology->Cpus == 1) ? "" : "s", topology->Cores, (topology->Cores == 1) ? "" : "s",
+        topology->Nodes, (topology->Nodes == 1) ? "" : "s", topology->Groups, (topology->Groups == 1) ? "" : "s");
+
+    for (node = 0; node < topology->Nodes; node++) {
+        count = 0;
+        for (i = 0; i < topology->Cpus; i++) {
+            count += (topology->Cpu[i].Node == node) ? 1 : 0;
+        }
+        if (count != 0) {
+            AffinityFormatNode(topology, node, list, sizeof(list));
+            LOG("    node %d: processor%s %s\n", node, (count == 1) ? "" : "s", list);
+        }
+    }
+}
+
+//
+// Orders the processors for compact and spread placement: compact by
+// node, core and sibling; spread by sibling, the core's rank within its
+// node, and node, so that consecutive workers alternate nodes and only
+// share a core once every core has one
+// Ϊպͷɢдհڵ㡢ġֵ򣻷ɢֵܴ򡢺
+// ڵڵĴ򡢽ڵʹڹ߳λڸڵ㣬ֻÿĶ
+// ߳ʱŹú
+//
+static VOID AffinityOrder(const ECHO_TOPOLOGY* topology, BOOLEAN spread, PULONG order)
+{
+    ULONGLONG keys[ECHO_MAX_CPUS];
+    ULONG ranks[ECHO_MAX_CPUS];
+    ULONG sibling;
+    ULONG rank;
+    ULONGLONG key;
+    ULONG index;
+    ULONG i;
+    ULONG j;
+
+    for (i = 0; i < topology->Cpus; i++) {
+        sibling = 0;
+        for (j = 0; j < i; j++) {
+            if (topology->Cpu[j].Core == topology->Cpu[i].Core) {
+                sibling++;
+            }
+        }
+
+        //
+        // A core's rank counts the cores of the node seen before it; its
+        // siblings take the rank of the first
+        // ĵĴΪڵֵĺֵܴõһĴ
+        //
+        rank = 0;
+        for (j = 0; j < i; j++) {
+            if (topology->Cpu[j].Core == topology->Cpu[i].Core) {
+                rank = ranks[j];
+                break;
+            }
+            if (topology->Cpu[j].Node == topology->Cpu[i].Node && ranks[j] + 1 > rank) {
+                rank = ranks[j] + 1;
+            }
+        }
+        ranks[i] = rank;
+
+        keys[i] = spread ?
+            ((ULONGLONG)sibling << 48) | ((ULONGLONG)rank << 32) | ((ULONGLONG)topology->Cpu[i].Node << 16) :
+            ((ULONGLONG)topology->Cpu[i].Node << 48) | ((ULONGLONG)rank << 32) | ((ULONGLONG)sibling << 16);
+        keys[i] |= i;
+        order[i] = i;
+    }
+
+    //
+    // Insertion sort; the keys are unique, their low bits being the index
+    // 򣻼ĵλΪ±꣬˸ͬ
+    //
+    for (i = 1; i < topology->Cpus; i++) {
+        index = order[i];
+        key = keys[index];
+        for (j = i; j > 0 && keys[order[j - 1]] > key; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = index;
+    }
+}
+
+//
+// ׺һ飬ʱ
+//
+static VOID AffinityAdd(PECHO_AFFINITY affinity, ULONG group, ULONGLONG mask)
+{
+    if (affinity->Count < ECHO_AFFINITY_MAX) {
+        affinity->Sets[affinity->Count].Group = (USHORT)group;
+        affinity->Sets[affinity->Count].Mask = mask;
+        affinity->Count++;
+    }
+}
+
+BOOLEAN EchoAffinityParse(IN PCSTR spec, OUT PECHO_AFFINITY affinity)
+{
+    const ECHO_TOPOLOGY* topology = EchoTopology();
+    ULONG order[ECHO_MAX_CPUS];
+    PCSTR cursor;
+    ULONG group;
+    ULONG first;
+    ULONG last;
+    ULONG number;
+    ULONG node;
+    ULONG i;
+
+    affinity->Mode = EchoAffinityNone;
+    affinity->Count = 0;
+
+    if (!_stricmp(spec, "none")) {
+        return TRUE;
+    }
+
+    if (!_stricmp(spec, "compact") || !_stricmp(spec, "spread")) {
+        affinity->Mode = !_stricmp(spec, "compact") ? EchoAffinityCompact : EchoAffinitySpread;
+        AffinityOrder(topology, affinity->Mode == EchoAffinitySpread, order);
+        for (i = 0; i < topology->Cpus; i++) {
+            AffinityAdd(affinity, topology->Cpu[order[i]].Group, 1ULL << topology->Cpu[order[i]].Number);
+        }
+        return TRUE;
+    }
+
+    //
+    // A node's processors in the group of its first one; Windows keeps a
+    // node within one group
+    // ڵһڵĴWindowsĽڵ㲻
+    //
+    if (!_stricmp(spec, "node")) {
+        affinity->Mode = EchoAffinityNode;
+        for (node = 0; node < topology->Nodes; node++) {
+            ULONGLONG mask = 0;
+
+            group = ECHO_MAX_CPUS;
+            for (i = 0; i < topology->Cpus; i++) {
+                if (topology->Cpu[i].Node != node) {
+                    continue;
+                }
+                if (group == ECHO_MAX_CPUS) {
+                    group = topology->Cpu[i].Group;
+                }
+                if (topology->Cpu[i].Group == group) {
+                    mask |= 1ULL << topology->Cpu[i].Number;
+                }
+            }
+            if (mask != 0) {
+                AffinityAdd(affinity, group, mask);
+            }
+        }
+        return TRUE;
+    }
+
+    affinity->Mode = EchoAffinityList;
+    cursor = spec;
+
+    group = ECHO_MAX_CPUS;
+
+    while (AffinityNextRange(&cursor, &group, &first, &last)) {
+        for (number = first; number <= last && number < ECHO_MAX_CPUS; number++) {
+
+            //
+            // Without a group a number counts over the whole machine
+            // δָʱ̨Χڼ
+            //
+            ULONG itemGroup = (group != ECHO_MAX_CPUS) ? group : number / AFFINITY_GROUP_SIZE;
+            ULONG itemNumber = (group != ECHO_MAX_CPUS) ? number : number % AFFINITY_GROUP_SIZE;
+
+            if (itemNumber >= AFFINITY_GROUP_SIZE) {
+                LOG("Processor %d:%d is out of its group\n", itemGroup, itemNumber);
+                return FALSE;
+            }
+
+            if (AffinityFind(topology, itemGroup, itemNumber) == ECHO_MAX_CPUS) {
+                LOG("Processor %d:%d is not available to this process\n", itemGroup, itemNumber);
+                return FALSE;
+            }
+            AffinityAdd(affinity, itemGroup, 1ULL << itemNumber);
+        }
+        group = ECHO_MAX_CPUS;
+    }
+
+    if (*cursor != '\0' || affinity->Count == 0) {
+        LOG("Bad affinity %s: none, compact, spread, node or a processor list such as 0,2,4-7\n", spec);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+PCSTR EchoAffinityName(IN ECHO_AFFINITY_MODE mode)
+{
+    switch (mode) {
+    case EchoAffinityCompact:
+        return "compact";
+    case EchoAffinitySpread:
+        return "spread";
+    case EchoAffinityNode:
+        return "node";
+    case EchoAffinityList:
+        return "list";
+    default:
+        return "none";
+    }
+}
+
+BOOLEAN EchoAffinityPick(
+    IN  const ECHO_AFFINITY* affinity,
+    IN  ULONG                index,
+    OUT PECHO_CPU_SET        set
+    )
+{
+    if (affinity == NULL || affinity->Mode == EchoAffinityNone || affinity->Count == 0) {
+        return FALSE;
+    }
+
+    *set = affinity->Sets[index % affinity->Count];
+
+    return TRUE;
+}
+
+ULONG EchoAffinitySetNode(IN const ECHO_CPU_SET* set)
+{
+    const ECHO_TOPOLOGY* topology = EchoTopology();
+    ULONG number;
+    ULONG i;
+
+    for (number = 0; number < AFFINITY_GROUP_SIZE; number++) {
+        if ((set->Mask & (1ULL << number)) != 0) {
+            i = AffinityFind(topology, set->Group, number);
+            return (i != ECHO_MAX_CPUS) ? topology->Cpu[i].Node : ECHO_NODE_ANY;
+        }
+    }
+
+    return ECHO_NODE_ANY;
+}
+
+BOOLEAN EchoAffinityPin(IN const ECHO_CPU_SET* set)
+{
+#ifdef _WIN32
+    GROUP_AFFINITY affinity;
+
+    ZeroMemory(&affinity, sizeof(affinity));
+    affinity.Group = set->Group;
+    affinity.Mask = (KAFFINITY)set->Mask;
+
+    if (!SetThreadGroupAffinity(GetCurrentThread(), &affinity, NULL)) {
+        LOG("EchoAffinityPin: SetThreadGroupAffinity failed %d\n", GetLastError());
+        return FALSE;
+    }
+
+    return TRUE;
+#elif defined(__linux__)
+    cpu_set_t cpus;
+    ULONG number;
+
+    CPU_ZERO(&cpus);
+    for (number = 0; number < AFFINITY_GROUP_SIZE; number++) {
+        if ((set->Mask & (1ULL << number)) != 0 && set->Group * AFFINITY_GROUP_SIZE + number < CPU_SETSIZE) {
+            CPU_SET(set->Group * AFFINITY_GROUP_SIZE + number, &cpus);
+        }
+    }
+
+    //
+    // Thread id 0 is the calling thread
+    // ̺߳0ʾ߳
+    //
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+        LOG("EchoAffinityPin: sched_setaffinity failed %d\n", errno);
+        return FALSE;
+    }
+
+    return TRUE;
+#else
+    (void)set;
+
+    return FALSE;
+#endif
+}
@@ -0,0 +1,126 @@
+/*++
+
+Module Name:
+
+    echoaffinity.h
+
+Abstract:
+
+    Processor topology and the placement of I/O workers. Left to the
+    scheduler, a worker moves between cores and NUMA nodes, loses its
+    caches on every move and reaches its buffers across the interconnect
+    when it lands on another node, which shows up as noise in the
+    measurements. The topology lists the logical processors the process
+    may use with their processor group, NUMA node and core. An affinity
+    assigns worker i a set of processors, one processor (compact, spread
+    or an explicit list) or every processor of a node, and the pool pins
+    each worker to its set and takes the buffers from the set's node.
+    Processor groups are Windows' sets of up to 64 processors; elsewhere
+    processor n is in group n / 64.
+    I/O̵߳ķáʱ̻߳ںĺNUMAڵ֮
+    ǨƣÿǨƶᶪʧ棬䵽ڵʱҪ绥仺ڲ
+    бΪг̿ʹõ߼䴦顢NUMAڵͺġ
+    ׺Ϊ߳iһ鴦һաɢʽбһ
+    ڵȫ̳߳ؽÿ̶̹߳䴦飬Ӹڽڵ
+    Windows64ļϣϵͳϴnn / 64
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#pragma once
+
+#include "echoport.h"
+
+#define ECHO_MAX_CPUS           1024
+#define ECHO_MAX_NODES          64
+#define ECHO_AFFINITY_MAX       256     // sets an affinity hands out in turn
+#define ECHO_NODE_ANY           ((ULONG)-1)
+
+typedef struct _ECHO_CPU_INFO {
+    USHORT Group;
+    USHORT Number;              // within the group
+    ULONG  Node;
+    ULONG  Core;                // dense over the machine; siblings share it
+} ECHO_CPU_INFO, *PECHO_CPU_INFO;
+
+typedef struct _ECHO_TOPOLOGY {
+    ULONG         Cpus;         // usable by the process, in group and number order
+    ULONG         Cores;
+    ULONG         Nodes;        // highest node number plus one
+    ULONG         Groups;
+    ECHO_CPU_INFO Cpu[ECHO_MAX_CPUS];
+} ECHO_TOPOLOGY, *PECHO_TOPOLOGY;
+
+//
+// The topology, read once; a machine the system cannot describe is one
+// node with one core per processor
+// ˣֻȡһΣϵͳ޷ĻΪһڵ㡢ÿһ
+//
+const ECHO_TOPOLOGY* EchoTopology(VOID);
+
+//
+// Prints the processors, cores and groups, and the processors of each node
+// ӡĺԼÿڵĴ
+//
+VOID EchoTopologyReport(VOID);
+
+//
+// Processors of one group a thread may run on
+// ߳̿еͬһڵĴ
+//
+typedef struct _ECHO_CPU_SET {
+    USHORT    Group;
+    ULONGLONG Mask;
+} ECHO_CPU_SET, *PECHO_CPU_SET;
+
+typedef enum _ECHO_AFFINITY_MODE {
+    EchoAffinityNone = 0,       // the scheduler places the workers
+    EchoAffinityCompact,        // one processor each, filling a node's cores and their siblings first
+    EchoAffinitySpread,         // one processor each, a core of every node in turn, siblings last
+    EchoAffinityNode,           // every processor of a node, the nodes in turn
+    EchoAffinityList            // the processors given, in turn
+} ECHO_AFFINITY_MODE;
+
+typedef struct _ECHO_AFFINITY {
+    ECHO_AFFINITY_MODE Mode;
+    ULONG              Count;
+    ECHO_CPU_SET       Sets[ECHO_AFFINITY_MAX];
+} ECHO_AFFINITY, *PECHO_AFFINITY;
+
+//
+// "none", "compact", "spread", "node", or a list of processors such as
+// "0,2,8-11" where an item may name its group as in "1:0-7". FALSE for a
+// bad list or processors the process may not use.
+// "none""compact""spread""node""0,2,8-11"Ĵбÿ
+// "1:0-7"ָ顣бЧ򺬽̲õĴʱFALSE
+//
+BOOLEAN EchoAffinityParse(IN PCSTR spec, OUT PECHO_AFFINITY affinity);
+
+PCSTR EchoAffinityName(IN ECHO_AFFINITY_MODE mode);
+
+//
+// The set of worker index, in turn over the affinity's sets; FALSE if
+// the affinity leaves placement to the scheduler
+// ߳indexĴ飬ȡ׺еĸ飻׺ԽɵʱFALSE
+//
+BOOLEAN EchoAffinityPick(
+    IN  const ECHO_AFFINITY* affinity,
+    IN  ULONG                index,
+    OUT PECHO_CPU_SET        set
+    );
+
+//
+// Node of the lowest processor of set, ECHO_NODE_ANY if unknown
+// бСĴڵĽڵ㣬δ֪ʱΪECHO_NODE_ANY
+//
+ULONG EchoAffinitySetNode(IN const ECHO_CPU_SET* set);
+
+//
+// Restricts the calling thread to set
+// ߳set
+//
+BOOLEAN EchoAffinityPin(IN const ECHO_CPU_SET* set);
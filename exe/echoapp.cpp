@@ -21,15 +21,24 @@ Environment:
 #include <DriverSpecs.h>
 _Analysis_mode_(_Analysis_code_type_user_code_)
 
-#define INITGUID
-
 #include <windows.h>
 #include <strsafe.h>
-#include <cfgmgr32.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <winioctl.h>
 #include "public.h"
+#include "echoaffinity.h"
+#include "echoarena.h"
+#include "echobench.h"
+#include "echoclient.h"
+#include "echoco.h"
+#include "echodepth.h"
+#include "echohist.h"
+#include "echopattern.h"
+#include "echopool.h"
+#include "echosuite.h"
+#include "echotrace.h"
+#include "echoverify.h"
 
 #define NUM_ASYNCH_IO   100
 #define BUFFER_SIZE     (40*1024)
@@ -37,30 +46,239 @@ _Analysis_mode_(_Analysis_code_type_user_code_)
 #define READER_TYPE   1
 #define WRITER_TYPE   2
 
-#define MAX_DEVPATH_LENGTH    256
+#define MAX_DEVPATH_LENGTH    ECHO_CLIENT_PATH_LENGTH
+#define MAX_DEVICES           16
+
+#define CLIENT_CHECK_LENGTH   1024
+
+#define NUM_PINGS       1000
+#define SCALE_MAX_THREADS  64
+#define SCALE_RUN_SECONDS  10
+#define SCALE_IO_SIZE      512
+#define ASYNC_WORKERS   4
+#define ASYNC_POLL_MS   100
+#define ASYNC_REPORT_MS 1000
+#define ASYNC_SHARD_KEY 0
+#define CANCEL_RUN_SECONDS 10
+#define CANCEL_QUEUE_DEPTH 64
+#define CANCEL_PERCENT     10
+#define CANCEL_ROUND_MS    5
+#define CANCEL_DRAIN_MS    5000
+#define CANCEL_IO_SIZE     512
+#define CANCEL_SHARD_KEY   0
+#define TRACED_REQUESTS    20
+#define TRACED_QUEUE_DEPTH 1
+#define TRACED_MAX_DEPTH   64
+#define TRACED_IO_SIZE     512
+#define TRACED_BUFFER_SIZE ((ULONG)sizeof(ECHO_TRACED_HEADER) + TRACED_IO_SIZE)
+#define TRACED_SHARD_KEY   0
+#define TRACED_GRACE_MS    5000
+#define TRACED_SLOWEST     5
+#define TRACED_BAR_WIDTH   40
+
+//
+// Client handles in a recorded trace
+// ¼ĸеĿͻ˾
+//
+#define TRACE_HANDLE_SYNC   0
+#define TRACE_HANDLE_WRITER 0
+#define TRACE_HANDLE_READER 1
+#define PING_WARMUP_MS  1000
+
+//
+// Calls timed by the synchronous write/read test
+// ͬдԼʱĵ
+//
+#define SYNC_CALL_WRITE 0
+#define SYNC_CALL_READ  1
+#define SYNC_CALL_IOCTL 2
+#define SYNC_CALL_COUNT 3
+
+//
+// Latencies kept by the cancellation stress
+// ȡѹԼ¼ӳ
+//
+#define CANCEL_HIST_ABORTED     0   // cancel to the cancelled completion
+#define CANCEL_HIST_RACED       1   // cancel to a normal completion
+#define CANCEL_HIST_UNCANCELLED 2   // issue to completion, never cancelled
+#define CANCEL_HIST_COUNT       3
 
-#define IOCTL_CODE_TEST CTL_CODE(FILE_DEVICE_UNKNOWN, 0x800, METHOD_BUFFERED, FILE_ANY_ACCESS)
+//
+// Stages of a traced echo as seen by the client. The driver's stamps split
+// the time between submission and completion; the first and last stages
+// are the trip through the I/O manager to and from the driver.
+// ͻ˿ĸٻԸ׶Ρʱύ֮ʱ䣻
+// һһ׶ǾI/O·̡
+//
+#define TRACED_STAGE_SEND       0   // submit to arrival in the driver
+#define TRACED_STAGE_QUEUE      1   // arrival to presentation by the shard
+#define TRACED_STAGE_COPY       2   // copy into the echo buffer
+#define TRACED_STAGE_PARK       3   // echo back and park
+#define TRACED_STAGE_TIMER      4   // parked until the timer tick
+#define TRACED_STAGE_COMPLETE   5   // timer tick to completion
+#define TRACED_STAGE_DELIVER    6   // completion to the client's port
+#define TRACED_STAGE_TOTAL      7   // submit to the client's port
+#define TRACED_STAGE_COUNT      8
 
 BOOLEAN G_bPerformAsyncIo;        // Ƿʹ첽I/O
 BOOLEAN G_bLimitedLoops;          // Ƿѭ
 ULONG   G_nAsyncIoLoopsNum;       // 첽ѭ
-WCHAR   G_szDevicePath[MAX_DEVPATH_LENGTH];
+ULONG   G_nAsyncWorkers = ASYNC_WORKERS; // ÿ첽̵߳ɶ˿ڹ߳
+ULONG   G_nAsyncTraceEvery;       // ÿNɴӡһ0Ϊӡ
+ULONG   G_nAsyncTargetUs;         // 첽д;ȵp99Ŀ꣬0Ϊ̶
+ECHO_DEPTH_RULE G_AsyncControl = EchoDepthAimd; // ӦȵĹ
+BOOLEAN G_bPingTest;              // Ƿ²Կӳ
+ULONG   G_nPings;                 // 
+BOOLEAN G_bTune;                  // Ƿѯ޸ĵŲ
+int     G_nTuneArgs;              // name=value
+char**  G_pTuneArgs;              // name=value
+BOOLEAN G_bScaleTest;             // ǷԷƬչ
+ULONG   G_nScaleSeconds;          // ÿ߳
+volatile BOOLEAN G_bStopScale;    // ֪ͨչԲ߳˳
+volatile BOOLEAN G_bStopAsyncIo;  // ֪ͨ첽߳˳
+BOOLEAN G_bBench;                 // Ƿи
+BOOLEAN G_bCancelTest;            // Ƿڸȡ
+ULONG   G_nCancelSeconds;         // ȡѹԵ
+ULONG   G_nCancelDepth = CANCEL_QUEUE_DEPTH; // ȡѹԵ;
+ULONG   G_nCancelPercent = CANCEL_PERCENT;   // ÿȡ;ٷֱ
+BOOLEAN G_bTracedTest;            // ǷٻԵĸ׶ӳ
+ULONG   G_nTracedRequests;        // ٻԵ
+ULONG   G_nTracedDepth = TRACED_QUEUE_DEPTH; // ٻԵ;
+ECHO_BENCH_OPTIONS G_BenchOptions; // 
+PECHO_LEDGER G_pLedger;           // 첽дУ˱
+PCSTR   G_pszJsonPath;            // ӳֱͼJSONļ
+PCSTR   G_pszCsvPath;             // ӳֱͼCSVļ
+BOOLEAN G_bLargePages;            // I/OǷʹôҳ
+PCSTR   G_pszAffinity;            // ̵߳ķãNULLΪϵͳ
+ECHO_AFFINITY G_Affinity;         // 첽д̵߳׺
+PCSTR   G_pszTracePath;           // ¼I/Oٵļ
+PECHO_TRACE_WRITER G_pTrace;      // дԺ첽дĸ
+PCSTR   G_pszBenchEngines = "iocp"; // ʹõ棬ŷָ
+BOOLEAN G_bSuite;                 // Ƿл׼׼
+BOOLEAN G_bCoro;                  // ǷЭ̿ͻ˲븺Ƚ
+BOOLEAN G_bClient;                // Ƿͻ˿ⲢȽ÷ʽ
+PCSTR   G_pszSuite;               // ׼׼ļ
+PCSTR   G_pszSuiteResults;        // ׼ļ
+ULONG   G_nSuiteRepeat = ECHO_SUITE_REPEAT; // ׼ÿصд
+ECHO_HISTOGRAM G_SyncLatency[SYNC_CALL_COUNT]; // ͬõӳ
+ECHO_HISTOGRAM G_AsyncLatency[EchoOpCount];    // 첽дӷɵӳ
+ECHO_HISTOGRAM G_CancelLatency[CANCEL_HIST_COUNT]; // ȡѹԵӳ
+ECHO_HISTOGRAM G_TracedLatency[TRACED_STAGE_COUNT]; // ٻԸ׶εӳ
+PCSTR   G_TracedStageNames[TRACED_STAGE_COUNT] = {   // ٻԸ׶ε
+    "send", "queue", "copy", "park", "timer", "complete", "deliver", "total" };
+WCHAR   G_szDevicePaths[MAX_DEVICES][MAX_DEVPATH_LENGTH]; // λ豸豸ʹõһ
+ULONG   G_nDevices;               // λ豸
 
 ULONG AsyncIo(PVOID threadParameter);
 
-BOOLEAN PerformWriteReadTest(
+BOOLEAN PerformPingTest(
     IN HANDLE hDevice,
-    IN ULONG  testLength
+    IN ULONG  count
+    );
+
+BOOLEAN PerformScaleTest(
+    IN HANDLE hDevice,
+    IN ULONG  seconds
+    );
+
+BOOLEAN PerformBenchmark(
+    IN HANDLE             hDevice,
+    IN PECHO_BENCH_OPTIONS options
+    );
+
+BOOLEAN PerformSuite(
+    IN PECHO_BENCH_OPTIONS options
+    );
+
+BOOLEAN PerformCoroutineTest(
+    IN PECHO_BENCH_OPTIONS options
+    );
+
+BOOLEAN PerformClientTest(
+    IN PECHO_BENCH_OPTIONS options
+    );
+
+BOOLEAN PerformCancelTest(
+    IN HANDLE hDevice,
+    IN ULONG  seconds
+    );
+
+BOOLEAN PerformTracedTest(
+    IN HANDLE hDevice,
+    IN ULONG  count
+    );
+
+BOOLEAN PerformTune(
+    IN HANDLE hDevice,
+    IN int    argc,
+    IN char*  argv[]
     );
 
-BOOL GetDevicePath(
-    IN  LPGUID interfaceGuid,
-    _Out_writes_(bufLen) PWCHAR devicePath,
-    _In_ size_t bufLen
+BOOLEAN PerformWriteReadTest(
+    IN HANDLE hDevice,
+    IN ULONG  testLength
     );
 
 #define LOG printf
 
+//
+// Ѽ¼ӳֱͼ
+//
+BOOLEAN ExportLatency(VOID)
+{
+    static const PCSTR syncNames[SYNC_CALL_COUNT] = { "sync-write", "sync-read", "sync-ioctl" };
+    static const PCSTR asyncNames[EchoOpCount] = { "async-write", "async-read" };
+    static const PCSTR cancelNames[CANCEL_HIST_COUNT] = { "cancel-aborted", "cancel-raced", "cancel-uncancelled" };
+    static const PCSTR tracedNames[TRACED_STAGE_COUNT] = {
+        "traced-send", "traced-queue", "traced-copy", "traced-park",
+        "traced-timer", "traced-complete", "traced-deliver", "traced-total" };
+    ECHO_HIST_NAMED named[SYNC_CALL_COUNT + EchoOpCount + CANCEL_HIST_COUNT + TRACED_STAGE_COUNT];
+    ULONG count = 0;
+    ULONG i;
+    BOOLEAN result = TRUE;
+
+    for (i = 0; i < SYNC_CALL_COUNT; i++) {
+        if (G_SyncLatency[i].Count != 0) {
+            named[count].Name = syncNames[i];
+            named[count].Histogram = &G_SyncLatency[i];
+            count++;
+        }
+    }
+
+    for (i = 0; i < EchoOpCount; i++) {
+        if (G_AsyncLatency[i].Count != 0) {
+            named[count].Name = asyncNames[i];
+            named[count].Histogram = &G_AsyncLatency[i];
+            count++;
+        }
+    }
+
+    for (i = 0; i < CANCEL_HIST_COUNT; i++) {
+        if (G_CancelLatency[i].Count != 0) {
+            named[count].Name = cancelNames[i];
+            named[count].Histogram = &G_CancelLatency[i];
+            count++;
+        }
+    }
+
+    for (i = 0; i < TRACED_STAGE_COUNT; i++) {
+        if (G_TracedLatency[i].Count != 0) {
+            named[count].Name = tracedNames[i];
+            named[count].Histogram = &G_TracedLatency[i];
+            count++;
+        }
+    }
+
+    if (G_pszJsonPath != NULL) {
+        result = EchoHistExport(G_pszJsonPath, EchoHistJson, named, count) && result;
+    }
+    if (G_pszCsvPath != NULL) {
+        result = EchoHistExport(G_pszCsvPath, EchoHistCsv, named, count) && result;
+    }
+
+    return result;
+}
+
 //
 // ں
 //
@@ -70,24 +288,302 @@ int __cdecl main(_In_ int argc, _In_reads_(argc) char* argv[])
 
     HANDLE  hDevice = INVALID_HANDLE_VALUE;
     HANDLE  th1 = NULL;
+    HANDLE  th2 = NULL;
+    DWORD   exitCode;
     BOOLEAN result = TRUE;
+    int     i;
+    int     j;
+
+    for (i = 0; i < SYNC_CALL_COUNT; i++) {
+        EchoHistReset(&G_SyncLatency[i]);
+    }
+    for (i = 0; i < EchoOpCount; i++) {
+        EchoHistReset(&G_AsyncLatency[i]);
+    }
+    for (i = 0; i < CANCEL_HIST_COUNT; i++) {
+        EchoHistReset(&G_CancelLatency[i]);
+    }
+    for (i = 0; i < TRACED_STAGE_COUNT; i++) {
+        EchoHistReset(&G_TracedLatency[i]);
+    }
+
+    //
+    // -json, -csv, -largepages, -affinity and -record apply to every mode;
+    // take them out before the modes parse the rest
+    // -json-csv-largepages-affinity-recordģʽڸģʽ֮ǰȡ
+    //
+    for (i = 1, j = 1; i < argc; i++) {
+        if (!_stricmp(argv[i], "-json") && i + 1 < argc) {
+            G_pszJsonPath = argv[++i];
+        }
+        else if (!_stricmp(argv[i], "-csv") && i + 1 < argc) {
+            G_pszCsvPath = argv[++i];
+        }
+        else if (!_stricmp(argv[i], "-largepages") && i + 1 < argc) {
+            G_bLargePages = (atoi(argv[++i]) != 0);
+        }
+        else if (!_stricmp(argv[i], "-record") && i + 1 < argc) {
+            G_pszTracePath = argv[++i];
+        }
+        else if (!_stricmp(argv[i], "-affinity") && i + 1 < argc) {
+            G_pszAffinity = argv[++i];
+        }
+        else {
+            argv[j++] = argv[i];
+        }
+    }
+    argc = j;
+
+    if (G_pszAffinity != NULL) {
+        if (!EchoAffinityParse(G_pszAffinity, &G_Affinity)) {
+            result = FALSE;
+            goto exit;
+        }
+        if (G_Affinity.Mode == EchoAffinityNone) {
+            G_pszAffinity = NULL;
+        }
+    }
+
+    EchoArenaUseLargePages(G_bLargePages);
 
     if (argc > 1)  {
         if(!_strnicmp (argv[1], "-Async", 6) ) {
             G_bPerformAsyncIo = TRUE;
-            if (argc > 2) {
-                G_nAsyncIoLoopsNum = atoi(argv[2]);
-                G_bLimitedLoops = TRUE;
+            G_bLimitedLoops = FALSE;
+            for (i = 2; i < argc; i++) {
+                if (!_stricmp(argv[i], "-workers") && i + 1 < argc) {
+                    G_nAsyncWorkers = atoi(argv[++i]);
+                    if (G_nAsyncWorkers == 0) {
+                        G_nAsyncWorkers = ASYNC_WORKERS;
+                    }
+                }
+                else if (!_stricmp(argv[i], "-trace") && i + 1 < argc) {
+                    G_nAsyncTraceEvery = atoi(argv[++i]);
+                }
+                else if (!_stricmp(argv[i], "-target") && i + 1 < argc) {
+                    G_nAsyncTargetUs = atoi(argv[++i]);
+                }
+                else if (!_stricmp(argv[i], "-control") && i + 1 < argc) {
+                    if (!EchoDepthParse(argv[++i], &G_AsyncControl)) {
+                        LOG("Bad value %s for -control\n", argv[i]);
+                        result = FALSE;
+                        goto exit;
+                    }
+                }
+                else {
+                    G_nAsyncIoLoopsNum = atoi(argv[i]);
+                    G_bLimitedLoops = TRUE;
+                }
             }
-            else {
-                G_bLimitedLoops = FALSE;
+        }
+        else if (!_strnicmp(argv[1], "-Tune", 5)) {
+            G_bTune = TRUE;
+            G_nTuneArgs = argc - 2;
+            G_pTuneArgs = argv + 2;
+        }
+        else if (!_strnicmp(argv[1], "-Scale", 6)) {
+            G_bScaleTest = TRUE;
+            G_nScaleSeconds = (argc > 2) ? atoi(argv[2]) : SCALE_RUN_SECONDS;
+            if (G_nScaleSeconds == 0) {
+                G_nScaleSeconds = SCALE_RUN_SECONDS;
+            }
+        }
+        else if (!_strnicmp(argv[1], "-Ping", 5)) {
+            G_bPingTest = TRUE;
+            G_nPings = (argc > 2) ? atoi(argv[2]) : NUM_PINGS;
+            if (G_nPings == 0) {
+                G_nPings = NUM_PINGS;
+            }
+        }
+        else if (!_strnicmp(argv[1], "-Cancel", 7)) {
+            G_bCancelTest = TRUE;
+            G_nCancelSeconds = CANCEL_RUN_SECONDS;
+            for (i = 2; i < argc; i++) {
+                if (!_stricmp(argv[i], "-qd") && i + 1 < argc) {
+                    G_nCancelDepth = atoi(argv[++i]);
+                }
+                else if (!_stricmp(argv[i], "-pct") && i + 1 < argc) {
+                    G_nCancelPercent = atoi(argv[++i]);
+                }
+                else if (atoi(argv[i]) > 0) {
+                    G_nCancelSeconds = atoi(argv[i]);
+                }
+            }
+            if (G_nCancelDepth == 0 || G_nCancelPercent > 100) {
+                LOG("-Cancel needs a queue depth above 0 and a percentage of 0-100\n");
+                result = FALSE;
+                goto exit;
+            }
+        }
+        else if (!_strnicmp(argv[1], "-Traced", 7)) {
+            G_bTracedTest = TRUE;
+            G_nTracedRequests = TRACED_REQUESTS;
+            for (i = 2; i < argc; i++) {
+                if (!_stricmp(argv[i], "-qd") && i + 1 < argc) {
+                    G_nTracedDepth = atoi(argv[++i]);
+                }
+                else if (atoi(argv[i]) > 0) {
+                    G_nTracedRequests = atoi(argv[i]);
+                }
+            }
+            if (G_nTracedDepth == 0 || G_nTracedDepth > TRACED_MAX_DEPTH) {
+                LOG("-Traced needs a queue depth of 1-%d\n", TRACED_MAX_DEPTH);
+                result = FALSE;
+                goto exit;
+            }
+        }
+        else if (!_strnicmp(argv[1], "-Pattern", 8)) {
+
+            //
+            // Needs no device: cross-check and time the pattern routines
+            // Ҫ豸ռ鲢ʱģʽ
+            //
+            result = EchoPatternSelfTest();
+            if (result) {
+                EchoPatternMeasure();
+            }
+            goto exit;
+        }
+        else if (!_strnicmp(argv[1], "-Bench", 6)) {
+            G_bBench = TRUE;
+            EchoBenchDefaultOptions(&G_BenchOptions);
+            G_BenchOptions.JsonPath = G_pszJsonPath;
+            G_BenchOptions.CsvPath = G_pszCsvPath;
+            G_BenchOptions.LargePages = G_bLargePages;
+            G_BenchOptions.Affinity = G_pszAffinity;
+            G_BenchOptions.RecordPath = G_pszTracePath;
+
+            //
+            // -engine comes first and is ours, the rest belong to the load generator
+            // -engineǰ棬ɱ
+            //
+            i = 2;
+            if (argc > 3 && !_stricmp(argv[2], "-engine")) {
+                G_pszBenchEngines = argv[3];
+                i = 4;
+            }
+            if (!EchoBenchParseOptions(argc - i, argv + i, &G_BenchOptions)) {
+                LOG("Usage:\n");
+                LOG("    Echoapp.exe -Bench [-engine <names>] [options] --- Measure IOPS, MB/s and latency percentiles\n");
+                LOG("        -engine <names> sync, event, iocp or threadpool; several separated by\n");
+                LOG("                        commas, or all, run the same workload on each and compare (iocp)\n");
+                EchoBenchUsage();
+                result = FALSE;
+                goto exit;
+            }
+        }
+        else if (!_strnicmp(argv[1], "-Coro", 5)) {
+            G_bCoro = TRUE;
+            EchoBenchDefaultOptions(&G_BenchOptions);
+            G_BenchOptions.LargePages = G_bLargePages;
+            G_BenchOptions.Affinity = G_pszAffinity;
+
+            if (!EchoBenchParseOptions(argc - 2, argv + 2, &G_BenchOptions)) {
+                LOG("Usage:\n");
+                LOG("    Echoapp.exe -Coro [options] --- Check the coroutine client and compare it with -Bench\n");
+                EchoBenchUsage();
+                result = FALSE;
+                goto exit;
+            }
+        }
+        else if (!_strnicmp(argv[1], "-Client", 7)) {
+            G_bClient = TRUE;
+            EchoBenchDefaultOptions(&G_BenchOptions);
+            G_BenchOptions.LargePages = G_bLargePages;
+            G_BenchOptions.Affinity = G_pszAffinity;
+
+            if (!EchoBenchParseOptions(argc - 2, argv + 2, &G_BenchOptions)) {
+                LOG("Usage:\n");
+                LOG("    Echoapp.exe -Client [options] --- Check the EchoClient library and compare its calls\n");
+                EchoBenchUsage();
+                result = FALSE;
+                goto exit;
+            }
+        }
+        else if (!_strnicmp(argv[1], "-Suite", 6) && argc > 3) {
+            G_bSuite = TRUE;
+            G_pszSuite = argv[2];
+            G_pszSuiteResults = argv[3];
+            EchoBenchDefaultOptions(&G_BenchOptions);
+            G_BenchOptions.LargePages = G_bLargePages;
+            G_BenchOptions.Affinity = G_pszAffinity;
+
+            //
+            // -engine and -repeat are ours, the rest apply to every workload
+            // -engine-repeatɱÿ
+            //
+            for (i = 4; i + 1 < argc; i += 2) {
+                if (!_stricmp(argv[i], "-engine")) {
+                    G_pszBenchEngines = argv[i + 1];
+                }
+                else if (!_stricmp(argv[i], "-repeat")) {
+                    G_nSuiteRepeat = atoi(argv[i + 1]);
+                }
+                else {
+                    break;
+                }
+            }
+            if (!EchoBenchParseOptions(argc - i, argv + i, &G_BenchOptions)) {
+                LOG("Usage:\n");
+                LOG("    Echoapp.exe -Suite <name|file> <results> [-engine <name>] [-repeat <n>] [options]\n");
+                EchoBenchUsage();
+                result = FALSE;
+                goto exit;
             }
         }
+        else if (!_strnicmp(argv[1], "-Compare", 8) &&
+                 (argc == 4 || (argc == 6 && !_stricmp(argv[4], "-threshold")))) {
+
+            //
+            // Needs no device: the regression gate over two results files
+            // Ҫ豸ļִлعŽ
+            //
+            result = EchoSuiteCompare(argv[2], argv[3], (argc == 6) ? atof(argv[5]) : ECHO_SUITE_THRESHOLD);
+            goto exit;
+        }
         else {
             LOG("Usage:\n");
             LOG("    Echoapp.exe         --- Send single write and read request synchronously\n");
             LOG("    Echoapp.exe -Async  --- Send reads and writes asynchronously without terminating\n");
             LOG("    Echoapp.exe -Async <number> --- Send <number> reads and writes asynchronously\n");
+            LOG("        -workers <n> --- Complete them on <n> threads per direction (%d)\n", ASYNC_WORKERS);
+            LOG("        -trace <n>   --- Print every n-th completion (none)\n");
+            LOG("        -target <us> --- Adapt the requests in flight, at most %d per direction, to keep\n", NUM_ASYNCH_IO);
+            LOG("                         their p99 under us microseconds (fixed at %d)\n", NUM_ASYNCH_IO);
+            LOG("        -control <aimd|gradient> --- Rule the adaptive depth follows (aimd)\n");
+            LOG("    Echoapp.exe -Ping [number]  --- Measure control request latency while reads and writes saturate the device\n");
+            LOG("    Echoapp.exe -Cancel [seconds] --- Cancel random requests under load for %d seconds\n", CANCEL_RUN_SECONDS);
+            LOG("        -qd <n>  --- Keep <n> reads and writes in flight (%d)\n", CANCEL_QUEUE_DEPTH);
+            LOG("        -pct <p> --- Cancel p%% of them every %d ms with CancelIoEx (%d)\n", CANCEL_ROUND_MS, CANCEL_PERCENT);
+            LOG("    Echoapp.exe -Traced [number] --- Send number traced echoes (%d) and break their latency\n", TRACED_REQUESTS);
+            LOG("        down into the stages the driver stamps on the way\n");
+            LOG("        -qd <n>  --- Keep <n> of them in flight on one shard (%d)\n", TRACED_QUEUE_DEPTH);
+            LOG("    Echoapp.exe -Scale [seconds] --- Measure echo throughput with 1 to %d client threads\n", SCALE_MAX_THREADS);
+            LOG("        -Scale and -Bench spread their threads over every device present\n");
+            LOG("    Echoapp.exe -Bench [-engine <names>] [options] --- Measure IOPS, MB/s and latency percentiles\n");
+            LOG("        -engine <names> sync, event, iocp or threadpool; several separated by\n");
+            LOG("                        commas, or all, run the same workload on each and compare (iocp)\n");
+            EchoBenchUsage();
+            LOG("    Echoapp.exe -Coro [options] --- Check the coroutine client, then run the -Bench\n");
+            LOG("        workload on one thread with the load generator and with coroutines and compare\n");
+            LOG("    Echoapp.exe -Client [options] --- Check the EchoClient library, then compare its\n");
+            LOG("        synchronous, pipelined and coalesced calls with -qd and -bs of the -Bench options\n");
+            LOG("    Echoapp.exe -Suite <name|file> <results> [-engine <name>] [-repeat <n>] [options]\n");
+            LOG("        --- Run every workload of a suite n times (%d) and save the runs; suites:\n", ECHO_SUITE_REPEAT);
+            LOG("        default, quick, or a file of lines \"<name> <options>\"\n");
+            LOG("    Echoapp.exe -Compare <baseline> <results> [-threshold <pct>]\n");
+            LOG("        --- Fail if a workload is slower with 95%% confidence by at least pct percent (%d)\n",
+                ECHO_SUITE_THRESHOLD);
+            LOG("    Echoapp.exe -Pattern --- Cross-check and time the pattern fill and check routines\n");
+            LOG("    Echoapp.exe -Tune [name=value ...] --- Show or change the queue tuning parameters\n");
+            LOG("        names: TimerPeriod, MaxWriteLength, PoolTag, StartDelay\n");
+            LOG("    Any mode also takes -json <file> and -csv <file> to export its latency histograms\n");
+            LOG("    and -largepages <0|1> to back its I/O buffers with large pages\n");
+            LOG("    -Async and the load generator modes take -affinity <spec> to pin their I/O workers\n");
+            LOG("    (none, compact, spread, node or processors such as 0,2,4-7) and place their\n");
+            LOG("    buffers on the workers' NUMA nodes\n");
+            LOG("    The write/read test, -Async and -Bench take -record <file> to write a trace of\n");
+            LOG("    their operations, which -Bench -replay <file> sends again\n");
             LOG("Exit the app anytime by pressing Ctrl-C\n");
             result = FALSE;
             goto exit;
@@ -95,23 +591,48 @@ int __cdecl main(_In_ int argc, _In_reads_(argc) char* argv[])
     }
 
     //
-    // GUIDȡ豸·
+    // The processors and nodes the placement of the workers is made from
+    // ̷߳ݵĴͽڵ
     //
-    if ( !GetDevicePath(
-            (LPGUID) &GUID_DEVINTERFACE_ECHO,
-            G_szDevicePath,
-            sizeof(G_szDevicePath)/sizeof(G_szDevicePath[0])) )
-    {
+    EchoTopologyReport();
+
+    //
+    // The benchmark records its own trace
+    // м¼
+    //
+    if (G_pszTracePath != NULL && !G_bBench && !G_bSuite && !G_bCoro && !G_bClient) {
+        G_pTrace = EchoTraceCreate(G_pszTracePath);
+        if (G_pTrace == NULL) {
+            result = FALSE;
+            goto exit;
+        }
+    }
+
+    //
+    // ȡλ豸·
+    //
+    if (!EchoClientGetDevicePaths(G_szDevicePaths, MAX_DEVICES, &G_nDevices)) {
         result = FALSE;
         goto exit;
     }
 
-    LOG("DevicePath: %ws\n", G_szDevicePath);
+    for (i = 0; i < (int)G_nDevices; i++) {
+        LOG("DevicePath %d: %ws\n", i, G_szDevicePaths[i]);
+    }
+
+    //
+    // -Scale and -Bench spread their threads over every device; the other
+    // tests check one device's echo
+    // -Scale-Bench̷ֲ߳豸Լһ豸Ļ
+    //
+    if (G_nDevices > 1 && !G_bScaleTest && !G_bBench && !G_bSuite) {
+        LOG("Testing device 0; -Scale and -Bench use all %d devices\n", G_nDevices);
+    }
 
     //
     // 豸
     //
-    hDevice = CreateFile(G_szDevicePath,
+    hDevice = CreateFile(G_szDevicePaths[0],
                          GENERIC_READ|GENERIC_WRITE,
                          FILE_SHARE_READ | FILE_SHARE_WRITE,
                          NULL,
@@ -129,6 +650,19 @@ int __cdecl main(_In_ int argc, _In_reads_(argc) char* argv[])
     LOG("Opened device successfully\n");
     OutputDebugStringA("Opened device successfully\n");
 
+    //
+    // The reader and writer pin the same shard, so every read echoes some
+    // write, and check it against one ledger
+    // ̺߳д̶̹߳ͬһƬʹÿζȡĳд룬ͬһ˱У
+    //
+    if (G_bPerformAsyncIo || G_bPingTest) {
+        G_pLedger = EchoLedgerCreate(ASYNC_SHARD_KEY, NUM_ASYNCH_IO);
+        if (G_pLedger == NULL) {
+            result = FALSE;
+            goto exit;
+        }
+    }
+
     if(G_bPerformAsyncIo) {
 
         LOG("Starting AsyncIo\n");
@@ -157,6 +691,79 @@ int __cdecl main(_In_ int argc, _In_reads_(argc) char* argv[])
         result = (BOOLEAN)AsyncIo((PVOID)WRITER_TYPE);
 
     }
+    else if (G_bPingTest) {
+
+        LOG("Starting PingTest\n");
+
+        //
+        // Saturate the bulk lane with unlimited reads and writes, then
+        // measure the control lane from this thread.
+        // ʹ޵ĶдʹͨͣȻڴ߳вͨ
+        //
+        G_bLimitedLoops = FALSE;
+
+        th1 = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) AsyncIo, (LPVOID)READER_TYPE, 0, NULL);
+        if (th1 == NULL) {
+            LOG("Couldn't create reader thread - error %d\n", GetLastError());
+            result = FALSE;
+            goto exit;
+        }
+
+        th2 = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) AsyncIo, (LPVOID)WRITER_TYPE, 0, NULL);
+        if (th2 == NULL) {
+            LOG("Couldn't create writer thread - error %d\n", GetLastError());
+            result = FALSE;
+            goto exit;
+        }
+
+        result = PerformPingTest(hDevice, G_nPings);
+    }
+    else if (G_bTune) {
+
+        result = PerformTune(hDevice, G_nTuneArgs, G_pTuneArgs);
+    }
+    else if (G_bCancelTest) {
+
+        LOG("Starting CancelTest\n");
+
+        result = PerformCancelTest(hDevice, G_nCancelSeconds);
+    }
+    else if (G_bTracedTest) {
+
+        LOG("Starting TracedTest\n");
+
+        result = PerformTracedTest(hDevice, G_nTracedRequests);
+    }
+    else if (G_bScaleTest) {
+
+        LOG("Starting ScaleTest\n");
+
+        result = PerformScaleTest(hDevice, G_nScaleSeconds);
+    }
+    else if (G_bBench) {
+
+        LOG("Starting Benchmark\n");
+
+        result = PerformBenchmark(hDevice, &G_BenchOptions);
+    }
+    else if (G_bSuite) {
+
+        LOG("Starting Suite\n");
+
+        result = PerformSuite(&G_BenchOptions);
+    }
+    else if (G_bCoro) {
+
+        LOG("Starting CoroutineTest\n");
+
+        result = PerformCoroutineTest(&G_BenchOptions);
+    }
+    else if (G_bClient) {
+
+        LOG("Starting ClientTest\n");
+
+        result = PerformClientTest(&G_BenchOptions);
+    }
     else {
         //
         // Write pattern buffers and read them back, then verify them
@@ -176,42 +783,54 @@ int __cdecl main(_In_ int argc, _In_reads_(argc) char* argv[])
 
 exit:
 
+    if (G_bPingTest) {
+        G_bStopAsyncIo = TRUE;
+    }
+
     if (th1 != NULL) {
         WaitForSingleObject(th1, INFINITE);
+
+        //
+        // The reader's verdict counts as much as the writer's
+        // ̵߳Ľд̵߳ͬҪ
+        //
+        if (G_bPerformAsyncIo && GetExitCodeThread(th1, &exitCode) && exitCode == FALSE) {
+            result = FALSE;
+        }
         CloseHandle(th1);
     }
 
+    if (th2 != NULL) {
+        WaitForSingleObject(th2, INFINITE);
+        CloseHandle(th2);
+    }
+
     if (hDevice != INVALID_HANDLE_VALUE) {
         CloseHandle(hDevice);
     }
 
-    return ((result == TRUE) ? 0 : 1);
-
-}
+    //
+    // The benchmark exports its own histograms
+    // еֱͼ
+    //
+    if (!G_bBench && !G_bSuite && !G_bCoro && !G_bClient && !ExportLatency()) {
+        result = FALSE;
+    }
 
-//
-// ģ⻺
-//
-PUCHAR CreatePatternBuffer(IN ULONG length)
-{
-    unsigned int i;
-    PUCHAR p, pBuf;
+    if (G_bPerformAsyncIo || G_bPingTest) {
+        EchoArenaReport();
+    }
 
-    pBuf = (PUCHAR)malloc(length);
-    if( pBuf == NULL ) {
-        LOG("Could not allocate %d byte buffer\n",length);
-        return NULL;
+    if (G_pTrace != NULL && !EchoTraceClose(G_pTrace)) {
+        result = FALSE;
     }
 
-    p = pBuf;
+    EchoLedgerDelete(G_pLedger);
+    EchoPatternCacheFree();
+    EchoArenaRelease();
 
-    // ڻд
-    for(i=0; i < length; i++ ) {
-        *p = (UCHAR)i;
-        p++;
-    }
+    return ((result == TRUE) ? 0 : 1);
 
-    return pBuf;
 }
 
 //
@@ -221,18 +840,18 @@ BOOLEAN VerifyPatternBuffer(
 	_In_reads_bytes_(length) PUCHAR pBuffer,
 	_In_ ULONG length)
 {
-    unsigned int i;
-    PUCHAR p = pBuffer;
+    ULONG offset;
 
-    for( i=0; i < length; i++ ) {
-
-        if( *p != (UCHAR)(i & 0xFF) ) {
-            LOG("Pattern changed. SB 0x%x, Is 0x%x\n",
-                   (UCHAR)(i & 0xFF), *p);
-            return FALSE;
-        }
+    //
+    // The vectorized check finds the same first mismatch the byte loop did
+    // Уҵĵһһλֽѭͬ
+    //
+    offset = EchoPatternCheck(pBuffer, length);
 
-        p++;
+    if( offset != length ) {
+        LOG("Pattern changed. SB 0x%x, Is 0x%x\n",
+               (UCHAR)(offset & 0xFF), pBuffer[offset]);
+        return FALSE;
     }
 
     return TRUE;
@@ -247,20 +866,22 @@ BOOLEAN PerformWriteReadTest(
     )
 {
     ULONG  bytesReturned =0;
-    PUCHAR writeBuffer = NULL,
-           readBuffer = NULL;
+    const UCHAR* writeBuffer = NULL;
+    PUCHAR readBuffer = NULL;
+    ULONGLONG startNs;
+    BOOL succeeded;
     BOOLEAN result = TRUE;
 
-    // д
-    writeBuffer = CreatePatternBuffer(length);
+    // ȡдģʽС棬ڴͷ
+    writeBuffer = EchoPatternGet(length);
     if( writeBuffer == NULL ) {
 
         result = FALSE;
         goto Cleanup;
     }
 
-    // 
-    readBuffer = (PUCHAR)malloc(length);
+    // ӻȡöظĲԸͬһ
+    readBuffer = EchoArenaAlloc(length);
     if( readBuffer == NULL ) {
 
         LOG("PerformWriteReadTest: Could not allocate %d "
@@ -271,14 +892,22 @@ BOOLEAN PerformWriteReadTest(
 
     }
 
-    // ģ⻺д豸
+    // ģ⻺д豸¼úʱ
     bytesReturned = 0;
 
-    if (!WriteFile (hDevice,
+    if (G_pTrace != NULL) {
+        EchoTraceRecord(G_pTrace, TRACE_HANDLE_SYNC, EchoOpWrite, length);
+    }
+
+    startNs = EchoNowNs();
+    succeeded = WriteFile (hDevice,
             writeBuffer,
             length,
             &bytesReturned,
-            NULL)) {
+            NULL);
+    EchoHistRecord(&G_SyncLatency[SYNC_CALL_WRITE], EchoNowNs() - startNs);
+
+    if (!succeeded) {
 
         LOG ("PerformWriteReadTest: WriteFile failed: "
                 "Error %d\n", GetLastError());
@@ -304,12 +933,20 @@ BOOLEAN PerformWriteReadTest(
 
     bytesReturned = 0;
 
-    // 豸ȡݵ
-    if ( !ReadFile (hDevice,
+    // 豸ȡݵ¼úʱ
+    if (G_pTrace != NULL) {
+        EchoTraceRecord(G_pTrace, TRACE_HANDLE_SYNC, EchoOpRead, length);
+    }
+
+    startNs = EchoNowNs();
+    succeeded = ReadFile (hDevice,
             readBuffer,
             length,
             &bytesReturned,
-            NULL)) {
+            NULL);
+    EchoHistRecord(&G_SyncLatency[SYNC_CALL_READ], EchoNowNs() - startNs);
+
+    if ( !succeeded ) {
 
         LOG ("PerformWriteReadTest: ReadFile failed: "
                 "Error %d\n", GetLastError());
@@ -349,7 +986,8 @@ BOOLEAN PerformWriteReadTest(
 
     // IOCONTROL
     ULONG nOutput = 0;
-    if (!DeviceIoControl(
+    startNs = EchoNowNs();
+    succeeded = DeviceIoControl(
         hDevice,
         IOCTL_CODE_TEST,
         NULL,
@@ -357,8 +995,10 @@ BOOLEAN PerformWriteReadTest(
         NULL,
         0,
         &nOutput,
-        NULL)
-        )
+        NULL);
+    EchoHistRecord(&G_SyncLatency[SYNC_CALL_IOCTL], EchoNowNs() - startNs);
+
+    if (!succeeded)
     {
         printf("ERROR: DeviceIoControl returns %0x.", GetLastError());
 
@@ -368,331 +1008,1862 @@ BOOLEAN PerformWriteReadTest(
 
 Cleanup:
 
-    //
-    // Free writeBuffer if non NULL.
-    // NULLͷWriteBuffer
-    //
-    if (writeBuffer) {
-        free (writeBuffer);
-    }
-
     //
     // Free readBuffer if non NULL
     // NULLͷReadBuffer
     //
     if (readBuffer) {
-        free (readBuffer);
+        EchoArenaFree(readBuffer, length);
     }
 
     return result;
 }
 
 //
-// 첽IO
+// ȽϺӳ
 //
-ULONG AsyncIo(PVOID threadParameter)
+int __cdecl CompareUlonglong(const void* a, const void* b)
 {
-    HANDLE hDevice = INVALID_HANDLE_VALUE;
-    HANDLE hCompletionPort = NULL;
-    OVERLAPPED *pOvList = NULL;
-    PUCHAR     buf = NULL;
-    ULONG      numberOfBytesTransferred;
-    OVERLAPPED *completedOv;
-    ULONG_PTR  i;
-    ULONG      ioType = (ULONG)(ULONG_PTR)threadParameter;
-    ULONG_PTR  key;
-    ULONG   error;
-    BOOLEAN result = TRUE;
-    ULONG maxPendingRequests = NUM_ASYNCH_IO;
-    ULONG remainingRequestsToSend = 0;
-    ULONG remainingRequestsToReceive = 0;
-
-    // 豸
-    hDevice = CreateFile(G_szDevicePath,
-                     GENERIC_WRITE|GENERIC_READ,
-                     FILE_SHARE_READ | FILE_SHARE_WRITE,
-                     NULL,
-                     OPEN_EXISTING,
-                     FILE_FLAG_OVERLAPPED,
-                     NULL );
+    ULONGLONG x = *(const ULONGLONG*)a;
+    ULONGLONG y = *(const ULONGLONG*)b;
 
+    return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
 
-    if (hDevice == INVALID_HANDLE_VALUE) {
-        LOG("Cannot open %ws error %d\n", G_szDevicePath, GetLastError());
-        result = FALSE;
-        goto Error;
+//
+// ֱͼͨӳٰٷλȡͰϽ磩
+//
+ULONGLONG LaneStatsPercentile(
+    IN PECHO_LANE_STATS laneStats,
+    IN ULONG permille
+    )
+{
+    ULONGLONG target = (laneStats->Requests * permille + 999) / 1000;
+    ULONGLONG seen = 0;
+    ULONG bucket;
+
+    for (bucket = 0; bucket < ECHO_LATENCY_BUCKETS; bucket++) {
+        seen += laneStats->Histogram[bucket];
+        if (seen >= target && seen != 0) {
+            return (bucket == 0) ? 1 : (1ULL << bucket);
+        }
     }
 
-    // I/Oɶ˿ڲָļ
-    // 򿪵ļʵI/Oɶ˿ʹ̽йظļ첽I/Oɵ֪ͨ
-    hCompletionPort = CreateIoCompletionPort(hDevice, NULL, 1, 0);
-    if (hCompletionPort == NULL) {
-        LOG("Cannot open completion port %d \n",GetLastError());
-        result = FALSE;
-        goto Error;
-    }
+    return laneStats->MaxLatencyUs;
+}
+
+//
+// ӡͨͳ
+//
+VOID PrintLaneStats(IN PECHO_STATS stats)
+{
+    static const char* laneNames[EchoLaneCount] = { "control", "bulk" };
+    ULONGLONG requests = 0;
+    ULONGLONG hostUs = stats->HostUserUs + stats->HostKernelUs;
+    char cycles[24];
+    ULONG lane;
+
+    LOG("%-8s %10s %10s %10s %10s\n", "lane", "requests", "avg(us)", "p99(us)", "max(us)");
+
+    for (lane = 0; lane < EchoLaneCount; lane++) {
+        PECHO_LANE_STATS laneStats = &stats->Lanes[lane];
+
+        requests += laneStats->Requests;
+
+        LOG("%-8s %10llu %10llu %10llu %10llu\n",
+            laneNames[lane],
+            laneStats->Requests,
+            laneStats->Requests ? laneStats->TotalLatencyUs / laneStats->Requests : 0,
+            LaneStatsPercentile(laneStats, 990),
+            laneStats->MaxLatencyUs);
+    }
+
+    if (stats->PowerTransitions != 0) {
+        LOG("Power transitions %d, last suspend %llu us, last resume %llu us\n",
+            stats->PowerTransitions, stats->LastSuspendUs, stats->LastResumeUs);
+    }
 
     //
-    // We will only have NUM_ASYNCH_IO or G_nAsyncIoLoopsNum pending at any
-    // time (whichever is less)
-    // κʱֻNUM_ASYNCH_IOG_AsyncIoLoopsNumԽΪ׼
+    // The host process may serve other devices, so this is an upper bound
+    // ܻ̿豸
     //
-    if (G_bLimitedLoops == TRUE) {
-        remainingRequestsToReceive = G_nAsyncIoLoopsNum;
-        if (G_nAsyncIoLoopsNum > NUM_ASYNCH_IO) {
-            //
-            // After we send the initial NUM_ASYNCH_IO, we will have additional
-            // (G_nAsyncIoLoopsNum - NUM_ASYNCH_IO) I/Os to send
-            // ͳʼNUM_ASYNCH_IOǽG_AsyncIoLoopsNum-NUM_ASYNCH_IOI/O
-            //
-            maxPendingRequests = NUM_ASYNCH_IO;
-            remainingRequestsToSend = G_nAsyncIoLoopsNum - NUM_ASYNCH_IO;
+    if (requests != 0 && hostUs != 0) {
+        StringCchPrintfA(cycles, sizeof(cycles), "n/a");
+        if (stats->HostCycles != 0) {
+            StringCchPrintfA(cycles, sizeof(cycles), "%.0f", (double)stats->HostCycles / requests);
         }
-        else {
-            maxPendingRequests = G_nAsyncIoLoopsNum;
-            remainingRequestsToSend = 0;
+        LOG("Driver host CPU %.2f us per request, %.0f%% in user mode, %s cycles per request\n",
+            (double)hostUs / requests, 100.0 * stats->HostUserUs / hostUs, cycles);
+    }
+}
+
+//
+// д²ӳ
+//
+BOOLEAN PerformPingTest(
+    IN HANDLE hDevice,
+    IN ULONG  count
+    )
+{
+    LARGE_INTEGER frequency, start, end;
+    ULONGLONG* latencies = NULL;
+    ECHO_STATS stats;
+    ULONG nOutput = 0;
+    ULONG i;
+    BOOLEAN result = TRUE;
+
+    latencies = (ULONGLONG*)malloc(count * sizeof(ULONGLONG));
+    if (latencies == NULL) {
+        LOG("PerformPingTest: Could not allocate %d latencies\n", count);
+        return FALSE;
+    }
+
+    QueryPerformanceFrequency(&frequency);
+
+    //
+    // Give the reader and writer threads time to fill the bulk lane
+    // д߳ʱͨ
+    //
+    Sleep(PING_WARMUP_MS);
+
+    if (!DeviceIoControl(hDevice, IOCTL_ECHO_RESET_STATS, NULL, 0, NULL, 0, &nOutput, NULL)) {
+        LOG("PerformPingTest: IOCTL_ECHO_RESET_STATS failed %d\n", GetLastError());
+        result = FALSE;
+        goto Cleanup;
+    }
+
+    for (i = 0; i < count; i++) {
+
+        QueryPerformanceCounter(&start);
+
+        if (!DeviceIoControl(hDevice, IOCTL_CODE_TEST, NULL, 0, NULL, 0, &nOutput, NULL)) {
+            LOG("PerformPingTest: IOCTL_CODE_TEST failed %d\n", GetLastError());
+            result = FALSE;
+            goto Cleanup;
         }
+
+        QueryPerformanceCounter(&end);
+
+        latencies[i] = (ULONGLONG)(end.QuadPart - start.QuadPart) * 1000000 / frequency.QuadPart;
     }
 
-    pOvList = (OVERLAPPED *)malloc(maxPendingRequests * sizeof(OVERLAPPED));
-    if (pOvList == NULL) {
-        LOG("Cannot allocate overlapped array \n");
+    qsort(latencies, count, sizeof(ULONGLONG), CompareUlonglong);
+
+    LOG("Ping latency over %d requests: p50 %llu us, p99 %llu us, max %llu us\n",
+        count,
+        latencies[count / 2],
+        latencies[(ULONGLONG)count * 99 / 100],
+        latencies[count - 1]);
+
+    if (!DeviceIoControl(hDevice, IOCTL_ECHO_GET_STATS, NULL, 0, &stats, sizeof(stats), &nOutput, NULL)) {
+        LOG("PerformPingTest: IOCTL_ECHO_GET_STATS failed %d\n", GetLastError());
         result = FALSE;
-        goto Error;
+        goto Cleanup;
     }
 
-    buf = (PUCHAR)malloc(maxPendingRequests * BUFFER_SIZE);
-    if (buf == NULL) {
-        LOG("Cannot allocate buffer \n");
+    if (nOutput != sizeof(stats)) {
+        LOG("PerformPingTest: IOCTL_ECHO_GET_STATS returned %d bytes, expected %d\n",
+            nOutput, (ULONG)sizeof(stats));
         result = FALSE;
-        goto Error;
+        goto Cleanup;
     }
 
-    ZeroMemory(pOvList, maxPendingRequests * sizeof(OVERLAPPED));
-    ZeroMemory(buf, maxPendingRequests * BUFFER_SIZE);
+    PrintLaneStats(&stats);
 
-    //
-    // Issue asynch I/O
-    // 첽I / O
-    //
+Cleanup:
 
-    for (i = 0; i < maxPendingRequests; i++) {
-        if (ioType == READER_TYPE) {
-            // 豸
-            if ( ReadFile( hDevice,
-                      buf + (i* BUFFER_SIZE),
-                      BUFFER_SIZE,
-                      NULL,
-                      &pOvList[i]) == 0) {
+    free(latencies);
 
-                error = GetLastError();
-                if (error != ERROR_IO_PENDING) {
-                    LOG(" %dth Read failed %d \n", (ULONG) i, GetLastError());
-                    result = FALSE;
-                    goto Error;
-                }
-            }
+    return result;
+}
+
+//
+// ӡŲ
+//
+VOID PrintTuning(IN PECHO_TUNING tuning)
+{
+    LOG("TimerPeriod    %d ms\n", tuning->TimerPeriodMs);
+    LOG("MaxWriteLength %d bytes\n", tuning->MaxWriteLength);
+    LOG("PoolTag        0x%08x '%c%c%c%c'\n", tuning->PoolTag,
+        (char)(tuning->PoolTag >> 24), (char)(tuning->PoolTag >> 16),
+        (char)(tuning->PoolTag >> 8), (char)tuning->PoolTag);
+    LOG("StartDelay     %d ms\n", tuning->StartDelayMs);
+    LOG("ShardCount     %d\n", tuning->ShardCount);
+}
+
+//
+// ѯŲname=value޸
+//
+BOOLEAN PerformTune(
+    IN HANDLE hDevice,
+    IN int    argc,
+    IN char*  argv[]
+    )
+{
+    ECHO_TUNING tuning;
+    ULONG nOutput = 0;
+    char* value;
+    int i;
+
+    if (!DeviceIoControl(hDevice, IOCTL_ECHO_GET_TUNING, NULL, 0, &tuning, sizeof(tuning), &nOutput, NULL)) {
+        LOG("PerformTune: IOCTL_ECHO_GET_TUNING failed %d\n", GetLastError());
+        return FALSE;
+    }
+
+    if (argc == 0) {
+        PrintTuning(&tuning);
+        return TRUE;
+    }
+
+    for (i = 0; i < argc; i++) {
 
+        value = strchr(argv[i], '=');
+        if (value == NULL) {
+            LOG("PerformTune: Expected name=value, got %s\n", argv[i]);
+            return FALSE;
+        }
+        *value++ = '\0';
+
+        if (!_stricmp(argv[i], "TimerPeriod")) {
+            tuning.TimerPeriodMs = strtoul(value, NULL, 0);
+        }
+        else if (!_stricmp(argv[i], "MaxWriteLength")) {
+            tuning.MaxWriteLength = strtoul(value, NULL, 0);
+        }
+        else if (!_stricmp(argv[i], "PoolTag")) {
+            tuning.PoolTag = strtoul(value, NULL, 0);
+        }
+        else if (!_stricmp(argv[i], "StartDelay")) {
+            tuning.StartDelayMs = strtoul(value, NULL, 0);
         }
         else {
-            // д豸
-            if ( WriteFile( hDevice,
-                      buf + (i* BUFFER_SIZE),
-                      BUFFER_SIZE,
-                      NULL,
-                      &pOvList[i]) == 0) {
-                error = GetLastError();
-                if (error != ERROR_IO_PENDING) {
-                    LOG(" %dth Write failed %d \n", (ULONG) i, GetLastError());
-                    result = FALSE;
-                    goto Error;
-                }
-            }
+            LOG("PerformTune: Unknown parameter %s\n", argv[i]);
+            return FALSE;
         }
     }
 
+    if (!DeviceIoControl(hDevice, IOCTL_ECHO_SET_TUNING, &tuning, sizeof(tuning), NULL, 0, &nOutput, NULL)) {
+        LOG("PerformTune: IOCTL_ECHO_SET_TUNING failed %d\n", GetLastError());
+        return FALSE;
+    }
+
+    PrintTuning(&tuning);
+
+    return TRUE;
+}
+
+//
+// չԲ̵߳Ĳͽ
+//
+typedef struct _SCALE_WORKER {
+    HANDLE    hThread;
+    ULONG     Device;           // index into G_szDevicePaths
+    ULONG     ShardKey;
+    ULONGLONG Ops;              // writes and reads that moved the whole buffer
+    ULONGLONG ShortTransfers;   // writes and reads that moved less
+    BOOLEAN   Result;
+} SCALE_WORKER, *PSCALE_WORKER;
+
+//
+// չԲ̣߳ԼľѭִдͶȡ
+//
+ULONG ScaleWorker(PVOID threadParameter)
+{
+    PSCALE_WORKER worker = (PSCALE_WORKER)threadParameter;
+    HANDLE hDevice;
+    UCHAR  buffer[SCALE_IO_SIZE];
+    ULONG  bytesReturned;
+
+    hDevice = CreateFile(G_szDevicePaths[worker->Device],
+                         GENERIC_READ|GENERIC_WRITE,
+                         FILE_SHARE_READ | FILE_SHARE_WRITE,
+                         NULL,
+                         OPEN_EXISTING,
+                         0,
+                         NULL);
+
+    if (hDevice == INVALID_HANDLE_VALUE) {
+        LOG("ScaleWorker: Cannot open %ws error %d\n", G_szDevicePaths[worker->Device], GetLastError());
+        worker->Result = FALSE;
+        return 0;
+    }
+
     //
-    // Wait for the I/Os to complete. If one completes then reissue the I/O
-    // ȴI/Oɡɣ·I/O
+    // Pin the handle to a shard so the workers spread evenly
+    // ̶һƬʹ߳̾ȷֲ
     //
-    WHILE (1) {
+    if (!DeviceIoControl(hDevice, IOCTL_ECHO_SET_SHARD_KEY,
+                         &worker->ShardKey, sizeof(worker->ShardKey),
+                         NULL, 0, &bytesReturned, NULL)) {
+        LOG("ScaleWorker: IOCTL_ECHO_SET_SHARD_KEY failed %d\n", GetLastError());
+        worker->Result = FALSE;
+        CloseHandle(hDevice);
+        return 0;
+    }
 
-        if ( GetQueuedCompletionStatus(hCompletionPort, &numberOfBytesTransferred, &key, &completedOv, INFINITE) == 0) {
-            LOG("GetQueuedCompletionStatus failed %d\n", GetLastError());
-            result = FALSE;
-            goto Error;
+    ZeroMemory(buffer, sizeof(buffer));
+
+    while (!G_bStopScale) {
+
+        if (!WriteFile(hDevice, buffer, sizeof(buffer), &bytesReturned, NULL)) {
+            LOG("ScaleWorker: WriteFile failed %d\n", GetLastError());
+            worker->Result = FALSE;
+            break;
         }
 
         //
-        // Read successfully completed. If we're doing unlimited I/Os then Issue another one.
-        // ȡɹɡ ҪƵI / O򷢳һI / O
+        // Only a transfer of the whole buffer counts as an op
+        // ֻдһβ
         //
-        if (ioType == READER_TYPE) {
+        if (bytesReturned == sizeof(buffer)) {
+            worker->Ops++;
+        }
+        else {
+            worker->ShortTransfers++;
+        }
 
-            i = completedOv - pOvList;
-            LOG("Number of bytes read by request number %Id is %d\n", i, numberOfBytesTransferred);
+        if (!ReadFile(hDevice, buffer, sizeof(buffer), &bytesReturned, NULL)) {
+            LOG("ScaleWorker: ReadFile failed %d\n", GetLastError());
+            worker->Result = FALSE;
+            break;
+        }
 
-            //
-            // If we're done with the I/Os, then exit
-            // I/O˳
-            //
-            if (G_bLimitedLoops == TRUE) {
-                if ((--remainingRequestsToReceive) == 0) {
-                    break;
-                }
+        if (bytesReturned == sizeof(buffer)) {
+            worker->Ops++;
+        }
+        else {
+            worker->ShortTransfers++;
+        }
+    }
 
-                if (remainingRequestsToSend == 0) {
-                    continue;
-                }
-                else {
-                    remainingRequestsToSend--;
-                }
+    CloseHandle(hDevice);
+
+    return 0;
+}
+
+//
+// 1SCALE_MAX_THREADSͻ߳µĻ
+//
+BOOLEAN PerformScaleTest(
+    IN HANDLE hDevice,
+    IN ULONG  seconds
+    )
+{
+    SCALE_WORKER workers[SCALE_MAX_THREADS];
+    LARGE_INTEGER frequency, start, end;
+    ECHO_STATS stats;
+    ULONG nOutput = 0;
+    ULONG threads;
+    ULONG i;
+    ULONGLONG totalOps;
+    ULONGLONG shortTransfers;
+    ULONGLONG deviceOps[MAX_DEVICES];
+    char column[16];
+    double elapsed;
+    BOOLEAN result = TRUE;
+
+    if (!DeviceIoControl(hDevice, IOCTL_ECHO_GET_STATS, NULL, 0, &stats, sizeof(stats), &nOutput, NULL)) {
+        LOG("PerformScaleTest: IOCTL_ECHO_GET_STATS failed %d\n", GetLastError());
+        return FALSE;
+    }
+
+    QueryPerformanceFrequency(&frequency);
+
+    //
+    // Threads go round-robin over the devices, and over the shards of each
+    // ߳䵽豸ÿ豸䵽Ƭ
+    //
+    if (G_nDevices == 1) {
+        LOG("Device has %d shards, %d seconds per step\n", stats.ShardCount, seconds);
+    }
+    else {
+        LOG("%d devices, the first with %d shards, %d seconds per step\n", G_nDevices, stats.ShardCount, seconds);
+    }
+
+    LOG("%8s %12s %12s", "threads", "ops", "ops/s");
+    for (i = 0; G_nDevices > 1 && i < G_nDevices; i++) {
+        StringCchPrintfA(column, sizeof(column), "dev%d ops/s", i);
+        LOG(" %12s", column);
+    }
+    LOG("\n");
+
+    for (threads = 1; threads <= SCALE_MAX_THREADS && result; threads *= 2) {
+
+        ZeroMemory(workers, sizeof(workers));
+        G_bStopScale = FALSE;
+
+        QueryPerformanceCounter(&start);
+
+        for (i = 0; i < threads; i++) {
+            workers[i].Device = i % G_nDevices;
+            workers[i].ShardKey = i / G_nDevices;
+            workers[i].Result = TRUE;
+            workers[i].hThread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) ScaleWorker, &workers[i], 0, NULL);
+            if (workers[i].hThread == NULL) {
+                LOG("Couldn't create scale thread - error %d\n", GetLastError());
+                result = FALSE;
+                break;
             }
+        }
 
-            if ( ReadFile( hDevice,
-                      buf + (i * BUFFER_SIZE),
-                      BUFFER_SIZE,
-                      NULL,
-                      completedOv) == 0) {
-                error = GetLastError();
-                if (error != ERROR_IO_PENDING) {
-                    LOG("%Idth Read failed %d \n", i, GetLastError());
-                    result = FALSE;
-                    goto Error;
-                }
+        Sleep(seconds * 1000);
+        G_bStopScale = TRUE;
+
+        totalOps = 0;
+        shortTransfers = 0;
+        ZeroMemory(deviceOps, sizeof(deviceOps));
+        for (i = 0; i < threads; i++) {
+            if (workers[i].hThread != NULL) {
+                WaitForSingleObject(workers[i].hThread, INFINITE);
+                CloseHandle(workers[i].hThread);
+                totalOps += workers[i].Ops;
+                shortTransfers += workers[i].ShortTransfers;
+                deviceOps[workers[i].Device] += workers[i].Ops;
+                result = result && workers[i].Result;
             }
         }
-        else {
 
-            i = completedOv - pOvList;
+        QueryPerformanceCounter(&end);
+        elapsed = (double)(end.QuadPart - start.QuadPart) / frequency.QuadPart;
 
-            LOG("Number of bytes written by request number %Id is %d\n", i, numberOfBytesTransferred);
+        LOG("%8d %12llu %12.1f", threads, totalOps, totalOps / elapsed);
+        for (i = 0; G_nDevices > 1 && i < G_nDevices; i++) {
+            LOG(" %12.1f", deviceOps[i] / elapsed);
+        }
+        LOG("\n");
 
-            //
-            // If we're done with the I/Os, then exit
-            // I/O˳
-            //
-            if (G_bLimitedLoops == TRUE) {
-                if ((--remainingRequestsToReceive) == 0) {
-                    break;
-                }
+        if (shortTransfers != 0) {
+            LOG("%8s %llu short transfers with %d threads\n", "", shortTransfers, threads);
+            result = FALSE;
+        }
+    }
 
-                if (remainingRequestsToSend == 0) {
-                    continue;
-                }
-                else {
-                    remainingRequestsToSend--;
-                }
-            }
+    return result;
+}
 
-            if ( WriteFile( hDevice,
-                      buf + (i * BUFFER_SIZE),
-                      BUFFER_SIZE,
-                      NULL,
-                      completedOv) == 0) {
-                error = GetLastError();
-                if (error != ERROR_IO_PENDING) {
+//
+// Ϊ׼̴߳豸棺߳䵽豸豸Ϲ̶ԼķƬ
+//
+EchoEngine* OpenDeviceEngine(PVOID context, ULONG index)
+{
+    ECHO_DEVICE_ENGINE_OPEN* open = *(ECHO_DEVICE_ENGINE_OPEN**)context;
 
-                    LOG("%Idth write failed %d \n", i, GetLastError());
-                    result = FALSE;
-                    goto Error;
-                }
-            }
+    return open(G_szDevicePaths[index % G_nDevices], index / G_nDevices);
+}
+
+//
+// The four ways to drive the device; OpenDeviceEngine takes the address
+// of an entry as its context
+// 豸ַʽOpenDeviceEngineһĵַΪ
+//
+ECHO_DEVICE_ENGINE_OPEN* G_DeviceEngineOpen[] = {
+    EchoSyncEngineOpen,
+    EchoEventEngineOpen,
+    EchoIocpEngineOpen,
+    EchoThreadpoolEngineOpen,
+};
+
+const ECHO_BENCH_ENGINE G_DeviceEngines[] = {
+    { "sync",       OpenDeviceEngine, &G_DeviceEngineOpen[0] },
+    { "event",      OpenDeviceEngine, &G_DeviceEngineOpen[1] },
+    { "iocp",       OpenDeviceEngine, &G_DeviceEngineOpen[2] },
+    { "threadpool", OpenDeviceEngine, &G_DeviceEngineOpen[3] },
+};
+
+//
+// 豸иӡÿ豸Ͽͨͳ
+//
+BOOLEAN PerformBenchmark(
+    IN HANDLE             hDevice,
+    IN PECHO_BENCH_OPTIONS options
+    )
+{
+    HANDLE devices[MAX_DEVICES];
+    ECHO_BENCH_ENGINE engines[ECHO_BENCH_MAX_ENGINES];
+    ECHO_STATS stats;
+    ULONG nOutput = 0;
+    ULONG engineCount;
+    ULONG i;
+    BOOLEAN result = TRUE;
+
+    engineCount = EchoBenchSelectEngines(G_pszBenchEngines, G_DeviceEngines,
+                                         sizeof(G_DeviceEngines) / sizeof(G_DeviceEngines[0]), engines);
+    if (engineCount == 0) {
+        LOG("PerformBenchmark: Unknown engine in %s\n", G_pszBenchEngines);
+        return FALSE;
+    }
+
+    //
+    // Statistics are kept per device, so every device gets its own
+    // handle to reset them before the run and read them after
+    // ͳư豸棬ÿ豸Լľǰáкȡ
+    //
+    devices[0] = hDevice;
+    for (i = 1; i < G_nDevices; i++) {
+        devices[i] = CreateFile(G_szDevicePaths[i],
+                                GENERIC_READ|GENERIC_WRITE,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                NULL,
+                                OPEN_EXISTING,
+                                0,
+                                NULL);
+        if (devices[i] == INVALID_HANDLE_VALUE) {
+            LOG("PerformBenchmark: Cannot open device %d error %d\n", i, GetLastError());
+            result = FALSE;
         }
     }
 
-Error:
-    if(hDevice != INVALID_HANDLE_VALUE) {
-        CloseHandle(hDevice);
+    for (i = 0; i < G_nDevices && result; i++) {
+        if (!DeviceIoControl(devices[i], IOCTL_ECHO_RESET_STATS, NULL, 0, NULL, 0, &nOutput, NULL)) {
+            LOG("PerformBenchmark: IOCTL_ECHO_RESET_STATS failed %d\n", GetLastError());
+            result = FALSE;
+        }
+    }
+
+    if (result) {
+        options->Devices = G_nDevices;
+        if (options->Threads < G_nDevices) {
+            LOG("Only %d of %d devices get a thread; raise -threads to use them all\n",
+                options->Threads, G_nDevices);
+        }
+
+        //
+        // A comparison runs every engine against the same devices, so the
+        // driver view below covers all of them together
+        // Ƚϻʹͬ豸ͼǵĺϼ
+        //
+        if (engineCount > 1) {
+            result = EchoBenchCompare(options, engines, engineCount);
+        }
+        else {
+            result = EchoBenchRun(options, engines[0].Open, engines[0].Context);
+        }
+
+        for (i = 0; i < G_nDevices; i++) {
+            if (!DeviceIoControl(devices[i], IOCTL_ECHO_GET_STATS, NULL, 0, &stats, sizeof(stats), &nOutput, NULL)) {
+                LOG("PerformBenchmark: IOCTL_ECHO_GET_STATS failed %d\n", GetLastError());
+                result = FALSE;
+                break;
+            }
+
+            if (G_nDevices == 1) {
+                LOG("\nDriver view of the run:\n");
+            }
+            else {
+                LOG("\nDriver view of the run on device %d:\n", i);
+            }
+            PrintLaneStats(&stats);
+        }
     }
 
-    if(hCompletionPort) {
-        CloseHandle(hCompletionPort);
+    for (i = 1; i < G_nDevices; i++) {
+        if (devices[i] != INVALID_HANDLE_VALUE) {
+            CloseHandle(devices[i]);
+        }
     }
 
-    if(buf) {
-        free(buf);
+    return result;
+}
+
+//
+// 豸л׼׼ÿб浽ļ
+//
+BOOLEAN PerformSuite(
+    IN PECHO_BENCH_OPTIONS options
+    )
+{
+    ECHO_BENCH_ENGINE engines[ECHO_BENCH_MAX_ENGINES];
+    ECHO_SUITE suite;
+    ULONG engineCount;
+
+    engineCount = EchoBenchSelectEngines(G_pszBenchEngines, G_DeviceEngines,
+                                         sizeof(G_DeviceEngines) / sizeof(G_DeviceEngines[0]), engines);
+    if (engineCount != 1) {
+        LOG("PerformSuite: -Suite takes one engine\n");
+        return FALSE;
     }
-    if(pOvList) {
-        free(pOvList);
+
+    if (!EchoSuiteLoad(G_pszSuite, &suite)) {
+        return FALSE;
     }
 
-    return (ULONG)result;
+    options->Devices = G_nDevices;
 
+    return EchoSuiteRun(&suite, options, G_nSuiteRepeat, engines[0].Open, engines[0].Context, G_pszSuiteResults);
 }
 
 //
-// GUIDȡ豸·
+// 豸0ͨɶ˿ڼЭ̿ͻˣ븺Ƚ
 //
-BOOL GetDevicePath(
-    _In_ LPGUID interfaceGuid,
-    _Out_writes_(bufLen) PWCHAR devicePath,
-    _In_ size_t bufLen
+BOOLEAN PerformCoroutineTest(
+    IN PECHO_BENCH_OPTIONS options
     )
 {
-    CONFIGRET cr = CR_SUCCESS;
-    PWSTR deviceInterfaceList = NULL;
-    ULONG deviceInterfaceListLength = 0;
-    PWSTR nextInterface;
-    HRESULT hr = E_FAIL;
-    BOOL bRet = TRUE;
+    EchoEngine* engine;
+    BOOLEAN result;
 
-    cr = CM_Get_Device_Interface_List_Size(
-                &deviceInterfaceListLength,
-                interfaceGuid,
-                NULL,
-                CM_GET_DEVICE_INTERFACE_LIST_PRESENT);
-    if (cr != CR_SUCCESS) {
-        LOG("Error 0x%x retrieving device interface list size.\n", cr);
-        goto clean0;
+    engine = EchoIocpEngineOpen(G_szDevicePaths[0], ECHO_SHARD_KEY_DEFAULT);
+    if (engine == NULL) {
+        return FALSE;
     }
 
-    if (deviceInterfaceListLength <= 1) {
-        bRet = FALSE;
-        LOG("Error: No active device interfaces found.\n"
-            " Is the sample driver loaded?");
-        goto clean0;
-    }
+    //
+    // The statistics query stands for any control the client may send
+    // ͳƲѯͻ˿ܷ͵κο
+    //
+    result = EchoCoSelfTest(engine, IOCTL_ECHO_GET_STATS, sizeof(ECHO_STATS));
 
-    deviceInterfaceList = (PWSTR)malloc(deviceInterfaceListLength * sizeof(WCHAR));
-    if (deviceInterfaceList == NULL) {
-        LOG("Error allocating memory for device interface list.\n");
-        goto clean0;
+    delete engine;
+
+    if (!result) {
+        return FALSE;
     }
-    ZeroMemory(deviceInterfaceList, deviceInterfaceListLength * sizeof(WCHAR));
 
-    cr = CM_Get_Device_Interface_List(
-                interfaceGuid,
-                NULL,
-                deviceInterfaceList,
-                deviceInterfaceListLength,
-                CM_GET_DEVICE_INTERFACE_LIST_PRESENT);
-    if (cr != CR_SUCCESS) {
-        LOG("Error 0x%x retrieving device interface list.\n", cr);
-        goto clean0;
+    return EchoCoBench(options, OpenDeviceEngine, &G_DeviceEngineOpen[2]);
+}
+
+//
+// ڻػԼͻ˿⣬پEchoClientOpen豸0ϻԣȽ÷ʽ
+//
+BOOLEAN PerformClientTest(
+    IN PECHO_BENCH_OPTIONS options
+    )
+{
+    static UCHAR data[CLIENT_CHECK_LENGTH];
+    static UCHAR echo[CLIENT_CHECK_LENGTH];
+    ECHO_CLIENT_CONFIG config;
+    ECHO_CLIENT_ITEM items[2];
+    PECHO_CLIENT client;
+    ULONG error;
+    ULONG i;
+
+    if (!EchoClientSelfTest()) {
+        return FALSE;
     }
 
-    nextInterface = deviceInterfaceList + wcslen(deviceInterfaceList) + 1;
-    if (*nextInterface != UNICODE_NULL) {
-        LOG("Warning: More than one device interface instance found. \n"
-            "Selecting first matching device.\n\n");
+    for (i = 0; i < CLIENT_CHECK_LENGTH; i++) {
+        data[i] = (UCHAR)(i + 3);
     }
 
-    hr = StringCchCopy(devicePath, bufLen, deviceInterfaceList);
-    if (FAILED(hr)) {
-        bRet = FALSE;
-        LOG("Error: StringCchCopy failed with HRESULT 0x%x", hr);
-        goto clean0;
+    //
+    // The way a service would use the library: one echo, then two items
+    // sharing one device write
+    // ʹøÿķʽһλԣȻһ豸д
+    //
+    EchoClientDefaultConfig(&config);
+    client = EchoClientOpen(G_szDevicePaths[0], ECHO_SHARD_KEY_DEFAULT, &config);
+    if (client == NULL) {
+        return FALSE;
     }
 
-clean0:
-    if (deviceInterfaceList != NULL) {
-        free(deviceInterfaceList);
+    error = EchoClientEcho(client, data, echo, CLIENT_CHECK_LENGTH);
+    if (error == ERROR_SUCCESS) {
+        items[0].Data = data;
+        items[0].Echo = echo;
+        items[0].Length = CLIENT_CHECK_LENGTH / 2;
+        items[1].Data = data + CLIENT_CHECK_LENGTH / 2;
+        items[1].Echo = echo + CLIENT_CHECK_LENGTH / 2;
+        items[1].Length = CLIENT_CHECK_LENGTH / 2;
+        error = EchoClientEchoBatch(client, items, 2);
     }
-    if (CR_SUCCESS != cr) {
-        bRet = FALSE;
+
+    EchoClientClose(client);
+
+    LOG("Device echo through EchoClient: %s (error %d)\n", (error == ERROR_SUCCESS) ? "ok" : "failed", error);
+    if (error != ERROR_SUCCESS) {
+        return FALSE;
     }
 
-    return bRet;
+    return EchoClientBench(options, OpenDeviceEngine, &G_DeviceEngineOpen[2]);
 }
 
+//
+// һ̵߳ͳƣɱÿȡ
+//
+typedef struct _ASYNC_WORKER_STATS {
+    SRWLOCK        Lock;
+    ULONGLONG      Requests;
+    ULONGLONG      Bytes;
+    ULONGLONG      Errors;
+    ECHO_HISTOGRAM LatencyNs;
+    ECHO_VERIFY_COUNTS Verify;
+    ULONGLONG      Completions;     // never reset, drives the sampled trace
+} ASYNC_WORKER_STATS, *PASYNC_WORKER_STATS;
+
+//
+// һ첽IO̵߳״̬乤̳߳ع
+//
+typedef struct _ASYNC_IO_CONTEXT {
+    ULONG               IoType;
+    volatile LONG       RemainingRequestsToSend;
+    BOOLEAN             Result;
+    PASYNC_WORKER_STATS Workers;
+    PECHO_VERIFY_OP     VerifyOps;      // one per slot
+    ASYNC_WORKER_STATS  Interval;       // merged by the reporter
+    ASYNC_WORKER_STATS  Total;
+} ASYNC_IO_CONTEXT, *PASYNC_IO_CONTEXT;
+
+//
+// Ϊв׼һдѭʱ꼴ֹͣ
+//
+BOOLEAN AsyncIoPrepare(PVOID context, ULONG worker, PECHO_IO io)
+{
+    PASYNC_IO_CONTEXT asyncIo = (PASYNC_IO_CONTEXT)context;
+    PECHO_VERIFY_OP verify = &asyncIo->VerifyOps[(ULONG_PTR)io->Context];
+
+    if (G_bLimitedLoops == TRUE &&
+        InterlockedDecrement(&asyncIo->RemainingRequestsToSend) < 0) {
+        return FALSE;
+    }
+
+    io->Op = (asyncIo->IoType == READER_TYPE) ? EchoOpRead : EchoOpWrite;
+    io->Length = BUFFER_SIZE;
+
+    //
+    // Writes carry a sequence-tagged payload; reads note what the ledger
+    // had seen when they were issued
+    // дЯкŵĸأȡ·ʱ˱Ѽ
+    //
+    if (io->Op == EchoOpWrite) {
+        EchoVerifyPrepareWrite(G_pLedger, verify, worker, io->Buffer, io->Length);
+    }
+    else {
+        EchoVerifyPrepareRead(G_pLedger, verify);
+    }
+
+    return TRUE;
+}
+
+//
+// һɣֻۼӱ̵߳ļֱͼÿG_nAsyncTraceEveryӡһ
+//
+VOID AsyncIoComplete(PVOID context, ULONG worker, PECHO_IO* completed, ULONG count)
+{
+    PASYNC_IO_CONTEXT asyncIo = (PASYNC_IO_CONTEXT)context;
+    PASYNC_WORKER_STATS stats = &asyncIo->Workers[worker];
+    ULONGLONG now = EchoNowNs();
+    ECHO_VERIFY_COUNTS verify = {};
+    ULONG i;
+
+    //
+    // Check payloads before taking the lock so the reporter never waits
+    // on a compare
+    // ڼǰУ鸺أʹ߲صȴȽ
+    //
+    for (i = 0; i < count; i++) {
+        EchoVerifyComplete(G_pLedger, &asyncIo->VerifyOps[(ULONG_PTR)completed[i]->Context],
+                           completed[i], &verify);
+    }
+
+    if (EchoVerifyFailures(&verify) != 0) {
+        asyncIo->Result = FALSE;
+    }
+
+    AcquireSRWLockExclusive(&stats->Lock);
+
+    EchoVerifyAddCounts(&stats->Verify, &verify);
+
+    for (i = 0; i < count; i++) {
+        stats->Requests++;
+        stats->Bytes += completed[i]->Transferred;
+        EchoHistRecord(&stats->LatencyNs, now - completed[i]->IssueNs);
+        if (completed[i]->Error != ERROR_SUCCESS) {
+            stats->Errors++;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&stats->Lock);
+
+    for (i = 0; i < count; i++) {
+
+        if (completed[i]->Error != ERROR_SUCCESS) {
+            LOG("%Idth %s failed %d \n", (ULONG_PTR)completed[i]->Context,
+                (asyncIo->IoType == READER_TYPE) ? "Read" : "Write", completed[i]->Error);
+            asyncIo->Result = FALSE;
+            continue;
+        }
+
+        //
+        // Only stats->Completions is touched outside the lock, and only
+        // by this worker
+        // ֻstats->Completionsʣ̷ֻ߳
+        //
+        if (G_nAsyncTraceEvery == 0 || ++stats->Completions % G_nAsyncTraceEvery != 0) {
+            continue;
+        }
+
+        if (asyncIo->IoType == READER_TYPE) {
+            LOG("Number of bytes read by request number %Id is %d\n",
+                (ULONG_PTR)completed[i]->Context, completed[i]->Transferred);
+        }
+        else {
+            LOG("Number of bytes written by request number %Id is %d\n",
+                (ULONG_PTR)completed[i]->Context, completed[i]->Transferred);
+        }
+    }
+}
+
+//
+// ϲ̵߳ļͳƲӡһУfinalʱӡܼ
+//
+VOID AsyncIoReport(
+    IN PASYNC_IO_CONTEXT asyncIo,
+    IN double            seconds,
+    IN BOOLEAN           final
+    )
+{
+    PASYNC_WORKER_STATS merged = &asyncIo->Interval;
+    PCSTR name = (asyncIo->IoType == READER_TYPE) ? "Reader" : "Writer";
+    ULONG i;
+
+    merged->Requests = 0;
+    merged->Bytes = 0;
+    merged->Errors = 0;
+    EchoHistReset(&merged->LatencyNs);
+    ZeroMemory(&merged->Verify, sizeof(merged->Verify));
+
+    for (i = 0; i < G_nAsyncWorkers; i++) {
+        PASYNC_WORKER_STATS stats = &asyncIo->Workers[i];
+
+        AcquireSRWLockExclusive(&stats->Lock);
+
+        merged->Requests += stats->Requests;
+        merged->Bytes += stats->Bytes;
+        merged->Errors += stats->Errors;
+        EchoHistMerge(&merged->LatencyNs, &stats->LatencyNs);
+        EchoVerifyAddCounts(&merged->Verify, &stats->Verify);
+
+        stats->Requests = 0;
+        stats->Bytes = 0;
+        stats->Errors = 0;
+        EchoHistReset(&stats->LatencyNs);
+        ZeroMemory(&stats->Verify, sizeof(stats->Verify));
+
+        ReleaseSRWLockExclusive(&stats->Lock);
+    }
+
+    asyncIo->Total.Requests += merged->Requests;
+    asyncIo->Total.Bytes += merged->Bytes;
+    asyncIo->Total.Errors += merged->Errors;
+    EchoHistMerge(&asyncIo->Total.LatencyNs, &merged->LatencyNs);
+    EchoVerifyAddCounts(&asyncIo->Total.Verify, &merged->Verify);
+
+    if (final) {
+        merged = &asyncIo->Total;
+    }
+
+    LOG("%s%s: %llu requests, %.1f requests/s, %.2f MB/s, p50 %.1f us, p99 %.1f us, max %.1f us, %llu errors\n",
+        name,
+        final ? " total" : "",
+        merged->Requests,
+        (seconds > 0) ? merged->Requests / seconds : 0.0,
+        (seconds > 0) ? merged->Bytes / seconds / (1024 * 1024) : 0.0,
+        EchoHistPercentile(&merged->LatencyNs, 50) / 1000.0,
+        EchoHistPercentile(&merged->LatencyNs, 99) / 1000.0,
+        merged->LatencyNs.Max / 1000.0,
+        merged->Errors);
+
+    //
+    // Reads carry the verdicts; a writer only reports a duplicate
+    // УԶȡдֻ߳ᱨظ
+    //
+    if (asyncIo->IoType == READER_TYPE || EchoVerifyFailures(&merged->Verify) != 0) {
+        LOG("%s%s: %llu verified, %llu empty, %llu torn, %llu lost, %llu reordered, %llu duplicated, %llu crossed\n",
+            name,
+            final ? " total" : "",
+            merged->Verify.Verified,
+            merged->Verify.Empty,
+            merged->Verify.Torn,
+            merged->Verify.Lost,
+            merged->Verify.Reordered,
+            merged->Verify.Duplicated,
+            merged->Verify.Crossed);
+    }
+}
+
+//
+// 첽IO
+//
+ULONG AsyncIo(PVOID threadParameter)
+{
+    EchoEngine* engine = NULL;
+    PECHO_POOL pool = NULL;
+    ECHO_POOL_CONFIG config;
+    ECHO_DEPTH_CONTROLLER depth;
+    ECHO_DEPTH_STATS depthStats;
+    ASYNC_IO_CONTEXT asyncIo;
+    ULONGLONG start, last, now;
+    ULONG i;
+    BOOLEAN result = FALSE;
+
+    ZeroMemory(&asyncIo, sizeof(asyncIo));
+    asyncIo.IoType = (ULONG)(ULONG_PTR)threadParameter;
+    asyncIo.RemainingRequestsToSend = (LONG)G_nAsyncIoLoopsNum;
+    asyncIo.Result = TRUE;
+    EchoHistReset(&asyncIo.Total.LatencyNs);
+
+    asyncIo.Workers = (PASYNC_WORKER_STATS)malloc(G_nAsyncWorkers * sizeof(ASYNC_WORKER_STATS));
+    if (asyncIo.Workers == NULL) {
+        LOG("Cannot allocate worker statistics \n");
+        return (ULONG)FALSE;
+    }
+
+    for (i = 0; i < G_nAsyncWorkers; i++) {
+        ZeroMemory(&asyncIo.Workers[i], sizeof(ASYNC_WORKER_STATS));
+        InitializeSRWLock(&asyncIo.Workers[i].Lock);
+        EchoHistReset(&asyncIo.Workers[i].LatencyNs);
+    }
+
+    asyncIo.VerifyOps = (PECHO_VERIFY_OP)calloc(NUM_ASYNCH_IO, sizeof(ECHO_VERIFY_OP));
+    if (asyncIo.VerifyOps == NULL) {
+        LOG("Cannot allocate verification state \n");
+        goto Error;
+    }
+
+    //
+    // Open the device on the shared shard and associate the handle with a
+    // completion port
+    // ڹƬϴ豸ɶ˿
+    //
+    engine = EchoIocpEngineOpen(G_szDevicePaths[0], ASYNC_SHARD_KEY);
+    if (engine == NULL) {
+        goto Error;
+    }
+
+    //
+    // G_nAsyncWorkers threads share the completion port. Each dequeues
+    // completions in batches and re-issues I/O from the shared free list
+    // of NUM_ASYNCH_IO (or G_nAsyncIoLoopsNum, whichever is less) slots.
+    // G_nAsyncWorkers̹߳ɶ˿ڡÿ߳ȡɣӹ
+    // NUM_ASYNCH_IOG_nAsyncIoLoopsNumԽΪ׼в·I/O
+    //
+    config.Engine = engine;
+    config.Workers = G_nAsyncWorkers;
+    config.Slots = NUM_ASYNCH_IO;
+    if (G_bLimitedLoops == TRUE && G_nAsyncIoLoopsNum < NUM_ASYNCH_IO) {
+        config.Slots = G_nAsyncIoLoopsNum;
+    }
+    config.BlockSize = BUFFER_SIZE;
+    config.Prepare = AsyncIoPrepare;
+    config.Complete = AsyncIoComplete;
+    config.Context = &asyncIo;
+    config.Stop = &G_bStopAsyncIo;
+    config.Rate = 0;
+    config.Arrival = EchoArrivalFixed;
+    config.Seed = 0;
+    config.External = FALSE;
+    config.Trace = G_pTrace;
+    config.TraceHandle = (asyncIo.IoType == READER_TYPE) ? TRACE_HANDLE_READER : TRACE_HANDLE_WRITER;
+    config.Depth = NULL;
+
+    //
+    // The writer's workers take the sets after the reader's
+    // д̳߳صĹ߳ʹö̳֮߳Ĵ
+    //
+    config.Affinity = &G_Affinity;
+    config.AffinityBase = (asyncIo.IoType == READER_TYPE) ? 0 : G_nAsyncWorkers;
+
+    //
+    // With a target the slots are only the most in flight; the controller
+    // starts at one and finds the depth the device serves within it
+    // Ŀʱֻ;ޣһʼҳ豸Ŀڷ
+    //
+    if (G_nAsyncTargetUs != 0 && config.Slots != 0) {
+        ECHO_DEPTH_CONFIG depthConfig;
+
+        depthConfig.Rule = G_AsyncControl;
+        depthConfig.MinDepth = 1;
+        depthConfig.MaxDepth = config.Slots;
+        depthConfig.InitialDepth = 1;
+        depthConfig.TargetNs = (ULONGLONG)G_nAsyncTargetUs * 1000;
+        EchoDepthInit(&depth, &depthConfig);
+        config.Depth = &depth;
+    }
+
+    if (config.Slots == 0) {
+        result = TRUE;
+        goto Error;
+    }
+
+    pool = EchoPoolStart(&config);
+    if (pool == NULL) {
+        goto Error;
+    }
+
+    //
+    // The workers only count; this thread prints the merged counts
+    // ֻ߳ɱ̴߳ӡϲļ
+    //
+    start = last = EchoNowNs();
+
+    while (!EchoPoolIsDone(pool)) {
+
+        Sleep(ASYNC_POLL_MS);
+
+        now = EchoNowNs();
+        if (now - last >= (ULONGLONG)ASYNC_REPORT_MS * 1000000) {
+            AsyncIoReport(&asyncIo, (now - last) / 1e9, FALSE);
+            last = now;
+        }
+    }
+
+    result = EchoPoolWait(pool) && asyncIo.Result;
+
+    AsyncIoReport(&asyncIo, (EchoNowNs() - start) / 1e9, TRUE);
+
+    if (config.Depth != NULL) {
+        EchoDepthQuery(&depth, &depthStats);
+        LOG("%s depth: settled at %.1f of %d (%d-%d recently), last p99 %.1f us against %d us, "
+            "%llu decisions, %llu missed\n",
+            (asyncIo.IoType == READER_TYPE) ? "Reader" : "Writer",
+            depthStats.Settled, config.Slots, depthStats.Low, depthStats.High,
+            depthStats.LastP99Ns / 1000.0, G_nAsyncTargetUs, depthStats.Decisions, depthStats.Misses);
+    }
+
+    //
+    // Each direction has its own thread, so its slot has one writer
+    // ÿԼֻ̣߳һд
+    //
+    EchoHistMerge(&G_AsyncLatency[(asyncIo.IoType == READER_TYPE) ? EchoOpRead : EchoOpWrite],
+                  &asyncIo.Total.LatencyNs);
+
+Error:
+    if (engine != NULL) {
+        delete engine;
+    }
+
+    free(asyncIo.Workers);
+    free(asyncIo.VerifyOps);
+
+    return (ULONG)result;
+
+}
+
+//
+// ȡѹеһ
+//
+typedef struct _CANCEL_SLOT {
+    OVERLAPPED Overlapped;
+    PUCHAR     Buffer;
+    BOOLEAN    Write;
+    BOOLEAN    InFlight;
+    ULONGLONG  IssueNs;
+    ULONGLONG  CancelNs;        // when CancelIoEx found it, 0 if it was not cancelled
+} CANCEL_SLOT, *PCANCEL_SLOT;
+
+//
+// ȡѹԵļ
+//
+typedef struct _CANCEL_COUNTS {
+    ULONGLONG Issued;
+    ULONGLONG Cancels;          // CancelIoEx calls that found the request
+    ULONGLONG TooLate;          // CancelIoEx calls that found it already completing
+    ULONGLONG Aborted;          // completed as cancelled after a cancel
+    ULONGLONG Raced;            // completed normally despite a cancel
+    ULONGLONG Completed;        // completed normally, never cancelled
+    ULONGLONG Unexpected;       // other failures, or cancelled without a cancel
+    ULONGLONG Duplicates;       // completions of a slot with nothing in flight
+} CANCEL_COUNTS, *PCANCEL_COUNTS;
+
+//
+// һϷд
+//
+BOOLEAN CancelIssue(
+    IN     HANDLE         hDevice,
+    IN OUT PCANCEL_SLOT   slot,
+    IN OUT PCANCEL_COUNTS counts
+    )
+{
+    BOOL started;
+
+    ZeroMemory(&slot->Overlapped, sizeof(slot->Overlapped));
+    slot->CancelNs = 0;
+    slot->IssueNs = EchoNowNs();
+    slot->InFlight = TRUE;
+
+    if (slot->Write) {
+        started = WriteFile(hDevice, slot->Buffer, CANCEL_IO_SIZE, NULL, &slot->Overlapped);
+    }
+    else {
+        started = ReadFile(hDevice, slot->Buffer, CANCEL_IO_SIZE, NULL, &slot->Overlapped);
+    }
+
+    //
+    // A request that fails to start queues no completion
+    // δܷ󲻻Ŷ
+    //
+    if (!started && GetLastError() != ERROR_IO_PENDING) {
+        LOG("PerformCancelTest: %s failed %d\n", slot->Write ? "WriteFile" : "ReadFile", GetLastError());
+        slot->InFlight = FALSE;
+        return FALSE;
+    }
+
+    counts->Issued++;
+
+    return TRUE;
+}
+
+//
+// ȡһ;󲢼ȡʱ
+//
+VOID CancelSlot(
+    IN     HANDLE         hDevice,
+    IN OUT PCANCEL_SLOT   slot,
+    IN OUT PCANCEL_COUNTS counts
+    )
+{
+    if (!slot->InFlight || slot->CancelNs != 0) {
+        return;
+    }
+
+    slot->CancelNs = EchoNowNs();
+
+    if (CancelIoEx(hDevice, &slot->Overlapped)) {
+        counts->Cancels++;
+        return;
+    }
+
+    //
+    // Not found means the request is already completing and its
+    // completion is on its way, so it counts as never cancelled
+    // δҵʾɹУ;У˰δȡ
+    //
+    if (GetLastError() == ERROR_NOT_FOUND) {
+        counts->TooLate++;
+    }
+    else {
+        LOG("PerformCancelTest: CancelIoEx failed %d\n", GetLastError());
+        counts->Unexpected++;
+    }
+    slot->CancelNs = 0;
+}
+
+//
+// ״̬һɲ¼ӳ
+//
+VOID CancelComplete(
+    IN     HANDLE          hDevice,
+    IN     PCANCEL_SLOT    slot,
+    IN     ULONGLONG       now,
+    IN OUT PCANCEL_COUNTS  counts,
+    IN OUT PECHO_HISTOGRAM interval
+    )
+{
+    ULONG bytes = 0;
+    ULONG error;
+
+    error = GetOverlappedResult(hDevice, &slot->Overlapped, &bytes, FALSE) ? ERROR_SUCCESS : GetLastError();
+
+    if (slot->CancelNs != 0 && error == ERROR_OPERATION_ABORTED) {
+        counts->Aborted++;
+        EchoHistRecord(&G_CancelLatency[CANCEL_HIST_ABORTED], now - slot->CancelNs);
+        EchoHistRecord(interval, now - slot->CancelNs);
+    }
+    else if (slot->CancelNs != 0 && error == ERROR_SUCCESS) {
+        counts->Raced++;
+        EchoHistRecord(&G_CancelLatency[CANCEL_HIST_RACED], now - slot->CancelNs);
+    }
+    else if (error == ERROR_SUCCESS) {
+        counts->Completed++;
+        EchoHistRecord(&G_CancelLatency[CANCEL_HIST_UNCANCELLED], now - slot->IssueNs);
+    }
+    else {
+        if (counts->Unexpected < 10) {
+            LOG("PerformCancelTest: %s %s completed with error %d\n",
+                slot->Write ? "write" : "read", (slot->CancelNs != 0) ? "cancelled" : "never cancelled", error);
+        }
+        counts->Unexpected++;
+    }
+}
+
+//
+// ӡһȡӳֱͼİٷλ
+//
+VOID CancelPrintLatency(
+    IN PCSTR                 label,
+    IN const ECHO_HISTOGRAM* histogram
+    )
+{
+    LOG("%-12s %10llu %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+        label, histogram->Count,
+        EchoHistPercentile(histogram, 50) / 1000.0,
+        EchoHistPercentile(histogram, 90) / 1000.0,
+        EchoHistPercentile(histogram, 99) / 1000.0,
+        EchoHistPercentile(histogram, 99.9) / 1000.0,
+        histogram->Max / 1000.0);
+}
+
+//
+// ڸȡ󣺲ȡɵʱ䣬ͳȡɵ
+// ǷԶ
+//
+BOOLEAN PerformCancelTest(
+    IN HANDLE hDevice,
+    IN ULONG  seconds
+    )
+{
+    OVERLAPPED_ENTRY entries[CANCEL_QUEUE_DEPTH];
+    PCANCEL_SLOT slots = NULL;
+    PCANCEL_SLOT slot;
+    CANCEL_COUNTS counts;
+    CANCEL_COUNTS last;
+    ECHO_HISTOGRAM interval;
+    ECHO_STATS stats;
+    HANDLE hCancel = INVALID_HANDLE_VALUE;
+    HANDLE hPort = NULL;
+    ULONGLONG rng = 0x9E3779B97F4A7C15ULL;
+    ULONGLONG start, end, nextRound, nextReport, now, until;
+    ULONG nOutput = 0;
+    ULONG removed;
+    ULONG inFlight = 0;
+    ULONG leaked = 0;
+    ULONG i;
+    BOOLEAN running = TRUE;
+    BOOLEAN result = TRUE;
+
+    ZeroMemory(&counts, sizeof(counts));
+    ZeroMemory(&last, sizeof(last));
+    EchoHistReset(&interval);
+
+    //
+    // An overlapped handle of its own on one shard, completing to a port
+    // that only this thread drains, so a slot is reissued and cancelled by
+    // the same thread and a cancel never lands on the slot's next request
+    // ʹԼص̶һƬɷ͵ֻб߳ȡĶ˿ڣ
+    // ˲۵·ȡͬһ߳нУȡԶ䵽۵һ
+    //
+    hCancel = EchoDeviceOpen(G_szDevicePaths[0], CANCEL_SHARD_KEY, TRUE);
+    if (hCancel == INVALID_HANDLE_VALUE) {
+        return FALSE;
+    }
+
+    hPort = CreateIoCompletionPort(hCancel, NULL, 0, 1);
+    if (hPort == NULL) {
+        LOG("PerformCancelTest: CreateIoCompletionPort failed %d\n", GetLastError());
+        result = FALSE;
+        goto Cleanup;
+    }
+
+    slots = (PCANCEL_SLOT)calloc(G_nCancelDepth, sizeof(CANCEL_SLOT));
+    if (slots == NULL) {
+        LOG("PerformCancelTest: Could not allocate %d slots\n", G_nCancelDepth);
+        result = FALSE;
+        goto Cleanup;
+    }
+
+    for (i = 0; i < G_nCancelDepth; i++) {
+        slots[i].Write = ((i & 1) == 0);
+        slots[i].Buffer = EchoArenaAlloc(CANCEL_IO_SIZE);
+        if (slots[i].Buffer == NULL) {
+            result = FALSE;
+            goto Cleanup;
+        }
+        FillMemory(slots[i].Buffer, CANCEL_IO_SIZE, (UCHAR)i);
+    }
+
+    if (!DeviceIoControl(hDevice, IOCTL_ECHO_RESET_STATS, NULL, 0, NULL, 0, &nOutput, NULL)) {
+        LOG("PerformCancelTest: IOCTL_ECHO_RESET_STATS failed %d\n", GetLastError());
+        result = FALSE;
+        goto Cleanup;
+    }
+
+    LOG("Cancel stress on shard %d: %d reads and writes of %d bytes in flight, "
+        "%d%% of them cancelled every %d ms, %d seconds\n",
+        CANCEL_SHARD_KEY, G_nCancelDepth, CANCEL_IO_SIZE, G_nCancelPercent, CANCEL_ROUND_MS, seconds);
+    LOG("%6s %10s %10s %10s %10s %10s %9s %9s\n",
+        "time", "issued", "cancels", "aborted", "raced", "too-late", "p50(us)", "p99(us)");
+
+    start = EchoNowNs();
+    end = start + (ULONGLONG)seconds * 1000000000;
+    nextRound = start + (ULONGLONG)CANCEL_ROUND_MS * 1000000;
+    nextReport = start + 1000000000;
+
+    for (i = 0; i < G_nCancelDepth; i++) {
+        if (!CancelIssue(hCancel, &slots[i], &counts)) {
+            result = FALSE;
+            break;
+        }
+        inFlight++;
+    }
+
+    while (inFlight != 0) {
+
+        now = EchoNowNs();
+
+        //
+        // At the end everything still in flight is cancelled, and whatever
+        // has not completed CANCEL_DRAIN_MS later has leaked
+        // ʱȡ;CANCEL_DRAIN_MS֮δɵļΪй©
+        //
+        if (running && (now >= end || !result)) {
+            running = FALSE;
+            end = now + (ULONGLONG)CANCEL_DRAIN_MS * 1000000;
+            for (i = 0; i < G_nCancelDepth; i++) {
+                CancelSlot(hCancel, &slots[i], &counts);
+            }
+        }
+        if (!running && now >= end) {
+            break;
+        }
+
+        if (running && now >= nextRound) {
+            for (i = 0; i < G_nCancelDepth; i++) {
+                rng ^= rng >> 12;
+                rng ^= rng << 25;
+                rng ^= rng >> 27;
+                if ((rng * 0x2545F4914F6CDD1DULL >> 32) % 100 < G_nCancelPercent) {
+                    CancelSlot(hCancel, &slots[i], &counts);
+                }
+            }
+            nextRound += (ULONGLONG)CANCEL_ROUND_MS * 1000000;
+            if (nextRound < now) {
+                nextRound = now + (ULONGLONG)CANCEL_ROUND_MS * 1000000;
+            }
+        }
+
+        if (running && now >= nextReport) {
+            LOG("%5.1fs %10llu %10llu %10llu %10llu %10llu %9.1f %9.1f\n",
+                (now - start) / 1e9,
+                counts.Issued - last.Issued,
+                counts.Cancels - last.Cancels,
+                counts.Aborted - last.Aborted,
+                counts.Raced - last.Raced,
+                counts.TooLate - last.TooLate,
+                EchoHistPercentile(&interval, 50) / 1000.0,
+                EchoHistPercentile(&interval, 99) / 1000.0);
+            last = counts;
+            EchoHistReset(&interval);
+            nextReport += 1000000000;
+        }
+
+        until = running ? ((nextRound < nextReport) ? nextRound : nextReport) : end;
+        now = EchoNowNs();
+
+        if (!GetQueuedCompletionStatusEx(hPort, entries, CANCEL_QUEUE_DEPTH, &removed,
+                                         (until > now) ? (ULONG)((until - now + 999999) / 1000000) : 0,
+                                         FALSE)) {
+            if (GetLastError() != WAIT_TIMEOUT) {
+                LOG("PerformCancelTest: GetQueuedCompletionStatusEx failed %d\n", GetLastError());
+                result = FALSE;
+                break;
+            }
+            continue;
+        }
+
+        now = EchoNowNs();
+
+        for (i = 0; i < removed; i++) {
+            slot = CONTAINING_RECORD(entries[i].lpOverlapped, CANCEL_SLOT, Overlapped);
+
+            if (!slot->InFlight) {
+                counts.Duplicates++;
+                continue;
+            }
+
+            slot->InFlight = FALSE;
+            inFlight--;
+
+            CancelComplete(hCancel, slot, now, &counts, &interval);
+
+            if (running) {
+                if (CancelIssue(hCancel, slot, &counts)) {
+                    inFlight++;
+                }
+                else {
+                    result = FALSE;
+                }
+            }
+        }
+    }
+
+    //
+    // A slot still in flight after the drain is a request the driver never
+    // completed; its buffer may still be written, so it is not freed
+    // ſպ;Ĳδɵ仺Կܱд룬˲ͷ
+    //
+    for (i = 0; i < G_nCancelDepth; i++) {
+        if (slots[i].InFlight) {
+            if (leaked < 10) {
+                LOG("Leaked: %s issued %.1f ms before the end, %s\n",
+                    slots[i].Write ? "write" : "read",
+                    (end - slots[i].IssueNs) / 1e6,
+                    (slots[i].CancelNs != 0) ? "cancelled" : "never cancelled");
+            }
+            leaked++;
+        }
+    }
+
+    LOG("\nLatency over the run (us):\n");
+    LOG("%-12s %10s %9s %9s %9s %9s %9s\n", "", "count", "p50", "p90", "p99", "p99.9", "max");
+    CancelPrintLatency("aborted", &G_CancelLatency[CANCEL_HIST_ABORTED]);
+    CancelPrintLatency("raced", &G_CancelLatency[CANCEL_HIST_RACED]);
+    CancelPrintLatency("uncancelled", &G_CancelLatency[CANCEL_HIST_UNCANCELLED]);
+
+    LOG("\n%llu issued, %llu cancels, %llu aborted, %llu completed normally despite the cancel, "
+        "%llu cancels too late to find the request, %llu never cancelled\n",
+        counts.Issued, counts.Cancels, counts.Aborted, counts.Raced, counts.TooLate, counts.Completed);
+    LOG("%llu unexpected errors, %llu duplicate completions, %d requests leaked\n",
+        counts.Unexpected, counts.Duplicates, leaked);
+
+    //
+    // "aborted" and "raced" run from the cancel, so their tail is what a
+    // client must wait after giving up before it can reuse the buffer
+    // "aborted""raced"ȡʱʼʱβͻ˷û
+    // ֮ǰȴʱ
+    //
+    if (G_CancelLatency[CANCEL_HIST_ABORTED].Count != 0) {
+        LOG("A cancelled request completes within %.1f us at p99.9 and %.1f us at worst; "
+            "allow that after a client timeout before reusing its buffer\n",
+            EchoHistPercentile(&G_CancelLatency[CANCEL_HIST_ABORTED], 99.9) / 1000.0,
+            G_CancelLatency[CANCEL_HIST_ABORTED].Max / 1000.0);
+    }
+
+    if (counts.Unexpected != 0 || counts.Duplicates != 0 || leaked != 0) {
+        result = FALSE;
+    }
+
+    if (!DeviceIoControl(hDevice, IOCTL_ECHO_GET_STATS, NULL, 0, &stats, sizeof(stats), &nOutput, NULL)) {
+        LOG("PerformCancelTest: IOCTL_ECHO_GET_STATS failed %d\n", GetLastError());
+        result = FALSE;
+    }
+    else {
+        LOG("\nDriver view of the run:\n");
+        PrintLaneStats(&stats);
+    }
+
+Cleanup:
+
+    if (hCancel != INVALID_HANDLE_VALUE) {
+        CloseHandle(hCancel);
+    }
+    if (hPort != NULL) {
+        CloseHandle(hPort);
+    }
+
+    for (i = 0; slots != NULL && i < G_nCancelDepth; i++) {
+        if (slots[i].Buffer != NULL && !slots[i].InFlight) {
+            EchoArenaFree(slots[i].Buffer, CANCEL_IO_SIZE);
+        }
+    }
+    if (leaked == 0) {
+        free(slots);
+    }
+
+    return result;
+}
+
+//
+// ٻԲеһ
+//
+typedef struct _TRACED_SLOT {
+    OVERLAPPED Overlapped;
+    PUCHAR     Input;           // header and payload sent
+    PUCHAR     Output;          // header with the stamps, and the echoed payload
+    LONGLONG   SubmitTicks;     // performance counter when submitted
+    BOOLEAN    InFlight;
+} TRACED_SLOT, *PTRACED_SLOT;
+
+//
+// һٻڸ׶εĺʱ
+//
+typedef struct _TRACED_SPLIT {
+    ULONGLONG RequestId;
+    ULONGLONG Ns[TRACED_STAGE_COUNT];
+} TRACED_SPLIT, *PTRACED_SPLIT;
+
+//
+// ֵܼ֮ߵʱΪ0
+//
+ULONGLONG TracedTicksToNs(
+    IN LONGLONG from,
+    IN LONGLONG to,
+    IN LONGLONG frequency
+    )
+{
+    ULONGLONG ticks;
+
+    if (to <= from) {
+        return 0;
+    }
+    ticks = (ULONGLONG)(to - from);
+
+    return ticks / frequency * 1000000000ULL + ticks % frequency * 1000000000ULL / frequency;
+}
+
+//
+// һϷٻ
+//
+BOOLEAN TracedIssue(
+    IN     HANDLE       hDevice,
+    IN OUT PTRACED_SLOT slot,
+    IN     ULONGLONG    requestId
+    )
+{
+    PECHO_TRACED_HEADER header = (PECHO_TRACED_HEADER)slot->Input;
+    LARGE_INTEGER now;
+    BOOL started;
+
+    ZeroMemory(header, sizeof(ECHO_TRACED_HEADER));
+    header->RequestId = requestId;
+    header->Length = TRACED_IO_SIZE;
+    FillMemory(header + 1, TRACED_IO_SIZE, (UCHAR)requestId);
+    ZeroMemory(slot->Output, TRACED_BUFFER_SIZE);
+    ZeroMemory(&slot->Overlapped, sizeof(slot->Overlapped));
+
+    QueryPerformanceCounter(&now);
+    slot->SubmitTicks = now.QuadPart;
+    slot->InFlight = TRUE;
+
+    started = DeviceIoControl(hDevice, IOCTL_ECHO_TRACED,
+                              slot->Input, TRACED_BUFFER_SIZE,
+                              slot->Output, TRACED_BUFFER_SIZE,
+                              NULL, &slot->Overlapped);
+
+    //
+    // A request that fails to start queues no completion
+    // δܷ󲻻Ŷ
+    //
+    if (!started && GetLastError() != ERROR_IO_PENDING) {
+        LOG("PerformTracedTest: DeviceIoControl failed %d\n", GetLastError());
+        slot->InFlight = FALSE;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+// Уһɵĸٻԣ׶βӳ
+//
+BOOLEAN TracedComplete(
+    IN  HANDLE        hDevice,
+    IN  PTRACED_SLOT  slot,
+    IN  LONGLONG      deliverTicks,
+    IN  LONGLONG      frequency,
+    OUT PTRACED_SPLIT split
+    )
+{
+    PECHO_TRACED_HEADER sent = (PECHO_TRACED_HEADER)slot->Input;
+    PECHO_TRACED_HEADER header = (PECHO_TRACED_HEADER)slot->Output;
+    LONGLONG edges[TRACED_STAGE_TOTAL + 1];
+    ULONG bytes = 0;
+    ULONG i;
+
+    if (!GetOverlappedResult(hDevice, &slot->Overlapped, &bytes, FALSE)) {
+        LOG("PerformTracedTest: request 0x%llx failed %d\n", sent->RequestId, GetLastError());
+        return FALSE;
+    }
+    if (bytes != TRACED_BUFFER_SIZE ||
+        header->RequestId != sent->RequestId || header->Length != sent->Length ||
+        memcmp(header + 1, sent + 1, TRACED_IO_SIZE) != 0) {
+        LOG("PerformTracedTest: request 0x%llx came back as 0x%llx with %d bytes\n",
+            sent->RequestId, header->RequestId, bytes);
+        return FALSE;
+    }
+
+    //
+    // The driver reads the same system-wide counter as the client, so its
+    // stamps and the client's fall on one time line
+    // ȡͻͬϵͳΧʱͻ˵λͬһʱ
+    //
+    if (header->Frequency != frequency) {
+        LOG("PerformTracedTest: driver counter runs at %lld Hz, client at %lld Hz\n",
+            header->Frequency, frequency);
+        return FALSE;
+    }
+
+    edges[0] = slot->SubmitTicks;
+    for (i = 0; i < EchoStageCount; i++) {
+        edges[i + 1] = header->Stamps[i];
+    }
+    edges[TRACED_STAGE_TOTAL] = deliverTicks;
+
+    split->RequestId = header->RequestId;
+    for (i = 0; i < TRACED_STAGE_TOTAL; i++) {
+        split->Ns[i] = TracedTicksToNs(edges[i], edges[i + 1], frequency);
+        EchoHistRecord(&G_TracedLatency[i], split->Ns[i]);
+    }
+    split->Ns[TRACED_STAGE_TOTAL] = TracedTicksToNs(edges[0], edges[TRACED_STAGE_TOTAL], frequency);
+    EchoHistRecord(&G_TracedLatency[TRACED_STAGE_TOTAL], split->Ns[TRACED_STAGE_TOTAL]);
+
+    return TRUE;
+}
+
+//
+// ӳٱTRACED_SLOWEST󣬴
+//
+VOID TracedKeepSlowest(
+    IN OUT PTRACED_SPLIT       slowest,
+    IN OUT PULONG              count,
+    IN     const TRACED_SPLIT* split
+    )
+{
+    ULONG i;
+
+    if (*count == TRACED_SLOWEST &&
+        split->Ns[TRACED_STAGE_TOTAL] <= slowest[TRACED_SLOWEST - 1].Ns[TRACED_STAGE_TOTAL]) {
+        return;
+    }
+
+    i = (*count < TRACED_SLOWEST) ? (*count)++ : TRACED_SLOWEST - 1;
+    while (i > 0 && slowest[i - 1].Ns[TRACED_STAGE_TOTAL] < split->Ns[TRACED_STAGE_TOTAL]) {
+        slowest[i] = slowest[i - 1];
+        i--;
+    }
+    slowest[i] = *split;
+}
+
+//
+// ӡ׶εӳٷֽ⣺ֵռȡٷλԼֵβӵĶѵ
+//
+VOID TracedPrintBreakdown(VOID)
+{
+    const ECHO_HISTOGRAM* histogram;
+    char bar[TRACED_BAR_WIDTH + 1];
+    double means[TRACED_STAGE_TOTAL];
+    double sum = 0;
+    double offset = 0;
+    ULONG start, end;
+    ULONG dominant = 0;
+    ULONG i, j;
+
+    if (G_TracedLatency[TRACED_STAGE_TOTAL].Count == 0) {
+        return;
+    }
+
+    for (i = 0; i < TRACED_STAGE_TOTAL; i++) {
+        histogram = &G_TracedLatency[i];
+        means[i] = (double)histogram->Total / histogram->Count;
+        sum += means[i];
+        if (means[i] > means[dominant]) {
+            dominant = i;
+        }
+    }
+    if (sum == 0) {
+        sum = 1;
+    }
+
+    //
+    // Stage means add up to the mean total, so each stage's segment starts
+    // where the one before it ends and the bar reads like a waterfall
+    // ׶ξֵ֮ͼֵܾÿ׶εδǰһνʼٲͼ
+    //
+    LOG("\nLatency by stage (us):\n");
+    LOG("%-9s %10s %7s %9s %9s %9s %9s  %s\n", "", "mean", "share", "p50", "p90", "p99", "max", "mean per stage");
+    for (i = 0; i <= TRACED_STAGE_TOTAL; i++) {
+        histogram = &G_TracedLatency[i];
+
+        for (j = 0; j < TRACED_BAR_WIDTH; j++) {
+            bar[j] = ' ';
+        }
+        bar[TRACED_BAR_WIDTH] = '\0';
+        if (i < TRACED_STAGE_TOTAL) {
+            start = (ULONG)(offset / sum * TRACED_BAR_WIDTH + 0.5);
+            offset += means[i];
+            end = (ULONG)(offset / sum * TRACED_BAR_WIDTH + 0.5);
+        }
+        else {
+            start = 0;
+            end = TRACED_BAR_WIDTH;
+        }
+        for (j = start; j < end && j < TRACED_BAR_WIDTH; j++) {
+            bar[j] = '#';
+        }
+
+        LOG("%-9s %10.1f %6.1f%% %9.1f %9.1f %9.1f %9.1f  |%s|\n",
+            G_TracedStageNames[i],
+            (double)histogram->Total / histogram->Count / 1000.0,
+            (i < TRACED_STAGE_TOTAL) ? means[i] * 100.0 / sum : 100.0,
+            EchoHistPercentile(histogram, 50) / 1000.0,
+            EchoHistPercentile(histogram, 90) / 1000.0,
+            EchoHistPercentile(histogram, 99) / 1000.0,
+            histogram->Max / 1000.0,
+            bar);
+    }
+
+    LOG("Most of the time goes to the %s stage (%.1f%%)%s\n",
+        G_TracedStageNames[dominant], means[dominant] * 100.0 / sum,
+        (dominant == TRACED_STAGE_TIMER) ? "; -Tune TimerPeriod=<ms> shortens it" : "");
+}
+
+//
+// ӡID׶κʱ
+//
+VOID TracedPrintSlowest(
+    IN const TRACED_SPLIT* slowest,
+    IN ULONG               count
+    )
+{
+    ULONG i, j;
+
+    if (count == 0) {
+        return;
+    }
+
+    LOG("\nSlowest requests (us):\n");
+    LOG("%-18s", "id");
+    for (j = 0; j < TRACED_STAGE_COUNT; j++) {
+        LOG(" %9s", G_TracedStageNames[j]);
+    }
+    LOG("\n");
+    for (i = 0; i < count; i++) {
+        LOG("0x%016llx", slowest[i].RequestId);
+        for (j = 0; j < TRACED_STAGE_COUNT; j++) {
+            LOG(" %9.1f", slowest[i].Ns[j] / 1000.0);
+        }
+        LOG("\n");
+    }
+}
+
+//
+// ٻԣÿпͻѡID侭ÿ׶μ¼ʱ
+// ɷأݴ˰׶ηֽӳٲҳ
+//
+BOOLEAN PerformTracedTest(
+    IN HANDLE hDevice,
+    IN ULONG  count
+    )
+{
+    OVERLAPPED_ENTRY entries[TRACED_MAX_DEPTH];
+    TRACED_SLOT slots[TRACED_MAX_DEPTH];
+    TRACED_SPLIT slowest[TRACED_SLOWEST];
+    TRACED_SPLIT split;
+    PTRACED_SLOT slot;
+    ECHO_TUNING tuning;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER now;
+    HANDLE hTraced = INVALID_HANDLE_VALUE;
+    HANDLE hPort = NULL;
+    ULONGLONG baseId;
+    ULONG nextId = 0;
+    ULONG nOutput = 0;
+    ULONG removed;
+    ULONG waitMs;
+    ULONG inFlight = 0;
+    ULONG completed = 0;
+    ULONG nSlowest = 0;
+    ULONG i;
+    BOOLEAN result = TRUE;
+
+    ZeroMemory(slots, sizeof(slots));
+
+    //
+    // Each request waits for a tick of its shard's timer, so the timer
+    // period sets both the length of the run and how long to wait
+    // ÿҪȴƬʱһδ˼ʱھʱ͵ȴʱ
+    //
+    if (!DeviceIoControl(hDevice, IOCTL_ECHO_GET_TUNING, NULL, 0, &tuning, sizeof(tuning), &nOutput, NULL)) {
+        LOG("PerformTracedTest: IOCTL_ECHO_GET_TUNING failed %d\n", GetLastError());
+        return FALSE;
+    }
+    waitMs = 2 * tuning.TimerPeriodMs + TRACED_GRACE_MS;
+
+    hTraced = EchoDeviceOpen(G_szDevicePaths[0], TRACED_SHARD_KEY, TRUE);
+    if (hTraced == INVALID_HANDLE_VALUE) {
+        return FALSE;
+    }
+
+    hPort = CreateIoCompletionPort(hTraced, NULL, 0, 1);
+    if (hPort == NULL) {
+        LOG("PerformTracedTest: CreateIoCompletionPort failed %d\n", GetLastError());
+        result = FALSE;
+        goto Cleanup;
+    }
+
+    for (i = 0; i < G_nTracedDepth; i++) {
+        slots[i].Input = EchoArenaAlloc(TRACED_BUFFER_SIZE);
+        slots[i].Output = EchoArenaAlloc(TRACED_BUFFER_SIZE);
+        if (slots[i].Input == NULL || slots[i].Output == NULL) {
+            result = FALSE;
+            goto Cleanup;
+        }
+    }
+
+    QueryPerformanceFrequency(&frequency);
+    baseId = (ULONGLONG)GetCurrentProcessId() << 32;
+
+    LOG("Traced echo on shard %d: %d requests of %d bytes, %d in flight; each waits for a timer "
+        "tick (TimerPeriod %d ms), about %.1f s\n",
+        TRACED_SHARD_KEY, count, TRACED_IO_SIZE, G_nTracedDepth, tuning.TimerPeriodMs,
+        (double)count * tuning.TimerPeriodMs / 1000.0);
+
+    for (i = 0; i < G_nTracedDepth && nextId < count; i++) {
+        if (!TracedIssue(hTraced, &slots[i], baseId + nextId)) {
+            result = FALSE;
+            break;
+        }
+        nextId++;
+        inFlight++;
+    }
+
+    while (inFlight != 0) {
+
+        if (!GetQueuedCompletionStatusEx(hPort, entries, TRACED_MAX_DEPTH, &removed, waitMs, FALSE)) {
+            if (GetLastError() == WAIT_TIMEOUT) {
+                LOG("PerformTracedTest: Nothing completed in %d ms, %d requests never came back\n",
+                    waitMs, inFlight);
+            }
+            else {
+                LOG("PerformTracedTest: GetQueuedCompletionStatusEx failed %d\n", GetLastError());
+            }
+            result = FALSE;
+            break;
+        }
+
+        QueryPerformanceCounter(&now);
+
+        for (i = 0; i < removed; i++) {
+            slot = CONTAINING_RECORD(entries[i].lpOverlapped, TRACED_SLOT, Overlapped);
+            slot->InFlight = FALSE;
+            inFlight--;
+
+            if (TracedComplete(hTraced, slot, now.QuadPart, frequency.QuadPart, &split)) {
+                completed++;
+                TracedKeepSlowest(slowest, &nSlowest, &split);
+            }
+            else {
+                result = FALSE;
+            }
+
+            if (result && nextId < count) {
+                if (!TracedIssue(hTraced, slot, baseId + nextId)) {
+                    result = FALSE;
+                    continue;
+                }
+                nextId++;
+                inFlight++;
+            }
+        }
+    }
+
+    LOG("\n%d of %d traced echoes came back intact\n", completed, count);
+    TracedPrintBreakdown();
+    TracedPrintSlowest(slowest, nSlowest);
+
+Cleanup:
+
+    if (hTraced != INVALID_HANDLE_VALUE) {
+        CloseHandle(hTraced);
+    }
+    if (hPort != NULL) {
+        CloseHandle(hPort);
+    }
+
+    //
+    // A slot still in flight may still be written, so its buffers are not freed
+    // ;ĲԿܱд룬˲ͷ仺
+    //
+    for (i = 0; i < G_nTracedDepth; i++) {
+        if (slots[i].InFlight) {
+            continue;
+        }
+        if (slots[i].Input != NULL) {
+            EchoArenaFree(slots[i].Input, TRACED_BUFFER_SIZE);
+        }
+        if (slots[i].Output != NULL) {
+            EchoArenaFree(slots[i].Output, TRACED_BUFFER_SIZE);
+        }
+    }
+
+    return result;
+}
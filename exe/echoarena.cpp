@@ -0,0 +1,513 @@
+/*++
+
+Module Name:
+
+    echoarena.cpp
+
+Abstract:
+
+    Process-wide arena for I/O buffers.
+    ̷ΧI/O
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#include "echoarena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/mman.h>
+#ifdef __linux__
+#include <errno.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#define LOG printf
+
+#define ARENA_MIN_SHIFT     6       // 64 bytes, one cache line
+#define ARENA_MAX_SHIFT     31
+#define ARENA_CLASSES       (ARENA_MAX_SHIFT - ARENA_MIN_SHIFT + 1)
+#define ARENA_SLAB_SIZE     ((size_t)2 * 1024 * 1024)
+#define ARENA_NODES         16      // nodes with classes of their own; the others share the unplaced ones
+
+#ifdef __linux__
+#define ARENA_MPOL_PREFERRED 1      // numaif.h, which may not be installed
+#endif
+
+//
+// A free buffer holds the link to the next one of its class
+// лڱͬһл
+//
+typedef struct _ARENA_BLOCK {
+    struct _ARENA_BLOCK* Next;
+} ARENA_BLOCK, *PARENA_BLOCK;
+
+typedef struct _ARENA_CLASS {
+    std::mutex   Lock;
+    PARENA_BLOCK Free;
+    PUCHAR       Carve;             // unused part of the class's last slab
+    PUCHAR       CarveEnd;
+    ULONGLONG    Allocs;
+    ULONGLONG    Recycled;
+    ULONGLONG    InUse;             // buffers
+} ARENA_CLASS, *PARENA_CLASS;
+
+typedef struct _ARENA_SLAB {
+    PUCHAR  Base;
+    size_t  Size;
+    BOOLEAN Large;
+    BOOLEAN Placed;                 // on the node it was asked for on
+} ARENA_SLAB, *PARENA_SLAB;
+
+//
+// Set 0 is left to the system, set n + 1 is on node n
+// 0齻ϵͳãn + 1λڽڵn
+//
+static ARENA_CLASS ArenaClasses[ARENA_NODES + 1][ARENA_CLASSES];
+
+static std::mutex              ArenaSlabLock;
+static std::vector<ARENA_SLAB> ArenaSlabs;
+static BOOLEAN                 ArenaWantLarge;
+static BOOLEAN                 ArenaLargeRefused;
+static BOOLEAN                 ArenaPlaceRefused;
+
+static std::atomic<ULONGLONG>  ArenaInUseBytes;
+static std::atomic<ULONGLONG>  ArenaPeakBytes;
+
+//
+// ĴС࣬ʱARENA_CLASSES
+//
+static ULONG ArenaClassOf(ULONG length)
+{
+    ULONG shift = ARENA_MIN_SHIFT;
+
+    while (shift <= ARENA_MAX_SHIFT && ((ULONGLONG)1 << shift) < length) {
+        shift++;
+    }
+
+    return shift - ARENA_MIN_SHIFT;
+}
+
+#ifdef _WIN32
+
+//
+// ΪڴȨҳҪȨ
+//
+static BOOLEAN ArenaEnableLockMemory(VOID)
+{
+    TOKEN_PRIVILEGES privileges;
+    HANDLE token;
+    BOOL succeeded;
+
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+        return FALSE;
+    }
+
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+    //
+    // AdjustTokenPrivileges succeeds without granting a privilege the
+    // account lacks; only the last error tells
+    // ˻ûиȨʱAdjustTokenPrivilegesԻɹֻĴ˵
+    //
+    succeeded = LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+                AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL) &&
+                GetLastError() == ERROR_SUCCESS;
+
+    CloseHandle(token);
+
+    return succeeded ? TRUE : FALSE;
+}
+
+//
+// ڴ棬nodeΪECHO_NODE_ANYʱڸýڵ
+//
+static PUCHAR ArenaVirtualAlloc(size_t size, DWORD type, ULONG node)
+{
+    if (node == ECHO_NODE_ANY) {
+        return (PUCHAR)VirtualAlloc(NULL, size, type, PAGE_READWRITE);
+    }
+
+    return (PUCHAR)VirtualAllocExNuma(GetCurrentProcess(), NULL, size, type, PAGE_READWRITE, node);
+}
+
+#endif
+
+#ifdef __linux__
+
+//
+// Prefers node for the pages of a mapping not yet touched; the system
+// still takes another node when this one is full
+// δʵӳҳȷnodeϣýڵʱϵͳԻʹڵ
+//
+static BOOLEAN ArenaPlace(PVOID base, size_t size, ULONG node)
+{
+    unsigned long mask[ECHO_MAX_NODES / (8 * sizeof(unsigned long))];
+
+    ZeroMemory(mask, sizeof(mask));
+    mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+
+    return syscall(SYS_mbind, base, size, ARENA_MPOL_PREFERRED, mask, ECHO_MAX_NODES + 1, 0) == 0 ?
+           TRUE : FALSE;
+}
+
+#endif
+
+//
+// ϵͳһ飬nodeΪECHO_NODE_ANYʱڸýڵϣ߳ArenaSlabLock
+//
+static PUCHAR ArenaMapSlab(size_t size, ULONG node, BOOLEAN* large, BOOLEAN* placed)
+{
+    PUCHAR base = NULL;
+
+    *large = FALSE;
+    *placed = FALSE;
+
+#ifdef _WIN32
+    if (ArenaPlaceRefused) {
+        node = ECHO_NODE_ANY;
+    }
+
+    if (ArenaWantLarge && !ArenaLargeRefused) {
+        SIZE_T largePage = GetLargePageMinimum();
+
+        if (largePage != 0 && ArenaEnableLockMemory()) {
+            base = ArenaVirtualAlloc((size + largePage - 1) / largePage * largePage,
+                                     MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                                     node);
+        }
+        if (base == NULL) {
+            LOG("EchoArena: Large pages unavailable (%d), using normal pages\n", GetLastError());
+            ArenaLargeRefused = TRUE;
+        }
+        else {
+            *large = TRUE;
+            *placed = (node != ECHO_NODE_ANY) ? TRUE : FALSE;
+            return base;
+        }
+    }
+
+    base = ArenaVirtualAlloc(size, MEM_RESERVE | MEM_COMMIT, node);
+    if (base == NULL && node != ECHO_NODE_ANY) {
+        LOG("EchoArena: Cannot place buffers on node %d (%d), leaving it to the system\n", node, GetLastError());
+        ArenaPlaceRefused = TRUE;
+        node = ECHO_NODE_ANY;
+        base = ArenaVirtualAlloc(size, MEM_RESERVE | MEM_COMMIT, node);
+    }
+    *placed = (base != NULL && node != ECHO_NODE_ANY) ? TRUE : FALSE;
+#else
+    PVOID mapped;
+
+    if (ArenaWantLarge && !ArenaLargeRefused) {
+        mapped = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mapped == MAP_FAILED) {
+            LOG("EchoArena: No huge pages reserved, using transparent huge pages\n");
+            ArenaLargeRefused = TRUE;
+        }
+        else {
+            *large = TRUE;
+            base = (PUCHAR)mapped;
+        }
+    }
+
+    if (base == NULL) {
+        mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED) {
+            return NULL;
+        }
+        base = (PUCHAR)mapped;
+        if (ArenaWantLarge) {
+            madvise(base, size, MADV_HUGEPAGE);
+        }
+    }
+
+    //
+    // The pages are not touched yet, so the policy decides where they go
+    // ҳδʣɲԾλ
+    //
+#ifdef __linux__
+    if (node != ECHO_NODE_ANY && !ArenaPlaceRefused) {
+        if (ArenaPlace(base, size, node)) {
+            *placed = TRUE;
+        }
+        else {
+            LOG("EchoArena: Cannot place buffers on node %d (%d), leaving it to the system\n", node, errno);
+            ArenaPlaceRefused = TRUE;
+        }
+    }
+#endif
+#endif
+
+    return base;
+}
+
+static VOID ArenaUnmapSlab(PARENA_SLAB slab)
+{
+#ifdef _WIN32
+    VirtualFree(slab->Base, 0, MEM_RELEASE);
+#else
+    munmap(slab->Base, slab->Size);
+#endif
+}
+
+//
+// ΪһС¿飬߳и
+//
+static BOOLEAN ArenaGrow(PARENA_CLASS cls, size_t blockSize, ULONG node)
+{
+    ARENA_SLAB slab;
+
+    slab.Size = (blockSize > ARENA_SLAB_SIZE) ? blockSize : ARENA_SLAB_SIZE;
+
+    std::lock_guard<std::mutex> lock(ArenaSlabLock);
+
+    slab.Base = ArenaMapSlab(slab.Size, node, &slab.Large, &slab.Placed);
+    if (slab.Base == NULL) {
+        LOG("EchoArena: Cannot allocate a slab of %zu bytes\n", slab.Size);
+        return FALSE;
+    }
+
+    ArenaSlabs.push_back(slab);
+
+    cls->Carve = slab.Base;
+    cls->CarveEnd = slab.Base + slab.Size;
+
+    return TRUE;
+}
+
+VOID EchoArenaUseLargePages(IN BOOLEAN enable)
+{
+    std::lock_guard<std::mutex> lock(ArenaSlabLock);
+
+    ArenaWantLarge = enable;
+}
+
+//
+// ڵĴС飬ûԼСĽڵʹýϵͳõһ
+//
+static ULONG ArenaSetOf(ULONG node)
+{
+    return (node < ARENA_NODES) ? node + 1 : 0;
+}
+
+PUCHAR EchoArenaAlloc(IN ULONG length)
+{
+    return EchoArenaAllocNode(length, ECHO_NODE_ANY);
+}
+
+PUCHAR EchoArenaAllocNode(IN ULONG length, IN ULONG node)
+{
+    ULONG set = ArenaSetOf(node);
+    ULONG index = ArenaClassOf(length);
+    size_t blockSize;
+    PARENA_CLASS cls;
+    PUCHAR buffer;
+    ULONGLONG inUse;
+    ULONGLONG peak;
+
+    if (index >= ARENA_CLASSES) {
+        return NULL;
+    }
+
+    cls = &ArenaClasses[set][index];
+    blockSize = (size_t)1 << (index + ARENA_MIN_SHIFT);
+
+    {
+        std::lock_guard<std::mutex> lock(cls->Lock);
+
+        //
+        // A freed buffer first, then the rest of the last slab, and only
+        // then a new slab
+        // ͷŵĻһʣಿ֣¿
+        //
+        if (cls->Free != NULL) {
+            buffer = (PUCHAR)cls->Free;
+            cls->Free = cls->Free->Next;
+            cls->Recycled++;
+        }
+        else {
+            if ((size_t)(cls->CarveEnd - cls->Carve) < blockSize &&
+                !ArenaGrow(cls, blockSize, (set != 0) ? set - 1 : ECHO_NODE_ANY)) {
+                return NULL;
+            }
+            buffer = cls->Carve;
+            cls->Carve += blockSize;
+        }
+
+        cls->Allocs++;
+        cls->InUse++;
+    }
+
+    inUse = ArenaInUseBytes.fetch_add(blockSize) + blockSize;
+
+    peak = ArenaPeakBytes.load();
+    while (inUse > peak && !ArenaPeakBytes.compare_exchange_weak(peak, inUse)) {
+    }
+
+    return buffer;
+}
+
+VOID EchoArenaFree(IN PUCHAR buffer, IN ULONG length)
+{
+    EchoArenaFreeNode(buffer, length, ECHO_NODE_ANY);
+}
+
+VOID EchoArenaFreeNode(IN PUCHAR buffer, IN ULONG length, IN ULONG node)
+{
+    ULONG index = ArenaClassOf(length);
+    PARENA_CLASS cls;
+    PARENA_BLOCK block = (PARENA_BLOCK)buffer;
+
+    if (buffer == NULL || index >= ARENA_CLASSES) {
+        return;
+    }
+
+    cls = &ArenaClasses[ArenaSetOf(node)][index];
+
+    {
+        std::lock_guard<std::mutex> lock(cls->Lock);
+
+        block->Next = cls->Free;
+        cls->Free = block;
+        cls->InUse--;
+    }
+
+    ArenaInUseBytes -= (ULONGLONG)1 << (index + ARENA_MIN_SHIFT);
+}
+
+//
+// ̵ĳפڴ棬δ֪ʱ0
+//
+static ULONGLONG ArenaResidentBytes(VOID)
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.WorkingSetSize;
+    }
+    return 0;
+#else
+    unsigned long long size = 0;
+    unsigned long long resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+
+    if (statm == NULL) {
+        return 0;
+    }
+    if (fscanf(statm, "%llu %llu", &size, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(statm);
+
+    return resident * (ULONGLONG)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+VOID EchoArenaQuery(OUT PECHO_ARENA_STATS stats)
+{
+    ULONG set;
+    ULONG i;
+
+    ZeroMemory(stats, sizeof(*stats));
+
+    for (set = 0; set <= ARENA_NODES; set++) {
+        for (i = 0; i < ARENA_CLASSES; i++) {
+            std::lock_guard<std::mutex> lock(ArenaClasses[set][i].Lock);
+
+            stats->Allocs += ArenaClasses[set][i].Allocs;
+            stats->Recycled += ArenaClasses[set][i].Recycled;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(ArenaSlabLock);
+
+        for (i = 0; i < ArenaSlabs.size(); i++) {
+            stats->Slabs++;
+            stats->SlabBytes += ArenaSlabs[i].Size;
+            if (ArenaSlabs[i].Large) {
+                stats->LargePages = TRUE;
+            }
+            if (ArenaSlabs[i].Placed) {
+                stats->NodeSlabs++;
+            }
+        }
+    }
+
+    stats->InUseBytes = ArenaInUseBytes;
+    stats->PeakInUseBytes = ArenaPeakBytes;
+    stats->ResidentBytes = ArenaResidentBytes();
+}
+
+VOID EchoArenaReport(VOID)
+{
+    ECHO_ARENA_STATS stats;
+    char placed[64] = "";
+
+    EchoArenaQuery(&stats);
+
+    if (stats.NodeSlabs != 0) {
+        snprintf(placed, sizeof(placed), " (%llu on their workers' nodes)", stats.NodeSlabs);
+    }
+
+    LOG("Buffers: %llu allocations, %llu from free lists, %llu slabs%s holding %.1f MB%s, "
+        "peak %.1f MB in use, process resident %.1f MB\n",
+        stats.Allocs, stats.Recycled, stats.Slabs, placed, stats.SlabBytes / 1048576.0,
+        stats.LargePages ? " in large pages" : "",
+        stats.PeakInUseBytes / 1048576.0, stats.ResidentBytes / 1048576.0);
+}
+
+VOID EchoArenaRelease(VOID)
+{
+    PARENA_CLASS cls;
+    ULONG set;
+    ULONG i;
+
+    //
+    // Classes lock before the slab list, as in EchoArenaAlloc
+    // EchoArenaAllocͬСб
+    //
+    for (set = 0; set <= ARENA_NODES; set++) {
+        for (i = 0; i < ARENA_CLASSES; i++) {
+            std::lock_guard<std::mutex> lock(ArenaClasses[set][i].Lock);
+
+            if (ArenaClasses[set][i].InUse != 0) {
+                return;
+            }
+        }
+    }
+
+    for (set = 0; set <= ARENA_NODES; set++) {
+        for (i = 0; i < ARENA_CLASSES; i++) {
+            cls = &ArenaClasses[set][i];
+
+            std::lock_guard<std::mutex> lock(cls->Lock);
+
+            cls->Free = NULL;
+            cls->Carve = NULL;
+            cls->CarveEnd = NULL;
+        }
+    }
+
+    std::lock_guard<std::mutex> slabLock(ArenaSlabLock);
+
+    for (i = 0; i < ArenaSlabs.size(); i++) {
+        ArenaUnmapSlab(&ArenaSlabs[i]);
+    }
+    ArenaSlabs.clear();
+}
@@ -0,0 +1,94 @@
+/*++
+
+Module Name:
+
+    echoarena.h
+
+Abstract:
+
+    Process-wide arena for I/O buffers. Buffers come in power-of-two size
+    classes carved from page-aligned slabs (2 MB, optionally backed by large
+    pages), and a freed buffer goes on its class's free list for the next
+    request of that class from any thread. Slabs are only returned to the
+    system by EchoArenaRelease, so in steady state a buffer costs no
+    allocation and the memory held is the peak of buffers in use rather
+    than a multiple of the thread count. A buffer may be asked for on a
+    NUMA node; each node has size classes of its own whose slabs the
+    system places on that node.
+    ̷ΧI/O2ݴС࣬ӰҳĿ飨2 MB
+    ѡʹôҳз֣ͷŵĻСĿбκ߳´
+    ʱʹáֻEchoArenaRelease黹ϵͳȶ״̬»
+    䣬ռõڴͬʱʹõĻֵ߳ı
+    ָNUMAڵ룻ÿڵԼĴС࣬ϵͳڸýڵϡ
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#pragma once
+
+#include "echoport.h"
+#include "echoaffinity.h"
+
+typedef struct _ECHO_ARENA_STATS {
+    ULONGLONG Allocs;           // buffers handed out
+    ULONGLONG Recycled;         // of which came off a free list
+    ULONGLONG Slabs;            // system allocations
+    ULONGLONG SlabBytes;        // memory the arena holds
+    ULONGLONG InUseBytes;       // in buffers not yet freed, by size class
+    ULONGLONG PeakInUseBytes;
+    ULONGLONG ResidentBytes;    // of the whole process, 0 if unknown
+    ULONGLONG NodeSlabs;        // placed on the node they were asked for on
+    BOOLEAN   LargePages;       // some slab is backed by large pages
+} ECHO_ARENA_STATS, *PECHO_ARENA_STATS;
+
+//
+// Asks for large pages for the slabs allocated from now on. Falls back to
+// normal pages, once and with a message, when the system refuses them.
+// ֮Ŀʹôҳϵͳܾʱ˵ͨҳֻʾһΡ
+//
+VOID EchoArenaUseLargePages(IN BOOLEAN enable);
+
+//
+// A buffer of at least length bytes, aligned to its size class or to the
+// page for classes of a page or more. NULL if it cannot be allocated.
+// lengthֽڵĻС룬һҳϵఴҳ롣
+// ޷ʱNULL
+//
+PUCHAR EchoArenaAlloc(IN ULONG length);
+
+//
+// Returns a buffer; length is the one it was allocated with
+// 黹lengthΪʱĳ
+//
+VOID EchoArenaFree(IN PUCHAR buffer, IN ULONG length);
+
+//
+// As EchoArenaAlloc and EchoArenaFree, from the size classes of a NUMA
+// node; ECHO_NODE_ANY, or a node the system cannot place memory on,
+// leaves the placement to the system. A buffer is freed on the node it
+// was allocated on.
+// EchoArenaAllocEchoArenaFreeͬʹһNUMAڵĴСࣻ
+// ECHO_NODE_ANYϵͳ޷ڴĽڵ㽻ϵͳáڷĽڵͷš
+//
+PUCHAR EchoArenaAllocNode(IN ULONG length, IN ULONG node);
+
+VOID EchoArenaFreeNode(IN PUCHAR buffer, IN ULONG length, IN ULONG node);
+
+VOID EchoArenaQuery(OUT PECHO_ARENA_STATS stats);
+
+//
+// Prints the allocation counts and memory of EchoArenaQuery on one line
+// һдӡEchoArenaQueryķڴ
+//
+VOID EchoArenaReport(VOID);
+
+//
+// Gives the slabs back to the system if every buffer has been freed; a
+// buffer still in use may be the target of an I/O that never completed.
+// лѹ黹ʱ齻ϵͳʹõĻδI/OĿꡣ
+//
+VOID EchoArenaRelease(VOID);
@@ -0,0 +1,1766 @@
+/*++
+
+Module Name:
+
+    echobench.cpp
+
+Abstract:
+
+    Closed-loop load generator over an EchoEngine.
+    EchoEngineıջ
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#include "echobench.h"
+#include "echoaffinity.h"
+#include "echoarena.h"
+#include "echocpu.h"
+#include "echohist.h"
+#include "echopool.h"
+#include "echotrace.h"
+#include "echoverify.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <thread>
+
+#define LOG printf
+
+#define BENCH_MAX_THREADS       64
+#define BENCH_MAX_WORKERS       32
+#define BENCH_ENGINE_NAME       16
+
+//
+// Longest the reporting loop sleeps, so it sees the end of a replay
+// ѭߵޣʹܼʱֻطŽ
+//
+#define BENCH_POLL_MS           100
+
+//
+// Arrivals a replay lets wait on one handle before it stops reading ahead;
+// they keep their recorded times, so the wait still counts as latency
+// طһϵȴĵͣȡǱ¼ʱ䣬
+// ˵ȴԼӳ
+//
+#define BENCH_REPLAY_BACKLOG    65536
+#define BENCH_REPLAY_SPIN_MS    20
+
+//
+// DurationSec of a replay that runs to the end of its trace
+// еĩβĻطŵDurationSec
+//
+#define BENCH_WHOLE_TRACE       ((ULONG)~0)
+
+//
+// Coefficient of variation of throughput and mean latency over the
+// detector's window that ends the warmup
+// Ԥļⴰƽӳٵıϵ
+//
+#define BENCH_STEADY_CV         0.05
+
+static const PCSTR BenchOpNames[EchoOpCount] = { "write", "read" };
+
+typedef struct _BENCH_OP_STATS {
+    ULONGLONG      Ops;
+    ULONGLONG      Bytes;
+    ULONGLONG      Errors;
+    ECHO_HISTOGRAM LatencyNs;
+} BENCH_OP_STATS, *PBENCH_OP_STATS;
+
+typedef struct _BENCH_WORKER {
+    ULONGLONG      Rng;
+    ULONGLONG      Completions;     // for sampled tracing
+
+    //
+    // Filled by the worker, taken by the reporter at every interval
+    // ɹ߳дÿȡ
+    //
+    std::mutex     Lock;
+    BENCH_OP_STATS Interval[EchoOpCount];
+    ECHO_VERIFY_COUNTS Verify;      // whole run
+} BENCH_WORKER, *PBENCH_WORKER;
+
+typedef struct _BENCH_RUN {
+    PECHO_BENCH_OPTIONS Options;
+    ULONG               Workers;        // per handle in this run
+    volatile BOOLEAN    Stop;
+    PECHO_TRACE_READER  Replay;         // NULL for the configured mix
+    volatile BOOLEAN    Replayed;       // every record has arrived
+    ECHO_AFFINITY       Affinity;       // none without Options->Affinity
+} BENCH_RUN, *PBENCH_RUN;
+
+//
+// Steady-state run: every sample taken from the workers goes to the
+// detector, and to the totals only once the warmup is over
+// ̬Уӹ߳ȡÿԤȽżܼ
+//
+typedef struct _BENCH_STEADY {
+    ECHO_STEADY    Detector;
+    BENCH_OP_STATS Sample[EchoOpCount];
+    BENCH_OP_STATS Warmup[EchoOpCount];     // kept only if the run never settles
+    BENCH_OP_STATS Pending[EchoOpCount];    // samples since the last report line
+    ULONGLONG      LastNs;                  // end of the last sample
+    ULONGLONG      SteadyNs;                // end of the warmup, 0 before
+} BENCH_STEADY, *PBENCH_STEADY;
+
+//
+// CPU a run cost the process, the part of it the stand-ins' device threads
+// spent, and the operations over the same span, warmup included
+// һеĽCPU豸̵߳Ĳ֣ԼͬһʱΣԤȣĲ
+//
+typedef struct _BENCH_CPU {
+    ECHO_CPU_SAMPLE Process;
+    ECHO_CPU_SAMPLE Host;
+    ULONGLONG       Ops;
+} BENCH_CPU, *PBENCH_CPU;
+
+//
+// One handle: its engine, the pool driving it and the pool's workers
+// һ桢̳߳Լ̳߳صĹ߳
+//
+typedef struct _BENCH_HANDLE {
+    PBENCH_RUN      Run;
+    ULONG           Index;
+    EchoEngine*     Engine;
+    PECHO_POOL      Pool;
+    PBENCH_WORKER   Workers;        // the pool's workers, then its pacing thread
+    BENCH_OP_STATS  Total[EchoOpCount];
+    PECHO_LEDGER    Ledger;         // NULL without verification
+    PECHO_VERIFY_OP VerifyOps;      // one per slot
+    ECHO_DEPTH_CONTROLLER Depth;    // of the slots in flight, used with a Target only
+} BENCH_HANDLE, *PBENCH_HANDLE;
+
+VOID EchoBenchDefaultOptions(OUT PECHO_BENCH_OPTIONS options)
+{
+    options->Threads = 1;
+    options->QueueDepth = 32;
+    options->BlockSize = 4096;
+    options->ReadPercent = 50;
+    options->DurationSec = 10;
+    options->IntervalSec = 1;
+    options->Workers = 1;
+    options->ScaleWorkers = 0;
+    options->TraceEvery = 0;
+    options->Verify = 1;
+    options->LargePages = 0;
+    options->Rate = 0;
+    options->Arrival = EchoArrivalFixed;
+    options->TargetUs = 0;
+    options->Control = EchoDepthAimd;
+    options->Steady = 0;
+    options->Devices = 1;
+    options->JsonPath = NULL;
+    options->CsvPath = NULL;
+    options->RecordPath = NULL;
+    options->ReplayPath = NULL;
+    options->Speed = 1;
+    options->Affinity = NULL;
+}
+
+VOID EchoBenchUsage(VOID)
+{
+    LOG("        -threads <n>   clients, each with its own handle (1)\n");
+    LOG("        -workers <n>   threads sharing each handle's completions (1)\n");
+    LOG("        -qd <n>        operations in flight per thread (32)\n");
+    LOG("        -bs <bytes>    bytes per read or write (4096)\n");
+    LOG("        -read <pct>    percentage of reads, the rest are writes (50)\n");
+    LOG("        -time <sec>    run time (10)\n");
+    LOG("        -interval <sec> seconds between reports, 0 for the final one only (1)\n");
+    LOG("        -scale <n>     repeat the run with 1, 2, 4 ... n workers and compare\n");
+    LOG("        -trace <n>     print every n-th completion, 0 for none (0)\n");
+    LOG("        -verify <0|1>  tag writes and check every read; keep -threads at or\n");
+    LOG("                       below the device's shard count (1)\n");
+    LOG("        -rate <n>      open loop: n requests a second over all threads, 0 for\n");
+    LOG("                       closed loop; -qd caps the requests in flight (0)\n");
+    LOG("        -arrival <fixed|poisson> schedule of the open-loop requests (fixed)\n");
+    LOG("        -target <us>   adapt each thread's queue depth to keep the p99 under us\n");
+    LOG("                       microseconds, -qd being the most; 0 for a fixed depth (0)\n");
+    LOG("        -control <aimd|gradient> rule the adaptive depth follows (aimd)\n");
+    LOG("        -steady <pct>  discard the warmup and run until throughput and mean\n");
+    LOG("                       latency are known within pct percent (95%% confidence),\n");
+    LOG("                       -time being the budget; 0 runs for -time (0)\n");
+    LOG("        -largepages <0|1> back the I/O buffers with large pages (0)\n");
+    LOG("        -affinity <spec> pin the workers and place their buffers on their NUMA\n");
+    LOG("                       node: none, compact, spread, node, or processors such as\n");
+    LOG("                       0,2,4-7 (group:number beyond 64); with -scale every step\n");
+    LOG("                       runs unpinned and pinned (none)\n");
+    LOG("        -json <file>   write the latency histograms of the run as JSON\n");
+    LOG("        -csv <file>    write a percentile row per operation type as CSV\n");
+    LOG("        -record <file> write a trace of every operation issued\n");
+    LOG("        -replay <file> send the operations of a trace at their recorded times\n");
+    LOG("                       instead of the mix, one thread per traced handle,\n");
+    LOG("                       without verification; runs to the end of the trace\n");
+    LOG("                       unless -time is given\n");
+    LOG("        -speed <x>     replay x times as fast as recorded (1)\n");
+}
+
+BOOLEAN EchoBenchParseOptions(
+    IN  int   argc,
+    IN  char* argv[],
+    OUT PECHO_BENCH_OPTIONS options
+    )
+{
+    BOOLEAN timed = FALSE;
+    ULONG value;
+    char* end;
+    int i;
+
+    for (i = 0; i < argc; i += 2) {
+
+        if (i + 1 >= argc) {
+            LOG("Missing value for %s\n", argv[i]);
+            return FALSE;
+        }
+
+        if (!_stricmp(argv[i], "-json")) {
+            options->JsonPath = argv[i + 1];
+            continue;
+        }
+        if (!_stricmp(argv[i], "-csv")) {
+            options->CsvPath = argv[i + 1];
+            continue;
+        }
+        if (!_stricmp(argv[i], "-record")) {
+            options->RecordPath = argv[i + 1];
+            continue;
+        }
+        if (!_stricmp(argv[i], "-replay")) {
+            options->ReplayPath = argv[i + 1];
+            continue;
+        }
+        if (!_stricmp(argv[i], "-speed")) {
+            options->Speed = strtod(argv[i + 1], &end);
+            if (*end != '\0' || !(options->Speed > 0)) {
+                LOG("Bad value %s for %s\n", argv[i + 1], argv[i]);
+                return FALSE;
+            }
+            continue;
+        }
+        if (!_stricmp(argv[i], "-affinity")) {
+            ECHO_AFFINITY affinity;
+
+            if (!EchoAffinityParse(argv[i + 1], &affinity)) {
+                return FALSE;
+            }
+            options->Affinity = (affinity.Mode != EchoAffinityNone) ? argv[i + 1] : NULL;
+            continue;
+        }
+        if (!_stricmp(argv[i], "-arrival")) {
+            if (!EchoPacerParse(argv[i + 1], &options->Arrival)) {
+                LOG("Bad value %s for %s\n", argv[i + 1], argv[i]);
+                return FALSE;
+            }
+            continue;
+        }
+        if (!_stricmp(argv[i], "-steady")) {
+            options->Steady = strtod(argv[i + 1], &end);
+            if (*end != '\0' || !(options->Steady >= 0 && options->Steady < 100)) {
+                LOG("Bad value %s for %s\n", argv[i + 1], argv[i]);
+                return FALSE;
+            }
+            continue;
+        }
+        if (!_stricmp(argv[i], "-control")) {
+            if (!EchoDepthParse(argv[i + 1], &options->Control)) {
+                LOG("Bad value %s for %s\n", argv[i + 1], argv[i]);
+                return FALSE;
+            }
+            continue;
+        }
+
+        value = strtoul(argv[i + 1], &end, 0);
+        if (*end != '\0') {
+            LOG("Bad value %s for %s\n", argv[i + 1], argv[i]);
+            return FALSE;
+        }
+
+        if (!_stricmp(argv[i], "-threads")) {
+            options->Threads = value;
+        }
+        else if (!_stricmp(argv[i], "-qd")) {
+            options->QueueDepth = value;
+        }
+        else if (!_stricmp(argv[i], "-bs")) {
+            options->BlockSize = value;
+        }
+        else if (!_stricmp(argv[i], "-read")) {
+            options->ReadPercent = value;
+        }
+        else if (!_stricmp(argv[i], "-time")) {
+            options->DurationSec = value;
+            timed = TRUE;
+        }
+        else if (!_stricmp(argv[i], "-interval")) {
+            options->IntervalSec = value;
+        }
+        else if (!_stricmp(argv[i], "-workers")) {
+            options->Workers = value;
+        }
+        else if (!_stricmp(argv[i], "-scale")) {
+            options->ScaleWorkers = value;
+        }
+        else if (!_stricmp(argv[i], "-trace")) {
+            options->TraceEvery = value;
+        }
+        else if (!_stricmp(argv[i], "-verify")) {
+            options->Verify = value;
+        }
+        else if (!_stricmp(argv[i], "-largepages")) {
+            options->LargePages = value;
+        }
+        else if (!_stricmp(argv[i], "-rate")) {
+            options->Rate = value;
+        }
+        else if (!_stricmp(argv[i], "-target")) {
+            options->TargetUs = value;
+        }
+        else {
+            LOG("Unknown option %s\n", argv[i]);
+            return FALSE;
+        }
+    }
+
+    //
+    // The trace decides the threads, lengths and mix; a handle's writes and
+    // reads need not follow the ledger's rules, so nothing is verified
+    // پ̡߳ȺͶдϵдͶȡһ˱Ĺ
+    // ˲У
+    //
+    if (options->ReplayPath != NULL) {
+        if (options->Rate != 0 || options->ScaleWorkers != 0) {
+            LOG("-replay cannot be combined with -rate or -scale\n");
+            return FALSE;
+        }
+        options->Verify = 0;
+        if (!timed) {
+            options->DurationSec = BENCH_WHOLE_TRACE;
+        }
+    }
+
+    if (options->Threads == 0 || options->Threads > BENCH_MAX_THREADS ||
+        options->Workers == 0 || options->Workers > BENCH_MAX_WORKERS ||
+        options->ScaleWorkers > BENCH_MAX_WORKERS ||
+        options->QueueDepth == 0 || options->BlockSize == 0 ||
+        options->ReadPercent > 100 || options->DurationSec == 0) {
+        LOG("Need 1-%d threads, 1-%d workers, a queue depth and block size above 0, "
+            "a read percentage of 0-100 and a time above 0\n", BENCH_MAX_THREADS, BENCH_MAX_WORKERS);
+        return FALSE;
+    }
+
+    if (options->Verify && options->BlockSize < ECHO_PAYLOAD_MIN_LENGTH) {
+        LOG("Verification needs a block size of at least %d bytes, or -verify 0\n",
+            (ULONG)ECHO_PAYLOAD_MIN_LENGTH);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+// xorshift64*ÿ߳һ״̬
+//
+static ULONGLONG BenchRandom(ULONGLONG* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+//
+// дѡһ
+//
+static BOOLEAN BenchPrepare(PVOID context, ULONG worker, PECHO_IO io)
+{
+    PBENCH_HANDLE handle = (PBENCH_HANDLE)context;
+    PECHO_BENCH_OPTIONS options = handle->Run->Options;
+    PECHO_VERIFY_OP verify;
+
+    //
+    // A replayed operation comes with its type and length
+    // طŵĲԴͺͳ
+    //
+    if (handle->Run->Replay == NULL) {
+        io->Op = (BenchRandom(&handle->Workers[worker].Rng) % 100 < options->ReadPercent) ? EchoOpRead : EchoOpWrite;
+        io->Length = options->BlockSize;
+    }
+
+    if (handle->Ledger != NULL) {
+        verify = &handle->VerifyOps[(ULONG_PTR)io->Context];
+
+        if (io->Op == EchoOpWrite) {
+            EchoVerifyPrepareWrite(handle->Ledger, verify, handle->Index * (handle->Run->Workers + 1) + worker,
+                                   io->Buffer, io->Length);
+        }
+        else {
+            EchoVerifyPrepareRead(handle->Ledger, verify);
+        }
+    }
+
+    return TRUE;
+}
+
+//
+// һͳ
+//
+static VOID BenchResetStats(PBENCH_OP_STATS stats)
+{
+    stats->Ops = 0;
+    stats->Bytes = 0;
+    stats->Errors = 0;
+    EchoHistReset(&stats->LatencyNs);
+}
+
+//
+// frominto
+//
+static VOID BenchMerge(PBENCH_OP_STATS into, const BENCH_OP_STATS* from)
+{
+    into->Ops += from->Ops;
+    into->Bytes += from->Bytes;
+    into->Errors += from->Errors;
+    EchoHistMerge(&into->LatencyNs, &from->LatencyNs);
+}
+
+//
+// ¼һɣֻڱ̵߳ļֱͼۼӣӡ
+//
+static VOID BenchComplete(PVOID context, ULONG worker, PECHO_IO* completed, ULONG count)
+{
+    PBENCH_HANDLE handle = (PBENCH_HANDLE)context;
+    PBENCH_WORKER stats = &handle->Workers[worker];
+    ULONG traceEvery = handle->Run->Options->TraceEvery;
+    ULONGLONG now = EchoNowNs();
+    ECHO_VERIFY_COUNTS verify = {};
+    ULONG i;
+
+    //
+    // Checked outside the lock so the reporter never waits on a compare
+    // У飬ʹ߲صȴȽ
+    //
+    if (handle->Ledger != NULL) {
+        for (i = 0; i < count; i++) {
+            EchoVerifyComplete(handle->Ledger, &handle->VerifyOps[(ULONG_PTR)completed[i]->Context],
+                               completed[i], &verify);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(stats->Lock);
+
+        EchoVerifyAddCounts(&stats->Verify, &verify);
+
+        for (i = 0; i < count; i++) {
+            PBENCH_OP_STATS opStats = &stats->Interval[completed[i]->Op];
+
+            opStats->Ops++;
+            opStats->Bytes += completed[i]->Transferred;
+            EchoHistRecord(&opStats->LatencyNs, now - completed[i]->IntendedNs);
+            if (completed[i]->Error != ERROR_SUCCESS) {
+                opStats->Errors++;
+            }
+        }
+    }
+
+    if (traceEvery == 0) {
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (++stats->Completions % traceEvery == 0) {
+            LOG("Number of bytes %s by request number %d is %d\n",
+                (completed[i]->Op == EchoOpRead) ? "read" : "written",
+                (ULONG)(ULONG_PTR)completed[i]->Context, completed[i]->Transferred);
+        }
+    }
+}
+
+//
+// ȡй߳ڱͳƣۼӵܼ
+//
+static VOID BenchCollect(
+    PBENCH_HANDLE   handles,
+    ULONG           count,
+    ULONG           perHandle,
+    PBENCH_OP_STATS interval
+    )
+{
+    ULONG i;
+    ULONG worker;
+    ULONG op;
+
+    for (op = 0; op < EchoOpCount; op++) {
+        BenchResetStats(&interval[op]);
+    }
+
+    for (i = 0; i < count; i++) {
+        for (worker = 0; worker < perHandle; worker++) {
+            PBENCH_WORKER stats = &handles[i].Workers[worker];
+            std::lock_guard<std::mutex> lock(stats->Lock);
+
+            for (op = 0; op < EchoOpCount; op++) {
+                BenchMerge(&interval[op], &stats->Interval[op]);
+                BenchMerge(&handles[i].Total[op], &stats->Interval[op]);
+                BenchResetStats(&stats->Interval[op]);
+            }
+        }
+    }
+}
+
+//
+// ӡһͳ
+//
+static VOID BenchPrintLine(
+    PCSTR           label,
+    ECHO_OP         op,
+    PBENCH_OP_STATS stats,
+    double          seconds
+    )
+{
+    LOG("%8s %-6s %11.1f %9.2f %9.1f %9.1f %9.1f %9.1f %9.1f %7llu\n",
+        label,
+        BenchOpNames[op],
+        stats->Ops / seconds,
+        stats->Bytes / seconds / (1024 * 1024),
+        EchoHistPercentile(&stats->LatencyNs, 50) / 1000.0,
+        EchoHistPercentile(&stats->LatencyNs, 90) / 1000.0,
+        EchoHistPercentile(&stats->LatencyNs, 99) / 1000.0,
+        EchoHistPercentile(&stats->LatencyNs, 99.9) / 1000.0,
+        stats->LatencyNs.Max / 1000.0,
+        stats->Errors);
+}
+
+static VOID BenchPrintHeader(VOID)
+{
+    LOG("%8s %-6s %11s %9s %9s %9s %9s %9s %9s %7s\n",
+        "time", "op", "IOPS", "MB/s", "p50(us)", "p90(us)", "p99(us)", "p99.9(us)", "max(us)", "errors");
+}
+
+//
+// еĿΪͻ˺֣û豸̼߳˻ʱFALSE
+// ʱ̶ͻ
+//
+static BOOLEAN BenchCpuSplit(const BENCH_CPU* cpu, PECHO_CPU_SAMPLE client, PECHO_CPU_SAMPLE host)
+{
+    *client = cpu->Process;
+    *host = cpu->Host;
+
+    if (host->UserNs + host->KernelNs + host->Switches + host->Cycles == 0) {
+        return FALSE;
+    }
+
+    //
+    // The client's cycles are only known if the host's are
+    // ֻ֪ʱͻ˵ſ֪
+    //
+    EchoCpuSubtract(client, host);
+    if ((host->Valid & ECHO_CPU_CYCLES) == 0) {
+        client->Valid &= ~(ECHO_CPU_CYCLES | ECHO_CPU_USER_CYCLES);
+    }
+    client->Valid |= host->Valid & ECHO_CPU_USER_CYCLES;
+
+    return TRUE;
+}
+
+//
+// ӡһÿCPUʱ䡢û̬ռȡлʱΪn/a
+//
+static VOID BenchPrintCpuLine(PCSTR label, const ECHO_CPU_SAMPLE* sample, ULONGLONG ops)
+{
+    ULONGLONG cpuNs = sample->UserNs + sample->KernelNs;
+    char cycles[24];
+    char switches[24];
+    char preemptions[24];
+
+    snprintf(cycles, sizeof(cycles), "n/a");
+    snprintf(switches, sizeof(switches), "n/a");
+    snprintf(preemptions, sizeof(preemptions), "n/a");
+
+    if ((sample->Valid & ECHO_CPU_CYCLES) != 0) {
+        snprintf(cycles, sizeof(cycles), "%.0f", (double)sample->Cycles / ops);
+    }
+    if ((sample->Valid & ECHO_CPU_SWITCHES) != 0) {
+        snprintf(switches, sizeof(switches), "%.3f", (double)sample->Switches / ops);
+        snprintf(preemptions, sizeof(preemptions), "%.3f", (double)sample->Preemptions / ops);
+    }
+
+    LOG("%8s %11.2f %6.0f%% %11s %12s %12s\n",
+        label, cpuNs / 1000.0 / ops, (cpuNs != 0) ? 100.0 * sample->UserNs / cpuNs : 0.0,
+        cycles, switches, preemptions);
+}
+
+//
+// ӡͻ˺ÿCPU
+//
+static VOID BenchPrintCpu(const BENCH_CPU* cpu)
+{
+    ECHO_CPU_SAMPLE client;
+    ECHO_CPU_SAMPLE host;
+    BOOLEAN hosted;
+
+    if (cpu->Ops == 0) {
+        return;
+    }
+
+    hosted = BenchCpuSplit(cpu, &client, &host);
+
+    LOG("\nCPU per operation over the whole run, setup and warmup included, %llu operations%s:\n",
+        cpu->Ops, ((cpu->Process.Valid & ECHO_CPU_USER_CYCLES) != 0) ? ", cycles in user mode only" : "");
+    LOG("%8s %11s %7s %11s %12s %12s\n", "side", "cpu(us/op)", "user", "cycles/op", "switches/op", "preempt/op");
+    BenchPrintCpuLine("client", &client, cpu->Ops);
+
+    if (hosted) {
+        BenchPrintCpuLine("host", &host, cpu->Ops);
+    }
+    else {
+        LOG("%8s no device thread in this process: a stand-in that serves on the client's\n"
+            "%8s threads counts as client, a driver reports its host with the driver view\n", "host", "");
+    }
+}
+
+//
+// ӡУ
+//
+static VOID BenchPrintVerify(const ECHO_VERIFY_COUNTS* verify)
+{
+    LOG("Verified %llu reads (%llu before any write): %llu torn, %llu lost, %llu reordered, "
+        "%llu duplicated, %llu crossed\n",
+        verify->Verified, verify->Empty, verify->Torn, verify->Lost, verify->Reordered,
+        verify->Duplicated, verify->Crossed);
+}
+
+//
+// ѡ͵ӳֱͼ
+//
+static BOOLEAN BenchExport(PECHO_BENCH_OPTIONS options, const BENCH_OP_STATS* total)
+{
+    ECHO_HIST_NAMED named[EchoOpCount];
+    ULONG count = 0;
+    ULONG op;
+    BOOLEAN result = TRUE;
+
+    for (op = 0; op < EchoOpCount; op++) {
+        if (total[op].Ops != 0) {
+            named[count].Name = BenchOpNames[op];
+            named[count].Histogram = &total[op].LatencyNs;
+            count++;
+        }
+    }
+
+    if (options->JsonPath != NULL) {
+        result = EchoHistExport(options->JsonPath, EchoHistJson, named, count) && result;
+    }
+    if (options->CsvPath != NULL) {
+        result = EchoHistExport(options->CsvPath, EchoHistCsv, named, count) && result;
+    }
+
+    return result;
+}
+
+//
+// ܸĿͷ
+//
+static VOID BenchPacing(
+    PBENCH_HANDLE     handles,
+    ULONG             count,
+    PECHO_POOL_PACING pacing
+    )
+{
+    ECHO_POOL_PACING one;
+    ULONG i;
+
+    ZeroMemory(pacing, sizeof(*pacing));
+
+    for (i = 0; i < count; i++) {
+        if (handles[i].Pool == NULL) {
+            continue;
+        }
+
+        EchoPoolPacing(handles[i].Pool, &one);
+
+        pacing->Arrivals += one.Arrivals;
+        pacing->Issued += one.Issued;
+        if (one.MaxBacklog > pacing->MaxBacklog) {
+            pacing->MaxBacklog = one.MaxBacklog;
+        }
+    }
+}
+
+//
+// ӡصķʺͻѹ
+//
+static VOID BenchPrintPacing(
+    PCSTR                   label,
+    PECHO_BENCH_OPTIONS     options,
+    const ECHO_POOL_PACING* pacing,
+    ULONGLONG               issued,
+    double                  seconds
+    )
+{
+    if (options->ReplayPath != NULL) {
+        LOG("%8s %-6s %11.1f replayed, backlog %llu, at most %llu on one thread\n",
+            label, "sent", issued / seconds,
+            pacing->Arrivals - pacing->Issued, pacing->MaxBacklog);
+        return;
+    }
+
+    LOG("%8s %-6s %11.1f of %d/s, backlog %llu, at most %llu on one thread\n",
+        label, "sent", issued / seconds, options->Rate,
+        pacing->Arrivals - pacing->Issued, pacing->MaxBacklog);
+}
+
+//
+// ӡÿ̵߳ӦȣȶȡڵķΧһڵp99
+//
+static VOID BenchPrintDepth(PBENCH_HANDLE handles, ULONG count)
+{
+    ECHO_DEPTH_STATS stats;
+    ULONG i;
+
+    if (count != 0) {
+        LOG("\n%8s %8s %11s %13s %10s %7s\n", "thread", "settled", "range", "last p99(us)", "decisions", "missed");
+    }
+
+    for (i = 0; i < count; i++) {
+        EchoDepthQuery(&handles[i].Depth, &stats);
+        LOG("%8d %8.1f %5d-%-5d %13.1f %10llu %7llu\n",
+            i, stats.Settled, stats.Low, stats.High, stats.LastP99Ns / 1000.0,
+            stats.Decisions, stats.Misses);
+    }
+}
+
+//
+// Takes a sample from the workers and hands it to the detector; once the
+// warmup is over it also goes to total. The per-handle totals restart
+// when the warmup ends. Returns TRUE when the means are known well enough.
+// ӹ߳ȡһԤȽͬʱtotalԤȽʱ
+// ܼ¿ʼֵ㹻ȷʱTRUE
+//
+static BOOLEAN BenchSteadySample(
+    PBENCH_STEADY   steady,
+    PBENCH_HANDLE   handles,
+    ULONG           count,
+    ULONG           perHandle,
+    PBENCH_OP_STATS total,
+    ULONGLONG       now
+    )
+{
+    ECHO_STEADY_PHASE phase;
+    ULONGLONG ops = 0;
+    ULONGLONG latencyNs = 0;
+    ULONG i;
+    ULONG op;
+
+    BenchCollect(handles, count, perHandle, steady->Sample);
+
+    for (op = 0; op < EchoOpCount; op++) {
+        ops += steady->Sample[op].Ops;
+        latencyNs += steady->Sample[op].LatencyNs.Total;
+        BenchMerge(&steady->Pending[op], &steady->Sample[op]);
+        BenchMerge((steady->SteadyNs != 0) ? &total[op] : &steady->Warmup[op], &steady->Sample[op]);
+    }
+
+    phase = EchoSteadyAdd(&steady->Detector, ops, latencyNs, (now - steady->LastNs) / 1e9);
+    steady->LastNs = now;
+
+    if (steady->SteadyNs == 0 && phase != EchoSteadyWarmup) {
+        steady->SteadyNs = now;
+        for (i = 0; i < count; i++) {
+            for (op = 0; op < EchoOpCount; op++) {
+                BenchResetStats(&handles[i].Total[op]);
+            }
+        }
+    }
+
+    return phase == EchoSteadyConverged;
+}
+
+//
+// ӡԤʱֵ̬
+//
+static VOID BenchPrintSteady(PBENCH_STEADY steady, PECHO_BENCH_OPTIONS options, ULONGLONG start, ULONGLONG end)
+{
+    ECHO_STEADY_STATS stats;
+    ULONGLONG discarded = 0;
+    ULONG op;
+
+    EchoSteadyQuery(&steady->Detector, &stats);
+
+    for (op = 0; op < EchoOpCount; op++) {
+        discarded += steady->Warmup[op].Ops;
+    }
+
+    if (stats.Phase == EchoSteadyWarmup) {
+        LOG("\nWarmup: no steady state within %.1f s; the totals include every sample\n", (end - start) / 1e9);
+        return;
+    }
+
+    LOG("\nWarmup: %.1f s, %d samples of %d ms, %llu operations discarded\n",
+        (steady->SteadyNs - start) / 1e9, stats.WarmupSamples, ECHO_STEADY_SAMPLE_MS, discarded);
+
+    if (stats.Batches < ECHO_STEADY_MIN_BATCHES) {
+        LOG("Steady: %.1f s, too short for a confidence interval (%d samples at least)\n",
+            (end - steady->SteadyNs) / 1e9, ECHO_STEADY_MIN_BATCHES);
+        return;
+    }
+
+    LOG("Steady: %.1f s, %.1f ops/s +-%.2f%%, mean latency %.1f us +-%.2f%% (95%%, %d batches of %d samples)\n",
+        (end - steady->SteadyNs) / 1e9,
+        stats.Rate.Mean, 100 * stats.Rate.HalfWidth / stats.Rate.Mean,
+        stats.LatencyNs.Mean / 1000, 100 * stats.LatencyNs.HalfWidth / stats.LatencyNs.Mean,
+        stats.Batches, stats.BatchSize);
+
+    if (stats.Phase != EchoSteadyConverged) {
+        LOG("The time budget ran out before +-%g%% was reached\n", options->Steady);
+    }
+}
+
+//
+// طŽеﶼѷ̳߳ѽʱΪTRUE
+//
+static BOOLEAN BenchReplayDrained(PBENCH_HANDLE handles, ULONG count)
+{
+    ECHO_POOL_PACING pacing;
+    ULONG i;
+
+    for (i = 0; i < count; i++) {
+        EchoPoolPacing(handles[i].Pool, &pacing);
+        if (pacing.Issued != pacing.Arrivals && !EchoPoolIsDone(handles[i].Pool)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+//
+// ط̣߳¼ʱ䣨ٶţеĲ̳߳
+//
+static VOID BenchReplay(PBENCH_HANDLE handles, ULONG count, ULONGLONG startNs)
+{
+    PBENCH_RUN run = handles[0].Run;
+    ECHO_TRACE_RECORD record;
+    ECHO_POOL_PACING pacing;
+    PBENCH_HANDLE handle;
+    ULONGLONG elapsedNs = 0;
+    ULONGLONG dueNs;
+    ULONGLONG now;
+
+    while (!run->Stop && EchoTraceNext(run->Replay, &record)) {
+
+        elapsedNs += record.GapNs;
+        dueNs = startNs + (ULONGLONG)(elapsedNs / run->Options->Speed);
+        handle = &handles[record.Handle % count];
+
+        for (;;) {
+            if (run->Stop) {
+                return;
+            }
+
+            now = EchoNowNs();
+            EchoPoolPacing(handle->Pool, &pacing);
+
+            if (now >= dueNs && pacing.Arrivals - pacing.Issued < BENCH_REPLAY_BACKLOG) {
+                break;
+            }
+
+            if (now < dueNs && dueNs - now <= (ULONGLONG)BENCH_REPLAY_SPIN_MS * 1000000) {
+                std::this_thread::yield();
+            }
+            else {
+                EchoSleepMs(1);
+            }
+        }
+
+        EchoPoolArrive(handle->Pool,
+                       dueNs,
+                       (record.Op == EchoOpRead) ? EchoOpRead : EchoOpWrite,
+                       (record.Length < run->Options->BlockSize) ? record.Length : run->Options->BlockSize);
+    }
+
+    run->Replayed = TRUE;
+}
+
+//
+// ÿworkers߳һΣܼtotalverifypacingУ
+// deviceTotalNULLʱ豸ܼƣÿ豸EchoOpCountreplayNULLʱ
+// طŸø٣traceNULLʱ¼ÿcpuNULLʱеCPU
+//
+static BOOLEAN BenchRunOnce(
+    PECHO_BENCH_OPTIONS options,
+    ULONG               workers,
+    BOOLEAN             report,
+    ECHO_ENGINE_OPEN*   open,
+    PVOID               context,
+    PECHO_TRACE_READER  replay,
+    PECHO_TRACE_WRITER  trace,
+    PBENCH_OP_STATS     total,
+    PBENCH_OP_STATS     deviceTotal,
+    PECHO_VERIFY_COUNTS verify,
+    PECHO_POOL_PACING   pacing,
+    PBENCH_CPU          cpu,
+    double*             seconds
+    )
+{
+    BENCH_RUN run;
+    PBENCH_HANDLE handles = NULL;
+    PBENCH_WORKER allWorkers = NULL;
+    ECHO_POOL_CONFIG config;
+    BENCH_OP_STATS interval[EchoOpCount];
+    PBENCH_STEADY steady = NULL;
+    ECHO_STEADY_CONFIG steadyConfig;
+    ECHO_CPU_COUNTER counter;
+    ECHO_CPU_SAMPLE sample;
+    ULONGLONG warmupOps = 0;
+    ULONG workerCount = options->Threads * (workers + 1);
+    ULONGLONG lastIssued = 0;
+    ULONGLONG start, end, last, next, now;
+    std::thread replayer;
+    char label[16];
+    ULONG i;
+    ULONG op;
+    BOOLEAN result = TRUE;
+
+    run.Options = options;
+    run.Workers = workers;
+    run.Stop = FALSE;
+    run.Replay = replay;
+    run.Replayed = FALSE;
+    run.Affinity.Mode = EchoAffinityNone;
+    run.Affinity.Count = 0;
+
+    //
+    // Checked when the options were parsed; a spec that fails now pins nothing
+    // ѡʱѼ飻ʱʧ̶ܵκ߳
+    //
+    if (options->Affinity != NULL && !EchoAffinityParse(options->Affinity, &run.Affinity)) {
+        run.Affinity.Mode = EchoAffinityNone;
+    }
+
+    for (op = 0; op < EchoOpCount; op++) {
+        BenchResetStats(&total[op]);
+    }
+    ZeroMemory(verify, sizeof(*verify));
+    ZeroMemory(pacing, sizeof(*pacing));
+
+    //
+    // Opened before any thread of the run starts, so that the process
+    // cycles cover them, and read after the engines are closed, so that
+    // the device threads have added themselves to the host account
+    // еκ֮߳ǰ򿪣ʹǣر֮ȡ
+    // ʹ豸߳ѽԼ˻
+    //
+    if (cpu != NULL) {
+        ZeroMemory(cpu, sizeof(*cpu));
+        EchoCpuOpen(&counter, FALSE);
+        EchoCpuRead(&counter, &cpu->Process);
+        EchoCpuHostRead(&cpu->Host);
+    }
+
+    handles = new BENCH_HANDLE[options->Threads]();
+    allWorkers = new BENCH_WORKER[workerCount]();
+
+    if (options->Steady != 0) {
+        steady = new BENCH_STEADY();
+        steadyConfig.MaxRateCv = BENCH_STEADY_CV;
+        steadyConfig.MaxLatencyCv = BENCH_STEADY_CV;
+        steadyConfig.RelativeError = options->Steady / 100;
+        EchoSteadyInit(&steady->Detector, &steadyConfig);
+        for (op = 0; op < EchoOpCount; op++) {
+            BenchResetStats(&steady->Sample[op]);
+            BenchResetStats(&steady->Warmup[op]);
+            BenchResetStats(&steady->Pending[op]);
+        }
+    }
+
+    for (i = 0; i < workerCount; i++) {
+        allWorkers[i].Rng = 0x9E3779B97F4A7C15ULL * (i + 1);
+        for (op = 0; op < EchoOpCount; op++) {
+            BenchResetStats(&allWorkers[i].Interval[op]);
+        }
+    }
+
+    for (i = 0; i < options->Threads; i++) {
+        handles[i].Run = &run;
+        handles[i].Index = i;
+        handles[i].Workers = &allWorkers[i * (workers + 1)];
+        for (op = 0; op < EchoOpCount; op++) {
+            BenchResetStats(&handles[i].Total[op]);
+        }
+        handles[i].Engine = open(context, i);
+        if (handles[i].Engine == NULL) {
+            result = FALSE;
+            goto Cleanup;
+        }
+
+        if (options->Verify) {
+            handles[i].Ledger = EchoLedgerCreate(i, options->QueueDepth);
+            handles[i].VerifyOps = new ECHO_VERIFY_OP[options->QueueDepth]();
+            if (handles[i].Ledger == NULL) {
+                result = FALSE;
+                goto Cleanup;
+            }
+        }
+    }
+
+    if (report) {
+        if (replay != NULL) {
+            const ECHO_TRACE_HEADER* header = EchoTraceHeader(replay);
+
+            LOG("Replay on %s: %llu operations over %.1f seconds at %.2fx speed, %d threads with %d workers "
+                "each, queue depth %d, up to %d bytes, latency from the recorded time\n",
+                handles[0].Engine->Name(), header->Records, header->DurationNs / 1e9, options->Speed,
+                options->Threads, workers, options->QueueDepth, options->BlockSize);
+        }
+        else {
+            LOG("Benchmark on %s: %d threads with %d workers each, queue depth %d, %d bytes, %d%% reads, %d seconds\n",
+                handles[0].Engine->Name(), options->Threads, workers, options->QueueDepth,
+                options->BlockSize, options->ReadPercent, options->DurationSec);
+        }
+        if (options->Devices > 1) {
+            LOG("Threads spread over %d devices, thread i on device i %% %d\n",
+                options->Devices, options->Devices);
+        }
+        if (options->Rate != 0) {
+            LOG("Open loop: %d requests a second on a %s schedule, latency from the scheduled time\n",
+                options->Rate, EchoPacerName(options->Arrival));
+        }
+        if (options->TargetUs != 0) {
+            LOG("Adaptive depth: %s, up to %d per thread, p99 target %d us\n",
+                EchoDepthName(options->Control), options->QueueDepth, options->TargetUs);
+        }
+        if (run.Affinity.Mode != EchoAffinityNone) {
+            LOG("Workers pinned %s over %d processor set%s in turn, I/O buffers on each worker's NUMA node\n",
+                EchoAffinityName(run.Affinity.Mode), run.Affinity.Count, (run.Affinity.Count == 1) ? "" : "s");
+        }
+        if (steady != NULL) {
+            LOG("Steady state: warmup discarded, then until the means are known within +-%g%%, "
+                "at most %d seconds\n", options->Steady, options->DurationSec);
+        }
+        if (options->IntervalSec != 0) {
+            BenchPrintHeader();
+        }
+    }
+
+    start = EchoNowNs();
+    end = (options->DurationSec == BENCH_WHOLE_TRACE) ? ~0ULL : start + (ULONGLONG)options->DurationSec * 1000000000;
+    last = start;
+
+    if (steady != NULL) {
+        steady->LastNs = start;
+    }
+
+    for (i = 0; i < options->Threads; i++) {
+        config.Engine = handles[i].Engine;
+        config.Workers = workers;
+        config.Slots = options->QueueDepth;
+        config.BlockSize = options->BlockSize;
+        config.Prepare = BenchPrepare;
+        config.Complete = BenchComplete;
+        config.Context = &handles[i];
+        config.Stop = &run.Stop;
+        config.Rate = (double)options->Rate / options->Threads;
+        config.Arrival = options->Arrival;
+        config.Seed = i + 1;
+        config.External = (replay != NULL);
+        config.Trace = trace;
+        config.TraceHandle = i;
+        config.Depth = NULL;
+        config.Affinity = &run.Affinity;
+        config.AffinityBase = i * (workers + 1);
+
+        if (options->TargetUs != 0) {
+            ECHO_DEPTH_CONFIG depth;
+
+            depth.Rule = options->Control;
+            depth.MinDepth = 1;
+            depth.MaxDepth = options->QueueDepth;
+            depth.InitialDepth = 1;
+            depth.TargetNs = (ULONGLONG)options->TargetUs * 1000;
+            EchoDepthInit(&handles[i].Depth, &depth);
+            config.Depth = &handles[i].Depth;
+        }
+
+        handles[i].Pool = EchoPoolStart(&config);
+        if (handles[i].Pool == NULL) {
+            run.Stop = TRUE;
+            result = FALSE;
+            break;
+        }
+    }
+
+    if (replay != NULL && !run.Stop) {
+        replayer = std::thread(BenchReplay, handles, options->Threads, start);
+    }
+
+    while (!run.Stop) {
+
+        next = (report && options->IntervalSec != 0) ? last + (ULONGLONG)options->IntervalSec * 1000000000 : end;
+        if (steady != NULL && steady->LastNs + (ULONGLONG)ECHO_STEADY_SAMPLE_MS * 1000000 < next) {
+            next = steady->LastNs + (ULONGLONG)ECHO_STEADY_SAMPLE_MS * 1000000;
+        }
+        if (next > end) {
+            next = end;
+        }
+
+        now = EchoNowNs();
+
+        //
+        // A replay ends once the whole trace has been sent
+        // ٶѷʱطŽ
+        //
+        if (run.Replayed && BenchReplayDrained(handles, options->Threads)) {
+            end = now;
+            next = now;
+        }
+
+        if (now < next) {
+            EchoSleepMs((next - now > (ULONGLONG)BENCH_POLL_MS * 1000000) ?
+                        BENCH_POLL_MS : (ULONG)((next - now + 999999) / 1000000));
+            continue;
+        }
+
+        //
+        // Stop before reporting so the report does not stretch the run
+        // ڱ֮ǰֹͣʹ治ӳʱ
+        //
+        if (now >= end) {
+            run.Stop = TRUE;
+            end = now;
+        }
+
+        //
+        // A steady-state run ends as soon as its means are known well enough
+        // ֵ̬㹻ȷʱ
+        //
+        if (steady != NULL && (run.Stop || now >= steady->LastNs + (ULONGLONG)ECHO_STEADY_SAMPLE_MS * 1000000)) {
+            BOOLEAN settled = (steady->SteadyNs != 0);
+
+            if (BenchSteadySample(steady, handles, options->Threads, workers + 1, total, now)) {
+                run.Stop = TRUE;
+                end = now;
+            }
+            if (report && !settled && steady->SteadyNs != 0) {
+                LOG("%7.1fs steady state, warmup discarded\n", (now - start) / 1e9);
+            }
+        }
+
+        if (report && options->IntervalSec != 0 &&
+            (run.Stop || now >= last + (ULONGLONG)options->IntervalSec * 1000000000)) {
+
+            //
+            // The samples already took the workers' counts
+            // Ѿȡ˹̵߳ļ
+            //
+            if (steady != NULL) {
+                for (op = 0; op < EchoOpCount; op++) {
+                    interval[op] = steady->Pending[op];
+                    BenchResetStats(&steady->Pending[op]);
+                }
+            }
+            else {
+                BenchCollect(handles, options->Threads, workers + 1, interval);
+            }
+            snprintf(label, sizeof(label), "%.1fs", (now - start) / 1e9);
+
+            for (op = 0; op < EchoOpCount; op++) {
+                if (steady == NULL) {
+                    BenchMerge(&total[op], &interval[op]);
+                }
+                if (interval[op].Ops != 0) {
+                    BenchPrintLine(label, (ECHO_OP)op, &interval[op], (now - last) / 1e9);
+                }
+            }
+
+            if (options->Rate != 0 || replay != NULL) {
+                BenchPacing(handles, options->Threads, pacing);
+                BenchPrintPacing(label, options, pacing, pacing->Issued - lastIssued, (now - last) / 1e9);
+                lastIssued = pacing->Issued;
+            }
+
+            last = now;
+        }
+    }
+
+    run.Stop = TRUE;
+
+    if (replayer.joinable()) {
+        replayer.join();
+    }
+
+    //
+    // Arrivals still waiting when the run stops are never sent
+    // ֹͣʱڵȴĵﲻٷ
+    //
+    BenchPacing(handles, options->Threads, pacing);
+
+    for (i = 0; i < options->Threads; i++) {
+        if (handles[i].Pool != NULL) {
+            result = EchoPoolWait(handles[i].Pool) && result;
+        }
+    }
+
+    if (report && options->TargetUs != 0) {
+        BenchPrintDepth(handles, options->Threads);
+    }
+
+    //
+    // Operations still in flight at the end are counted but the time spent
+    // draining them is not, so the rates cover the measured duration
+    // ʱ;Ĳͳƣſǵʱ䲻룬ʶӦõʱ
+    //
+    BenchCollect(handles, options->Threads, workers + 1, interval);
+
+    //
+    // A run that never settled keeps its warmup, so it still has totals
+    // δȶбԤȣʹܼ
+    //
+    if (steady != NULL) {
+        if (report) {
+            BenchPrintSteady(steady, options, start, end);
+        }
+        for (op = 0; op < EchoOpCount; op++) {
+            if (steady->Warmup[op].Errors != 0) {
+                result = FALSE;
+            }
+            if (steady->SteadyNs == 0) {
+                BenchMerge(&total[op], &steady->Warmup[op]);
+            }
+            else {
+                warmupOps += steady->Warmup[op].Ops;
+            }
+        }
+    }
+
+    for (op = 0; op < EchoOpCount; op++) {
+        BenchMerge(&total[op], &interval[op]);
+        if (total[op].Errors != 0) {
+            result = FALSE;
+        }
+    }
+
+    if (deviceTotal != NULL) {
+        for (i = 0; i < options->Devices * EchoOpCount; i++) {
+            BenchResetStats(&deviceTotal[i]);
+        }
+        for (i = 0; i < options->Threads; i++) {
+            for (op = 0; op < EchoOpCount; op++) {
+                BenchMerge(&deviceTotal[(i % options->Devices) * EchoOpCount + op], &handles[i].Total[op]);
+            }
+        }
+    }
+
+    for (i = 0; i < workerCount; i++) {
+        EchoVerifyAddCounts(verify, &allWorkers[i].Verify);
+    }
+    if (EchoVerifyFailures(verify) != 0) {
+        result = FALSE;
+    }
+
+    *seconds = (end - ((steady != NULL && steady->SteadyNs != 0) ? steady->SteadyNs : start)) / 1e9;
+
+Cleanup:
+
+    for (i = 0; i < options->Threads; i++) {
+        delete handles[i].Engine;
+        EchoLedgerDelete(handles[i].Ledger);
+        delete[] handles[i].VerifyOps;
+    }
+    delete[] handles;
+    delete[] allWorkers;
+    delete steady;
+
+    if (cpu != NULL) {
+        EchoCpuRead(&counter, &sample);
+        EchoCpuSubtract(&sample, &cpu->Process);
+        cpu->Process = sample;
+        EchoCpuClose(&counter);
+
+        EchoCpuHostRead(&sample);
+        EchoCpuSubtract(&sample, &cpu->Host);
+        cpu->Host = sample;
+
+        cpu->Ops = warmupOps;
+        for (op = 0; op < EchoOpCount; op++) {
+            cpu->Ops += total[op].Ops;
+        }
+    }
+
+    return result;
+}
+
+//
+// Ƚ124...ScaleWorkers߳µӳ٣Affinityʱÿһ
+// Ȳ̶ٹ̶һ
+//
+static BOOLEAN BenchScale(
+    IN PECHO_BENCH_OPTIONS options,
+    IN ECHO_ENGINE_OPEN*   open,
+    IN PVOID               context,
+    IN PECHO_TRACE_WRITER  trace
+    )
+{
+    BENCH_OP_STATS total[EchoOpCount];
+    BENCH_OP_STATS all;
+    ECHO_BENCH_OPTIONS unpinned = *options;
+    ECHO_VERIFY_COUNTS verify;
+    ECHO_VERIFY_COUNTS allVerify = {};
+    ECHO_POOL_PACING pacing;
+    BOOLEAN compare = (options->Affinity != NULL);
+    double unpinnedRate = 0;
+    double seconds = 0;
+    double rate;
+    char gain[16];
+    ULONG workers;
+    ULONG pass;
+    ULONG op;
+    BOOLEAN result = TRUE;
+
+    unpinned.Affinity = NULL;
+
+    LOG("Scaling %d threads, queue depth %d, %d bytes, %d%% reads, %d seconds per step\n",
+        options->Threads, options->QueueDepth, options->BlockSize,
+        options->ReadPercent, options->DurationSec);
+
+    if (compare) {
+        LOG("Every step unpinned, then pinned by -affinity %s\n", options->Affinity);
+        LOG("%8s %9s %11s %9s %9s %9s %7s %8s\n",
+            "workers", "placement", "IOPS", "MB/s", "p50(us)", "p99(us)", "errors", "IOPS +/-");
+    }
+    else {
+        LOG("%8s %11s %9s %9s %9s %7s\n", "workers", "IOPS", "MB/s", "p50(us)", "p99(us)", "errors");
+    }
+
+    for (workers = 1; workers <= options->ScaleWorkers && result; workers *= 2) {
+
+        //
+        // The unpinned run goes first, so that a pinned run never starts on
+        // caches the other placement warmed
+        // в̶һΣʹ̶вһַԤȹĻ濪ʼ
+        //
+        for (pass = compare ? 0 : 1; pass < 2 && result; pass++) {
+
+            result = BenchRunOnce((pass == 0) ? &unpinned : options, workers, FALSE, open, context, NULL, trace,
+                                  total, NULL, &verify, &pacing, NULL, &seconds);
+            EchoVerifyAddCounts(&allVerify, &verify);
+
+            BenchResetStats(&all);
+
+            for (op = 0; op < EchoOpCount; op++) {
+                BenchMerge(&all, &total[op]);
+            }
+
+            rate = all.Ops / seconds;
+
+            if (!compare) {
+                LOG("%8d %11.1f %9.2f %9.1f %9.1f %7llu\n",
+                    workers,
+                    rate,
+                    all.Bytes / seconds / (1024 * 1024),
+                    EchoHistPercentile(&all.LatencyNs, 50) / 1000.0,
+                    EchoHistPercentile(&all.LatencyNs, 99) / 1000.0,
+                    all.Errors);
+                continue;
+            }
+
+            gain[0] = '\0';
+            if (pass == 0) {
+                unpinnedRate = rate;
+            }
+            else if (unpinnedRate > 0) {
+                snprintf(gain, sizeof(gain), "%+.1f%%", (rate / unpinnedRate - 1) * 100);
+            }
+
+            LOG("%8d %9s %11.1f %9.2f %9.1f %9.1f %7llu %8s\n",
+                workers,
+                (pass == 0) ? "unpinned" : "pinned",
+                rate,
+                all.Bytes / seconds / (1024 * 1024),
+                EchoHistPercentile(&all.LatencyNs, 50) / 1000.0,
+                EchoHistPercentile(&all.LatencyNs, 99) / 1000.0,
+                all.Errors,
+                gain);
+        }
+    }
+
+    if (options->Verify) {
+        BenchPrintVerify(&allVerify);
+    }
+
+    EchoArenaReport();
+
+    return result;
+}
+
+//
+// Ҫطŵĸٲѡÿеľһ̣߳
+// Ĳ
+//
+static PECHO_TRACE_READER BenchOpenReplay(PECHO_BENCH_OPTIONS options)
+{
+    PECHO_TRACE_READER replay;
+    const ECHO_TRACE_HEADER* header;
+
+    replay = EchoTraceOpen(options->ReplayPath);
+    if (replay == NULL) {
+        return NULL;
+    }
+
+    header = EchoTraceHeader(replay);
+    if (header->Records == 0) {
+        LOG("%s holds no operations\n", options->ReplayPath);
+        EchoTraceDelete(replay);
+        return NULL;
+    }
+
+    options->Threads = (header->Handles < BENCH_MAX_THREADS) ? header->Handles : BENCH_MAX_THREADS;
+    options->BlockSize = (header->MaxLength != 0) ? header->MaxLength : 1;
+    if (header->Handles > BENCH_MAX_THREADS) {
+        LOG("Replaying %d traced handles on %d threads\n", header->Handles, BENCH_MAX_THREADS);
+    }
+
+    return replay;
+}
+
+BOOLEAN EchoBenchRun(
+    IN PECHO_BENCH_OPTIONS options,
+    IN ECHO_ENGINE_OPEN*   open,
+    IN PVOID               context
+    )
+{
+    BENCH_OP_STATS total[EchoOpCount];
+    PBENCH_OP_STATS deviceTotal = NULL;
+    PECHO_TRACE_READER replay = NULL;
+    PECHO_TRACE_WRITER trace = NULL;
+    ECHO_VERIFY_COUNTS verify;
+    ECHO_POOL_PACING pacing;
+    BENCH_CPU cpu;
+    double seconds = 0;
+    char label[16];
+    ULONG device;
+    ULONG op;
+    BOOLEAN result;
+
+    if (options->ReplayPath != NULL) {
+        replay = BenchOpenReplay(options);
+        if (replay == NULL) {
+            return FALSE;
+        }
+    }
+
+    if (options->RecordPath != NULL) {
+        trace = EchoTraceCreate(options->RecordPath);
+        if (trace == NULL) {
+            EchoTraceDelete(replay);
+            return FALSE;
+        }
+    }
+
+    if (options->Verify) {
+        EchoVerifyMeasureCost(options->BlockSize);
+    }
+
+    EchoArenaUseLargePages(options->LargePages != 0);
+
+    if (options->ScaleWorkers != 0) {
+        result = BenchScale(options, open, context, trace);
+        if (trace != NULL) {
+            result = EchoTraceClose(trace) && result;
+        }
+        return result;
+    }
+
+    if (options->Devices > 1) {
+        deviceTotal = new BENCH_OP_STATS[options->Devices * EchoOpCount];
+    }
+
+    result = BenchRunOnce(options, options->Workers, TRUE, open, context, replay, trace,
+                          total, deviceTotal, &verify, &pacing, &cpu, &seconds);
+
+    if (trace != NULL) {
+        result = EchoTraceClose(trace) && result;
+    }
+    EchoTraceDelete(replay);
+
+    if (seconds != 0) {
+        if (options->IntervalSec != 0) {
+            LOG("\n");
+        }
+        BenchPrintHeader();
+
+        //
+        // Each device's share first, then the aggregate
+        // ȴӡ豸Ĳ֣ٴӡܼ
+        //
+        for (device = 0; deviceTotal != NULL && device < options->Devices; device++) {
+            snprintf(label, sizeof(label), "dev%d", device);
+            for (op = 0; op < EchoOpCount; op++) {
+                if (deviceTotal[device * EchoOpCount + op].Ops != 0) {
+                    BenchPrintLine(label, (ECHO_OP)op, &deviceTotal[device * EchoOpCount + op], seconds);
+                }
+            }
+        }
+
+        for (op = 0; op < EchoOpCount; op++) {
+            if (total[op].Ops != 0) {
+                BenchPrintLine("total", (ECHO_OP)op, &total[op], seconds);
+            }
+        }
+
+        if (options->Rate != 0 || options->ReplayPath != NULL) {
+            BenchPrintPacing("total", options, &pacing, pacing.Issued, seconds);
+        }
+
+        if (options->Verify) {
+            BenchPrintVerify(&verify);
+        }
+
+        BenchPrintCpu(&cpu);
+
+        EchoArenaReport();
+
+        result = BenchExport(options, total) && result;
+    }
+
+    delete[] deviceTotal;
+
+    return result;
+}
+
+BOOLEAN EchoBenchMeasure(
+    IN  PECHO_BENCH_OPTIONS options,
+    IN  ECHO_ENGINE_OPEN*   open,
+    IN  PVOID               context,
+    OUT PECHO_BENCH_RESULT  result
+    )
+{
+    BENCH_OP_STATS total[EchoOpCount];
+    BENCH_OP_STATS all;
+    ECHO_VERIFY_COUNTS verify;
+    ECHO_POOL_PACING pacing;
+    double seconds = 0;
+    ULONG op;
+    BOOLEAN succeeded;
+
+    ZeroMemory(result, sizeof(*result));
+
+    succeeded = BenchRunOnce(options, options->Workers, FALSE, open, context, NULL, NULL,
+                             total, NULL, &verify, &pacing, NULL, &seconds);
+
+    BenchResetStats(&all);
+    for (op = 0; op < EchoOpCount; op++) {
+        BenchMerge(&all, &total[op]);
+    }
+
+    if (seconds != 0) {
+        result->OpsPerSec = all.Ops / seconds;
+        result->MBPerSec = all.Bytes / seconds / (1024 * 1024);
+    }
+    result->P50Us = EchoHistPercentile(&all.LatencyNs, 50) / 1000.0;
+    result->P99Us = EchoHistPercentile(&all.LatencyNs, 99) / 1000.0;
+    result->P999Us = EchoHistPercentile(&all.LatencyNs, 99.9) / 1000.0;
+    result->Errors = all.Errors + EchoVerifyFailures(&verify);
+
+    return succeeded && seconds != 0;
+}
+
+ULONG EchoBenchSelectEngines(
+    IN  PCSTR                    list,
+    IN  const ECHO_BENCH_ENGINE* engines,
+    IN  ULONG                    count,
+    OUT PECHO_BENCH_ENGINE       selected
+    )
+{
+    char name[BENCH_ENGINE_NAME];
+    PCSTR comma;
+    size_t length;
+    ULONG chosen = 0;
+    ULONG i;
+
+    if (!_stricmp(list, "all")) {
+        for (i = 0; i < count && i < ECHO_BENCH_MAX_ENGINES; i++) {
+            selected[chosen++] = engines[i];
+        }
+        return chosen;
+    }
+
+    while (*list != '\0') {
+
+        comma = strchr(list, ',');
+        length = (comma != NULL) ? (size_t)(comma - list) : strlen(list);
+
+        if (length == 0 || length >= sizeof(name)) {
+            LOG("Bad engine list\n");
+            return 0;
+        }
+
+        memcpy(name, list, length);
+        name[length] = '\0';
+
+        for (i = 0; i < count && _stricmp(engines[i].Name, name); i++) {
+        }
+
+        if (i == count) {
+            LOG("Unknown engine %s\n", name);
+            return 0;
+        }
+        if (chosen == ECHO_BENCH_MAX_ENGINES) {
+            LOG("At most %d engines can be compared\n", ECHO_BENCH_MAX_ENGINES);
+            return 0;
+        }
+
+        selected[chosen++] = engines[i];
+        list += length + ((comma != NULL) ? 1 : 0);
+    }
+
+    return chosen;
+}
+
+BOOLEAN EchoBenchCompare(
+    IN PECHO_BENCH_OPTIONS      options,
+    IN const ECHO_BENCH_ENGINE* engines,
+    IN ULONG                    count
+    )
+{
+    BENCH_OP_STATS total[ECHO_BENCH_MAX_ENGINES][EchoOpCount];
+    BENCH_OP_STATS all;
+    ECHO_VERIFY_COUNTS verify;
+    ECHO_VERIFY_COUNTS allVerify = {};
+    ECHO_POOL_PACING pacing;
+    ECHO_HIST_NAMED named[ECHO_BENCH_MAX_ENGINES * EchoOpCount];
+    char names[ECHO_BENCH_MAX_ENGINES * EchoOpCount][BENCH_ENGINE_NAME + 8];
+    PECHO_TRACE_READER replay = NULL;
+    BENCH_CPU cpu;
+    ECHO_CPU_SAMPLE client;
+    ECHO_CPU_SAMPLE host;
+    char cycles[2][24];
+    double seconds = 0;
+    ULONG histograms = 0;
+    ULONG engine;
+    ULONG op;
+    BOOLEAN result = TRUE;
+
+    if (count > ECHO_BENCH_MAX_ENGINES || options->ScaleWorkers != 0 || options->RecordPath != NULL) {
+        LOG("Compare up to %d engines; -scale and -record take a single engine\n", ECHO_BENCH_MAX_ENGINES);
+        return FALSE;
+    }
+
+    if (options->Verify) {
+        EchoVerifyMeasureCost(options->BlockSize);
+    }
+
+    EchoArenaUseLargePages(options->LargePages != 0);
+
+    //
+    // Every engine runs the same workload. CPU time is split between the
+    // client and the device threads of a stand-in; a stand-in that serves
+    // on the client's threads counts as client
+    // ÿͬĸءCPUʱΪͻ˺豸֣߳ڿͻ
+    // ߳ϴΪͻ
+    //
+    if (options->ReplayPath != NULL) {
+        LOG("Comparing %d engines replaying %s at %.2fx speed, CPU per operation of the client "
+            "and of the stand-in's device threads\n",
+            count, options->ReplayPath, options->Speed);
+    }
+    else {
+        LOG("Comparing %d engines: %d threads with %d workers each, queue depth %d, %d bytes, "
+            "%d%% reads, %d seconds each, CPU per operation of the client and of the stand-in's "
+            "device threads\n",
+            count, options->Threads, options->Workers, options->QueueDepth, options->BlockSize,
+            options->ReadPercent, options->DurationSec);
+    }
+    LOG("%-12s %11s %9s %9s %9s %9s %8s %8s %10s %10s %7s\n",
+        "engine", "IOPS", "MB/s", "p50(us)", "p99(us)", "p99.9(us)", "client", "host",
+        "client", "host", "errors");
+    LOG("%-12s %11s %9s %9s %9s %9s %8s %8s %10s %10s %7s\n",
+        "", "", "", "", "", "", "(us/op)", "(us/op)", "(cyc/op)", "(cyc/op)", "");
+
+    for (engine = 0; engine < count; engine++) {
+
+        //
+        // Each replay starts the trace from its first record
+        // ÿλطŶӸٵĵһ¼ʼ
+        //
+        if (options->ReplayPath != NULL) {
+            replay = BenchOpenReplay(options);
+            if (replay == NULL) {
+                result = FALSE;
+                break;
+            }
+        }
+
+        result = BenchRunOnce(options, options->Workers, FALSE, engines[engine].Open, engines[engine].Context,
+                              replay, NULL, total[engine], NULL, &verify, &pacing, &cpu, &seconds) && result;
+
+        EchoTraceDelete(replay);
+        replay = NULL;
+
+        EchoVerifyAddCounts(&allVerify, &verify);
+        BenchResetStats(&all);
+
+        for (op = 0; op < EchoOpCount; op++) {
+            BenchMerge(&all, &total[engine][op]);
+
+            if (total[engine][op].Ops != 0) {
+                snprintf(names[histograms], sizeof(names[histograms]), "%s %s",
+                         engines[engine].Name, BenchOpNames[op]);
+                named[histograms].Name = names[histograms];
+                named[histograms].Histogram = &total[engine][op].LatencyNs;
+                histograms++;
+            }
+        }
+
+        //
+        // The CPU covers the warmup too, so it is divided by cpu.Ops
+        // CPUҲԤȣ˳cpu.Ops
+        //
+        BenchCpuSplit(&cpu, &client, &host);
+        if (cpu.Ops == 0) {
+            cpu.Ops = 1;
+        }
+        snprintf(cycles[0], sizeof(cycles[0]), "n/a");
+        snprintf(cycles[1], sizeof(cycles[1]), "n/a");
+        if ((client.Valid & ECHO_CPU_CYCLES) != 0) {
+            snprintf(cycles[0], sizeof(cycles[0]), "%.0f", (double)client.Cycles / cpu.Ops);
+        }
+        if ((host.Valid & ECHO_CPU_CYCLES) != 0) {
+            snprintf(cycles[1], sizeof(cycles[1]), "%.0f", (double)host.Cycles / cpu.Ops);
+        }
+
+        LOG("%-12s %11.1f %9.2f %9.1f %9.1f %9.1f %8.2f %8.2f %10s %10s %7llu\n",
+            engines[engine].Name,
+            (seconds != 0) ? all.Ops / seconds : 0,
+            (seconds != 0) ? all.Bytes / seconds / (1024 * 1024) : 0,
+            EchoHistPercentile(&all.LatencyNs, 50) / 1000.0,
+            EchoHistPercentile(&all.LatencyNs, 99) / 1000.0,
+            EchoHistPercentile(&all.LatencyNs, 99.9) / 1000.0,
+            (client.UserNs + client.KernelNs) / 1000.0 / cpu.Ops,
+            (host.UserNs + host.KernelNs) / 1000.0 / cpu.Ops,
+            cycles[0], cycles[1],
+            all.Errors);
+    }
+
+    if (options->Verify) {
+        BenchPrintVerify(&allVerify);
+    }
+
+    EchoArenaReport();
+
+    if (options->JsonPath != NULL) {
+        result = EchoHistExport(options->JsonPath, EchoHistJson, named, histograms) && result;
+    }
+    if (options->CsvPath != NULL) {
+        result = EchoHistExport(options->CsvPath, EchoHistCsv, named, histograms) && result;
+    }
+
+    return result;
+}
@@ -0,0 +1,195 @@
+/*++
+
+Module Name:
+
+    echobench.h
+
+Abstract:
+
+    Load generator. Each thread keeps QueueDepth operations in flight on
+    its own engine, picking reads or writes by the configured mix, and a
+    pool of Workers threads shares the engine's completions. The run
+    reports IOPS, MB/s and latency percentiles per operation type at every
+    interval and at the end. I/O buffers come from the shared buffer arena
+    (see echoarena.h), whose allocation counts and memory are reported at
+    the end.
+    ÿ߳ԼϱQueueDepth;õı
+    ѡдWorkers߳ɵ̳߳عɡڼÿ
+    ʱͱIOPSMB/sӳٰٷλI/OԹ
+    echoarena.hнʱڴ档
+
+    With Verify set, every write carries a sequence-tagged payload and
+    every read is checked against the ledger of its thread (see
+    echoverify.h).
+    VerifyʱÿдЯкŵĸأÿζȡ̵߳˱
+    У飨echoverify.h
+
+    With a Rate the load is open-loop: requests arrive on a fixed or
+    Poisson schedule and QueueDepth only caps how many are in flight.
+    Latency runs from each request's scheduled time, so time spent waiting
+    for a slot counts (see echopace.h).
+    RateʱΪ󰴾ȻʱQueueDepthֻ;
+    ӳٴÿļƻʱ俪ʼ㣬˵ȴв۵ʱҲ
+    echopace.h
+
+    A run can be recorded as a trace of every operation issued. A trace
+    can be replayed in place of the mix, each operation sent at its
+    recorded time scaled by Speed, open-loop like a Rate run (see
+    echotrace.h).
+    пԼ¼Ϊÿѷĸ١ٿԴдطţÿ
+    ¼ʱ䣨SpeedţRateһΪ
+    echotrace.h
+
+    The same workload can run on several engines in turn, with one line of
+    throughput, latency and CPU time per operation for each.
+    ͬһؿڶУÿһӳٺÿ
+    CPUʱ䡣
+
+    With a Target, each thread's queue depth adapts to keep the p99 of its
+    completions under it, up to QueueDepth (see echodepth.h).
+    Targetʱÿ̵߳ĶԶʹɵp99Ŀ֮ڣ
+    ΪQueueDepthechodepth.h
+
+    With Steady, the warmup is detected and left out of the results. The
+    run ends once its mean throughput and latency are known to within
+    Steady percent, or when DurationSec runs out (see echosteady.h).
+    SteadyʱԤȲųڽ֮⡣ƽӳٵ
+    ȴﵽSteadyٷֱȻDurationSecʱechosteady.h
+
+    With an Affinity, the workers are pinned to processors and their
+    buffers are placed on their NUMA nodes. A scaling run compares every
+    step unpinned and pinned (see echoaffinity.h).
+    Affinityʱ̶̱߳ϣ仺NUMAڵϡ
+    չжÿһֱȽϲ̶͹̶Ľechoaffinity.h
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#pragma once
+
+#include "echodepth.h"
+#include "echoengine.h"
+#include "echopace.h"
+#include "echosteady.h"
+
+#define ECHO_BENCH_MAX_ENGINES  8
+
+typedef struct _ECHO_BENCH_OPTIONS {
+    ULONG Threads;
+    ULONG QueueDepth;       // operations in flight per thread
+    ULONG BlockSize;        // bytes per operation
+    ULONG ReadPercent;      // 0 writes only, 100 reads only
+    ULONG DurationSec;
+    ULONG IntervalSec;      // 0 reports only at the end
+    ULONG Workers;          // threads sharing each handle's completions
+    ULONG ScaleWorkers;     // nonzero compares 1, 2, 4 ... ScaleWorkers workers
+    ULONG TraceEvery;       // prints every n-th completion, 0 for none
+    ULONG Verify;           // nonzero tags every write and checks every read
+    ULONG LargePages;       // nonzero backs the I/O buffers with large pages
+    ULONG Rate;             // open-loop requests a second over all threads, 0 for a closed loop
+    ECHO_ARRIVAL Arrival;
+    ULONG TargetUs;         // p99 the queue depth adapts to, 0 for a fixed depth; QueueDepth is then the most
+    ECHO_DEPTH_RULE Control;
+    double Steady;          // percent the steady-state means must be known to, DurationSec
+                            // being the budget; 0 runs DurationSec and keeps the warmup
+    ULONG Devices;          // thread i runs on device i % Devices; set by the host (1)
+    PCSTR JsonPath;         // latency histograms of the run, NULL for none
+    PCSTR CsvPath;
+    PCSTR RecordPath;       // trace of every operation issued, NULL for none
+    PCSTR Affinity;         // placement of the workers as for EchoAffinityParse, NULL to leave it to the system
+    PCSTR ReplayPath;       // trace replayed instead of the mix, NULL for none
+    double Speed;           // of the replay, 2 for twice the recorded rate (1)
+} ECHO_BENCH_OPTIONS, *PECHO_BENCH_OPTIONS;
+
+VOID EchoBenchDefaultOptions(OUT PECHO_BENCH_OPTIONS options);
+
+//
+// Parses "-name value" pairs into options. Returns FALSE on an unknown
+// name or a bad value.
+// "-name value"ԽoptionsСδֵ֪ЧʱFALSE
+//
+BOOLEAN EchoBenchParseOptions(
+    IN  int   argc,
+    IN  char* argv[],
+    OUT PECHO_BENCH_OPTIONS options
+    );
+
+VOID EchoBenchUsage(VOID);
+
+//
+// Runs the benchmark, opening one engine per thread with open(context, index).
+// With more than one device the totals are also reported per device.
+// л׼ԣopen(context, index)Ϊÿ̴߳һ档ж豸ʱ
+// 豸ܼơ
+//
+BOOLEAN EchoBenchRun(
+    IN PECHO_BENCH_OPTIONS options,
+    IN ECHO_ENGINE_OPEN*   open,
+    IN PVOID               context
+    );
+
+//
+// Summary of one quiet run over all operation types
+// һξĬвϵĻ
+//
+typedef struct _ECHO_BENCH_RESULT {
+    double    OpsPerSec;
+    double    MBPerSec;
+    double    P50Us;
+    double    P99Us;
+    double    P999Us;
+    ULONGLONG Errors;           // failed operations plus verification failures
+} ECHO_BENCH_RESULT, *PECHO_BENCH_RESULT;
+
+//
+// Runs the workload of options once without reporting and summarizes it
+// in result. Returns FALSE if the run could not start or had errors.
+// һoptionsĸأдresult޷ʼ
+// дʱFALSE
+//
+BOOLEAN EchoBenchMeasure(
+    IN  PECHO_BENCH_OPTIONS options,
+    IN  ECHO_ENGINE_OPEN*   open,
+    IN  PVOID               context,
+    OUT PECHO_BENCH_RESULT  result
+    );
+
+//
+// An engine the host offers: open(context, index) opens it for thread index
+// ṩ棺open(context, index)Ϊ߳index
+//
+typedef struct _ECHO_BENCH_ENGINE {
+    PCSTR             Name;
+    ECHO_ENGINE_OPEN* Open;
+    PVOID             Context;
+} ECHO_BENCH_ENGINE, *PECHO_BENCH_ENGINE;
+
+//
+// Copies the engines named in list, comma separated or "all", into
+// selected (room for ECHO_BENCH_MAX_ENGINES). Returns how many, 0 on an
+// unknown name.
+// listԶŷָг棨"all"Ƶselected
+// ECHO_BENCH_MAX_ENGINESظƵδ֪ʱ0
+//
+ULONG EchoBenchSelectEngines(
+    IN  PCSTR                    list,
+    IN  const ECHO_BENCH_ENGINE* engines,
+    IN  ULONG                    count,
+    OUT PECHO_BENCH_ENGINE       selected
+    );
+
+//
+// Runs the workload of options on each engine in turn and prints ops/s,
+// MB/s, latency percentiles and process CPU time per operation for each
+// ÿoptionsĸأΪÿӡÿMB/s
+// ӳٰٷλԼÿĽCPUʱ
+//
+BOOLEAN EchoBenchCompare(
+    IN PECHO_BENCH_OPTIONS      options,
+    IN const ECHO_BENCH_ENGINE* engines,
+    IN ULONG                    count
+    );
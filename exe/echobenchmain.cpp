@@ -0,0 +1,302 @@
+/*++
+
+Module Name:
+
+    echobenchmain.cpp
+
+Abstract:
+
+    Entry point of the benchmark on hosts without the echo driver. It runs
+    the same load generator as "echoapp -Bench" against the loopback,
+    blocking, epoll or ring engine, compares several of them, or runs a
+    suite and checks its results against a baseline, which is how the
+    benchmark itself is exercised on Linux:
+
+        g++ -std=c++20 -O2 -pthread -I exe exe/echobenchmain.cpp
+            exe/echobench.cpp exe/echohist.cpp exe/echopool.cpp
+            exe/echoverify.cpp exe/echoarena.cpp exe/echopace.cpp
+            exe/echotrace.cpp exe/echopattern.cpp exe/echoloopback.cpp
+            exe/echoepoll.cpp exe/echoblocking.cpp exe/echoring.cpp
+            exe/echosuite.cpp exe/echoco.cpp exe/echoclient.cpp
+            exe/echodepth.cpp exe/echosteady.cpp exe/echocpu.cpp
+            exe/echoaffinity.cpp -o echobench
+
+    Only the coroutine client needs C++20; built as C++11 everything else
+    works and -coro and -cotest report it unavailable.
+
+    ûлϵĻ׼ڡԻػepoll
+    "echoapp -Bench"ͬĸȽм׼
+    ߱Ƚϣ׼ԱLinux֤ġЭ̿ͻҪ
+    -std=c++20C++11ʱ๦ճ-coro-cotestᱨ治á
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#include "echoaffinity.h"
+#include "echobench.h"
+#include "echoclient.h"
+#include "echoco.h"
+#include "echodepth.h"
+#include "echohist.h"
+#include "echopace.h"
+#include "echopattern.h"
+#include "echosteady.h"
+#include "echosuite.h"
+#include "echotrace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LOG printf
+
+//
+// Time the stand-ins take per request
+// ÿõʱ
+//
+static ULONGLONG HostServiceNs;
+
+//
+// Service time of the stand-in under the coroutine self-test, long enough
+// for its cancellation check to catch reads still queued
+// ЭԼķʱ䣬ȡŶӵĶ
+//
+#define HOST_COTEST_SERVICE_NS  1000000
+#define HOST_COTEST_CONTROL     64
+
+static EchoEngine* OpenLoopback(PVOID context, ULONG index)
+{
+    (void)context;
+    (void)index;
+
+    return EchoLoopbackEngineOpen(HostServiceNs);
+}
+
+static EchoEngine* OpenBlocking(PVOID context, ULONG index)
+{
+    (void)context;
+    (void)index;
+
+    return EchoBlockingEngineOpen(HostServiceNs);
+}
+
+static EchoEngine* OpenEpoll(PVOID context, ULONG index)
+{
+    (void)context;
+    (void)index;
+
+    return EchoEpollEngineOpen(HostServiceNs);
+}
+
+static EchoEngine* OpenRing(PVOID context, ULONG index)
+{
+    (void)context;
+    (void)index;
+
+    return EchoRingEngineOpen(HostServiceNs);
+}
+
+//
+// epollЭ̿ͻ˵Լ
+//
+static BOOLEAN CoroutineSelfTest(VOID)
+{
+    EchoEngine* engine = EchoEpollEngineOpen(HOST_COTEST_SERVICE_NS);
+    BOOLEAN result;
+
+    if (engine == NULL) {
+        return FALSE;
+    }
+
+    result = EchoCoSelfTest(engine, 0, HOST_COTEST_CONTROL);
+
+    delete engine;
+
+    return result;
+}
+
+static const ECHO_BENCH_ENGINE HostEngines[] = {
+    { "loopback", OpenLoopback, NULL },
+    { "blocking", OpenBlocking, NULL },
+    { "epoll",    OpenEpoll,    NULL },
+    { "ring",     OpenRing,     NULL },
+};
+
+int main(int argc, char* argv[])
+{
+    ECHO_BENCH_OPTIONS options;
+    ECHO_BENCH_ENGINE engines[ECHO_BENCH_MAX_ENGINES];
+    ECHO_SUITE suite;
+    PCSTR engineList = "loopback";
+    PCSTR suiteName = NULL;
+    PCSTR savePath = NULL;
+    ULONG repeat = ECHO_SUITE_REPEAT;
+    ULONG engineCount;
+    BOOLEAN coroutines = FALSE;
+    BOOLEAN client = FALSE;
+    int first = 1;
+
+    EchoBenchDefaultOptions(&options);
+
+    if (argc == 2 && !_stricmp(argv[1], "-pattern")) {
+        if (!EchoPatternSelfTest()) {
+            return 1;
+        }
+        EchoPatternMeasure();
+        return 0;
+    }
+
+    if (argc == 2 && !_stricmp(argv[1], "-hist")) {
+        return EchoHistSelfTest() ? 0 : 1;
+    }
+
+    if (argc == 2 && !_stricmp(argv[1], "-pace")) {
+        return EchoPacerSelfTest() ? 0 : 1;
+    }
+
+    if (argc == 2 && !_stricmp(argv[1], "-tracefile")) {
+        return EchoTraceSelfTest() ? 0 : 1;
+    }
+
+    if (argc == 2 && !_stricmp(argv[1], "-regress")) {
+        return EchoSuiteSelfTest() ? 0 : 1;
+    }
+
+    if (argc == 2 && !_stricmp(argv[1], "-cotest")) {
+        return CoroutineSelfTest() ? 0 : 1;
+    }
+
+    if (argc == 2 && !_stricmp(argv[1], "-clienttest")) {
+        return EchoClientSelfTest() ? 0 : 1;
+    }
+
+    if (argc == 2 && !_stricmp(argv[1], "-depthtest")) {
+        return EchoDepthSelfTest() ? 0 : 1;
+    }
+
+    if (argc == 2 && !_stricmp(argv[1], "-steadytest")) {
+        return EchoSteadySelfTest() ? 0 : 1;
+    }
+
+    //
+    // Needs no engine: the regression gate over two results files
+    // Ҫ棺ļִлعŽ
+    //
+    if ((argc == 4 || (argc == 6 && !_stricmp(argv[4], "-threshold"))) && !_stricmp(argv[1], "-compare")) {
+        return EchoSuiteCompare(argv[2], argv[3], (argc == 6) ? atof(argv[5]) : ECHO_SUITE_THRESHOLD) ? 0 : 1;
+    }
+
+    //
+    // -engine, -service, -devices, -coro, -client and the suite options are
+    // ours, the rest belong to the load generator
+    // -engine-service-devices-coro-client׼ɱ
+    // 
+    //
+    while (first < argc) {
+        if (!_stricmp(argv[first], "-coro")) {
+            coroutines = TRUE;
+            first++;
+            continue;
+        }
+        if (!_stricmp(argv[first], "-client")) {
+            client = TRUE;
+            first++;
+            continue;
+        }
+
+        if (first + 1 == argc) {
+            break;
+        }
+        else if (!_stricmp(argv[first], "-service")) {
+            HostServiceNs = strtoull(argv[first + 1], NULL, 0) * 1000;
+        }
+        else if (!_stricmp(argv[first], "-devices") && atoi(argv[first + 1]) > 0) {
+            options.Devices = atoi(argv[first + 1]);
+        }
+        else if (!_stricmp(argv[first], "-engine")) {
+            engineList = argv[first + 1];
+        }
+        else if (!_stricmp(argv[first], "-suite")) {
+            suiteName = argv[first + 1];
+        }
+        else if (!_stricmp(argv[first], "-save")) {
+            savePath = argv[first + 1];
+        }
+        else if (!_stricmp(argv[first], "-repeat")) {
+            repeat = atoi(argv[first + 1]);
+        }
+        else {
+            break;
+        }
+        first += 2;
+    }
+
+    engineCount = EchoBenchSelectEngines(engineList, HostEngines,
+                                         sizeof(HostEngines) / sizeof(HostEngines[0]), engines);
+
+    if (engineCount == 0 || !EchoBenchParseOptions(argc - first, argv + first, &options) ||
+        (suiteName != NULL && (savePath == NULL || engineCount > 1)) ||
+        ((coroutines || client) && (suiteName != NULL || engineCount > 1)) || (coroutines && client)) {
+        LOG("Usage:\n");
+        LOG("    echobench [-engine <names>] [-service <us>] [-devices <n>] [options]\n");
+        LOG("    echobench [-engine <name>] [-service <us>] -suite <name|file> -save <file>\n");
+        LOG("              [-repeat <n>] [options]\n");
+        LOG("                         run every workload of a suite n times (%d) and save the\n", ECHO_SUITE_REPEAT);
+        LOG("                         runs as a results file; suites: default, quick, or a file\n");
+        LOG("                         of lines \"<name> <options>\"; options given here apply\n");
+        LOG("                         to every workload that does not set them\n");
+        LOG("    echobench [-engine <name>] [-service <us>] -coro [options]\n");
+        LOG("                         run the workload on one thread with the load generator and\n");
+        LOG("                         with the coroutine client, and compare them\n");
+        LOG("    echobench [-engine <name>] [-service <us>] -client [options]\n");
+        LOG("                         compare synchronous, pipelined and coalesced calls of the\n");
+        LOG("                         EchoClient library\n");
+        LOG("    echobench -compare <baseline> <results> [-threshold <pct>]\n");
+        LOG("                         fail if a workload is slower with 95%% confidence by at\n");
+        LOG("                         least pct percent (%d)\n", ECHO_SUITE_THRESHOLD);
+        LOG("    echobench -pattern   cross-check and time the pattern fill and check routines\n");
+        LOG("    echobench -hist      check histogram buckets, percentiles and merging\n");
+        LOG("    echobench -pace      check the fixed and Poisson arrival schedules\n");
+        LOG("    echobench -tracefile record a trace from several threads and read it back\n");
+        LOG("    echobench -regress   check the regression gate on synthetic results files\n");
+        LOG("    echobench -cotest    check the coroutine client on the epoll stand-in\n");
+        LOG("    echobench -clienttest check the EchoClient library on the loopback stand-in\n");
+        LOG("    echobench -depthtest check the adaptive queue depth on synthetic latency curves\n");
+        LOG("    echobench -steadytest check warmup detection and the confidence intervals\n");
+        LOG("                       on synthetic runs\n");
+        LOG("        -engine <names> in-process stand-in for the device: loopback, blocking,\n");
+        LOG("                       epoll or ring; several separated by commas, or all,\n");
+        LOG("                       run the same workload on each and compare (loopback)\n");
+        LOG("        -service <us>  time the stand-in takes per request (0)\n");
+        LOG("        -devices <n>   report the threads as n devices, thread i on i %% n; each\n");
+        LOG("                       thread has its own stand-in either way (1)\n");
+        EchoBenchUsage();
+        return 1;
+    }
+
+    EchoTopologyReport();
+
+    if (coroutines) {
+        return EchoCoBench(&options, engines[0].Open, engines[0].Context) ? 0 : 1;
+    }
+
+    if (client) {
+        return EchoClientBench(&options, engines[0].Open, engines[0].Context) ? 0 : 1;
+    }
+
+    if (suiteName != NULL) {
+        if (!EchoSuiteLoad(suiteName, &suite)) {
+            return 1;
+        }
+        return EchoSuiteRun(&suite, &options, repeat, engines[0].Open, engines[0].Context, savePath) ? 0 : 1;
+    }
+
+    if (engineCount > 1) {
+        return EchoBenchCompare(&options, engines, engineCount) ? 0 : 1;
+    }
+
+    return EchoBenchRun(&options, engines[0].Open, engines[0].Context) ? 0 : 1;
+}
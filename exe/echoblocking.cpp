@@ -0,0 +1,104 @@
+/*++
+
+Module Name:
+
+    echoblocking.cpp
+
+Abstract:
+
+    Linux stand-in for the synchronous device engine. Submit services the
+    request on the calling thread and returns once it has completed, one
+    request at a time per engine like calls on a synchronous handle, so a
+    thread has one request in flight however deep the queue.
+    ͬ豸LinuxSubmitڵ߳ϴɺ󷵻أͬ
+    ϵĵһÿһδһ۶жһֻ߳
+    һ;
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#ifdef __linux__
+
+#include "echoengine.h"
+
+#include <new>
+#include <vector>
+
+class EchoBlockingEngine : public EchoEngine
+{
+public:
+    explicit EchoBlockingEngine(ULONGLONG serviceNs)
+        : m_ServiceNs(serviceNs)
+    {
+    }
+
+    PCSTR Name()
+    {
+        return "blocking";
+    }
+
+    BOOLEAN Submit(PECHO_IO io);
+
+    ULONG Reap(PECHO_IO* completed, ULONG max, ULONG timeoutMs)
+    {
+        return m_Ready.Pop(completed, max, timeoutMs);
+    }
+
+private:
+    ULONGLONG          m_ServiceNs;
+    std::mutex         m_Device;        // one request at a time
+    std::vector<UCHAR> m_Data;          // data of the last write
+    EchoReadyQueue     m_Ready;
+};
+
+//
+// ڵ߳ϴ󣬺ʱm_ServiceNsȻ󽻸Reap
+//
+BOOLEAN EchoBlockingEngine::Submit(PECHO_IO io)
+{
+    ULONGLONG done;
+    ULONGLONG now;
+    struct timespec delay;
+
+    {
+        std::lock_guard<std::mutex> lock(m_Device);
+
+        if (io->Op == EchoOpWrite) {
+            m_Data.assign(io->Buffer, io->Buffer + io->Length);
+            io->Transferred = io->Length;
+        }
+        else {
+            io->Transferred = (m_Data.size() < io->Length) ? (ULONG)m_Data.size() : io->Length;
+            if (io->Transferred != 0) {
+                memcpy(io->Buffer, &m_Data[0], io->Transferred);
+            }
+        }
+        io->Error = ERROR_SUCCESS;
+
+        //
+        // The caller blocks for the service time, holding the device
+        // ڷʱռ豸
+        //
+        done = EchoNowNs() + m_ServiceNs;
+        while (m_ServiceNs != 0 && (now = EchoNowNs()) < done) {
+            delay.tv_sec = (time_t)((done - now) / 1000000000);
+            delay.tv_nsec = (long)((done - now) % 1000000000);
+            nanosleep(&delay, NULL);
+        }
+    }
+
+    m_Ready.Push(io);
+
+    return TRUE;
+}
+
+EchoEngine* EchoBlockingEngineOpen(ULONGLONG serviceNs)
+{
+    return new (std::nothrow) EchoBlockingEngine(serviceNs);
+}
+
+#endif
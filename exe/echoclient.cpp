@@ -0,0 +1,1319 @@
+/*++
+
+Module Name:
+
+    echoclient.cpp
+
+Abstract:
+
+    Echo client library: device discovery and open, the call queue that
+    pipelines calls onto the engine and coalesces small writes, the
+    synchronous and batched calls built on it, the self-test against the
+    loopback stand-in, and the benchmark.
+    Կͻ˿⣺豸򿪡ˮʽؽ沢ϲСдĵ
+    СͬáԻػԼ죬Լ׼ԡ
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#include "echoclient.h"
+#include "echoarena.h"
+
+#ifdef _WIN32
+#include <initguid.h>
+#include <cfgmgr32.h>
+#include <strsafe.h>
+#include <winioctl.h>
+#include "public.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define LOG printf
+
+#define CLIENT_POLL_MS          10      // how often the completer looks for a close
+#define CLIENT_MAX_DEVICES      16
+
+//
+// Largest coalesced write of the benchmark, under the 40 KB the driver
+// accepts by default, and the calls it keeps outstanding per device
+// operation in flight
+// ׼ĺϲд루ĬϽܵ40 KBԼÿ;豸
+// Ӧֵδɵ
+//
+#define CLIENT_BENCH_BATCH      32768
+#define CLIENT_BENCH_FANIN      16
+
+#define CLIENT_TEST_LENGTH      4096
+#define CLIENT_TEST_PART        16
+#define CLIENT_TEST_WAIT_MS     5000
+#define CLIENT_TEST_ADAPTIVE    3000    // calls the adaptive depth settles over
+
+typedef struct _CLIENT_CALL {
+    ECHO_OP               Op;
+    PUCHAR                Buffer;
+    ULONG                 Length;
+    BOOLEAN               Coalesce;     // a write short enough to share a device write
+    ULONGLONG             Seq;
+    ULONGLONG             StartNs;
+    ECHO_CLIENT_CALLBACK* Callback;
+    PVOID                 Context;
+} CLIENT_CALL, *PCLIENT_CALL;
+
+//
+// One device operation in flight, carrying one call or a batch of writes
+// һ;豸Яһûһд
+//
+typedef struct _CLIENT_SLOT {
+    ECHO_IO     Io;
+    PUCHAR      Batch;                  // BatchBytes, NULL without coalescing
+    ULONG       Parts;
+    CLIENT_CALL Calls[ECHO_CLIENT_BATCH_PARTS];
+} CLIENT_SLOT, *PCLIENT_SLOT;
+
+struct _ECHO_CLIENT {
+    EchoEngine*               Engine;
+    ECHO_CLIENT_CONFIG        Config;
+    PCLIENT_SLOT              Slots;
+    std::mutex                Lock;
+    std::condition_variable   Wake;         // batcher: a new head call or a free slot
+    std::condition_variable   Changed;      // callers: room in the queue, a call done, idle
+    std::deque<CLIENT_CALL>   Waiting;      // in call order
+    std::vector<PCLIENT_SLOT> Free;
+    std::vector<PCLIENT_SLOT> Failed;       // refused by the engine, not yet finished
+    ULONG                     InFlight;
+    BOOLEAN                   Adaptive;     // DepthControl limits InFlight
+    ECHO_DEPTH_CONTROLLER     DepthControl;
+    ULONGLONG                 NextSeq;
+    ULONGLONG                 FlushSeq;     // calls before this one go out without waiting
+    BOOLEAN                   Closing;
+    std::atomic<bool>         Stop;
+    std::thread               Completer;
+    std::thread               Batcher;
+    std::thread::id           CompleterId;
+    ECHO_CLIENT_STATS         Stats;
+};
+
+VOID EchoClientDefaultConfig(OUT PECHO_CLIENT_CONFIG config)
+{
+    config->Depth = ECHO_CLIENT_DEPTH;
+    config->BatchBytes = 0;
+    config->BatchWindowUs = ECHO_CLIENT_BATCH_WINDOW_US;
+    config->TargetLatencyUs = 0;
+}
+
+//
+// ãпв;ӦʱΪTRUE
+//
+static BOOLEAN ClientCanIssue(PECHO_CLIENT client)
+{
+    if (client->Free.empty()) {
+        return FALSE;
+    }
+
+    return !client->Adaptive || client->InFlight < EchoDepthCurrent(&client->DepthControl);
+}
+
+//
+// ãڿԷʱ˳򷢳ȴеĵãܾĲ۷Failed
+//
+static VOID ClientPump(PECHO_CLIENT client)
+{
+    ULONGLONG windowNs = (ULONGLONG)client->Config.BatchWindowUs * 1000;
+    size_t waiting = client->Waiting.size();
+    PCLIENT_SLOT slot;
+    PCLIENT_CALL head;
+    PCLIENT_CALL next;
+    BOOLEAN ready;
+    ULONG offset;
+    ULONG parts;
+    ULONG bytes;
+    ULONG i;
+
+    while (!client->Waiting.empty() && ClientCanIssue(client)) {
+        head = &client->Waiting.front();
+        parts = 1;
+        bytes = head->Length;
+
+        //
+        // A batch goes out once nothing more can join it, once it is
+        // flushed, or once its oldest write has waited out the window
+        // ޷ټáˢ»дʱ䴰ʱ
+        //
+        if (head->Coalesce) {
+            ready = (head->Seq < client->FlushSeq || EchoNowNs() - head->StartNs >= windowNs);
+
+            while (parts < client->Waiting.size() && parts < ECHO_CLIENT_BATCH_PARTS) {
+                next = &client->Waiting[parts];
+                if (!next->Coalesce || bytes + next->Length > client->Config.BatchBytes) {
+                    ready = TRUE;
+                    break;
+                }
+                bytes += next->Length;
+                parts++;
+            }
+
+            if (parts == ECHO_CLIENT_BATCH_PARTS || bytes == client->Config.BatchBytes) {
+                ready = TRUE;
+            }
+
+            if (!ready) {
+                break;
+            }
+        }
+
+        slot = client->Free.back();
+        client->Free.pop_back();
+
+        ZeroMemory(&slot->Io, sizeof(slot->Io));
+        slot->Io.Op = head->Op;
+        slot->Io.Length = bytes;
+        slot->Io.Context = slot;
+        slot->Parts = parts;
+
+        //
+        // A lone call moves its own buffer; a batch is copied together
+        // ֱʹԼĻαƵһ
+        //
+        if (parts == 1) {
+            slot->Calls[0] = *head;
+            slot->Io.Buffer = head->Buffer;
+            client->Waiting.pop_front();
+        }
+        else {
+            for (i = 0, offset = 0; i < parts; i++) {
+                slot->Calls[i] = client->Waiting.front();
+                client->Waiting.pop_front();
+                memcpy(slot->Batch + offset, slot->Calls[i].Buffer, slot->Calls[i].Length);
+                offset += slot->Calls[i].Length;
+            }
+            slot->Io.Buffer = slot->Batch;
+            client->Stats.Batches++;
+            client->Stats.Coalesced += parts;
+        }
+
+        client->InFlight++;
+        if (client->InFlight > client->Stats.MaxInFlight) {
+            client->Stats.MaxInFlight = client->InFlight;
+        }
+        client->Stats.DeviceOps++;
+
+        slot->Io.IssueNs = EchoNowNs();
+        slot->Io.IntendedNs = slot->Io.IssueNs;
+
+        if (!client->Engine->Submit(&slot->Io)) {
+            client->Failed.push_back(slot);
+        }
+    }
+
+    if (client->Waiting.size() < waiting) {
+        client->Changed.notify_all();
+    }
+}
+
+//
+// ɵĲۣлصȻ黹۲ȴеĵã
+// 䱻ܾĲͬڴ˽
+//
+static VOID ClientComplete(PECHO_CLIENT client, PCLIENT_SLOT* slots, ULONG count)
+{
+    std::vector<PCLIENT_SLOT> failed;
+    PCLIENT_CALL call;
+    PCLIENT_SLOT slot;
+    ULONGLONG nowNs;
+    ULONG transferred;
+    ULONG offset;
+    ULONG error;
+    ULONG i;
+    ULONG j;
+
+    for (;;) {
+        nowNs = EchoNowNs();
+
+        //
+        // Each call of a batch gets its share of the bytes moved
+        // еÿûֽԼĲ
+        //
+        for (i = 0; i < count; i++) {
+            slot = slots[i];
+            for (j = 0, offset = 0; j < slot->Parts; j++) {
+                call = &slot->Calls[j];
+                error = slot->Io.Error;
+                if (slot->Parts == 1) {
+                    transferred = slot->Io.Transferred;
+                }
+                else if (slot->Io.Transferred <= offset) {
+                    transferred = 0;
+                }
+                else {
+                    transferred = slot->Io.Transferred - offset;
+                    if (transferred > call->Length) {
+                        transferred = call->Length;
+                    }
+                }
+                offset += call->Length;
+
+                call->Callback(call->Context, error, transferred);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(client->Lock);
+
+            for (i = 0; i < count; i++) {
+                slot = slots[i];
+                for (j = 0; j < slot->Parts; j++) {
+                    EchoHistRecord(&client->Stats.CallLatencyNs, nowNs - slot->Calls[j].StartNs);
+                    if (slot->Io.Error != ERROR_SUCCESS) {
+                        client->Stats.Errors++;
+                    }
+                }
+                if (client->Adaptive && slot->Io.Error == ERROR_SUCCESS) {
+                    EchoDepthRecord(&client->DepthControl, nowNs - slot->Io.IssueNs);
+                }
+                client->Free.push_back(slot);
+                client->InFlight--;
+            }
+
+            ClientPump(client);
+
+            if (!client->Waiting.empty()) {
+                client->Wake.notify_one();
+            }
+            client->Changed.notify_all();
+
+            failed.clear();
+            failed.swap(client->Failed);
+        }
+
+        if (failed.empty()) {
+            break;
+        }
+
+        slots = &failed[0];
+        count = (ULONG)failed.size();
+    }
+}
+
+//
+// ãȴеĵãܾĲ
+//
+static VOID ClientPumpAndFinish(PECHO_CLIENT client, std::unique_lock<std::mutex>& lock)
+{
+    std::vector<PCLIENT_SLOT> failed;
+
+    ClientPump(client);
+
+    if (!client->Failed.empty()) {
+        failed.swap(client->Failed);
+        lock.unlock();
+        ClientComplete(client, &failed[0], (ULONG)failed.size());
+        lock.lock();
+    }
+}
+
+//
+// ̣߳ȡֱͻ˹ر
+//
+static VOID ClientCompleter(PECHO_CLIENT client)
+{
+    PECHO_IO completed[ECHO_REAP_MAX];
+    PCLIENT_SLOT slots[ECHO_REAP_MAX];
+    ULONG count;
+    ULONG i;
+
+    while (!client->Stop) {
+        count = client->Engine->Reap(completed, ECHO_REAP_MAX, CLIENT_POLL_MS);
+        for (i = 0; i < count; i++) {
+            slots[i] = (PCLIENT_SLOT)completed[i]->Context;
+        }
+        if (count != 0) {
+            ClientComplete(client, slots, count);
+        }
+    }
+}
+
+//
+// ̣߳εʱ䴰ڵʱ䷢
+//
+static VOID ClientBatcher(PECHO_CLIENT client)
+{
+    std::unique_lock<std::mutex> lock(client->Lock);
+    ULONGLONG windowNs = (ULONGLONG)client->Config.BatchWindowUs * 1000;
+    ULONGLONG dueNs;
+    ULONGLONG nowNs;
+
+    while (!client->Stop) {
+        if (client->Waiting.empty() || !client->Waiting.front().Coalesce || !ClientCanIssue(client)) {
+            client->Wake.wait(lock);
+            continue;
+        }
+
+        dueNs = client->Waiting.front().StartNs + windowNs;
+        nowNs = EchoNowNs();
+        if (nowNs < dueNs) {
+            client->Wake.wait_for(lock, std::chrono::nanoseconds(dueNs - nowNs));
+        }
+
+        ClientPumpAndFinish(client, lock);
+    }
+}
+
+//
+// üУʱ߳ϳ⣩flushΪTRUEʱ֮ͬǰ
+// 
+//
+static BOOLEAN ClientEnqueue(
+    IN PECHO_CLIENT          client,
+    IN ECHO_OP               op,
+    IN PUCHAR                buffer,
+    IN ULONG                 length,
+    IN BOOLEAN               coalesce,
+    IN BOOLEAN               flush,
+    IN ECHO_CLIENT_CALLBACK* callback,
+    IN PVOID                 context
+    )
+{
+    std::unique_lock<std::mutex> lock(client->Lock);
+    CLIENT_CALL call;
+
+    //
+    // A callback that blocked here would stop the completions that make
+    // room, so the completer thread never waits
+    // ڴĻصֹڳռɣ̴߳Ӳȴ
+    //
+    if (std::this_thread::get_id() != client->CompleterId) {
+        while (!client->Closing && client->Waiting.size() >= ECHO_CLIENT_QUEUE) {
+            client->Changed.wait(lock);
+        }
+    }
+
+    if (client->Closing) {
+        return FALSE;
+    }
+
+    call.Op = op;
+    call.Buffer = buffer;
+    call.Length = length;
+    call.Coalesce = (coalesce && op == EchoOpWrite && length < client->Config.BatchBytes);
+    call.Seq = client->NextSeq++;
+    call.StartNs = EchoNowNs();
+    call.Callback = callback;
+    call.Context = context;
+
+    if (flush) {
+        client->FlushSeq = client->NextSeq;
+    }
+
+    client->Waiting.push_back(call);
+    client->Stats.Calls++;
+
+    ClientPumpAndFinish(client, lock);
+
+    //
+    // The batcher already waits on an older head call
+    // ߳ڵȴĶ׵
+    //
+    if (client->Waiting.size() == 1 && client->Waiting.front().Coalesce) {
+        client->Wake.notify_one();
+    }
+
+    return TRUE;
+}
+
+typedef struct _CLIENT_WAIT {
+    PECHO_CLIENT Client;
+    BOOLEAN      Done;
+    ULONG        Error;
+    ULONG        Transferred;
+} CLIENT_WAIT, *PCLIENT_WAIT;
+
+static VOID ClientWaitDone(PVOID context, ULONG error, ULONG transferred)
+{
+    PCLIENT_WAIT wait = (PCLIENT_WAIT)context;
+    std::lock_guard<std::mutex> lock(wait->Client->Lock);
+
+    wait->Error = error;
+    wait->Transferred = transferred;
+    wait->Done = TRUE;
+    wait->Client->Changed.notify_all();
+}
+
+//
+// һòȴȴʱ䴰
+//
+static ULONG ClientCall(
+    IN  PECHO_CLIENT client,
+    IN  ECHO_OP      op,
+    IN  PUCHAR       buffer,
+    IN  ULONG        length,
+    IN  BOOLEAN      coalesce,
+    OUT PULONG       transferred
+    )
+{
+    CLIENT_WAIT wait;
+
+    wait.Client = client;
+    wait.Done = FALSE;
+    wait.Error = ERROR_SUCCESS;
+    wait.Transferred = 0;
+
+    *transferred = 0;
+
+    if (!ClientEnqueue(client, op, buffer, length, coalesce, TRUE, ClientWaitDone, &wait)) {
+        return ERROR_OPERATION_ABORTED;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(client->Lock);
+
+        while (!wait.Done) {
+            client->Changed.wait(lock);
+        }
+    }
+
+    *transferred = wait.Transferred;
+
+    return wait.Error;
+}
+
+#ifdef _WIN32
+
+BOOLEAN EchoClientGetDevicePaths(
+    OUT WCHAR  devicePaths[][ECHO_CLIENT_PATH_LENGTH],
+    IN  ULONG  maxPaths,
+    OUT PULONG count
+    )
+{
+    CONFIGRET cr = CR_SUCCESS;
+    PWSTR deviceInterfaceList = NULL;
+    ULONG deviceInterfaceListLength = 0;
+    PWSTR nextInterface;
+    HRESULT hr = E_FAIL;
+    BOOLEAN bRet = TRUE;
+
+    *count = 0;
+
+    cr = CM_Get_Device_Interface_List_Size(
+                &deviceInterfaceListLength,
+                (LPGUID)&GUID_DEVINTERFACE_ECHO,
+                NULL,
+                CM_GET_DEVICE_INTERFACE_LIST_PRESENT);
+    if (cr != CR_SUCCESS) {
+        LOG("Error 0x%x retrieving device interface list size.\n", cr);
+        goto clean0;
+    }
+
+    if (deviceInterfaceListLength <= 1) {
+        bRet = FALSE;
+        LOG("Error: No active device interfaces found.\n"
+            " Is the sample driver loaded?");
+        goto clean0;
+    }
+
+    deviceInterfaceList = (PWSTR)malloc(deviceInterfaceListLength * sizeof(WCHAR));
+    if (deviceInterfaceList == NULL) {
+        bRet = FALSE;
+        LOG("Error allocating memory for device interface list.\n");
+        goto clean0;
+    }
+    ZeroMemory(deviceInterfaceList, deviceInterfaceListLength * sizeof(WCHAR));
+
+    cr = CM_Get_Device_Interface_List(
+                (LPGUID)&GUID_DEVINTERFACE_ECHO,
+                NULL,
+                deviceInterfaceList,
+                deviceInterfaceListLength,
+                CM_GET_DEVICE_INTERFACE_LIST_PRESENT);
+    if (cr != CR_SUCCESS) {
+        LOG("Error 0x%x retrieving device interface list.\n", cr);
+        goto clean0;
+    }
+
+    //
+    // The list is a sequence of strings ended by an empty one
+    // бһַԿַ
+    //
+    for (nextInterface = deviceInterfaceList;
+         *nextInterface != UNICODE_NULL;
+         nextInterface += wcslen(nextInterface) + 1) {
+
+        if (*count == maxPaths) {
+            LOG("Warning: More than %d device interface instances found. \n"
+                "Using the first %d.\n\n", maxPaths, maxPaths);
+            break;
+        }
+
+        hr = StringCchCopy(devicePaths[*count], ECHO_CLIENT_PATH_LENGTH, nextInterface);
+        if (FAILED(hr)) {
+            bRet = FALSE;
+            LOG("Error: StringCchCopy failed with HRESULT 0x%x", hr);
+            goto clean0;
+        }
+
+        (*count)++;
+    }
+
+clean0:
+    if (deviceInterfaceList != NULL) {
+        free(deviceInterfaceList);
+    }
+    if (CR_SUCCESS != cr) {
+        bRet = FALSE;
+    }
+
+    return bRet;
+}
+
+PECHO_CLIENT EchoClientOpen(
+    IN PCWSTR                    devicePath,
+    IN ULONG                     shardKey,
+    IN const ECHO_CLIENT_CONFIG* config
+    )
+{
+    WCHAR paths[CLIENT_MAX_DEVICES][ECHO_CLIENT_PATH_LENGTH];
+    EchoEngine* engine;
+    ULONG count;
+
+    if (devicePath == NULL) {
+        if (!EchoClientGetDevicePaths(paths, CLIENT_MAX_DEVICES, &count)) {
+            return NULL;
+        }
+        devicePath = paths[0];
+    }
+
+    engine = EchoIocpEngineOpen(devicePath, shardKey);
+    if (engine == NULL) {
+        return NULL;
+    }
+
+    return EchoClientOpenEngine(engine, config);
+}
+
+#endif
+
+//
+// ͷſͻ˵Ĳۡλ棻̱߳Ѿ
+//
+static VOID ClientFree(PECHO_CLIENT client)
+{
+    ULONG i;
+
+    if (client->Slots != NULL) {
+        for (i = 0; i < client->Config.Depth; i++) {
+            if (client->Slots[i].Batch != NULL) {
+                EchoArenaFree(client->Slots[i].Batch, client->Config.BatchBytes);
+            }
+        }
+        delete[] client->Slots;
+    }
+
+    delete client->Engine;
+    delete client;
+}
+
+PECHO_CLIENT EchoClientOpenEngine(
+    IN EchoEngine*               engine,
+    IN const ECHO_CLIENT_CONFIG* config
+    )
+{
+    PECHO_CLIENT client;
+    ULONG i;
+
+    if (engine == NULL) {
+        return NULL;
+    }
+
+    client = new (std::nothrow) _ECHO_CLIENT();
+    if (client == NULL) {
+        delete engine;
+        return NULL;
+    }
+
+    client->Engine = engine;
+    client->Config = *config;
+    if (client->Config.Depth == 0) {
+        client->Config.Depth = 1;
+    }
+    EchoHistReset(&client->Stats.CallLatencyNs);
+
+    //
+    // Depth is then only the most in flight; the controller starts at one
+    // ʱDepthֻ;ޣһʼ
+    //
+    if (client->Config.TargetLatencyUs != 0) {
+        ECHO_DEPTH_CONFIG depth;
+
+        depth.Rule = EchoDepthAimd;
+        depth.MinDepth = 1;
+        depth.MaxDepth = client->Config.Depth;
+        depth.InitialDepth = 1;
+        depth.TargetNs = (ULONGLONG)client->Config.TargetLatencyUs * 1000;
+        EchoDepthInit(&client->DepthControl, &depth);
+        client->Adaptive = TRUE;
+    }
+
+    client->Slots = new (std::nothrow) CLIENT_SLOT[client->Config.Depth];
+    if (client->Slots == NULL) {
+        LOG("EchoClientOpenEngine: Cannot allocate %d slots\n", client->Config.Depth);
+        ClientFree(client);
+        return NULL;
+    }
+
+    for (i = 0; i < client->Config.Depth; i++) {
+        client->Slots[i].Batch = NULL;
+    }
+
+    //
+    // Slot 0 is handed out first
+    // 0ȷ
+    //
+    client->Free.reserve(client->Config.Depth);
+    for (i = client->Config.Depth; i > 0; i--) {
+        if (client->Config.BatchBytes != 0) {
+            client->Slots[i - 1].Batch = EchoArenaAlloc(client->Config.BatchBytes);
+            if (client->Slots[i - 1].Batch == NULL) {
+                LOG("EchoClientOpenEngine: Cannot allocate the batch buffers\n");
+                ClientFree(client);
+                return NULL;
+            }
+        }
+        client->Free.push_back(&client->Slots[i - 1]);
+    }
+
+    client->Completer = std::thread(ClientCompleter, client);
+    client->CompleterId = client->Completer.get_id();
+
+    if (client->Config.BatchBytes != 0) {
+        client->Batcher = std::thread(ClientBatcher, client);
+    }
+
+    return client;
+}
+
+VOID EchoClientClose(IN PECHO_CLIENT client)
+{
+    {
+        std::unique_lock<std::mutex> lock(client->Lock);
+
+        //
+        // Refuse new calls, send every waiting one at once and wait for
+        // all of them
+        // ܾµãеȴеĵòȴȫ
+        //
+        client->Closing = TRUE;
+        client->FlushSeq = client->NextSeq;
+        client->Changed.notify_all();
+
+        ClientPumpAndFinish(client, lock);
+
+        while (!client->Waiting.empty() || client->InFlight != 0) {
+            client->Changed.wait(lock);
+        }
+
+        client->Stop = true;
+        client->Wake.notify_all();
+    }
+
+    client->Completer.join();
+    if (client->Batcher.joinable()) {
+        client->Batcher.join();
+    }
+
+    ClientFree(client);
+}
+
+BOOLEAN EchoClientWriteAsync(
+    IN PECHO_CLIENT          client,
+    IN const UCHAR*          buffer,
+    IN ULONG                 length,
+    IN ECHO_CLIENT_CALLBACK* callback,
+    IN PVOID                 context
+    )
+{
+    return ClientEnqueue(client, EchoOpWrite, (PUCHAR)buffer, length, TRUE, FALSE, callback, context);
+}
+
+BOOLEAN EchoClientReadAsync(
+    IN PECHO_CLIENT          client,
+    IN PUCHAR                buffer,
+    IN ULONG                 length,
+    IN ECHO_CLIENT_CALLBACK* callback,
+    IN PVOID                 context
+    )
+{
+    return ClientEnqueue(client, EchoOpRead, buffer, length, FALSE, FALSE, callback, context);
+}
+
+VOID EchoClientFlush(IN PECHO_CLIENT client)
+{
+    std::unique_lock<std::mutex> lock(client->Lock);
+
+    client->FlushSeq = client->NextSeq;
+
+    ClientPumpAndFinish(client, lock);
+}
+
+ULONG EchoClientWrite(
+    IN  PECHO_CLIENT client,
+    IN  const UCHAR* buffer,
+    IN  ULONG        length,
+    OUT PULONG       transferred
+    )
+{
+    return ClientCall(client, EchoOpWrite, (PUCHAR)buffer, length, TRUE, transferred);
+}
+
+ULONG EchoClientRead(
+    IN  PECHO_CLIENT client,
+    OUT PUCHAR       buffer,
+    IN  ULONG        length,
+    OUT PULONG       transferred
+    )
+{
+    return ClientCall(client, EchoOpRead, buffer, length, FALSE, transferred);
+}
+
+ULONG EchoClientEcho(
+    IN  PECHO_CLIENT client,
+    IN  const UCHAR* data,
+    OUT PUCHAR       echo,
+    IN  ULONG        length
+    )
+{
+    ULONG transferred;
+    ULONG error;
+
+    error = EchoClientWrite(client, data, length, &transferred);
+    if (error != ERROR_SUCCESS) {
+        return error;
+    }
+
+    error = EchoClientRead(client, echo, length, &transferred);
+    if (error != ERROR_SUCCESS) {
+        return error;
+    }
+
+    if (transferred != length || memcmp(data, echo, length) != 0) {
+        return ERROR_INVALID_DATA;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+ULONG EchoClientEchoBatch(
+    IN     PECHO_CLIENT      client,
+    IN OUT PECHO_CLIENT_ITEM items,
+    IN     ULONG             count
+    )
+{
+    PUCHAR data;
+    PUCHAR echo;
+    ULONG transferred;
+    ULONG offset;
+    ULONG length;
+    ULONG error;
+    ULONG i;
+
+    for (i = 0, length = 0; i < count; i++) {
+        items[i].Transferred = 0;
+        length += items[i].Length;
+    }
+
+    if (length == 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    data = EchoArenaAlloc(length);
+    echo = EchoArenaAlloc(length);
+    if (data == NULL || echo == NULL) {
+        error = ERROR_NOT_ENOUGH_MEMORY;
+        goto exit;
+    }
+
+    for (i = 0, offset = 0; i < count; i++) {
+        memcpy(data + offset, items[i].Data, items[i].Length);
+        offset += items[i].Length;
+    }
+
+    //
+    // The items already share one write, which must not join a batch
+    // Щѹһд룬ټ
+    //
+    error = ClientCall(client, EchoOpWrite, data, length, FALSE, &transferred);
+    if (error != ERROR_SUCCESS) {
+        goto exit;
+    }
+
+    error = ClientCall(client, EchoOpRead, echo, length, FALSE, &transferred);
+    if (error != ERROR_SUCCESS) {
+        goto exit;
+    }
+
+    //
+    // Scatter the echo back over the items
+    // Բֻظ
+    //
+    for (i = 0, offset = 0; i < count; i++) {
+        if (transferred > offset) {
+            items[i].Transferred = (transferred - offset < items[i].Length) ? transferred - offset : items[i].Length;
+            memcpy(items[i].Echo, echo + offset, items[i].Transferred);
+        }
+        offset += items[i].Length;
+    }
+
+    if (transferred != length || memcmp(data, echo, length) != 0) {
+        error = ERROR_INVALID_DATA;
+    }
+
+exit:
+    if (data != NULL) {
+        EchoArenaFree(data, length);
+    }
+    if (echo != NULL) {
+        EchoArenaFree(echo, length);
+    }
+
+    return error;
+}
+
+VOID EchoClientQuery(
+    IN  PECHO_CLIENT       client,
+    OUT PECHO_CLIENT_STATS stats
+    )
+{
+    std::lock_guard<std::mutex> lock(client->Lock);
+
+    *stats = client->Stats;
+    stats->Depth = client->Adaptive ? EchoDepthCurrent(&client->DepthControl) : client->Config.Depth;
+}
+
+//
+// Asynchronous calls of the self-test and the benchmark count their
+// completions here
+// Լͻ׼Ե첽ڴͳ
+//
+typedef struct _CLIENT_COUNTER {
+    std::atomic<ULONG>     Done;
+    std::atomic<ULONG>     Failed;
+    std::atomic<ULONG>     Transferred;    // of the last call
+    std::atomic<ULONGLONG> LastNs;         // when the last call finished
+} CLIENT_COUNTER, *PCLIENT_COUNTER;
+
+static VOID ClientCountDone(PVOID context, ULONG error, ULONG transferred)
+{
+    PCLIENT_COUNTER counter = (PCLIENT_COUNTER)context;
+
+    if (error != ERROR_SUCCESS) {
+        counter->Failed++;
+    }
+    counter->Transferred = transferred;
+    counter->LastNs = EchoNowNs();
+    counter->Done++;
+}
+
+//
+// ȴcounterexpectedãʱFALSE
+//
+static BOOLEAN ClientCountWait(PCLIENT_COUNTER counter, ULONG expected)
+{
+    ULONG waitedMs;
+
+    for (waitedMs = 0; counter->Done < expected; waitedMs++) {
+        if (waitedMs == CLIENT_TEST_WAIT_MS) {
+            return FALSE;
+        }
+        EchoSleepMs(1);
+    }
+
+    return counter->Failed == 0;
+}
+
+static PECHO_CLIENT ClientTestOpen(
+    ULONGLONG serviceNs,
+    ULONG     depth,
+    ULONG     batchBytes,
+    ULONG     windowUs,
+    ULONG     targetUs
+    )
+{
+    ECHO_CLIENT_CONFIG config;
+
+    EchoClientDefaultConfig(&config);
+    config.Depth = depth;
+    config.BatchBytes = batchBytes;
+    config.BatchWindowUs = windowUs;
+    config.TargetLatencyUs = targetUs;
+
+    return EchoClientOpenEngine(EchoLoopbackEngineOpen(serviceNs), &config);
+}
+
+BOOLEAN EchoClientSelfTest(VOID)
+{
+    static UCHAR data[CLIENT_TEST_LENGTH];
+    static UCHAR echo[CLIENT_TEST_LENGTH];
+    ECHO_CLIENT_ITEM items[3];
+    ECHO_CLIENT_STATS stats;
+    CLIENT_COUNTER counter;
+    PECHO_CLIENT client;
+    ULONGLONG startNs;
+    ULONG transferred;
+    ULONG i;
+    BOOLEAN passed;
+    BOOLEAN result = TRUE;
+
+    for (i = 0; i < CLIENT_TEST_LENGTH; i++) {
+        data[i] = (UCHAR)(i * 7 + 1);
+    }
+
+    //
+    // Synchronous echo, and a read that follows a write in the queue sees it
+    // ͬԣԼид֮Ķȡܿд
+    //
+    client = ClientTestOpen(0, ECHO_CLIENT_DEPTH, 0, ECHO_CLIENT_BATCH_WINDOW_US, 0);
+    if (client == NULL) {
+        return FALSE;
+    }
+
+    passed = (EchoClientEcho(client, data, echo, CLIENT_TEST_LENGTH) == ERROR_SUCCESS);
+
+    counter.Done = 0;
+    counter.Failed = 0;
+    passed = passed && EchoClientWriteAsync(client, data + 1, 100, ClientCountDone, &counter);
+    passed = passed && EchoClientReadAsync(client, echo, CLIENT_TEST_LENGTH, ClientCountDone, &counter);
+    passed = passed && ClientCountWait(&counter, 2) &&
+             counter.Transferred == 100 && memcmp(echo, data + 1, 100) == 0;
+
+    EchoClientClose(client);
+    LOG("Synchronous echo and write-read order: %s\n", passed ? "ok" : "failed");
+    result = result && passed;
+
+    //
+    // Pipelining keeps Depth operations in flight and no more
+    // ˮ߱Depth;Ҳ
+    //
+    client = ClientTestOpen(200000, 4, 0, ECHO_CLIENT_BATCH_WINDOW_US, 0);
+    if (client == NULL) {
+        return FALSE;
+    }
+
+    counter.Done = 0;
+    counter.Failed = 0;
+    for (i = 0, passed = TRUE; i < 64 && passed; i++) {
+        passed = EchoClientWriteAsync(client, data, 512, ClientCountDone, &counter);
+    }
+    passed = passed && ClientCountWait(&counter, 64);
+
+    EchoClientQuery(client, &stats);
+    passed = passed && stats.MaxInFlight == 4 && stats.DeviceOps == 64 && stats.Batches == 0;
+
+    EchoClientClose(client);
+    LOG("Pipelining at depth 4: %s (%d in flight at most)\n", passed ? "ok" : "failed", stats.MaxInFlight);
+    result = result && passed;
+
+    //
+    // 64 small writes fill one batch without waiting for the window, and a
+    // read returns all of them in order
+    // 64Сд벻ȴʱ䴰ڼһΣȡ˳򷵻ȫ
+    //
+    client = ClientTestOpen(0, ECHO_CLIENT_DEPTH, ECHO_CLIENT_BATCH_PARTS * CLIENT_TEST_PART, 1000000, 0);
+    if (client == NULL) {
+        return FALSE;
+    }
+
+    counter.Done = 0;
+    counter.Failed = 0;
+    startNs = EchoNowNs();
+    for (i = 0, passed = TRUE; i < ECHO_CLIENT_BATCH_PARTS && passed; i++) {
+        passed = EchoClientWriteAsync(client, data + i * CLIENT_TEST_PART, CLIENT_TEST_PART,
+                                      ClientCountDone, &counter);
+    }
+    passed = passed && ClientCountWait(&counter, ECHO_CLIENT_BATCH_PARTS) &&
+             counter.LastNs - startNs < 500000000ULL;
+    passed = passed && EchoClientRead(client, echo, CLIENT_TEST_LENGTH, &transferred) == ERROR_SUCCESS &&
+             transferred == ECHO_CLIENT_BATCH_PARTS * CLIENT_TEST_PART &&
+             memcmp(echo, data, transferred) == 0;
+
+    EchoClientQuery(client, &stats);
+    passed = passed && stats.Batches == 1 && stats.Coalesced == ECHO_CLIENT_BATCH_PARTS && stats.DeviceOps == 2;
+
+    EchoClientClose(client);
+    LOG("Coalescing %d writes: %s (%llu device operations)\n",
+        ECHO_CLIENT_BATCH_PARTS, passed ? "ok" : "failed", stats.DeviceOps);
+    result = result && passed;
+
+    //
+    // A lone small write waits out the window; one followed by a read goes
+    // out with it at once
+    // Сдʱ䴰ڣŶȡд֮
+    //
+    client = ClientTestOpen(0, ECHO_CLIENT_DEPTH, 1024, 20000, 0);
+    if (client == NULL) {
+        return FALSE;
+    }
+
+    counter.Done = 0;
+    counter.Failed = 0;
+    startNs = EchoNowNs();
+    passed = EchoClientWriteAsync(client, data, CLIENT_TEST_PART, ClientCountDone, &counter) &&
+             ClientCountWait(&counter, 1) && counter.LastNs - startNs >= 20000000ULL;
+
+    counter.Done = 0;
+    startNs = EchoNowNs();
+    passed = passed && EchoClientWriteAsync(client, data + 5, CLIENT_TEST_PART, ClientCountDone, &counter) &&
+             EchoClientReadAsync(client, echo, CLIENT_TEST_LENGTH, ClientCountDone, &counter) &&
+             ClientCountWait(&counter, 2) && counter.LastNs - startNs < 10000000ULL &&
+             memcmp(echo, data + 5, CLIENT_TEST_PART) == 0;
+
+    EchoClientClose(client);
+    LOG("Batch window: %s\n", passed ? "ok" : "failed");
+    result = result && passed;
+
+    //
+    // A stand-in serving one request per 100 us meets a 1 ms target only
+    // around ten deep, so the adaptive depth stays well below its 64 slots
+    // ÿ100 usһֻʮҲ1 msĿ꣬Ӧ
+    // Զ64
+    //
+    client = ClientTestOpen(100000, 64, 0, ECHO_CLIENT_BATCH_WINDOW_US, 1000);
+    if (client == NULL) {
+        return FALSE;
+    }
+
+    counter.Done = 0;
+    counter.Failed = 0;
+    for (i = 0, passed = TRUE; i < CLIENT_TEST_ADAPTIVE && passed; i++) {
+        passed = EchoClientWriteAsync(client, data, 512, ClientCountDone, &counter);
+    }
+    passed = passed && ClientCountWait(&counter, CLIENT_TEST_ADAPTIVE);
+
+    EchoClientQuery(client, &stats);
+    passed = passed && stats.Depth >= 2 && stats.Depth <= 16 && stats.MaxInFlight < 64;
+
+    EchoClientClose(client);
+    LOG("Adaptive depth for a 1 ms target: %s (depth %d, %d in flight at most)\n",
+        passed ? "ok" : "failed", stats.Depth, stats.MaxInFlight);
+    result = result && passed;
+
+    //
+    // A batched echo splits the echo back over its items, and closing
+    // sends the calls still waiting for their window
+    // ԽԲֻظرʱڵȴʱ䴰ڵĵ
+    //
+    client = ClientTestOpen(0, ECHO_CLIENT_DEPTH, 1024, 1000000, 0);
+    if (client == NULL) {
+        return FALSE;
+    }
+
+    items[0].Data = data;
+    items[0].Echo = echo;
+    items[0].Length = 10;
+    items[1].Data = data + 100;
+    items[1].Echo = echo + 100;
+    items[1].Length = 1000;
+    items[2].Data = data + 2000;
+    items[2].Echo = echo + 2000;
+    items[2].Length = 1;
+    memset(echo, 0, sizeof(echo));
+
+    passed = EchoClientEchoBatch(client, items, 3) == ERROR_SUCCESS &&
+             items[0].Transferred == 10 && items[1].Transferred == 1000 && items[2].Transferred == 1 &&
+             memcmp(echo, data, 10) == 0 && memcmp(echo + 100, data + 100, 1000) == 0 &&
+             echo[2000] == data[2000];
+    LOG("Batched echo: %s\n", passed ? "ok" : "failed");
+    result = result && passed;
+
+    counter.Done = 0;
+    counter.Failed = 0;
+    for (i = 0, passed = TRUE; i < 10 && passed; i++) {
+        passed = EchoClientWriteAsync(client, data, CLIENT_TEST_PART, ClientCountDone, &counter);
+    }
+    startNs = EchoNowNs();
+    EchoClientClose(client);
+    passed = passed && counter.Done == 10 && counter.Failed == 0 && EchoNowNs() - startNs < 500000000ULL;
+    LOG("Close with calls waiting: %s\n", passed ? "ok" : "failed");
+    result = result && passed;
+
+    LOG("EchoClient self-test %s\n", result ? "passed" : "FAILED");
+
+    return result;
+}
+
+typedef struct _CLIENT_BENCH {
+    PECHO_CLIENT        Client;
+    PUCHAR              Buffer;
+    ULONG               Length;
+    ULONGLONG           DeadlineNs;
+    std::atomic<ULONG>  Outstanding;
+    std::atomic<ULONG>  Errors;
+} CLIENT_BENCH, *PCLIENT_BENCH;
+
+//
+// ׼Եдڽֹʱ֮ǰһ
+//
+static VOID ClientBenchDone(PVOID context, ULONG error, ULONG transferred)
+{
+    PCLIENT_BENCH bench = (PCLIENT_BENCH)context;
+
+    if (error != ERROR_SUCCESS || transferred != bench->Length) {
+        bench->Errors++;
+    }
+
+    if (EchoNowNs() < bench->DeadlineNs &&
+        EchoClientWriteAsync(bench->Client, bench->Buffer, bench->Length, ClientBenchDone, bench)) {
+        return;
+    }
+
+    bench->Outstanding--;
+}
+
+//
+// configһֵ÷ʽӡһУcallsΪ0ʱΪͬԣ򱣳calls
+// 첽дδ
+//
+static BOOLEAN ClientBenchRun(
+    IN PCSTR                     name,
+    IN PECHO_BENCH_OPTIONS       options,
+    IN ECHO_ENGINE_OPEN*         open,
+    IN PVOID                     context,
+    IN const ECHO_CLIENT_CONFIG* config,
+    IN ULONG                     calls,
+    IN PUCHAR                    data,
+    IN PUCHAR                    echo
+    )
+{
+    ECHO_CLIENT_STATS stats;
+    CLIENT_BENCH bench;
+    ULONGLONG startNs;
+    double seconds;
+    ULONG i;
+
+    bench.Client = EchoClientOpenEngine(open(context, 0), config);
+    if (bench.Client == NULL) {
+        LOG("%-12s cannot open the engine\n", name);
+        return FALSE;
+    }
+
+    bench.Buffer = data;
+    bench.Length = options->BlockSize;
+    bench.Outstanding = 0;
+    bench.Errors = 0;
+
+    startNs = EchoNowNs();
+    bench.DeadlineNs = startNs + (ULONGLONG)options->DurationSec * 1000000000ULL;
+
+    if (calls == 0) {
+        while (EchoNowNs() < bench.DeadlineNs) {
+            if (EchoClientEcho(bench.Client, data, echo, options->BlockSize) != ERROR_SUCCESS) {
+                bench.Errors++;
+            }
+        }
+    }
+    else {
+        for (i = 0; i < calls; i++) {
+            bench.Outstanding++;
+            if (!EchoClientWriteAsync(bench.Client, data, options->BlockSize, ClientBenchDone, &bench)) {
+                bench.Outstanding--;
+                bench.Errors++;
+            }
+        }
+        while (bench.Outstanding != 0) {
+            EchoSleepMs(1);
+        }
+    }
+
+    seconds = (EchoNowNs() - startNs) / 1e9;
+
+    EchoClientQuery(bench.Client, &stats);
+    EchoClientClose(bench.Client);
+
+    LOG("%-12s %11.0f %9.1f %12.0f %9.1f %9.1f %7llu\n",
+        name,
+        stats.Calls / seconds,
+        stats.Calls * (double)options->BlockSize / seconds / (1024 * 1024),
+        stats.DeviceOps / seconds,
+        EchoHistPercentile(&stats.CallLatencyNs, 50) / 1000.0,
+        EchoHistPercentile(&stats.CallLatencyNs, 99) / 1000.0,
+        stats.Errors + bench.Errors);
+
+    return stats.Errors + bench.Errors == 0;
+}
+
+BOOLEAN EchoClientBench(
+    IN PECHO_BENCH_OPTIONS options,
+    IN ECHO_ENGINE_OPEN*   open,
+    IN PVOID               context
+    )
+{
+    ECHO_CLIENT_CONFIG config;
+    PUCHAR data;
+    PUCHAR echo;
+    ULONG calls;
+    ULONG i;
+    BOOLEAN result = TRUE;
+
+    if (options->Rate != 0 || options->ReplayPath != NULL || options->RecordPath != NULL ||
+        options->ScaleWorkers != 0) {
+        LOG("The client benchmark runs a closed loop without -rate, -replay, -record or -scale\n");
+        return FALSE;
+    }
+
+    data = EchoArenaAlloc(options->BlockSize);
+    echo = EchoArenaAlloc(options->BlockSize);
+    if (data == NULL || echo == NULL) {
+        LOG("Cannot allocate the client buffers\n");
+        result = FALSE;
+        goto exit;
+    }
+
+    for (i = 0; i < options->BlockSize; i++) {
+        data[i] = (UCHAR)(i * 7 + 1);
+    }
+
+    calls = options->QueueDepth * CLIENT_BENCH_FANIN;
+
+    LOG("Comparing EchoClient calls: %d bytes, queue depth %d, %d writes outstanding in the "
+        "async modes, %d seconds each, one client\n",
+        options->BlockSize, options->QueueDepth, calls, options->DurationSec);
+    LOG("%-12s %11s %9s %12s %9s %9s %7s\n",
+        "calls", "calls/s", "MB/s", "device op/s", "p50(us)", "p99(us)", "errors");
+
+    EchoClientDefaultConfig(&config);
+    config.Depth = 1;
+    result = ClientBenchRun("sync echo", options, open, context, &config, 0, data, echo) && result;
+
+    config.Depth = options->QueueDepth;
+    result = ClientBenchRun("pipelined", options, open, context, &config, calls, data, echo) && result;
+
+    //
+    // Coalescing needs room for two writes in a batch
+    // ϲҪһд
+    //
+    if (options->BlockSize * 2 > CLIENT_BENCH_BATCH) {
+        LOG("%-12s skipped: %d-byte writes do not fit two to a %d-byte batch\n",
+            "coalesced", options->BlockSize, CLIENT_BENCH_BATCH);
+    }
+    else {
+        config.BatchBytes = CLIENT_BENCH_BATCH;
+        result = ClientBenchRun("coalesced", options, open, context, &config, calls, data, echo) && result;
+    }
+
+exit:
+    if (data != NULL) {
+        EchoArenaFree(data, options->BlockSize);
+    }
+    if (echo != NULL) {
+        EchoArenaFree(echo, options->BlockSize);
+    }
+
+    return result;
+}
@@ -0,0 +1,243 @@
+/*++
+
+Module Name:
+
+    echoclient.h
+
+Abstract:
+
+    Echo client library, built as the echoclient static library so that
+    services can talk to the device without echoapp. It finds the device
+    interfaces, opens a handle on the completion port engine, and offers
+    synchronous, asynchronous and batched echo calls over any engine, so
+    the loopback stand-in can take the device's place in tests.
+    Asynchronous calls are pipelined: up to Depth device operations are in
+    flight and later calls wait their turn in order. Writes shorter than
+    BatchBytes are coalesced into one device write of up to BatchBytes,
+    sent when it is full, when a call that cannot join it arrives, or when
+    the oldest write in it has waited BatchWindowUs. The device keeps the
+    last write, so a read after a coalesced write returns the whole batch.
+    With a TargetLatencyUs the depth adapts, up to Depth, to keep the p99
+    of device operations under it (see echodepth.h).
+    Կͻ˿⣬Ϊechoclient̬⣬ʹechoapp豸ͨš
+    豸ӿڣɶ˿ϴ򿪾ṩͬ첽
+    Եã˲пûػ豸첽òˮߣDepth
+    豸;֮ĵð˳ȴBatchBytesд뱻ϲΪһ
+    BatchBytesֽڵ豸д룬д˲ܼĵáдѵȴ
+    BatchWindowUsʱ豸һд룬˺ϲд֮Ķȡݡ
+    TargetLatencyUsʱDepthԶʹ豸p99Ŀ֮
+    echodepth.h
+
+Environment:
+
+    user mode only; consumers on Windows link mincore.lib
+    ûģʽWindowsϵʹmincore.lib
+
+--*/
+
+#pragma once
+
+#include "echobench.h"
+#include "echohist.h"
+
+#define ECHO_CLIENT_PATH_LENGTH     256
+#define ECHO_CLIENT_DEPTH           8       // device operations in flight unless told otherwise
+#define ECHO_CLIENT_BATCH_WINDOW_US 100
+#define ECHO_CLIENT_BATCH_PARTS     64      // most writes one batch carries
+#define ECHO_CLIENT_QUEUE           4096    // calls waiting before a caller blocks
+
+//
+// Called on the client's threads when an asynchronous call finishes. It
+// may start asynchronous calls, which then never block, but must not make
+// synchronous ones or close the client.
+// 첽ýʱڿͻ˵߳ϵáпԷ첽ãʱ
+// ܷͬûرտͻˡ
+//
+typedef VOID ECHO_CLIENT_CALLBACK(PVOID context, ULONG error, ULONG transferred);
+
+typedef struct _ECHO_CLIENT_CONFIG {
+    ULONG Depth;                // device operations in flight
+    ULONG BatchBytes;           // largest coalesced write, 0 turns coalescing off
+    ULONG BatchWindowUs;        // longest a coalesced write waits for company
+    ULONG TargetLatencyUs;      // p99 of device operations the depth adapts to, Depth
+                                // being the most; 0 keeps Depth in flight
+} ECHO_CLIENT_CONFIG, *PECHO_CLIENT_CONFIG;
+
+typedef struct _ECHO_CLIENT_STATS {
+    ULONGLONG      Calls;           // reads and writes asked for
+    ULONGLONG      DeviceOps;       // reads and writes sent to the device
+    ULONGLONG      Batches;         // device writes carrying more than one call
+    ULONGLONG      Coalesced;       // calls that shared a device write
+    ULONGLONG      Errors;          // calls that failed
+    ULONG          MaxInFlight;
+    ULONG          Depth;           // device operations allowed in flight now
+    ECHO_HISTOGRAM CallLatencyNs;   // from the call to its completion
+} ECHO_CLIENT_STATS, *PECHO_CLIENT_STATS;
+
+//
+// One call of a batched echo
+// еһ
+//
+typedef struct _ECHO_CLIENT_ITEM {
+    const UCHAR* Data;
+    PUCHAR       Echo;          // receives the echo of Data
+    ULONG        Length;
+    ULONG        Transferred;   // bytes of Echo filled in
+} ECHO_CLIENT_ITEM, *PECHO_CLIENT_ITEM;
+
+typedef struct _ECHO_CLIENT* PECHO_CLIENT;
+
+//
+// Depth ECHO_CLIENT_DEPTH, no coalescing, no latency target
+// DepthΪECHO_CLIENT_DEPTHϲӳĿ
+//
+VOID EchoClientDefaultConfig(OUT PECHO_CLIENT_CONFIG config);
+
+#ifdef _WIN32
+
+//
+// Copies the paths of the present echo device interfaces, at most
+// maxPaths of them, into devicePaths. FALSE if none is present.
+// λĻ豸ӿ·maxPathsƵdevicePathsûλ豸ʱ
+// FALSE
+//
+BOOLEAN EchoClientGetDevicePaths(
+    OUT WCHAR  devicePaths[][ECHO_CLIENT_PATH_LENGTH],
+    IN  ULONG  maxPaths,
+    OUT PULONG count
+    );
+
+//
+// Opens devicePath, or the first present device when NULL, pins the handle
+// to shardKey unless it is ECHO_SHARD_KEY_DEFAULT, and starts a client on
+// its completion port. NULL on failure.
+// devicePathΪNULLʱ򿪵һλ豸shardKeyΪ
+// ECHO_SHARD_KEY_DEFAULTʱ̶÷Ƭɶ˿ͻˡ
+// ʧʱNULL
+//
+PECHO_CLIENT EchoClientOpen(
+    IN PCWSTR                    devicePath,
+    IN ULONG                     shardKey,
+    IN const ECHO_CLIENT_CONFIG* config
+    );
+
+#endif
+
+//
+// Starts a client over engine, which it owns from now on, even on failure.
+// NULL on failure.
+// engineͻˣ˺engineͻУʧʱҲˡʧʱNULL
+//
+PECHO_CLIENT EchoClientOpenEngine(
+    IN EchoEngine*               engine,
+    IN const ECHO_CLIENT_CONFIG* config
+    );
+
+//
+// Sends what is waiting, waits for every call to finish and frees the
+// client and its engine
+// ȴеĵãȴеýȻͷſͻ˼
+//
+VOID EchoClientClose(IN PECHO_CLIENT client);
+
+//
+// Queue a write or read; callback runs when it finishes and the buffer must
+// stay valid until then. Blocks while ECHO_CLIENT_QUEUE calls wait. FALSE
+// once the client is closing.
+// дŶӣʱcallbackڴ֮ǰ뱣Ч
+// ECHO_CLIENT_QUEUEڵȴʱͻڹرʱFALSE
+//
+BOOLEAN EchoClientWriteAsync(
+    IN PECHO_CLIENT          client,
+    IN const UCHAR*          buffer,
+    IN ULONG                 length,
+    IN ECHO_CLIENT_CALLBACK* callback,
+    IN PVOID                 context
+    );
+
+BOOLEAN EchoClientReadAsync(
+    IN PECHO_CLIENT          client,
+    IN PUCHAR                buffer,
+    IN ULONG                 length,
+    IN ECHO_CLIENT_CALLBACK* callback,
+    IN PVOID                 context
+    );
+
+//
+// Sends the batch being filled without waiting for its window
+// Σȴʱ䴰
+//
+VOID EchoClientFlush(IN PECHO_CLIENT client);
+
+//
+// Synchronous calls return a Win32 error code. They do not wait for the
+// batch window: the batch their write joins goes out at once.
+// ͬ÷Win32롣ǲȴʱ䴰ڣд
+//
+ULONG EchoClientWrite(
+    IN  PECHO_CLIENT client,
+    IN  const UCHAR* buffer,
+    IN  ULONG        length,
+    OUT PULONG       transferred
+    );
+
+ULONG EchoClientRead(
+    IN  PECHO_CLIENT client,
+    OUT PUCHAR       buffer,
+    IN  ULONG        length,
+    OUT PULONG       transferred
+    );
+
+//
+// Writes data, reads it back into echo and checks that it came back whole.
+// ERROR_INVALID_DATA if the echo differs, as it will when another caller
+// writes in between.
+// дdataصechoвǷءԲͬʱ
+// ֮д룩ERROR_INVALID_DATA
+//
+ULONG EchoClientEcho(
+    IN  PECHO_CLIENT client,
+    IN  const UCHAR* data,
+    OUT PUCHAR       echo,
+    IN  ULONG        length
+    );
+
+//
+// Echoes count items with one device write carrying all of them and one
+// read, split back into each item's Echo. ERROR_INVALID_DATA if the echo
+// differs. The total must fit the device's largest write.
+// һЯ豸дһζȡcountֻÿEcho
+// ԲͬʱERROR_INVALID_DATAܳȲܳ豸д롣
+//
+ULONG EchoClientEchoBatch(
+    IN     PECHO_CLIENT      client,
+    IN OUT PECHO_CLIENT_ITEM items,
+    IN     ULONG             count
+    );
+
+VOID EchoClientQuery(
+    IN  PECHO_CLIENT       client,
+    OUT PECHO_CLIENT_STATS stats
+    );
+
+//
+// Checks echo, pipelining, coalescing, the batch window, batched echo, the
+// adaptive depth and closing with calls pending against the loopback
+// stand-in. FALSE if a check fails.
+// ڻػϼԡˮߡϲʱ䴰ڡԡӦԼ
+// δɵõĹرաмʧʱFALSE
+//
+BOOLEAN EchoClientSelfTest(VOID);
+
+//
+// Measures synchronous echo, pipelined writes at options->QueueDepth and
+// coalesced writes, each options->BlockSize bytes for options->DurationSec
+// seconds, on an engine from open(context, 0)
+// open(context, 0)򿪵ϲͬԡoptions->QueueDepthȵˮ
+// дԼϲд룬ÿoptions->BlockSizeֽڣoptions->DurationSec
+//
+BOOLEAN EchoClientBench(
+    IN PECHO_BENCH_OPTIONS options,
+    IN ECHO_ENGINE_OPEN*   open,
+    IN PVOID               context
+    );
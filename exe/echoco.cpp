@@ -0,0 +1,793 @@
+/*++
+
+Module Name:
+
+    echoco.cpp
+
+Abstract:
+
+    Coroutine client: the loop, its frame pool, the awaitable operations,
+    the self-test, and the benchmark against the pool-based load generator.
+    Э̿ͻˣѭ֡ءɵȴĲԼ죬Լ̳߳صĸ
+    ԱȵĻ׼ԡ
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#include "echoco.h"
+#include "echoarena.h"
+#include "echohist.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define LOG printf
+
+#ifdef ECHO_CO_SUPPORTED
+
+#include <thread>
+#include <vector>
+
+//
+// Operations the cancellation check keeps in flight, and how long after
+// starting them it asks them to stop
+// ȡ鱣;ĲԼֹͣ
+//
+#define CO_TEST_CANCEL_OPS      64
+#define CO_TEST_CANCEL_AFTER_MS 5
+#define CO_TEST_LENGTH          512
+
+void* EchoCoTask::promise_type::AllocateFrame(EchoCoLoop* loop, size_t size) noexcept
+{
+    return EchoCoLoop::AllocateFrame(loop, size);
+}
+
+void EchoCoTask::promise_type::FreeFrame(void* frame, size_t size)
+{
+    (void)size;
+
+    EchoCoLoop::FreeFrame(frame);
+}
+
+//
+// ʱͷԼ֪֡ͨѭȴתȴ
+//
+std::coroutine_handle<> EchoCoTask::promise_type::FinalAwaiter::await_suspend(
+    std::coroutine_handle<promise_type> handle
+    ) noexcept
+{
+    promise_type& promise = handle.promise();
+    EchoCoLoop* owner = promise.Owner;
+    ULONG error = promise.Error;
+
+    if (owner != NULL) {
+        handle.destroy();
+        owner->TaskDone(error);
+        return std::noop_coroutine();
+    }
+
+    if (promise.Continuation) {
+        return promise.Continuation;
+    }
+
+    return std::noop_coroutine();
+}
+
+EchoCoIo::EchoCoIo(
+    EchoCoLoop*     loop,
+    ECHO_OP         op,
+    BOOLEAN         control,
+    ULONG           code,
+    PUCHAR          buffer,
+    ULONG           length,
+    std::stop_token stop
+    )
+    : m_Loop(loop), m_Control(control), m_Code(code), m_Started(FALSE), m_Done(false),
+      m_Stop(std::move(stop))
+{
+    ZeroMemory(&m_Io, sizeof(m_Io));
+
+    m_Io.Op = op;
+    m_Io.Buffer = buffer;
+    m_Io.Length = length;
+    m_Io.Context = this;
+}
+
+//
+// ֹͣѱܾʱ
+//
+VOID EchoCoIo::Start(VOID)
+{
+    BOOLEAN submitted;
+
+    if (m_Started) {
+        return;
+    }
+    m_Started = TRUE;
+
+    //
+    // A stop requested before the start costs no trip to the device
+    // ǰֹͣĲؾ豸
+    //
+    if (m_Stop.stop_requested()) {
+        m_Io.Error = ERROR_OPERATION_ABORTED;
+        m_Done = true;
+        return;
+    }
+
+    m_Io.IssueNs = EchoNowNs();
+    m_Io.IntendedNs = m_Io.IssueNs;
+
+    if (m_Control) {
+        submitted = m_Loop->m_Engine->Control(&m_Io, m_Code);
+    }
+    else {
+        submitted = m_Loop->m_Engine->Submit(&m_Io);
+    }
+
+    if (!submitted) {
+        m_Done = true;
+        return;
+    }
+
+    m_Loop->m_InFlight++;
+
+    //
+    // Registered only once the engine owns the operation; a stop requested
+    // in between runs the callback right here
+    // ֻӹܲǼǣֹͣڴ˴лص
+    //
+    if (m_Stop.stop_possible()) {
+        m_Cancel.emplace(m_Stop, Canceller{ this });
+    }
+}
+
+//
+// ֹͣ߳
+//
+void EchoCoIo::Canceller::operator()() noexcept
+{
+    Io->m_Loop->m_Engine->Cancel(&Io->m_Io);
+}
+
+//
+// ѭȡɺãעֹͣصָȴ
+//
+VOID EchoCoIo::Complete(VOID)
+{
+    std::coroutine_handle<> waiter = m_Waiter;
+
+    //
+    // Waits for a stop callback running on another thread to return, so
+    // none can touch the operation once the waiter moves on
+    // ȴ߳еֹͣصأʹȴ߼󲻻лصʸò
+    //
+    m_Cancel.reset();
+
+    m_Loop->m_InFlight--;
+    m_Done = true;
+    m_Waiter = NULL;
+
+    if (waiter) {
+        waiter.resume();
+    }
+}
+
+EchoCoLoop::EchoCoLoop(EchoEngine* engine)
+    : m_Engine(engine), m_Live(0), m_Failed(0), m_InFlight(0), m_Blocks(NULL), m_Free(NULL)
+{
+    ZeroMemory(&m_Frames, sizeof(m_Frames));
+}
+
+EchoCoLoop::~EchoCoLoop()
+{
+    //
+    // A frame still in use belongs to a task that never finished; its
+    // block cannot be given back
+    // ʹõ֡δ鲻ܹ黹
+    //
+    if (m_Frames.InUse != 0) {
+        LOG("EchoCoLoop: %d coroutine frames still in use\n", m_Frames.InUse);
+        return;
+    }
+
+    delete[] m_Blocks;
+}
+
+BOOLEAN EchoCoLoop::Init(ULONG frames)
+{
+    size_t stride = sizeof(FRAME_HEADER) + ECHO_CO_FRAME_BYTES;
+    FRAME_HEADER* header;
+    ULONG i;
+
+    m_Blocks = new (std::nothrow) UCHAR[stride * frames];
+    if (m_Blocks == NULL) {
+        LOG("EchoCoLoop: Cannot allocate %d coroutine frames\n", frames);
+        return FALSE;
+    }
+
+    for (i = frames; i > 0; i--) {
+        header = (FRAME_HEADER*)(m_Blocks + stride * (i - 1));
+        header->Loop = this;
+        header->Pooled = TRUE;
+        header->Next = m_Free;
+        m_Free = header;
+    }
+
+    m_Frames.Blocks = frames;
+    m_Frames.BlockBytes = ECHO_CO_FRAME_BYTES;
+
+    return TRUE;
+}
+
+//
+// loopĳȡһ֡ѿա֡κѭʱӶѷ
+//
+PVOID EchoCoLoop::AllocateFrame(EchoCoLoop* loop, size_t size)
+{
+    FRAME_HEADER* header;
+
+    if (loop != NULL && loop->m_Free != NULL && size <= ECHO_CO_FRAME_BYTES) {
+        header = loop->m_Free;
+        loop->m_Free = header->Next;
+        loop->m_Frames.Pooled++;
+    }
+    else {
+        header = (FRAME_HEADER*)::operator new(sizeof(FRAME_HEADER) + size, std::nothrow);
+        if (header == NULL) {
+            return NULL;
+        }
+        header->Loop = loop;
+        header->Pooled = FALSE;
+
+        if (loop != NULL) {
+            loop->m_Frames.Heap++;
+        }
+    }
+
+    if (loop != NULL) {
+        loop->m_Frames.InUse++;
+    }
+
+    return header + 1;
+}
+
+VOID EchoCoLoop::FreeFrame(PVOID frame)
+{
+    FRAME_HEADER* header = (FRAME_HEADER*)frame - 1;
+    EchoCoLoop* loop = header->Loop;
+
+    if (loop != NULL) {
+        loop->m_Frames.InUse--;
+    }
+
+    if (header->Pooled) {
+        header->Next = loop->m_Free;
+        loop->m_Free = header;
+    }
+    else {
+        ::operator delete(header);
+    }
+}
+
+BOOLEAN EchoCoLoop::Spawn(EchoCoTask task)
+{
+    std::coroutine_handle<EchoCoTask::promise_type> handle = task.m_Handle;
+
+    if (!handle) {
+        LOG("EchoCoLoop: Cannot allocate a coroutine frame\n");
+        return FALSE;
+    }
+
+    //
+    // The task now frees itself when it returns
+    // ˺񷵻ʱͷ
+    //
+    task.m_Handle = NULL;
+    handle.promise().Owner = this;
+    m_Live++;
+
+    handle.resume();
+
+    return TRUE;
+}
+
+VOID EchoCoLoop::TaskDone(ULONG error)
+{
+    m_Live--;
+
+    if (error != ERROR_SUCCESS) {
+        m_Failed++;
+    }
+}
+
+BOOLEAN EchoCoLoop::Run(ULONG stallMs)
+{
+    PECHO_IO completed[ECHO_REAP_MAX];
+    ULONG failed;
+    ULONG count;
+    ULONG i;
+
+    while (m_Live != 0) {
+
+        if (m_InFlight == 0) {
+            LOG("EchoCoLoop: %d tasks wait with nothing in flight\n", m_Live);
+            m_Failed = 0;
+            return FALSE;
+        }
+
+        count = m_Engine->Reap(completed, ECHO_REAP_MAX, stallMs);
+        if (count == 0) {
+            LOG("EchoCoLoop: No completion in %d ms with %d operations in flight\n", stallMs, m_InFlight);
+            m_Failed = 0;
+            return FALSE;
+        }
+
+        //
+        // Each completion resumes its coroutine, which runs on until its
+        // next wait, often starting the next operation on the way
+        // ÿɻָЭ̣Эеһεȴ;ͨᷢһ
+        //
+        for (i = 0; i < count; i++) {
+            ((EchoCoIo*)completed[i]->Context)->Complete();
+        }
+    }
+
+    //
+    // Errors count once, for the Run that saw the tasks return
+    // ֻ뿴񷵻صǴRun
+    //
+    failed = m_Failed;
+    m_Failed = 0;
+
+    return (failed == 0) ? TRUE : FALSE;
+}
+
+VOID EchoCoLoop::FrameStats(OUT PECHO_CO_FRAME_STATS stats)
+{
+    *stats = m_Frames;
+}
+
+//
+// ˮʽдͶ߶ŵȴȡ뷵д
+//
+static EchoCoTask CoTestEcho(EchoCoLoop& loop, PUCHAR buffer, ULONG length)
+{
+    ECHO_CO_RESULT written;
+    ECHO_CO_RESULT read;
+    ULONG i;
+
+    for (i = 0; i < length; i++) {
+        buffer[i] = (UCHAR)(i * 7 + 1);
+    }
+    ZeroMemory(buffer + length, length);
+
+    EchoCoIo write = loop.Write(buffer, length);
+    EchoCoIo readBack = loop.Read(buffer + length, length);
+
+    write.Start();
+    readBack.Start();
+
+    written = co_await write;
+    read = co_await readBack;
+
+    if (written.Error != ERROR_SUCCESS || written.Transferred != length) {
+        LOG("Coroutine write failed %d, %d of %d bytes\n", written.Error, written.Transferred, length);
+        co_return ERROR_INVALID_PARAMETER;
+    }
+
+    if (read.Error != ERROR_SUCCESS || read.Transferred != length ||
+        memcmp(buffer, buffer + length, length) != 0) {
+        LOG("Coroutine read failed %d, %d of %d bytes, or did not echo the write\n",
+            read.Error, read.Transferred, length);
+        co_return ERROR_INVALID_PARAMETER;
+    }
+
+    co_return ERROR_SUCCESS;
+}
+
+//
+// 뷵ȫ
+//
+static EchoCoTask CoTestControl(EchoCoLoop& loop, ULONG code, PUCHAR buffer, ULONG length)
+{
+    ECHO_CO_RESULT result = co_await loop.Ioctl(code, buffer, length);
+
+    if (result.Error != ERROR_SUCCESS || result.Transferred != length) {
+        LOG("Coroutine control failed %d, %d of %d bytes\n", result.Error, result.Transferred, length);
+        co_return ERROR_INVALID_PARAMETER;
+    }
+
+    co_return ERROR_SUCCESS;
+}
+
+typedef struct _CO_TEST_CANCEL {
+    ULONG Aborted;
+    ULONG Completed;
+} CO_TEST_CANCEL, *PCO_TEST_CANCEL;
+
+//
+// һȡĶȡɶԣ󲻿
+//
+static EchoCoTask CoTestCancelRead(
+    EchoCoLoop&     loop,
+    PUCHAR          buffer,
+    ULONG           length,
+    std::stop_token stop,
+    PCO_TEST_CANCEL counts
+    )
+{
+    ECHO_CO_RESULT result = co_await loop.Read(buffer, length, stop);
+
+    if (result.Error == ERROR_OPERATION_ABORTED) {
+        counts->Aborted++;
+    }
+    else if (result.Error == ERROR_SUCCESS) {
+        counts->Completed++;
+    }
+    else {
+        LOG("Cancellable read failed %d\n", result.Error);
+        co_return result.Error;
+    }
+
+    co_return ERROR_SUCCESS;
+}
+
+//
+// ֹͣʱĲ豸ERROR_OPERATION_ABORTED
+//
+static EchoCoTask CoTestStopped(EchoCoLoop& loop, PUCHAR buffer, ULONG length)
+{
+    std::stop_source stopped;
+    ECHO_CO_RESULT result;
+
+    stopped.request_stop();
+
+    result = co_await loop.Read(buffer, length, stopped.get_token());
+
+    if (result.Error != ERROR_OPERATION_ABORTED || result.Transferred != 0) {
+        LOG("Read after the stop returned %d, not ERROR_OPERATION_ABORTED\n", result.Error);
+        co_return ERROR_INVALID_PARAMETER;
+    }
+
+    co_return ERROR_SUCCESS;
+}
+
+//
+// и飬ÿ鶼ѭſ
+//
+BOOLEAN EchoCoSelfTest(
+    IN EchoEngine* engine,
+    IN ULONG       controlCode,
+    IN ULONG       controlLength
+    )
+{
+    EchoCoLoop loop(engine);
+    ECHO_CO_FRAME_STATS frames;
+    CO_TEST_CANCEL counts = {};
+    std::stop_source stop;
+    std::vector<UCHAR> buffer;
+    ULONG length = CO_TEST_LENGTH;
+    ULONG i;
+    BOOLEAN result = TRUE;
+
+    if (!loop.Init(ECHO_CO_FRAMES)) {
+        return FALSE;
+    }
+
+    buffer.resize(((controlLength > length * 2) ? controlLength : length * 2) + length * CO_TEST_CANCEL_OPS);
+
+    if (!loop.Spawn(CoTestEcho(loop, &buffer[0], length)) || !loop.Run(ECHO_CO_STALL_MS)) {
+        LOG("Pipelined write and read: failed\n");
+        result = FALSE;
+    }
+    else {
+        LOG("Pipelined write and read: ok\n");
+    }
+
+    if (!loop.Spawn(CoTestControl(loop, controlCode, &buffer[0], controlLength)) || !loop.Run(ECHO_CO_STALL_MS)) {
+        LOG("Control request: failed\n");
+        result = FALSE;
+    }
+    else {
+        LOG("Control request: ok\n");
+    }
+
+    //
+    // Nothing is in flight, so Run has nothing to wait for; the task must
+    // have finished within Spawn
+    // û;RunȴSpawnн
+    //
+    if (!loop.Spawn(CoTestStopped(loop, &buffer[0], length)) || !loop.Run(ECHO_CO_STALL_MS)) {
+        LOG("Stop before start: failed\n");
+        result = FALSE;
+    }
+    else {
+        LOG("Stop before start: ok\n");
+    }
+
+    //
+    // The reads queue behind each other on the device; a stop requested
+    // from another thread while they wait must finish the waiting ones
+    // 豸Ŷӣȴڼһֹ߳ͣڵȴĶ
+    //
+    for (i = 0; i < CO_TEST_CANCEL_OPS; i++) {
+        if (!loop.Spawn(CoTestCancelRead(loop, &buffer[(size_t)length * (2 + i)], length,
+                                         stop.get_token(), &counts))) {
+            result = FALSE;
+        }
+    }
+
+    std::thread stopper([&stop]() {
+        EchoSleepMs(CO_TEST_CANCEL_AFTER_MS);
+        stop.request_stop();
+    });
+
+    if (!loop.Run(ECHO_CO_STALL_MS) || counts.Aborted == 0 ||
+        counts.Aborted + counts.Completed != CO_TEST_CANCEL_OPS) {
+        LOG("Stop in flight: failed, %d of %d reads aborted, %d completed\n",
+            counts.Aborted, CO_TEST_CANCEL_OPS, counts.Completed);
+        result = FALSE;
+    }
+    else {
+        LOG("Stop in flight: ok, %d of %d reads aborted\n", counts.Aborted, CO_TEST_CANCEL_OPS);
+    }
+
+    stopper.join();
+
+    loop.FrameStats(&frames);
+    if (frames.InUse != 0 || frames.Heap != 0) {
+        LOG("Coroutine frames: failed, %d still in use, %llu from the heap\n", frames.InUse, frames.Heap);
+        result = FALSE;
+    }
+    else {
+        LOG("Coroutine frames: ok, %llu from the pool, none from the heap\n", frames.Pooled);
+    }
+
+    return result;
+}
+
+typedef struct _CO_BENCH {
+    PECHO_BENCH_OPTIONS Options;
+    ULONGLONG           DeadlineNs;
+    ULONGLONG           Rng;
+    ULONGLONG           Ops;
+    ULONGLONG           Bytes;
+    ULONGLONG           Errors;
+    ECHO_HISTOGRAM      LatencyNs;
+} CO_BENCH, *PCO_BENCH;
+
+//
+// xorshift64*븺ѡķʽͬ
+//
+static ULONGLONG CoBenchRandom(ULONGLONG* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+//
+// һһЭ̣֡ѭĳ
+//
+static EchoCoTask CoBenchOne(EchoCoLoop& loop, ECHO_OP op, PUCHAR buffer, ULONG length)
+{
+    ECHO_CO_RESULT result;
+
+    if (op == EchoOpWrite) {
+        result = co_await loop.Write(buffer, length);
+    }
+    else {
+        result = co_await loop.Read(buffer, length);
+    }
+
+    co_return result.Error;
+}
+
+//
+// һ;ֹۣʱǰдϷ
+//
+static EchoCoTask CoBenchPipeline(EchoCoLoop& loop, PCO_BENCH bench, PUCHAR buffer)
+{
+    ULONG length = bench->Options->BlockSize;
+    ULONGLONG startNs;
+    ULONG error;
+    ECHO_OP op;
+
+    while (EchoNowNs() < bench->DeadlineNs) {
+
+        op = (CoBenchRandom(&bench->Rng) % 100 < bench->Options->ReadPercent) ? EchoOpRead : EchoOpWrite;
+        startNs = EchoNowNs();
+
+        error = co_await CoBenchOne(loop, op, buffer, length);
+
+        EchoHistRecord(&bench->LatencyNs, EchoNowNs() - startNs);
+        if (error != ERROR_SUCCESS) {
+            bench->Errors++;
+        }
+        else {
+            bench->Ops++;
+            bench->Bytes += length;
+        }
+    }
+
+    co_return ERROR_SUCCESS;
+}
+
+//
+// ӡһнȽϵĸʽͬ
+//
+static VOID CoBenchPrintLine(
+    PCSTR     name,
+    double    opsPerSec,
+    double    mbPerSec,
+    double    p50Us,
+    double    p99Us,
+    double    p999Us,
+    double    cpuUsPerOp,
+    ULONGLONG errors
+    )
+{
+    LOG("%-12s %11.1f %9.2f %9.1f %9.1f %9.1f %11.2f %7llu\n",
+        name, opsPerSec, mbPerSec, p50Us, p99Us, p999Us, cpuUsPerOp, errors);
+}
+
+BOOLEAN EchoCoBench(
+    IN PECHO_BENCH_OPTIONS options,
+    IN ECHO_ENGINE_OPEN*   open,
+    IN PVOID               context
+    )
+{
+    ECHO_BENCH_OPTIONS single = *options;
+    ECHO_BENCH_RESULT raw;
+    ECHO_CO_FRAME_STATS frames;
+    std::vector<PUCHAR> buffers;
+    EchoEngine* engine;
+    CO_BENCH bench = {};
+    ULONGLONG cpuNs;
+    ULONGLONG startNs;
+    double seconds;
+    ULONG frameCount;
+    ULONG i;
+    BOOLEAN result;
+
+    if (options->Rate != 0 || options->ReplayPath != NULL || options->RecordPath != NULL ||
+        options->ScaleWorkers != 0) {
+        LOG("The coroutine comparison runs a closed loop without -rate, -replay, -record or -scale\n");
+        return FALSE;
+    }
+
+    //
+    // One thread each way, a single pool worker against a single loop, and
+    // neither pays for verification
+    // ַʽһ̣̳߳߳ع̶߳ԵѭҶУ
+    //
+    single.Threads = 1;
+    single.Workers = 1;
+    single.Devices = 1;
+    single.Verify = 0;
+
+    LOG("Comparing the load generator with coroutines: 1 thread, queue depth %d, %d bytes, "
+        "%d%% reads, %d seconds each, no verification, CPU time of the whole process\n",
+        single.QueueDepth, single.BlockSize, single.ReadPercent, single.DurationSec);
+    LOG("%-12s %11s %9s %9s %9s %9s %11s %7s\n",
+        "client", "IOPS", "MB/s", "p50(us)", "p99(us)", "p99.9(us)", "cpu(us/op)", "errors");
+
+    cpuNs = EchoCpuTimeNs();
+    result = EchoBenchMeasure(&single, open, context, &raw);
+    cpuNs = EchoCpuTimeNs() - cpuNs;
+
+    CoBenchPrintLine("pool", raw.OpsPerSec, raw.MBPerSec, raw.P50Us, raw.P99Us, raw.P999Us,
+                     (raw.OpsPerSec != 0) ? cpuNs / 1000.0 / (raw.OpsPerSec * single.DurationSec) : 0,
+                     raw.Errors);
+
+    engine = open(context, 0);
+    if (engine == NULL) {
+        return FALSE;
+    }
+
+    //
+    // Every slot holds its pipeline's frame and the frame of the operation
+    // it waits on
+    // ÿռˮߵ֡Լȴ֡
+    //
+    frameCount = (single.QueueDepth * 2 > ECHO_CO_FRAMES) ? single.QueueDepth * 2 : ECHO_CO_FRAMES;
+
+    {
+        EchoCoLoop loop(engine);
+
+        if (!loop.Init(frameCount)) {
+            delete engine;
+            return FALSE;
+        }
+
+        for (i = 0; i < single.QueueDepth; i++) {
+            buffers.push_back(EchoArenaAlloc(single.BlockSize));
+            if (buffers.back() == NULL) {
+                LOG("Cannot allocate the coroutine buffers\n");
+                result = FALSE;
+                break;
+            }
+        }
+
+        bench.Options = &single;
+        bench.Rng = 0x9E3779B97F4A7C15ULL;
+        bench.LatencyNs.Min = ~0ULL;
+
+        cpuNs = EchoCpuTimeNs();
+        startNs = EchoNowNs();
+        bench.DeadlineNs = startNs + (ULONGLONG)single.DurationSec * 1000000000ULL;
+
+        for (i = 0; i < buffers.size() && buffers[i] != NULL; i++) {
+            if (!loop.Spawn(CoBenchPipeline(loop, &bench, buffers[i]))) {
+                result = FALSE;
+            }
+        }
+
+        result = loop.Run(ECHO_CO_STALL_MS) && result;
+
+        seconds = (EchoNowNs() - startNs) / 1e9;
+        cpuNs = EchoCpuTimeNs() - cpuNs;
+
+        CoBenchPrintLine("coroutine",
+                         bench.Ops / seconds,
+                         bench.Bytes / seconds / (1024 * 1024),
+                         EchoHistPercentile(&bench.LatencyNs, 50) / 1000.0,
+                         EchoHistPercentile(&bench.LatencyNs, 99) / 1000.0,
+                         EchoHistPercentile(&bench.LatencyNs, 99.9) / 1000.0,
+                         (bench.Ops != 0) ? cpuNs / 1000.0 / bench.Ops : 0,
+                         bench.Errors);
+
+        loop.FrameStats(&frames);
+        LOG("Coroutine frames: %llu for %llu operations, %llu from the heap; pool of %d blocks of %d bytes\n",
+            frames.Pooled + frames.Heap, bench.Ops + bench.Errors, frames.Heap, frames.Blocks, frames.BlockBytes);
+    }
+
+    for (i = 0; i < buffers.size() && buffers[i] != NULL; i++) {
+        EchoArenaFree(buffers[i], single.BlockSize);
+    }
+
+    delete engine;
+
+    return result && bench.Errors == 0;
+}
+
+#else
+
+BOOLEAN EchoCoSelfTest(
+    IN EchoEngine* engine,
+    IN ULONG       controlCode,
+    IN ULONG       controlLength
+    )
+{
+    (void)engine;
+    (void)controlCode;
+    (void)controlLength;
+
+    LOG("The coroutine client needs a C++20 compiler\n");
+
+    return FALSE;
+}
+
+BOOLEAN EchoCoBench(
+    IN PECHO_BENCH_OPTIONS options,
+    IN ECHO_ENGINE_OPEN*   open,
+    IN PVOID               context
+    )
+{
+    (void)options;
+    (void)open;
+    (void)context;
+
+    LOG("The coroutine client needs a C++20 compiler\n");
+
+    return FALSE;
+}
+
+#endif
@@ -0,0 +1,398 @@
+/*++
+
+Module Name:
+
+    echoco.h
+
+Abstract:
+
+    Coroutine client for the echo device (C++20). A loop runs on one
+    thread over an engine: the completion port on Windows, the epoll
+    stand-in on Linux. Reads, writes and controls are awaitable; each
+    holds its ECHO_IO in the awaiting coroutine's frame and resumes it
+    when the loop reaps the completion. An operation can be started before
+    it is awaited, so one coroutine can keep several in flight, and an
+    operation given a stop token is cancelled through the engine when a
+    stop is requested. Coroutine frames come from a fixed pool owned by
+    the loop, so a loop in steady state allocates nothing per operation.
+    Compilers without coroutines see only the self-test and the benchmark,
+    which then report that they are unavailable.
+    豸Э̿ͻˣC++20ѭһ߳ϻУWindows
+    ɶ˿ڣLinuxepollдͿ󶼿co_awaitÿ
+    ECHO_IOλڵȴЭ֡УѭȡɺָЭ̡ڵȴ֮ǰ
+    һЭ̿Աֶ;ֹͣƵĲֹͣʱ
+    ȡЭ֡ѭӵеĹ̶أ̬µѭΪÿڴ档
+    ֧Э̵ıֻܿԼͻ׼ԣǻᱨ治á
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#pragma once
+
+#include "echobench.h"
+
+#if defined(__cpp_impl_coroutine)
+#define ECHO_CO_SUPPORTED   1
+#endif
+
+//
+// Frames the loop pools, and the largest frame a pool block holds; larger
+// frames, and frames past the pool, come from the heap and are counted
+// ѭе֡Լؿɵ֡֡ͳص֡ԶѲ
+//
+#define ECHO_CO_FRAMES          256
+#define ECHO_CO_FRAME_BYTES     1024
+
+//
+// Time Run waits for a completion before it gives up on the operations
+// in flight
+// Runȴɵʱ䣬;
+//
+#define ECHO_CO_STALL_MS        10000
+
+typedef struct _ECHO_CO_FRAME_STATS {
+    ULONGLONG Pooled;           // frames taken from the pool
+    ULONGLONG Heap;             // frames the pool could not hold
+    ULONG     InUse;
+    ULONG     Blocks;
+    ULONG     BlockBytes;
+} ECHO_CO_FRAME_STATS, *PECHO_CO_FRAME_STATS;
+
+//
+// Checks a pipelined write and read, a control, and cancellation before
+// and during an operation on engine, and that every frame went back to
+// the pool. controlCode is sent with a controlLength-byte buffer and must
+// complete with all of it. FALSE if a check fails.
+// engineϼˮʽдͶ󡢲ǰͽеȡԼ
+// ֡ѹ黹СcontrolCodecontrolLengthֽڵĻͣʱ
+// ȫֽڡмʧʱFALSE
+//
+BOOLEAN EchoCoSelfTest(
+    IN EchoEngine* engine,
+    IN ULONG       controlCode,
+    IN ULONG       controlLength
+    );
+
+//
+// Runs the workload of options on one thread twice, with the pool-based
+// load generator and with a coroutine per operation in flight, and prints
+// both with the CPU time per operation and the frames the coroutines took
+// һ߳ϽoptionsĸΣһʹû̳߳صĸ
+// һÿ;һЭ̣ӡߵĽÿCPUʱԼЭõ֡
+//
+BOOLEAN EchoCoBench(
+    IN PECHO_BENCH_OPTIONS options,
+    IN ECHO_ENGINE_OPEN*   open,
+    IN PVOID               context
+    );
+
+#ifdef ECHO_CO_SUPPORTED
+
+#include <coroutine>
+#include <cstddef>
+#include <new>
+#include <optional>
+#include <stop_token>
+
+class EchoCoLoop;
+
+typedef struct _ECHO_CO_RESULT {
+    ULONG Error;                // Win32 error code
+    ULONG Transferred;
+} ECHO_CO_RESULT, *PECHO_CO_RESULT;
+
+//
+// A lazily started coroutine returning a Win32 error code. Awaiting it
+// runs it to the end; EchoCoLoop::Spawn runs it detached.
+// ӳWin32Э̡ȴὫе
+// EchoCoLoop::SpawnԷ뷽ʽ
+//
+class EchoCoTask
+{
+public:
+    struct promise_type {
+        std::coroutine_handle<> Continuation;
+        EchoCoLoop*             Owner = NULL;   // set when spawned
+        ULONG                   Error = ERROR_SUCCESS;
+
+        //
+        // Frames of coroutines whose first parameter is the loop come
+        // from its pool; any other frame comes from the heap
+        // һΪѭЭ̣֡ѭĳأ֡Զ
+        //
+        template <typename... Args>
+        static void* operator new(size_t size, EchoCoLoop& loop, Args&...) noexcept
+        {
+            return AllocateFrame(&loop, size);
+        }
+
+        static void* operator new(size_t size) noexcept
+        {
+            return AllocateFrame(NULL, size);
+        }
+
+        static void operator delete(void* frame, size_t size)
+        {
+            FreeFrame(frame, size);
+        }
+
+        static EchoCoTask get_return_object_on_allocation_failure()
+        {
+            return EchoCoTask();
+        }
+
+        EchoCoTask get_return_object()
+        {
+            return EchoCoTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept
+            {
+                return false;
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept;
+
+            void await_resume() noexcept
+            {
+            }
+        };
+
+        FinalAwaiter final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_value(ULONG error)
+        {
+            Error = error;
+        }
+
+        void unhandled_exception()
+        {
+            Error = ERROR_INVALID_PARAMETER;
+        }
+
+    private:
+        static void* AllocateFrame(EchoCoLoop* loop, size_t size) noexcept;
+
+        static void FreeFrame(void* frame, size_t size);
+    };
+
+    EchoCoTask() : m_Handle(NULL)
+    {
+    }
+
+    EchoCoTask(EchoCoTask&& other) noexcept : m_Handle(other.m_Handle)
+    {
+        other.m_Handle = NULL;
+    }
+
+    EchoCoTask(const EchoCoTask&) = delete;
+    EchoCoTask& operator=(const EchoCoTask&) = delete;
+
+    ~EchoCoTask()
+    {
+        if (m_Handle) {
+            m_Handle.destroy();
+        }
+    }
+
+    //
+    // FALSE if the frame could not be allocated
+    // ֡޷ʱΪFALSE
+    //
+    BOOLEAN Valid() const
+    {
+        return m_Handle ? TRUE : FALSE;
+    }
+
+    bool await_ready() noexcept
+    {
+        return !m_Handle;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        m_Handle.promise().Continuation = awaiting;
+
+        return m_Handle;
+    }
+
+    ULONG await_resume() noexcept
+    {
+        return m_Handle ? m_Handle.promise().Error : ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+private:
+    friend class EchoCoLoop;
+
+    explicit EchoCoTask(std::coroutine_handle<promise_type> handle) : m_Handle(handle)
+    {
+    }
+
+    std::coroutine_handle<promise_type> m_Handle;
+};
+
+//
+// One read, write or control. It is started by Start or by being awaited,
+// and once started it must be awaited before it goes out of scope; the
+// ECHO_IO the engine works on lives inside it.
+// һдStart򱻵ȴʱ𣬷뿪֮ǰȴ
+// ECHO_IOС
+//
+class EchoCoIo
+{
+public:
+    EchoCoIo(EchoCoLoop* loop, ECHO_OP op, BOOLEAN control, ULONG code, PUCHAR buffer, ULONG length,
+             std::stop_token stop);
+
+    EchoCoIo(const EchoCoIo&) = delete;
+    EchoCoIo& operator=(const EchoCoIo&) = delete;
+
+    //
+    // Sends the operation now; awaiting it later collects the result
+    // ֮ȴȡý
+    //
+    VOID Start(VOID);
+
+    bool await_ready() noexcept
+    {
+        Start();
+
+        return m_Done;
+    }
+
+    void await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        m_Waiter = awaiting;
+    }
+
+    ECHO_CO_RESULT await_resume() noexcept
+    {
+        ECHO_CO_RESULT result;
+
+        result.Error = m_Io.Error;
+        result.Transferred = m_Io.Transferred;
+
+        return result;
+    }
+
+private:
+    friend class EchoCoLoop;
+
+    struct Canceller {
+        EchoCoIo* Io;
+
+        void operator()() noexcept;
+    };
+
+    VOID Complete(VOID);
+
+    EchoCoLoop*                                  m_Loop;
+    ECHO_IO                                      m_Io;
+    BOOLEAN                                      m_Control;
+    ULONG                                        m_Code;
+    BOOLEAN                                      m_Started;
+    bool                                         m_Done;
+    std::coroutine_handle<>                      m_Waiter;
+    std::stop_token                              m_Stop;
+    std::optional<std::stop_callback<Canceller>> m_Cancel;     // while in flight
+};
+
+//
+// Runs coroutines over engine on the calling thread. Every coroutine of a
+// loop runs on the thread in Run; only stop requests may come from others.
+// ڵ߳ϻengineЭ̡ѭЭ̶ڵRun߳У
+// ֹֻ̡ͣ߳
+//
+class EchoCoLoop
+{
+public:
+    explicit EchoCoLoop(EchoEngine* engine);
+
+    ~EchoCoLoop();
+
+    //
+    // Allocates the frame pool. FALSE without memory.
+    // ֡ءڴ治ʱFALSE
+    //
+    BOOLEAN Init(ULONG frames);
+
+    //
+    // Starts task detached; it runs until its first wait at once. FALSE
+    // if its frame could not be allocated.
+    // Է뷽ʽtaskеһεȴ֡޷ʱFALSE
+    //
+    BOOLEAN Spawn(EchoCoTask task);
+
+    //
+    // Delivers completions until every spawned task has returned. FALSE if
+    // a task returned an error, or if the tasks left wait on nothing or see
+    // no completion for stallMs.
+    // ֱзѷء񷵻ش󣬻ʣ񲻵ȴκ
+    // stallMsûκʱFALSE
+    //
+    BOOLEAN Run(ULONG stallMs);
+
+    EchoCoIo Write(PUCHAR buffer, ULONG length, std::stop_token stop = std::stop_token())
+    {
+        return EchoCoIo(this, EchoOpWrite, FALSE, 0, buffer, length, stop);
+    }
+
+    EchoCoIo Read(PUCHAR buffer, ULONG length, std::stop_token stop = std::stop_token())
+    {
+        return EchoCoIo(this, EchoOpRead, FALSE, 0, buffer, length, stop);
+    }
+
+    //
+    // buffer holds the input and receives the output
+    // buffer벢
+    //
+    EchoCoIo Ioctl(ULONG code, PUCHAR buffer, ULONG length, std::stop_token stop = std::stop_token())
+    {
+        return EchoCoIo(this, EchoOpRead, TRUE, code, buffer, length, stop);
+    }
+
+    VOID FrameStats(OUT PECHO_CO_FRAME_STATS stats);
+
+private:
+    friend struct EchoCoTask::promise_type;
+    friend class EchoCoIo;
+
+    //
+    // Precedes every frame, padded so the frame keeps the alignment of new
+    // λÿ֮֡ǰʹ֡newĶ
+    //
+    struct alignas(std::max_align_t) FRAME_HEADER {
+        EchoCoLoop*   Loop;         // NULL for a frame of no loop
+        FRAME_HEADER* Next;         // in the free list
+        BOOLEAN       Pooled;
+    };
+
+    static PVOID AllocateFrame(EchoCoLoop* loop, size_t size);
+
+    static VOID FreeFrame(PVOID frame);
+
+    VOID TaskDone(ULONG error);
+
+    EchoEngine*         m_Engine;
+    ULONG               m_Live;         // spawned tasks not yet returned
+    ULONG               m_Failed;       // of which returned an error
+    ULONG               m_InFlight;
+    PUCHAR              m_Blocks;
+    FRAME_HEADER*       m_Free;
+    ECHO_CO_FRAME_STATS m_Frames;
+};
+
+#endif
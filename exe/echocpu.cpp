@@ -0,0 +1,217 @@
+/*++
+
+Module Name:
+
+    echocpu.cpp
+
+Abstract:
+
+    CPU time, context switch and cycle counters of the process and of a
+    thread, and the host account of the stand-ins' device threads.
+    ̵̺߳CPUʱ䡢лڼԼ豸̵߳˻
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#include "echocpu.h"
+
+#include <mutex>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+//
+// Spent by the device threads that have exited
+// ˳豸̵߳Ŀ
+//
+static std::mutex      CpuHostLock;
+static ECHO_CPU_SAMPLE CpuHost;
+static BOOLEAN         CpuHostAdded;
+
+#ifdef _WIN32
+
+//
+// FILETIME100Ϊλ
+//
+static ULONGLONG CpuFileTimeNs(const FILETIME* time)
+{
+    return (((ULONGLONG)time->dwHighDateTime << 32) | time->dwLowDateTime) * 100;
+}
+
+#endif
+
+#ifdef __linux__
+
+//
+// ڼȳ԰ں̬ϵͳʱֻͳû̬ʧʱ-1
+//
+static int CpuOpenCycles(BOOLEAN thread, PULONG valid)
+{
+    struct perf_event_attr attr;
+    int fd;
+
+    ZeroMemory(&attr, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.inherit = thread ? 0 : 1;
+    attr.exclude_hv = 1;
+
+    //
+    // pid 0 is the calling thread; inherit adds the threads it creates
+    // pidΪ0ʾ̣߳inherit߳
+    //
+    fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd != -1) {
+        *valid |= ECHO_CPU_CYCLES;
+        return fd;
+    }
+
+    //
+    // A perf_event_paranoid of 2 still allows user mode
+    // perf_event_paranoidΪ2ʱͳû̬
+    //
+    attr.exclude_kernel = 1;
+    fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd != -1) {
+        *valid |= ECHO_CPU_CYCLES | ECHO_CPU_USER_CYCLES;
+    }
+
+    return fd;
+}
+
+#endif
+
+VOID EchoCpuOpen(OUT PECHO_CPU_COUNTER counter, IN BOOLEAN thread)
+{
+    counter->Thread = thread;
+    counter->Valid = 0;
+    counter->CycleFd = -1;
+
+#ifdef _WIN32
+    ULONG64 cycles;
+
+    if (thread ? QueryThreadCycleTime(GetCurrentThread(), &cycles) :
+                 QueryProcessCycleTime(GetCurrentProcess(), &cycles)) {
+        counter->Valid |= ECHO_CPU_CYCLES;
+    }
+#else
+    counter->Valid |= ECHO_CPU_SWITCHES;
+#ifdef __linux__
+    counter->CycleFd = CpuOpenCycles(thread, &counter->Valid);
+#endif
+#endif
+}
+
+VOID EchoCpuRead(IN const ECHO_CPU_COUNTER* counter, OUT PECHO_CPU_SAMPLE sample)
+{
+    ZeroMemory(sample, sizeof(*sample));
+    sample->Valid = counter->Valid;
+
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    ULONG64 cycles = 0;
+
+    if (counter->Thread ? GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user) :
+                          GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+        sample->UserNs = CpuFileTimeNs(&user);
+        sample->KernelNs = CpuFileTimeNs(&kernel);
+    }
+
+    if ((counter->Valid & ECHO_CPU_CYCLES) != 0) {
+        if (counter->Thread) {
+            QueryThreadCycleTime(GetCurrentThread(), &cycles);
+        }
+        else {
+            QueryProcessCycleTime(GetCurrentProcess(), &cycles);
+        }
+        sample->Cycles = cycles;
+    }
+#else
+    struct rusage usage;
+
+#ifdef RUSAGE_THREAD
+    if (getrusage(counter->Thread ? RUSAGE_THREAD : RUSAGE_SELF, &usage) == 0) {
+#else
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#endif
+        sample->UserNs = (ULONGLONG)usage.ru_utime.tv_sec * 1000000000ULL +
+                         (ULONGLONG)usage.ru_utime.tv_usec * 1000;
+        sample->KernelNs = (ULONGLONG)usage.ru_stime.tv_sec * 1000000000ULL +
+                           (ULONGLONG)usage.ru_stime.tv_usec * 1000;
+        sample->Switches = (ULONGLONG)usage.ru_nvcsw;
+        sample->Preemptions = (ULONGLONG)usage.ru_nivcsw;
+    }
+
+#ifdef __linux__
+    if (counter->CycleFd != -1 &&
+        read(counter->CycleFd, &sample->Cycles, sizeof(sample->Cycles)) != sizeof(sample->Cycles)) {
+        sample->Cycles = 0;
+        sample->Valid &= ~(ECHO_CPU_CYCLES | ECHO_CPU_USER_CYCLES);
+    }
+#endif
+#endif
+}
+
+VOID EchoCpuClose(IN OUT PECHO_CPU_COUNTER counter)
+{
+#ifdef __linux__
+    if (counter->CycleFd != -1) {
+        close(counter->CycleFd);
+    }
+#endif
+    counter->CycleFd = -1;
+    counter->Valid = 0;
+}
+
+//
+// ʱ0
+//
+static ULONGLONG CpuDelta(ULONGLONG end, ULONGLONG start)
+{
+    return (end > start) ? end - start : 0;
+}
+
+VOID EchoCpuSubtract(IN OUT PECHO_CPU_SAMPLE sample, IN const ECHO_CPU_SAMPLE* start)
+{
+    sample->UserNs = CpuDelta(sample->UserNs, start->UserNs);
+    sample->KernelNs = CpuDelta(sample->KernelNs, start->KernelNs);
+    sample->Switches = CpuDelta(sample->Switches, start->Switches);
+    sample->Preemptions = CpuDelta(sample->Preemptions, start->Preemptions);
+    sample->Cycles = CpuDelta(sample->Cycles, start->Cycles);
+}
+
+VOID EchoCpuHostAdd(IN const ECHO_CPU_SAMPLE* sample)
+{
+    std::lock_guard<std::mutex> lock(CpuHostLock);
+
+    CpuHost.UserNs += sample->UserNs;
+    CpuHost.KernelNs += sample->KernelNs;
+    CpuHost.Switches += sample->Switches;
+    CpuHost.Preemptions += sample->Preemptions;
+    CpuHost.Cycles += sample->Cycles;
+
+    //
+    // A counter only one thread had is no count of them all
+    // ֻв߳̾߱ļܴȫ߳
+    //
+    CpuHost.Valid = CpuHostAdded ? (CpuHost.Valid & sample->Valid) : sample->Valid;
+    if ((sample->Valid & ECHO_CPU_USER_CYCLES) != 0) {
+        CpuHost.Valid |= (CpuHost.Valid & ECHO_CPU_CYCLES) ? ECHO_CPU_USER_CYCLES : 0;
+    }
+    CpuHostAdded = TRUE;
+}
+
+VOID EchoCpuHostRead(OUT PECHO_CPU_SAMPLE sample)
+{
+    std::lock_guard<std::mutex> lock(CpuHostLock);
+
+    *sample = CpuHost;
+}
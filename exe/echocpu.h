@@ -0,0 +1,120 @@
+/*++
+
+Module Name:
+
+    echocpu.h
+
+Abstract:
+
+    CPU cost of the echo path. Throughput says how fast requests go but
+    not what they cost the machine, so a run is bracketed by samples of
+    the CPU time its process spent in user and kernel mode, the context
+    switches it took (waits, and preemptions by the scheduler) and, where
+    the processor exposes a counter, the cycles it ran. A counter covers
+    the whole process or one thread. The in-process stand-ins serve their
+    requests on device threads of their own, which add what they spent to
+    a host account when they exit; the difference between the process and
+    the host account is then the client's share. Cycles come from
+    perf_event_open on Linux, counting kernel mode too where the system
+    allows it, and from QueryProcessCycleTime and QueryThreadCycleTime on
+    Windows, which does not count context switches per process.
+    ·CPU˵ж죬ȴ˵û˶٣
+    һеǰԽ̵CPUʱ䣨û̬ں̬лȴԼ
+    ռȡṩʱеȡ̻һ
+    ̡߳Լ豸߳ϴЩ߳˳ʱ俪
+    ˻˻֮Ϊͻ˵Ĳ֡Linuxperf_event_open
+    ϵͳʱҲں̬WindowsQueryProcessCycleTime
+    QueryThreadCycleTimeWindowsͳл
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#pragma once
+
+#include "echoport.h"
+
+//
+// Counters a sample holds besides the CPU times, which are always there
+// гCPUʱ䣨Ǵڣļ
+//
+#define ECHO_CPU_SWITCHES       0x1
+#define ECHO_CPU_CYCLES         0x2
+#define ECHO_CPU_USER_CYCLES    0x4     // the cycles leave kernel mode out
+
+typedef struct _ECHO_CPU_SAMPLE {
+    ULONGLONG UserNs;
+    ULONGLONG KernelNs;
+    ULONGLONG Switches;         // voluntary: the thread waited
+    ULONGLONG Preemptions;      // involuntary: the scheduler took the processor
+    ULONGLONG Cycles;
+    ULONG     Valid;            // ECHO_CPU_*
+} ECHO_CPU_SAMPLE, *PECHO_CPU_SAMPLE;
+
+typedef struct _ECHO_CPU_COUNTER {
+    BOOLEAN Thread;             // of the thread that opened it, else of the process
+    ULONG   Valid;
+    int     CycleFd;            // Linux: the perf event, -1 without one
+} ECHO_CPU_COUNTER, *PECHO_CPU_COUNTER;
+
+//
+// Opens a counter of the process, or of the calling thread. On Linux the
+// process cycles cover the calling thread and the threads created after
+// the counter, so it is opened before the threads it should count start.
+// A thread counter is read on the thread that opened it.
+// 򿪽̵ļ̵߳ļLinuxϽǵ߳Լ
+// ֮󴴽̣߳ӦҪͳƵ֮߳ǰ򿪡̼߳ڴ߳϶ȡ
+//
+VOID EchoCpuOpen(OUT PECHO_CPU_COUNTER counter, IN BOOLEAN thread);
+
+VOID EchoCpuRead(IN const ECHO_CPU_COUNTER* counter, OUT PECHO_CPU_SAMPLE sample);
+
+VOID EchoCpuClose(IN OUT PECHO_CPU_COUNTER counter);
+
+//
+// sample -= start, counter by counter; a counter that went backwards
+// stays at 0
+// ִsample -= start˵ļΪ0
+//
+VOID EchoCpuSubtract(IN OUT PECHO_CPU_SAMPLE sample, IN const ECHO_CPU_SAMPLE* start);
+
+//
+// Adds what a device thread of a stand-in spent to the host account, and
+// reads the account; it only grows
+// 豸̵߳Ŀ˻Լȡ˻˻ֻ
+//
+VOID EchoCpuHostAdd(IN const ECHO_CPU_SAMPLE* sample);
+
+VOID EchoCpuHostRead(OUT PECHO_CPU_SAMPLE sample);
+
+//
+// Accounts the calling thread to the host account for as long as the
+// object lives, for the device threads of the stand-ins
+// ڶڼ佫̼߳˻豸߳ʹ
+//
+class EchoCpuHostThread
+{
+public:
+    EchoCpuHostThread()
+    {
+        EchoCpuOpen(&m_Counter, TRUE);
+        EchoCpuRead(&m_Counter, &m_Start);
+    }
+
+    ~EchoCpuHostThread()
+    {
+        ECHO_CPU_SAMPLE end;
+
+        EchoCpuRead(&m_Counter, &end);
+        EchoCpuSubtract(&end, &m_Start);
+        EchoCpuHostAdd(&end);
+        EchoCpuClose(&m_Counter);
+    }
+
+private:
+    ECHO_CPU_COUNTER m_Counter;
+    ECHO_CPU_SAMPLE  m_Start;
+};
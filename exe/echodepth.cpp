@@ -0,0 +1,367 @@
+/*++
+
+Module Name:
+
+    echodepth.cpp
+
+Abstract:
+
+    Adaptive queue depth: the AIMD and gradient rules, and their self-test
+    against synthetic latency-vs-depth curves.
+    ӦȣAIMDݶȹԼںϳɵӳ-ϵԼ졣
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#include "echodepth.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#define LOG printf
+
+#define DEPTH_BACKOFF           0.75    // AIMD: share of the depth kept after a miss
+#define DEPTH_GAIN              0.5     // gradient: share of the way moved per window
+#define DEPTH_RATIO_MIN         0.5
+#define DEPTH_RATIO_MAX         2.0
+
+//
+// Windows each simulated run takes, and the depth it may reach
+// ÿģеĴԼɴﵽ
+//
+#define DEPTH_TEST_WINDOWS      200
+#define DEPTH_TEST_MAX          256
+
+VOID EchoDepthInit(
+    OUT PECHO_DEPTH_CONTROLLER controller,
+    IN  const ECHO_DEPTH_CONFIG* config
+    )
+{
+    ZeroMemory(controller, sizeof(*controller));
+
+    controller->Config = *config;
+    if (controller->Config.MinDepth == 0) {
+        controller->Config.MinDepth = 1;
+    }
+    if (controller->Config.MaxDepth < controller->Config.MinDepth) {
+        controller->Config.MaxDepth = controller->Config.MinDepth;
+    }
+    if (controller->Config.InitialDepth < controller->Config.MinDepth) {
+        controller->Config.InitialDepth = controller->Config.MinDepth;
+    }
+    if (controller->Config.InitialDepth > controller->Config.MaxDepth) {
+        controller->Config.InitialDepth = controller->Config.MaxDepth;
+    }
+
+    controller->Limit = controller->Config.InitialDepth;
+    controller->Depth = controller->Config.InitialDepth;
+    controller->SlowStart = TRUE;
+
+    EchoHistReset(&controller->Window);
+}
+
+BOOLEAN EchoDepthRecord(
+    IN OUT PECHO_DEPTH_CONTROLLER controller,
+    IN     ULONGLONG              latencyNs
+    )
+{
+    const ECHO_DEPTH_CONFIG* config = &controller->Config;
+    ULONGLONG p99;
+    double ratio;
+    double step;
+    ULONG slot;
+    BOOLEAN miss;
+
+    EchoHistRecord(&controller->Window, latencyNs);
+    controller->WindowOps++;
+
+    //
+    // A window spans at least two rounds of the depth, so every slot is
+    // seen more than once
+    // һٸȵ֣ʹÿ۶۲첻ֹһ
+    //
+    if (controller->WindowOps < ECHO_DEPTH_WINDOW || controller->WindowOps < 2 * controller->Depth) {
+        return FALSE;
+    }
+
+    p99 = EchoHistPercentile(&controller->Window, 99);
+    miss = (p99 > config->TargetNs);
+
+    slot = (ULONG)(controller->Decisions % ECHO_DEPTH_HISTORY);
+    controller->History[slot] = controller->Depth;
+    controller->HistoryMet[slot] = !miss;
+
+    if (config->Rule == EchoDepthAimd) {
+        if (miss) {
+            controller->Limit *= DEPTH_BACKOFF;
+            controller->SlowStart = FALSE;
+        }
+        else if (controller->SlowStart) {
+            controller->Limit *= 2;
+        }
+        else {
+            controller->Limit += 1;
+        }
+    }
+    else {
+        ratio = (p99 != 0) ? (double)config->TargetNs / p99 : DEPTH_RATIO_MAX;
+        if (ratio < DEPTH_RATIO_MIN) {
+            ratio = DEPTH_RATIO_MIN;
+        }
+        if (ratio > DEPTH_RATIO_MAX) {
+            ratio = DEPTH_RATIO_MAX;
+        }
+
+        //
+        // Growth is capped so a flat curve does not carry the depth far
+        // past a cliff in one window
+        // ƽ̹һڽȴ֮Զ
+        //
+        step = controller->Limit * (ratio - 1) * DEPTH_GAIN;
+        if (step > sqrt(controller->Limit) + 1) {
+            step = sqrt(controller->Limit) + 1;
+        }
+        controller->Limit += step;
+    }
+
+    if (controller->Limit < config->MinDepth) {
+        controller->Limit = config->MinDepth;
+    }
+    if (controller->Limit > config->MaxDepth) {
+        controller->Limit = config->MaxDepth;
+    }
+
+    controller->Depth = (ULONG)(controller->Limit + 0.5);
+    controller->Decisions++;
+    controller->Misses += miss;
+    controller->LastP99Ns = p99;
+
+    controller->WindowOps = 0;
+    EchoHistReset(&controller->Window);
+
+    return TRUE;
+}
+
+VOID EchoDepthQuery(
+    IN  const ECHO_DEPTH_CONTROLLER* controller,
+    OUT PECHO_DEPTH_STATS            stats
+    )
+{
+    ULONG count;
+    ULONG met;
+    double sumMet = 0;
+    double sum = 0;
+    ULONG i;
+
+    stats->Depth = controller->Depth;
+    stats->Decisions = controller->Decisions;
+    stats->Misses = controller->Misses;
+    stats->LastP99Ns = controller->LastP99Ns;
+
+    count = (controller->Decisions < ECHO_DEPTH_HISTORY) ? (ULONG)controller->Decisions : ECHO_DEPTH_HISTORY;
+    if (count == 0) {
+        stats->Settled = controller->Depth;
+        stats->Low = controller->Depth;
+        stats->High = controller->Depth;
+        return;
+    }
+
+    stats->Low = ~0U;
+    stats->High = 0;
+
+    for (i = 0, met = 0; i < count; i++) {
+        sum += controller->History[i];
+        if (controller->HistoryMet[i]) {
+            sumMet += controller->History[i];
+            met++;
+        }
+        if (controller->History[i] < stats->Low) {
+            stats->Low = controller->History[i];
+        }
+        if (controller->History[i] > stats->High) {
+            stats->High = controller->History[i];
+        }
+    }
+
+    stats->Settled = (met != 0) ? sumMet / met : sum / count;
+}
+
+BOOLEAN EchoDepthParse(IN PCSTR name, OUT ECHO_DEPTH_RULE* rule)
+{
+    if (!_stricmp(name, "aimd")) {
+        *rule = EchoDepthAimd;
+        return TRUE;
+    }
+    if (!_stricmp(name, "gradient")) {
+        *rule = EchoDepthGradient;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+PCSTR EchoDepthName(IN ECHO_DEPTH_RULE rule)
+{
+    return (rule == EchoDepthGradient) ? "gradient" : "aimd";
+}
+
+//
+// A device by its latency at each depth: Lanes requests are served at
+// once in BaseNs, deeper queues wait their turn, and past CliffDepth (if
+// set) every request takes CliffNs
+// Ըµӳ豸ͬʱLanesÿʱBaseNs
+// εȴCliffDepthãÿʱCliffNs
+//
+typedef struct _DEPTH_CURVE {
+    PCSTR     Name;
+    ULONGLONG BaseNs;
+    ULONG     Lanes;
+    ULONG     CliffDepth;
+    ULONGLONG CliffNs;
+    ULONGLONG TargetNs;
+} DEPTH_CURVE, *PDEPTH_CURVE;
+
+static const DEPTH_CURVE DepthCurves[] = {
+    { "one server",    20000,  1,  0,  0,       1000000   },
+    { "8 lanes",       50000,  8,  0,  0,       400000    },
+    { "cliff at 48",   100000, 64, 48, 2000000, 500000    },
+    { "out of reach",  2000000, 1, 0,  0,       500000    },
+    { "never reached", 10000,  1,  0,  0,       100000000 },
+};
+
+//
+// depthӳ
+//
+static ULONGLONG DepthCurveNs(const DEPTH_CURVE* curve, ULONG depth)
+{
+    if (curve->CliffDepth != 0 && depth > curve->CliffDepth) {
+        return curve->CliffNs;
+    }
+    if (depth <= curve->Lanes) {
+        return curve->BaseNs;
+    }
+
+    return curve->BaseNs * depth / curve->Lanes;
+}
+
+//
+// ӳٲĿȣûʱΪ0
+//
+static ULONG DepthCurveKnee(const DEPTH_CURVE* curve)
+{
+    ULONG knee = 0;
+    ULONG depth;
+
+    for (depth = 1; depth <= DEPTH_TEST_MAX; depth++) {
+        if (DepthCurveNs(curve, depth) <= curve->TargetNs) {
+            knee = depth;
+        }
+    }
+
+    return knee;
+}
+
+//
+// depthÿLittleƽӳټ
+//
+static double DepthCurveOps(const DEPTH_CURVE* curve, ULONG depth)
+{
+    return depth * 1e9 / (DepthCurveNs(curve, depth) * 0.85);
+}
+
+//
+// Runs rule against curve; each completion takes 70-100% of the curve's
+// latency at the depth in force, so a window's p99 is just under it
+// curveruleÿɺʱΪǰӳٵ70-100%˴ڵ
+// p99Եֵ
+//
+static BOOLEAN DepthTestCurve(const DEPTH_CURVE* curve, ECHO_DEPTH_RULE rule)
+{
+    ECHO_DEPTH_CONTROLLER controller;
+    ECHO_DEPTH_CONFIG config;
+    ECHO_DEPTH_STATS stats;
+    ULONGLONG rng = 0x9E3779B97F4A7C15ULL;
+    ULONGLONG latencyNs;
+    ULONG windows = 0;
+    ULONG settled;
+    ULONG knee;
+    double fraction;
+    BOOLEAN passed;
+
+    config.Rule = rule;
+    config.MinDepth = 1;
+    config.MaxDepth = DEPTH_TEST_MAX;
+    config.InitialDepth = 1;
+    config.TargetNs = curve->TargetNs;
+    EchoDepthInit(&controller, &config);
+
+    while (windows < DEPTH_TEST_WINDOWS) {
+        rng ^= rng >> 12;
+        rng ^= rng << 25;
+        rng ^= rng >> 27;
+        fraction = 0.7 + 0.3 * (double)((rng * 0x2545F4914F6CDD1DULL) >> 11) / (double)(1ULL << 53);
+
+        latencyNs = (ULONGLONG)(DepthCurveNs(curve, EchoDepthCurrent(&controller)) * fraction);
+        if (EchoDepthRecord(&controller, latencyNs)) {
+            windows++;
+        }
+    }
+
+    EchoDepthQuery(&controller, &stats);
+    settled = (ULONG)(stats.Settled + 0.5);
+    knee = DepthCurveKnee(curve);
+
+    //
+    // Near the knee and within the target: at least 60% of its depth, and
+    // a p99 the target allows. With the target out of reach the depth
+    // bottoms out; never reached, it tops out.
+    // ӽյĿ꣺Ϊյȵ60%p99Ŀ֮ڡĿ޷ﵽʱ
+    // ȽͣԶᴥʱߡ
+    //
+    if (knee == 0) {
+        passed = (settled == config.MinDepth);
+    }
+    else {
+        passed = (settled >= knee * 6 / 10 && settled <= knee &&
+                  DepthCurveNs(curve, settled) <= curve->TargetNs);
+    }
+
+    LOG("%-14s %-9s %5d %8.1f %5d-%-5d %9.0f %10.0f %6.0f%% %s\n",
+        curve->Name, EchoDepthName(rule), knee, stats.Settled, stats.Low, stats.High,
+        DepthCurveNs(curve, settled) / 1000.0, DepthCurveOps(curve, settled),
+        (knee != 0) ? 100.0 * DepthCurveOps(curve, settled) / DepthCurveOps(curve, knee) : 100.0,
+        passed ? "ok" : "FAILED");
+
+    return passed;
+}
+
+BOOLEAN EchoDepthSelfTest(VOID)
+{
+    ECHO_DEPTH_RULE rule;
+    ULONG i;
+    BOOLEAN result = TRUE;
+
+    LOG("%-14s %-9s %5s %8s %11s %9s %10s %7s\n",
+        "curve", "rule", "knee", "settled", "range", "max(us)", "ops/s", "of knee");
+
+    for (i = 0; i < sizeof(DepthCurves) / sizeof(DepthCurves[0]); i++) {
+        result = DepthTestCurve(&DepthCurves[i], EchoDepthAimd) && result;
+        result = DepthTestCurve(&DepthCurves[i], EchoDepthGradient) && result;
+    }
+
+    if (!EchoDepthParse("AIMD", &rule) || rule != EchoDepthAimd ||
+        !EchoDepthParse("gradient", &rule) || rule != EchoDepthGradient ||
+        EchoDepthParse("vegas", &rule)) {
+        LOG("Depth controller: rule names do not parse\n");
+        result = FALSE;
+    }
+
+    LOG("Depth controller self-test of %d curves: %s\n", (ULONG)(sizeof(DepthCurves) / sizeof(DepthCurves[0])),
+        result ? "passed" : "FAILED");
+
+    return result;
+}
@@ -0,0 +1,132 @@
+/*++
+
+Module Name:
+
+    echodepth.h
+
+Abstract:
+
+    Adaptive queue depth. A fixed number of operations in flight is too
+    many for a device that serves them one at a time, which then only
+    queues them and adds latency, and too few for one with parallel lanes,
+    which then idles. The controller instead moves the depth against a
+    latency target: after every window of completions it compares the
+    window's p99 with the target and grows or shrinks the depth, so the
+    depth climbs until latency starts to rise past the target, the knee of
+    the latency-vs-depth curve. Two rules are offered. AIMD doubles the
+    depth until the first miss, then adds one per window met and backs off
+    by a quarter on a miss. Gradient moves the depth halfway towards
+    depth * target / p99 each window, growing by at most the square root
+    of the depth. Both rules keep probing around the knee, so the depth
+    they settle on is the mean over the last windows that met the target.
+    Ӧȡ̶;豸˵ֻ̫࣬
+    ŶӲӳ٣вͨ豸˵̫٣ʹСΪӳ
+    Ŀȣÿһڵ֮󣬽ڵp99ĿȽϲСȣ
+    ȻӳٿʼĿΪֹӳ-ߵĹյ㡣ṩֹ
+    AIMDڵһγĿǰȼӱ֮ÿ괰ڼһʱķ֮һ
+    Gradientÿڽdepth * target / p99ƶһ룬Ϊȵƽ
+    ֹ򶼳ڹյ㸽̽ȶȡɸ괰ڵƽȡ
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#pragma once
+
+#include "echohist.h"
+
+//
+// Completions per decision at least, and the windows the settled depth is
+// taken from
+// ÿξҪԼȶȡĴ
+//
+#define ECHO_DEPTH_WINDOW       200
+#define ECHO_DEPTH_HISTORY      16
+
+typedef enum _ECHO_DEPTH_RULE {
+    EchoDepthAimd = 0,
+    EchoDepthGradient
+} ECHO_DEPTH_RULE;
+
+typedef struct _ECHO_DEPTH_CONFIG {
+    ECHO_DEPTH_RULE Rule;
+    ULONG           MinDepth;
+    ULONG           MaxDepth;
+    ULONG           InitialDepth;
+    ULONGLONG       TargetNs;       // p99 of a window the depth is held to
+} ECHO_DEPTH_CONFIG, *PECHO_DEPTH_CONFIG;
+
+typedef struct _ECHO_DEPTH_STATS {
+    ULONG     Depth;            // in force now
+    double    Settled;          // mean of the last windows that met the target, else of all
+    ULONG     Low;              // range over the last windows
+    ULONG     High;
+    ULONGLONG Decisions;
+    ULONGLONG Misses;           // windows whose p99 exceeded the target
+    ULONGLONG LastP99Ns;
+} ECHO_DEPTH_STATS, *PECHO_DEPTH_STATS;
+
+//
+// Not thread-safe: callers sharing a controller serialize on their own
+// ̰߳ȫĵдл
+//
+typedef struct _ECHO_DEPTH_CONTROLLER {
+    ECHO_DEPTH_CONFIG Config;
+    double            Limit;            // fractional depth the rule works on
+    ULONG             Depth;            // Limit rounded, what callers keep in flight
+    BOOLEAN           SlowStart;        // AIMD until the first miss
+    ULONG             WindowOps;
+    ECHO_HISTOGRAM    Window;
+    ULONG             History[ECHO_DEPTH_HISTORY];     // depth of each of the last windows
+    BOOLEAN           HistoryMet[ECHO_DEPTH_HISTORY];
+    ULONGLONG         Decisions;
+    ULONGLONG         Misses;
+    ULONGLONG         LastP99Ns;
+} ECHO_DEPTH_CONTROLLER, *PECHO_DEPTH_CONTROLLER;
+
+VOID EchoDepthInit(
+    OUT PECHO_DEPTH_CONTROLLER controller,
+    IN  const ECHO_DEPTH_CONFIG* config
+    );
+
+//
+// Records the latency of one completion. Returns TRUE when it ended a
+// window and the depth was decided again.
+// ¼һɵӳ١һڲ¾ʱTRUE
+//
+BOOLEAN EchoDepthRecord(
+    IN OUT PECHO_DEPTH_CONTROLLER controller,
+    IN     ULONGLONG              latencyNs
+    );
+
+inline ULONG EchoDepthCurrent(IN const ECHO_DEPTH_CONTROLLER* controller)
+{
+    return controller->Depth;
+}
+
+VOID EchoDepthQuery(
+    IN  const ECHO_DEPTH_CONTROLLER* controller,
+    OUT PECHO_DEPTH_STATS            stats
+    );
+
+//
+// "aimd" or "gradient"; FALSE for anything else
+// "aimd""gradient"ֵFALSE
+//
+BOOLEAN EchoDepthParse(IN PCSTR name, OUT ECHO_DEPTH_RULE* rule);
+
+PCSTR EchoDepthName(IN ECHO_DEPTH_RULE rule);
+
+//
+// Runs both rules against synthetic latency-vs-depth curves (one server,
+// parallel lanes, a cliff, a target out of reach and one never reached)
+// and checks that each settles near the knee with its p99 near the target.
+// FALSE on a failure.
+// ںϳɵӳ-ߣߡͨ¡޷ﵽĿԶ
+// Ŀֹ꣩򣬼ÿֹȶڹյ㸽p99ӽĿꡣ
+// ʧʱFALSE
+//
+BOOLEAN EchoDepthSelfTest(VOID);
@@ -0,0 +1,229 @@
+/*++
+
+Module Name:
+
+    echoengine.h
+
+Abstract:
+
+    The I/O engine interface the benchmark drives. An engine starts reads
+    and writes and hands back the completed ones. On Windows four engines
+    talk to the echo driver: blocking calls, overlapped I/O with an event
+    per operation, a completion port, and thread-pool I/O. Elsewhere
+    in-process stand-ins echo the last write the same four ways: loopback,
+    blocking calls, epoll and a pair of io_uring-style rings. The benchmark
+    logic therefore runs, and the engines compare, where the driver cannot.
+    ׼I/Oӿڡ淢дɵĲWindows
+    ĸͨţáÿһ¼صI/Oɶ˿
+    Լ̳߳I/Oƽ̨ϣַͬʽһд룺
+    ػáepollԼһio_uringʽĻ˻׼߼޷
+    ĵطУҲȽϡ
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#pragma once
+
+#include "echoport.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+typedef enum _ECHO_OP {
+    EchoOpWrite = 0,
+    EchoOpRead,
+    EchoOpCount
+} ECHO_OP;
+
+//
+// One asynchronous operation. The engine owns EnginePrivate while the
+// operation is in flight; the device engine keeps its OVERLAPPED there.
+// һ첽ڼEnginePrivateУ豸дOVERLAPPED
+//
+typedef struct _ECHO_IO {
+    ULONG_PTR EnginePrivate[8];
+    ECHO_OP   Op;
+    PUCHAR    Buffer;
+    ULONG     Length;
+    ULONG     Transferred;      // bytes moved, set on completion
+    ULONG     Error;            // Win32 error code, set on completion
+    ULONGLONG IssueNs;          // EchoNowNs() when submitted
+    ULONGLONG IntendedNs;       // when an open-loop schedule meant to submit it, else IssueNs
+    PVOID     Context;          // owned by the caller
+} ECHO_IO, *PECHO_IO;
+
+//
+// Largest number of completions one Reap call returns
+// һReap÷ص
+//
+#define ECHO_REAP_MAX   64
+
+class EchoEngine
+{
+public:
+    virtual ~EchoEngine() {}
+
+    virtual PCSTR Name() = 0;
+
+    //
+    // Starts io. Returns FALSE with io->Error set if it could not be
+    // started; otherwise its completion is always returned by Reap.
+    // io޷ʱFALSEio->ErrorܻReapء
+    //
+    virtual BOOLEAN Submit(PECHO_IO io) = 0;
+
+    //
+    // Returns up to max (at most ECHO_REAP_MAX) completed operations,
+    // waiting up to timeoutMs for the first one.
+    // maxECHO_REAP_MAXɵĲȴtimeoutMs롣
+    //
+    virtual ULONG Reap(PECHO_IO* completed, ULONG max, ULONG timeoutMs) = 0;
+
+    //
+    // Starts a control request with code; Buffer holds the input and
+    // receives the output, Length bytes either way. Its completion comes
+    // back through Reap like a read or write. Engines without controls
+    // refuse with ERROR_NOT_SUPPORTED.
+    // codeBuffer벢ȾΪLengthֽڡ
+    // дһReapءֿ֧ERROR_NOT_SUPPORTEDܾ
+    //
+    virtual BOOLEAN Control(PECHO_IO io, ULONG code)
+    {
+        (void)code;
+
+        io->Error = ERROR_NOT_SUPPORTED;
+
+        return FALSE;
+    }
+
+    //
+    // Asks for io, which was started and not yet reaped, to finish early
+    // with ERROR_OPERATION_ABORTED. Safe from any thread. Returns FALSE
+    // if the engine cannot cancel or io is already done; either way io is
+    // still returned by Reap, possibly with its normal result.
+    // ѷδȡصioǰERROR_OPERATION_ABORTEDκ߳
+    // á޷ȡioʱFALSEioReapأ
+    // ɡ
+    //
+    virtual BOOLEAN Cancel(PECHO_IO io)
+    {
+        (void)io;
+
+        return FALSE;
+    }
+};
+
+//
+// Opens the engine for benchmark thread 'index'; NULL on failure
+// Ϊ׼߳index棻ʧʱNULL
+//
+typedef EchoEngine* ECHO_ENGINE_OPEN(PVOID context, ULONG index);
+
+//
+// Completed operations waiting for Reap, for engines whose completions
+// do not arrive on a queue of their own (blocking calls, thread-pool
+// callbacks)
+// ȴReapɲɲеʹãá̳߳ػص
+//
+class EchoReadyQueue
+{
+public:
+    VOID Push(PECHO_IO io)
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+
+        m_Ready.push_back(io);
+        m_Pushed.notify_one();
+    }
+
+    ULONG Pop(PECHO_IO* completed, ULONG max, ULONG timeoutMs)
+    {
+        std::unique_lock<std::mutex> lock(m_Lock);
+        ULONG count = 0;
+
+        if (max > ECHO_REAP_MAX) {
+            max = ECHO_REAP_MAX;
+        }
+
+        if (m_Ready.empty()) {
+            m_Pushed.wait_for(lock, std::chrono::milliseconds(timeoutMs));
+        }
+
+        while (count < max && !m_Ready.empty()) {
+            completed[count++] = m_Ready.front();
+            m_Ready.pop_front();
+        }
+
+        return count;
+    }
+
+private:
+    std::mutex              m_Lock;
+    std::condition_variable m_Pushed;
+    std::deque<PECHO_IO>    m_Ready;
+};
+
+//
+// ػ棺ÿʱserviceNsͬһϵδ
+//
+EchoEngine* EchoLoopbackEngineOpen(ULONGLONG serviceNs);
+
+#ifdef __linux__
+
+//
+// epoll棺󾭹ܵ豸̣߳ɾһܵepollȡ
+//
+EchoEngine* EchoEpollEngineOpen(ULONGLONG serviceNs);
+
+//
+// 棺Submitڵ߳ϴɺŷ
+//
+EchoEngine* EchoBlockingEngineOpen(ULONGLONG serviceNs);
+
+//
+// 棺ύѯ豸̣߳ɾɻȡأϵͳ
+//
+EchoEngine* EchoRingEngineOpen(ULONGLONG serviceNs);
+
+#endif
+
+#ifdef _WIN32
+
+//
+// 豸棺devicePathصʽ򿪾ɶ˿ڣ
+// shardKeyΪECHO_SHARD_KEY_DEFAULTʱ̶÷Ƭ
+//
+#define ECHO_SHARD_KEY_DEFAULT  ((ULONG)-1)
+
+typedef EchoEngine* ECHO_DEVICE_ENGINE_OPEN(PCWSTR devicePath, ULONG shardKey);
+
+//
+// devicePath̶ƬoverlappedΪTRUEʱصʽ򿪣
+// ʧʱINVALID_HANDLE_VALUE
+//
+HANDLE EchoDeviceOpen(PCWSTR devicePath, ULONG shardKey, BOOLEAN overlapped);
+
+EchoEngine* EchoIocpEngineOpen(PCWSTR devicePath, ULONG shardKey);
+
+//
+// ͬ棺صϵWriteFile/ReadFile
+//
+EchoEngine* EchoSyncEngineOpen(PCWSTR devicePath, ULONG shardKey);
+
+//
+// ¼棺ÿһ¼WaitForMultipleObjectsȴ
+//
+EchoEngine* EchoEventEngineOpen(PCWSTR devicePath, ULONG shardKey);
+
+//
+// ̳߳棺CreateThreadpoolIo̳߳ػصReap
+//
+EchoEngine* EchoThreadpoolEngineOpen(PCWSTR devicePath, ULONG shardKey);
+
+#endif
@@ -0,0 +1,330 @@
+/*++
+
+Module Name:
+
+    echoepoll.cpp
+
+Abstract:
+
+    Linux stand-in for the device engine. Requests go to a device thread
+    through a pipe and completions come back through a second pipe that
+    the workers wait on with epoll and drain in batches, so the worker
+    pool sees the same shape as a completion port: a kernel queue shared
+    by every worker, several completions per wakeup. Like the driver it
+    takes control requests and finishes a cancelled request that it has
+    not yet serviced with ERROR_OPERATION_ABORTED.
+    豸Linuxͨܵ͵豸̣߳ͨڶܵأ
+    ߳epollȴȡ˹̳߳ؿ̬ɶ˿ͬ
+    й̹߳һں˶Уÿλȡöɡһ
+    󣬲ERROR_OPERATION_ABORTEDδȡ
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#ifdef __linux__
+
+#include "echocpu.h"
+#include "echoengine.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <new>
+#include <thread>
+#include <vector>
+
+#define LOG printf
+
+//
+// Pointers moved per pipe write; a write of at most PIPE_BUF bytes is
+// atomic, so readers always see whole pointers
+// ÿιܵд봫͵ָPIPE_BUFֽڵдԭӵģ˶ָܶ
+//
+#define EPOLL_BATCH     (PIPE_BUF / sizeof(PECHO_IO))
+
+//
+// ECHO_IO::EnginePrivate slots: whether the request is a control, and
+// whether it has been cancelled
+// ECHO_IO::EnginePrivateеĲۣǷΪԼǷѱȡ
+//
+#define EPOLL_CONTROL   0
+#define EPOLL_CANCELLED 1
+
+class EchoEpollEngine : public EchoEngine
+{
+public:
+    explicit EchoEpollEngine(ULONGLONG serviceNs)
+        : m_ServiceNs(serviceNs), m_Epoll(-1)
+    {
+        m_Requests[0] = m_Requests[1] = -1;
+        m_Completions[0] = m_Completions[1] = -1;
+    }
+
+    ~EchoEpollEngine();
+
+    PCSTR Name()
+    {
+        return "epoll";
+    }
+
+    BOOLEAN Open(VOID);
+
+    BOOLEAN Submit(PECHO_IO io);
+
+    ULONG Reap(PECHO_IO* completed, ULONG max, ULONG timeoutMs);
+
+    BOOLEAN Control(PECHO_IO io, ULONG code);
+
+    BOOLEAN Cancel(PECHO_IO io);
+
+private:
+    BOOLEAN Queue(PECHO_IO io, BOOLEAN control);
+
+    VOID DeviceThread(VOID);
+
+    ULONGLONG          m_ServiceNs;
+    int                m_Requests[2];
+    int                m_Completions[2];
+    int                m_Epoll;
+    std::thread        m_Device;
+    std::vector<UCHAR> m_Data;          // data of the last write
+};
+
+EchoEpollEngine::~EchoEpollEngine()
+{
+    //
+    // Closing the request pipe ends the device thread
+    // رܵ豸߳
+    //
+    if (m_Requests[1] != -1) {
+        close(m_Requests[1]);
+    }
+    if (m_Device.joinable()) {
+        m_Device.join();
+    }
+
+    if (m_Requests[0] != -1) {
+        close(m_Requests[0]);
+    }
+    if (m_Completions[0] != -1) {
+        close(m_Completions[0]);
+    }
+    if (m_Completions[1] != -1) {
+        close(m_Completions[1]);
+    }
+    if (m_Epoll != -1) {
+        close(m_Epoll);
+    }
+}
+
+//
+// ܵepollʵ豸߳
+//
+BOOLEAN EchoEpollEngine::Open(VOID)
+{
+    struct epoll_event event;
+
+    if (pipe2(m_Requests, O_CLOEXEC) != 0 || pipe2(m_Completions, O_CLOEXEC) != 0) {
+        LOG("EchoEpollEngine: pipe2 failed %d\n", errno);
+        return FALSE;
+    }
+
+    //
+    // Workers race for the completions, so the losers must not block
+    // ߳ɣδ̲߳
+    //
+    if (fcntl(m_Completions[0], F_SETFL, O_NONBLOCK) != 0) {
+        LOG("EchoEpollEngine: fcntl failed %d\n", errno);
+        return FALSE;
+    }
+
+    m_Epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (m_Epoll == -1) {
+        LOG("EchoEpollEngine: epoll_create1 failed %d\n", errno);
+        return FALSE;
+    }
+
+    event.events = EPOLLIN;
+    event.data.u64 = 0;
+    if (epoll_ctl(m_Epoll, EPOLL_CTL_ADD, m_Completions[0], &event) != 0) {
+        LOG("EchoEpollEngine: epoll_ctl failed %d\n", errno);
+        return FALSE;
+    }
+
+    m_Device = std::thread(&EchoEpollEngine::DeviceThread, this);
+
+    return TRUE;
+}
+
+//
+// 豸̣߳δÿʱm_ServiceNsȻдɡ
+// ԭ룻ȡ󲻴Ҳռ÷ʱ䡣俪˻
+//
+VOID EchoEpollEngine::DeviceThread(VOID)
+{
+    EchoCpuHostThread account;
+    PECHO_IO batch[EPOLL_BATCH];
+    ULONGLONG busyUntil = 0;
+    ULONGLONG now;
+    struct timespec delay;
+    ssize_t bytes;
+    size_t count;
+    size_t i;
+
+    for (;;) {
+
+        bytes = read(m_Requests[0], batch, sizeof(batch));
+        if (bytes <= 0) {
+            if (bytes < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        count = (size_t)bytes / sizeof(PECHO_IO);
+
+        for (i = 0; i < count; i++) {
+            PECHO_IO io = batch[i];
+
+            //
+            // A cancelled request is finished the way the framework
+            // finishes a queued one: at once and without its data
+            // ȡ󰴿ܽŶķʽҲ
+            //
+            if (__atomic_load_n(&io->EnginePrivate[EPOLL_CANCELLED], __ATOMIC_ACQUIRE) != 0) {
+                io->Transferred = 0;
+                io->Error = ERROR_OPERATION_ABORTED;
+                continue;
+            }
+
+            if (io->EnginePrivate[EPOLL_CONTROL] != 0) {
+                io->Transferred = io->Length;
+            }
+            else if (io->Op == EchoOpWrite) {
+                m_Data.assign(io->Buffer, io->Buffer + io->Length);
+                io->Transferred = io->Length;
+            }
+            else {
+                io->Transferred = (m_Data.size() < io->Length) ? (ULONG)m_Data.size() : io->Length;
+                if (io->Transferred != 0) {
+                    memcpy(io->Buffer, &m_Data[0], io->Transferred);
+                }
+            }
+            io->Error = ERROR_SUCCESS;
+
+            if (m_ServiceNs != 0) {
+                now = EchoNowNs();
+                busyUntil = ((busyUntil > now) ? busyUntil : now) + m_ServiceNs;
+                while ((now = EchoNowNs()) < busyUntil) {
+                    delay.tv_sec = (time_t)((busyUntil - now) / 1000000000);
+                    delay.tv_nsec = (long)((busyUntil - now) % 1000000000);
+                    nanosleep(&delay, NULL);
+                }
+            }
+        }
+
+        if (write(m_Completions[1], batch, (size_t)bytes) != bytes) {
+            LOG("EchoEpollEngine: completion write failed %d\n", errno);
+            break;
+        }
+    }
+}
+
+//
+// ддܵ
+//
+BOOLEAN EchoEpollEngine::Submit(PECHO_IO io)
+{
+    return Queue(io, FALSE);
+}
+
+//
+// дܵǱд֮ǰ豸߳ʱȡ
+//
+BOOLEAN EchoEpollEngine::Queue(PECHO_IO io, BOOLEAN control)
+{
+    io->EnginePrivate[EPOLL_CONTROL] = control;
+    io->EnginePrivate[EPOLL_CANCELLED] = 0;
+
+    if (write(m_Requests[1], &io, sizeof(io)) != (ssize_t)sizeof(io)) {
+        io->Error = ERROR_INVALID_PARAMETER;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+// дܵʶκο룬ԭ
+//
+BOOLEAN EchoEpollEngine::Control(PECHO_IO io, ULONG code)
+{
+    (void)code;
+
+    return Queue(io, TRUE);
+}
+
+//
+// ȡ豸߳ȡʱERROR_OPERATION_ABORTED
+//
+BOOLEAN EchoEpollEngine::Cancel(PECHO_IO io)
+{
+    __atomic_store_n(&io->EnginePrivate[EPOLL_CANCELLED], 1, __ATOMIC_RELEASE);
+
+    return TRUE;
+}
+
+//
+// epollȴɹܵȻһζȡһ
+//
+ULONG EchoEpollEngine::Reap(PECHO_IO* completed, ULONG max, ULONG timeoutMs)
+{
+    struct epoll_event event;
+    ULONGLONG deadline = EchoNowNs() + (ULONGLONG)timeoutMs * 1000000;
+    ULONGLONG now;
+    ssize_t bytes;
+
+    if (max > ECHO_REAP_MAX) {
+        max = ECHO_REAP_MAX;
+    }
+
+    for (;;) {
+
+        bytes = read(m_Completions[0], completed, max * sizeof(PECHO_IO));
+        if (bytes > 0) {
+            return (ULONG)((size_t)bytes / sizeof(PECHO_IO));
+        }
+
+        if (bytes < 0 && errno != EAGAIN && errno != EINTR) {
+            LOG("EchoEpollEngine: completion read failed %d\n", errno);
+            return 0;
+        }
+
+        now = EchoNowNs();
+        if (now >= deadline) {
+            return 0;
+        }
+
+        epoll_wait(m_Epoll, &event, 1, (int)((deadline - now + 999999) / 1000000));
+    }
+}
+
+EchoEngine* EchoEpollEngineOpen(ULONGLONG serviceNs)
+{
+    EchoEpollEngine* engine = new (std::nothrow) EchoEpollEngine(serviceNs);
+
+    if (engine != NULL && !engine->Open()) {
+        delete engine;
+        engine = NULL;
+    }
+
+    return engine;
+}
+
+#endif
@@ -0,0 +1,266 @@
+/*++
+
+Module Name:
+
+    echoevent.cpp
+
+Abstract:
+
+    Event device engine: overlapped reads and writes on the echo device,
+    each with an event of its own, and completions found by waiting on the
+    events with WaitForMultipleObjects. A wait covers at most 63 requests
+    plus a wake event that Submit sets, so deeper queues are waited on in
+    turns, which is the cost this model has next to a completion port.
+    ¼豸棺ڻ豸ִصдÿԼ¼
+    WaitForMultipleObjectsȴЩ¼ɡһεȴา63
+    һSubmitõĻ¼˸ĶҪȴǸģ
+    ɶ˿ڵĴۡ
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#include "echoengine.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#define LOG printf
+
+//
+// The OVERLAPPED comes first in EnginePrivate, its event handle last
+// OVERLAPPEDλEnginePrivateͷ¼λĩβ
+//
+#define EVENT_SLOT      7
+
+static_assert(sizeof(OVERLAPPED) <= EVENT_SLOT * sizeof(ULONG_PTR),
+              "OVERLAPPED and its event must fit in ECHO_IO::EnginePrivate");
+
+class EchoEventEngine : public EchoEngine
+{
+public:
+    EchoEventEngine()
+        : m_hDevice(INVALID_HANDLE_VALUE), m_hWake(NULL), m_Next(0)
+    {
+    }
+
+    ~EchoEventEngine();
+
+    PCSTR Name()
+    {
+        return "event";
+    }
+
+    BOOLEAN Open(PCWSTR devicePath, ULONG shardKey);
+
+    BOOLEAN Submit(PECHO_IO io);
+
+    ULONG Reap(PECHO_IO* completed, ULONG max, ULONG timeoutMs);
+
+private:
+    HANDLE                m_hDevice;
+    HANDLE                m_hWake;      // set by Submit, so waits pick up new requests
+    SRWLOCK               m_Lock;
+    std::vector<PECHO_IO> m_Pending;    // in flight, under m_Lock
+    std::vector<HANDLE>   m_Events;     // every event created, closed with the engine
+    size_t                m_Next;       // where the next wait starts in m_Pending
+};
+
+EchoEventEngine::~EchoEventEngine()
+{
+    size_t i;
+
+    if (m_hDevice != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_hDevice);
+    }
+    if (m_hWake != NULL) {
+        CloseHandle(m_hWake);
+    }
+    for (i = 0; i < m_Events.size(); i++) {
+        CloseHandle(m_Events[i]);
+    }
+}
+
+//
+// صʽ豸¼
+//
+BOOLEAN EchoEventEngine::Open(PCWSTR devicePath, ULONG shardKey)
+{
+    InitializeSRWLock(&m_Lock);
+
+    m_hDevice = EchoDeviceOpen(devicePath, shardKey, TRUE);
+    if (m_hDevice == INVALID_HANDLE_VALUE) {
+        return FALSE;
+    }
+
+    m_hWake = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (m_hWake == NULL) {
+        LOG("EchoEventEngine: CreateEvent failed %d\n", GetLastError());
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+// ԲԼ¼صд
+//
+BOOLEAN EchoEventEngine::Submit(PECHO_IO io)
+{
+    LPOVERLAPPED ov = (LPOVERLAPPED)io->EnginePrivate;
+    HANDLE hEvent = (HANDLE)io->EnginePrivate[EVENT_SLOT];
+    std::vector<PECHO_IO>::iterator pending;
+    ULONG error;
+    BOOL started;
+
+    //
+    // A slot gets its event on first use and keeps it
+    // ״ʹʱȡ¼һֱ
+    //
+    if (hEvent == NULL) {
+        hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (hEvent == NULL) {
+            io->Error = GetLastError();
+            return FALSE;
+        }
+
+        AcquireSRWLockExclusive(&m_Lock);
+        m_Events.push_back(hEvent);
+        ReleaseSRWLockExclusive(&m_Lock);
+
+        io->EnginePrivate[EVENT_SLOT] = (ULONG_PTR)hEvent;
+    }
+
+    ZeroMemory(ov, sizeof(*ov));
+    ov->Internal = STATUS_PENDING;
+    ov->hEvent = hEvent;
+
+    //
+    // Pending before it starts, so a reaper that sees the event signaled
+    // also finds the operation; the status keeps reapers off it until then
+    // ڷ֮ǰ;бʹ¼ѴȡҲҵò
+    // ڴ֮ǰ״̬ʹȡ߲ȡ
+    //
+    AcquireSRWLockExclusive(&m_Lock);
+    m_Pending.push_back(io);
+    ReleaseSRWLockExclusive(&m_Lock);
+
+    if (io->Op == EchoOpWrite) {
+        started = WriteFile(m_hDevice, io->Buffer, io->Length, NULL, ov);
+    }
+    else {
+        started = ReadFile(m_hDevice, io->Buffer, io->Length, NULL, ov);
+    }
+
+    if (!started && GetLastError() != ERROR_IO_PENDING) {
+        error = GetLastError();
+
+        //
+        // A failure the driver completed may already have been reaped, and
+        // then it is reported like any other completion
+        // ɵʧܿѱȡߣʱһϱ
+        //
+        AcquireSRWLockExclusive(&m_Lock);
+        pending = std::find(m_Pending.begin(), m_Pending.end(), io);
+        if (pending == m_Pending.end()) {
+            ReleaseSRWLockExclusive(&m_Lock);
+            return TRUE;
+        }
+        m_Pending.erase(pending);
+        ReleaseSRWLockExclusive(&m_Lock);
+
+        io->Error = error;
+        return FALSE;
+    }
+
+    SetEvent(m_hWake);
+
+    return TRUE;
+}
+
+//
+// ȴ;¼ȻȡɵĲ
+//
+ULONG EchoEventEngine::Reap(PECHO_IO* completed, ULONG max, ULONG timeoutMs)
+{
+    HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+    ULONGLONG deadline = EchoNowNs() + (ULONGLONG)timeoutMs * 1000000;
+    ULONGLONG now;
+    ULONG count = 0;
+    ULONG waits;
+    ULONG bytes;
+    size_t i;
+    size_t n;
+
+    if (max > ECHO_REAP_MAX) {
+        max = ECHO_REAP_MAX;
+    }
+
+    for (;;) {
+
+        //
+        // Collect what has completed; each wait starts further along the
+        // list so requests beyond the first 63 are not starved
+        // ȡɵĲÿεȴбλÿʼʹǰ63֮󲻻
+        //
+        AcquireSRWLockExclusive(&m_Lock);
+
+        for (i = 0; i < m_Pending.size() && count < max; ) {
+            if (HasOverlappedIoCompleted((LPOVERLAPPED)m_Pending[i]->EnginePrivate)) {
+                completed[count++] = m_Pending[i];
+                m_Pending[i] = m_Pending.back();
+                m_Pending.pop_back();
+            }
+            else {
+                i++;
+            }
+        }
+
+        handles[0] = m_hWake;
+        waits = 1;
+        n = m_Pending.size();
+        for (i = 0; i < n && waits < MAXIMUM_WAIT_OBJECTS; i++) {
+            handles[waits++] = ((LPOVERLAPPED)m_Pending[(m_Next + i) % n]->EnginePrivate)->hEvent;
+        }
+        m_Next = (n != 0) ? (m_Next + waits - 1) % n : 0;
+
+        ReleaseSRWLockExclusive(&m_Lock);
+
+        now = EchoNowNs();
+        if (count != 0 || now >= deadline) {
+            break;
+        }
+
+        WaitForMultipleObjects(waits, handles, FALSE, (ULONG)((deadline - now + 999999) / 1000000));
+    }
+
+    for (i = 0; i < count; i++) {
+        LPOVERLAPPED ov = (LPOVERLAPPED)completed[i]->EnginePrivate;
+
+        bytes = 0;
+        completed[i]->Error = ERROR_SUCCESS;
+        if (!GetOverlappedResult(m_hDevice, ov, &bytes, FALSE)) {
+            completed[i]->Error = GetLastError();
+        }
+        completed[i]->Transferred = bytes;
+    }
+
+    return count;
+}
+
+EchoEngine* EchoEventEngineOpen(PCWSTR devicePath, ULONG shardKey)
+{
+    EchoEventEngine* engine = new (std::nothrow) EchoEventEngine();
+
+    if (engine != NULL && !engine->Open(devicePath, shardKey)) {
+        delete engine;
+        engine = NULL;
+    }
+
+    return engine;
+}
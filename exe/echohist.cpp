@@ -0,0 +1,394 @@
+/*++
+
+Module Name:
+
+    echohist.cpp
+
+Abstract:
+
+    Log-linear latency histogram.
+    ӳֱͼ
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#include "echohist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#define LOG printf
+
+#define HIST_TEST_SAMPLES   200000
+
+//
+// Percentiles of the exported tables
+// еİٷλ
+//
+static const double HistPercentiles[] = { 50, 75, 90, 99, 99.9, 99.99 };
+static const PCSTR  HistPercentileNames[] = { "50", "75", "90", "99", "99.9", "99.99" };
+
+#define HIST_PERCENTILE_COUNT   (sizeof(HistPercentiles) / sizeof(HistPercentiles[0]))
+
+//
+// ͰеСֵ
+//
+static ULONGLONG HistBucketLowest(ULONG bucket)
+{
+    ULONG shift;
+
+    if (bucket < ECHO_HIST_SUB_COUNT) {
+        return bucket;
+    }
+
+    shift = bucket / ECHO_HIST_HALF_COUNT - 1;
+
+    return (ULONGLONG)(bucket - shift * ECHO_HIST_HALF_COUNT) << shift;
+}
+
+//
+// Ͱеֵ
+//
+static ULONGLONG HistBucketHighest(ULONG bucket)
+{
+    ULONG shift;
+
+    if (bucket < ECHO_HIST_SUB_COUNT) {
+        return bucket;
+    }
+
+    shift = bucket / ECHO_HIST_HALF_COUNT - 1;
+
+    return (((ULONGLONG)(bucket - shift * ECHO_HIST_HALF_COUNT) + 1) << shift) - 1;
+}
+
+VOID EchoHistReset(OUT PECHO_HISTOGRAM histogram)
+{
+    ZeroMemory(histogram, sizeof(*histogram));
+    histogram->Min = ~0ULL;
+}
+
+VOID EchoHistMerge(
+    IN OUT PECHO_HISTOGRAM       into,
+    IN     const ECHO_HISTOGRAM* from
+    )
+{
+    ULONG i;
+
+    if (from->Count == 0) {
+        return;
+    }
+
+    for (i = 0; i < ECHO_HIST_BUCKETS; i++) {
+        into->Buckets[i] += from->Buckets[i];
+    }
+
+    into->Count += from->Count;
+    into->Total += from->Total;
+
+    if (from->Min < into->Min) {
+        into->Min = from->Min;
+    }
+    if (from->Max > into->Max) {
+        into->Max = from->Max;
+    }
+}
+
+ULONGLONG EchoHistPercentile(
+    IN const ECHO_HISTOGRAM* histogram,
+    IN double                percentile
+    )
+{
+    double rank;
+    ULONGLONG target;
+    ULONGLONG seen = 0;
+    ULONGLONG value;
+    ULONG i;
+
+    if (histogram->Count == 0) {
+        return 0;
+    }
+
+    //
+    // The smallest rank that covers the percentile of the samples
+    // ǸðٷλС
+    //
+    rank = histogram->Count * percentile / 100.0;
+    target = (ULONGLONG)rank;
+    if (target < rank || target == 0) {
+        target++;
+    }
+
+    for (i = 0; i < ECHO_HIST_BUCKETS; i++) {
+        seen += histogram->Buckets[i];
+        if (seen >= target) {
+
+            //
+            // The bucket bound can exceed what was actually seen
+            // ͰϽܳʵʼ¼ֵ
+            //
+            value = HistBucketHighest(i);
+            return (value < histogram->Max) ? value : histogram->Max;
+        }
+    }
+
+    return histogram->Max;
+}
+
+//
+// Ҫдļ
+//
+static FILE* HistOpen(PCSTR path)
+{
+    FILE* file = NULL;
+
+#ifdef _MSC_VER
+    if (fopen_s(&file, path, "w") != 0) {
+        file = NULL;
+    }
+#else
+    file = fopen(path, "w");
+#endif
+
+    return file;
+}
+
+//
+// ֱͼMinΪ~0ʱΪ0
+//
+static ULONGLONG HistMin(const ECHO_HISTOGRAM* histogram)
+{
+    return (histogram->Count != 0) ? histogram->Min : 0;
+}
+
+static VOID HistWriteJson(FILE* file, const ECHO_HIST_NAMED* histograms, ULONG count)
+{
+    const ECHO_HISTOGRAM* histogram;
+    BOOLEAN first;
+    ULONG i;
+    ULONG p;
+    ULONG b;
+
+    fprintf(file, "{\n  \"unit\": \"ns\",\n  \"histograms\": [");
+
+    for (i = 0; i < count; i++) {
+        histogram = histograms[i].Histogram;
+
+        fprintf(file, "%s\n    {\n", (i != 0) ? "," : "");
+        fprintf(file, "      \"name\": \"%s\",\n", histograms[i].Name);
+        fprintf(file, "      \"count\": %llu,\n", histogram->Count);
+        fprintf(file, "      \"min\": %llu,\n", HistMin(histogram));
+        fprintf(file, "      \"mean\": %llu,\n",
+                (histogram->Count != 0) ? histogram->Total / histogram->Count : 0);
+        fprintf(file, "      \"max\": %llu,\n", histogram->Max);
+
+        fprintf(file, "      \"percentiles\": {");
+        for (p = 0; p < HIST_PERCENTILE_COUNT; p++) {
+            fprintf(file, "%s\"%s\": %llu", (p != 0) ? ", " : " ",
+                    HistPercentileNames[p], EchoHistPercentile(histogram, HistPercentiles[p]));
+        }
+        fprintf(file, " },\n");
+
+        //
+        // Only non-empty buckets, as [lowest, highest, count]
+        // ֻдǿͰʽΪ[Сֵ, ֵ, ]
+        //
+        fprintf(file, "      \"buckets\": [");
+        first = TRUE;
+        for (b = 0; b < ECHO_HIST_BUCKETS; b++) {
+            if (histogram->Buckets[b] != 0) {
+                fprintf(file, "%s[%llu, %llu, %llu]", first ? "" : ", ",
+                        HistBucketLowest(b), HistBucketHighest(b), histogram->Buckets[b]);
+                first = FALSE;
+            }
+        }
+        fprintf(file, "]\n    }");
+    }
+
+    fprintf(file, "\n  ]\n}\n");
+}
+
+static VOID HistWriteCsv(FILE* file, const ECHO_HIST_NAMED* histograms, ULONG count)
+{
+    const ECHO_HISTOGRAM* histogram;
+    ULONG i;
+    ULONG p;
+
+    fprintf(file, "name,count,min_ns,mean_ns");
+    for (p = 0; p < HIST_PERCENTILE_COUNT; p++) {
+        fprintf(file, ",p%s_ns", HistPercentileNames[p]);
+    }
+    fprintf(file, ",max_ns\n");
+
+    for (i = 0; i < count; i++) {
+        histogram = histograms[i].Histogram;
+
+        fprintf(file, "%s,%llu,%llu,%llu", histograms[i].Name, histogram->Count, HistMin(histogram),
+                (histogram->Count != 0) ? histogram->Total / histogram->Count : 0);
+        for (p = 0; p < HIST_PERCENTILE_COUNT; p++) {
+            fprintf(file, ",%llu", EchoHistPercentile(histogram, HistPercentiles[p]));
+        }
+        fprintf(file, ",%llu\n", histogram->Max);
+    }
+}
+
+BOOLEAN EchoHistExport(
+    IN PCSTR                  path,
+    IN ECHO_HIST_FORMAT       format,
+    IN const ECHO_HIST_NAMED* histograms,
+    IN ULONG                  count
+    )
+{
+    FILE* file;
+    BOOLEAN result;
+
+    file = HistOpen(path);
+    if (file == NULL) {
+        LOG("Cannot open %s for writing\n", path);
+        return FALSE;
+    }
+
+    if (format == EchoHistJson) {
+        HistWriteJson(file, histograms, count);
+    }
+    else {
+        HistWriteCsv(file, histograms, count);
+    }
+
+    result = (ferror(file) == 0);
+
+    if (fclose(file) != 0 || !result) {
+        LOG("Cannot write %s\n", path);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+// ȷֲֵ1 nsԼ17
+//
+static ULONGLONG HistTestValue(ULONGLONG* state)
+{
+    ULONGLONG bits;
+
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    bits = *state * 0x2545F4914F6CDD1DULL;
+
+    return (bits >> 24) >> (bits % ECHO_HIST_MAX_BITS);
+}
+
+BOOLEAN EchoHistSelfTest(VOID)
+{
+    PECHO_HISTOGRAM whole;
+    PECHO_HISTOGRAM halves;
+    std::vector<ULONGLONG> samples;
+    ULONGLONG state = 0x9E3779B97F4A7C15ULL;
+    ULONGLONG value;
+    ULONGLONG exact;
+    ULONGLONG reported;
+    ULONGLONG rank;
+    ULONG bucket;
+    ULONG i;
+    ULONG p;
+    BOOLEAN result = TRUE;
+
+    whole = (PECHO_HISTOGRAM)malloc(sizeof(ECHO_HISTOGRAM));
+    halves = (PECHO_HISTOGRAM)malloc(2 * sizeof(ECHO_HISTOGRAM));
+    if (whole == NULL || halves == NULL) {
+        free(whole);
+        free(halves);
+        return FALSE;
+    }
+
+    EchoHistReset(whole);
+    EchoHistReset(&halves[0]);
+    EchoHistReset(&halves[1]);
+
+    //
+    // Bucket bounds: every value lies in its bucket, exact below
+    // ECHO_HIST_SUB_COUNT and within 1/64 of itself above
+    // Ͱ߽磺ÿֵͰڣСECHO_HIST_SUB_COUNTʱȷʱ
+    // 1/64
+    //
+    for (i = 0; i < HIST_TEST_SAMPLES && result; i++) {
+        value = HistTestValue(&state);
+        bucket = EchoHistBucket(value);
+
+        if (bucket >= ECHO_HIST_BUCKETS ||
+            HistBucketLowest(bucket) > value || HistBucketHighest(bucket) < value ||
+            (HistBucketHighest(bucket) - HistBucketLowest(bucket)) * ECHO_HIST_HALF_COUNT > value) {
+            LOG("Histogram: %llu lands in bucket %d [%llu, %llu]\n",
+                value, bucket, HistBucketLowest(bucket), HistBucketHighest(bucket));
+            result = FALSE;
+        }
+
+        samples.push_back(value);
+        EchoHistRecord(whole, value);
+        EchoHistRecord(&halves[i & 1], value);
+    }
+
+    //
+    // Percentiles: at or above the exact rank, by at most the bucket width
+    // ٷλھȷֵͰ
+    //
+    std::sort(samples.begin(), samples.end());
+
+    for (p = 0; p < HIST_PERCENTILE_COUNT && result; p++) {
+        rank = (ULONGLONG)(samples.size() * HistPercentiles[p] / 100.0 + 0.999999);
+        exact = samples[(size_t)rank - 1];
+        reported = EchoHistPercentile(whole, HistPercentiles[p]);
+
+        if (reported < exact || (reported - exact) * ECHO_HIST_HALF_COUNT > exact) {
+            LOG("Histogram: p%s is %llu, exact %llu\n", HistPercentileNames[p], reported, exact);
+            result = FALSE;
+        }
+    }
+
+    if (result && (whole->Min != samples.front() || whole->Max != samples.back() ||
+                   EchoHistPercentile(whole, 100) != samples.back())) {
+        LOG("Histogram: min %llu max %llu, exact %llu %llu\n",
+            whole->Min, whole->Max, samples.front(), samples.back());
+        result = FALSE;
+    }
+
+    //
+    // Merging two halves gives the histogram of the whole
+    // ϲõֱͼ
+    //
+    EchoHistMerge(&halves[0], &halves[1]);
+
+    if (result && memcmp(&halves[0], whole, sizeof(ECHO_HISTOGRAM)) != 0) {
+        LOG("Histogram: merged halves differ from the whole\n");
+        result = FALSE;
+    }
+
+    //
+    // Values beyond the range are clamped to the last bucket
+    // ΧֵضϵһͰ
+    //
+    EchoHistReset(whole);
+    EchoHistRecord(whole, ~0ULL);
+
+    if (result && (whole->Max != ECHO_HIST_MAX_VALUE ||
+                   whole->Buckets[ECHO_HIST_BUCKETS - 1] != 1)) {
+        LOG("Histogram: a value beyond the range was not clamped\n");
+        result = FALSE;
+    }
+
+    free(whole);
+    free(halves);
+
+    LOG("Histogram self-test of %d samples: %s\n", HIST_TEST_SAMPLES, result ? "passed" : "FAILED");
+
+    return result;
+}
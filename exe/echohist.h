@@ -0,0 +1,158 @@
+/*++
+
+Module Name:
+
+    echohist.h
+
+Abstract:
+
+    Log-linear latency histogram. Values below 2^ECHO_HIST_SUB_BITS have a
+    bucket each; above that every power of two is split into
+    2^(ECHO_HIST_SUB_BITS-1) equal buckets, so a bucket is never wider
+    than 1/64 of its values. Recording is a few instructions and
+    histograms of different threads merge by adding buckets, which is
+    what lets each thread count on its own and the reporter combine them.
+    Histograms export to JSON (summary, percentile table and buckets) or
+    CSV (one summary row each) so runs can be charted and diffed.
+    ӳֱͼС2^ECHO_HIST_SUB_BITSֵÿֵһͰֵÿ
+    2䱻Ϊ2^(ECHO_HIST_SUB_BITS-1)ͰͰֵ1/64
+    ¼ֻ輸ָ̵ֱͬ߳ͼͰӼɺϲÿ߳̿Ը
+    ɱߺϲֱͼɵΪJSONժҪٷλͰCSVÿһ
+    ժҪڻƺͱȽ϶С
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#pragma once
+
+#include "echoport.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define ECHO_HIST_SUB_BITS      7
+#define ECHO_HIST_SUB_COUNT     (1 << ECHO_HIST_SUB_BITS)
+#define ECHO_HIST_HALF_COUNT    (ECHO_HIST_SUB_COUNT / 2)
+
+//
+// Values are clamped to 2^ECHO_HIST_MAX_BITS - 1 (about 18 minutes in ns)
+// ֵ2^ECHO_HIST_MAX_BITS - 1ڣԼ18ӣ
+//
+#define ECHO_HIST_MAX_BITS      40
+#define ECHO_HIST_MAX_VALUE     ((1ULL << ECHO_HIST_MAX_BITS) - 1)
+#define ECHO_HIST_BUCKETS \
+    ((ECHO_HIST_MAX_BITS - ECHO_HIST_SUB_BITS + 2) * ECHO_HIST_HALF_COUNT)
+
+typedef struct _ECHO_HISTOGRAM {
+    ULONGLONG Count;
+    ULONGLONG Total;            // sum of the recorded values
+    ULONGLONG Min;
+    ULONGLONG Max;
+    ULONGLONG Buckets[ECHO_HIST_BUCKETS];
+} ECHO_HISTOGRAM, *PECHO_HISTOGRAM;
+
+//
+// λλãvalueΪ0
+//
+inline ULONG EchoHistMsb(ULONGLONG value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+
+    _BitScanReverse64(&index, value);
+
+    return index;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
+//
+// ֵڵͰ
+//
+inline ULONG EchoHistBucket(ULONGLONG value)
+{
+    ULONG shift;
+
+    if (value < ECHO_HIST_SUB_COUNT) {
+        return (ULONG)value;
+    }
+
+    shift = EchoHistMsb(value) - (ECHO_HIST_SUB_BITS - 1);
+
+    return shift * ECHO_HIST_HALF_COUNT + (ULONG)(value >> shift);
+}
+
+inline VOID EchoHistRecord(PECHO_HISTOGRAM histogram, ULONGLONG value)
+{
+    if (value > ECHO_HIST_MAX_VALUE) {
+        value = ECHO_HIST_MAX_VALUE;
+    }
+
+    histogram->Buckets[EchoHistBucket(value)]++;
+    histogram->Count++;
+    histogram->Total += value;
+
+    if (value < histogram->Min) {
+        histogram->Min = value;
+    }
+    if (value > histogram->Max) {
+        histogram->Max = value;
+    }
+}
+
+VOID EchoHistReset(OUT PECHO_HISTOGRAM histogram);
+
+//
+// fromļӵinto
+//
+VOID EchoHistMerge(
+    IN OUT PECHO_HISTOGRAM       into,
+    IN     const ECHO_HISTOGRAM* from
+    );
+
+//
+// Highest value of the bucket holding the given percentile (0-100);
+// 0 for an empty histogram
+// ٷλ0-100Ͱֱֵͼ0
+//
+ULONGLONG EchoHistPercentile(
+    IN const ECHO_HISTOGRAM* histogram,
+    IN double                percentile
+    );
+
+typedef struct _ECHO_HIST_NAMED {
+    PCSTR                 Name;
+    const ECHO_HISTOGRAM* Histogram;
+} ECHO_HIST_NAMED, *PECHO_HIST_NAMED;
+
+typedef enum _ECHO_HIST_FORMAT {
+    EchoHistJson,
+    EchoHistCsv
+} ECHO_HIST_FORMAT;
+
+//
+// Writes the histograms to path: JSON with the summary, percentile table
+// and non-empty buckets of each, or CSV with one summary row per
+// histogram. Values are in ns.
+// ֱͼдpathJSONÿֱͼժҪٷλͷǿͰCSVÿֱͼ
+// һժҪֵΪλ
+//
+BOOLEAN EchoHistExport(
+    IN PCSTR                  path,
+    IN ECHO_HIST_FORMAT       format,
+    IN const ECHO_HIST_NAMED* histograms,
+    IN ULONG                  count
+    );
+
+//
+// Checks bucket bounds, percentiles against exact ranks, merging and
+// clamping. FALSE if any check fails.
+// Ͱ߽硢ٷλ뾫ȷһԡϲԼضϡмʧʱFALSE
+//
+BOOLEAN EchoHistSelfTest(VOID);
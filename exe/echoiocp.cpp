@@ -0,0 +1,255 @@
+/*++
+
+Module Name:
+
+    echoiocp.cpp
+
+Abstract:
+
+    Device engine: overlapped reads and writes on the echo device, with
+    completions dequeued in batches from an I/O completion port. Also the
+    device open that every device engine shares.
+    豸棺ڻ豸ִصдI/Oɶ˿ȡɡ
+    豸湲õ豸̡
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#include "echoengine.h"
+
+#include <winioctl.h>
+#include <stdio.h>
+#include <new>
+#include "public.h"
+
+#define LOG printf
+
+static_assert(sizeof(OVERLAPPED) <= sizeof(((PECHO_IO)0)->EnginePrivate),
+              "OVERLAPPED must fit in ECHO_IO::EnginePrivate");
+
+class EchoIocpEngine : public EchoEngine
+{
+public:
+    EchoIocpEngine()
+        : m_hDevice(INVALID_HANDLE_VALUE), m_hPort(NULL)
+    {
+    }
+
+    ~EchoIocpEngine()
+    {
+        if (m_hDevice != INVALID_HANDLE_VALUE) {
+            CloseHandle(m_hDevice);
+        }
+        if (m_hPort != NULL) {
+            CloseHandle(m_hPort);
+        }
+    }
+
+    PCSTR Name()
+    {
+        return "iocp";
+    }
+
+    BOOLEAN Open(PCWSTR devicePath, ULONG shardKey);
+
+    BOOLEAN Submit(PECHO_IO io);
+
+    ULONG Reap(PECHO_IO* completed, ULONG max, ULONG timeoutMs);
+
+    BOOLEAN Control(PECHO_IO io, ULONG code);
+
+    BOOLEAN Cancel(PECHO_IO io);
+
+private:
+    HANDLE m_hDevice;
+    HANDLE m_hPort;
+};
+
+HANDLE EchoDeviceOpen(PCWSTR devicePath, ULONG shardKey, BOOLEAN overlapped)
+{
+    OVERLAPPED ov;
+    ULONG bytesReturned;
+    HANDLE hDevice;
+    BOOL succeeded;
+
+    hDevice = CreateFile(devicePath,
+                         GENERIC_READ|GENERIC_WRITE,
+                         FILE_SHARE_READ | FILE_SHARE_WRITE,
+                         NULL,
+                         OPEN_EXISTING,
+                         overlapped ? FILE_FLAG_OVERLAPPED : 0,
+                         NULL);
+
+    if (hDevice == INVALID_HANDLE_VALUE) {
+        LOG("EchoDeviceOpen: Cannot open %ws error %d\n", devicePath, GetLastError());
+        return INVALID_HANDLE_VALUE;
+    }
+
+    if (shardKey == ECHO_SHARD_KEY_DEFAULT) {
+        return hDevice;
+    }
+
+    if (!overlapped) {
+        succeeded = DeviceIoControl(hDevice, IOCTL_ECHO_SET_SHARD_KEY,
+                                    &shardKey, sizeof(shardKey), NULL, 0, &bytesReturned, NULL);
+    }
+    else {
+
+        //
+        // An overlapped handle waits on an event; no completion port is
+        // associated yet, so nothing gets queued to one
+        // صȴ¼ʱδɶ˿ڣ
+        //
+        ZeroMemory(&ov, sizeof(ov));
+        ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (ov.hEvent == NULL) {
+            LOG("EchoDeviceOpen: CreateEvent failed %d\n", GetLastError());
+            CloseHandle(hDevice);
+            return INVALID_HANDLE_VALUE;
+        }
+
+        succeeded = DeviceIoControl(hDevice, IOCTL_ECHO_SET_SHARD_KEY,
+                                    &shardKey, sizeof(shardKey), NULL, 0, NULL, &ov);
+        if (succeeded || GetLastError() == ERROR_IO_PENDING) {
+            succeeded = GetOverlappedResult(hDevice, &ov, &bytesReturned, TRUE);
+        }
+
+        CloseHandle(ov.hEvent);
+    }
+
+    if (!succeeded) {
+        LOG("EchoDeviceOpen: IOCTL_ECHO_SET_SHARD_KEY failed %d\n", GetLastError());
+        CloseHandle(hDevice);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    return hDevice;
+}
+
+//
+// 豸̶Ƭɶ˿
+//
+BOOLEAN EchoIocpEngine::Open(PCWSTR devicePath, ULONG shardKey)
+{
+    m_hDevice = EchoDeviceOpen(devicePath, shardKey, TRUE);
+    if (m_hDevice == INVALID_HANDLE_VALUE) {
+        return FALSE;
+    }
+
+    m_hPort = CreateIoCompletionPort(m_hDevice, NULL, 1, 0);
+    if (m_hPort == NULL) {
+        LOG("EchoIocpEngine: Cannot open completion port %d\n", GetLastError());
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+// صд
+//
+BOOLEAN EchoIocpEngine::Submit(PECHO_IO io)
+{
+    LPOVERLAPPED ov = (LPOVERLAPPED)io->EnginePrivate;
+    BOOL started;
+
+    ZeroMemory(ov, sizeof(*ov));
+
+    if (io->Op == EchoOpWrite) {
+        started = WriteFile(m_hDevice, io->Buffer, io->Length, NULL, ov);
+    }
+    else {
+        started = ReadFile(m_hDevice, io->Buffer, io->Length, NULL, ov);
+    }
+
+    if (!started && GetLastError() != ERROR_IO_PENDING) {
+        io->Error = GetLastError();
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+// صDeviceIoControlioĻ
+//
+BOOLEAN EchoIocpEngine::Control(PECHO_IO io, ULONG code)
+{
+    LPOVERLAPPED ov = (LPOVERLAPPED)io->EnginePrivate;
+
+    ZeroMemory(ov, sizeof(*ov));
+
+    if (!DeviceIoControl(m_hDevice, code, io->Buffer, io->Length, io->Buffer, io->Length, NULL, ov) &&
+        GetLastError() != ERROR_IO_PENDING) {
+        io->Error = GetLastError();
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+// CancelIoExȡһERROR_NOT_FOUNDʾѾ
+//
+BOOLEAN EchoIocpEngine::Cancel(PECHO_IO io)
+{
+    return CancelIoEx(m_hDevice, (LPOVERLAPPED)io->EnginePrivate) ? TRUE : FALSE;
+}
+
+//
+// GetQueuedCompletionStatusExȡ
+//
+ULONG EchoIocpEngine::Reap(PECHO_IO* completed, ULONG max, ULONG timeoutMs)
+{
+    OVERLAPPED_ENTRY entries[ECHO_REAP_MAX];
+    ULONG count = 0;
+    ULONG i;
+    ULONG bytes;
+    PECHO_IO io;
+
+    if (max > ECHO_REAP_MAX) {
+        max = ECHO_REAP_MAX;
+    }
+
+    if (!GetQueuedCompletionStatusEx(m_hPort, entries, max, &count, timeoutMs, FALSE)) {
+        if (GetLastError() != WAIT_TIMEOUT) {
+            LOG("EchoIocpEngine: GetQueuedCompletionStatusEx failed %d\n", GetLastError());
+        }
+        return 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        io = CONTAINING_RECORD(entries[i].lpOverlapped, ECHO_IO, EnginePrivate);
+        io->Transferred = entries[i].dwNumberOfBytesTransferred;
+        io->Error = ERROR_SUCCESS;
+
+        //
+        // Internal holds the final status; only a failure needs translating
+        // Internal״ֻ̬ʧʱҪת
+        //
+        if (entries[i].lpOverlapped->Internal != 0 &&
+            !GetOverlappedResult(m_hDevice, entries[i].lpOverlapped, &bytes, FALSE)) {
+            io->Error = GetLastError();
+        }
+
+        completed[i] = io;
+    }
+
+    return count;
+}
+
+EchoEngine* EchoIocpEngineOpen(PCWSTR devicePath, ULONG shardKey)
+{
+    EchoIocpEngine* engine = new (std::nothrow) EchoIocpEngine();
+
+    if (engine != NULL && !engine->Open(devicePath, shardKey)) {
+        delete engine;
+        engine = NULL;
+    }
+
+    return engine;
+}
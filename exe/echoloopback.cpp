@@ -0,0 +1,142 @@
+/*++
+
+Module Name:
+
+    echoloopback.cpp
+
+Abstract:
+
+    In-process stand-in for the echo device. Like one shard of the driver
+    it keeps the data of the last write and returns it to reads, and it
+    services requests one after another, each taking a fixed time.
+    豸ĽһƬһһд
+    ظȡδÿʱ̶
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#include "echoengine.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <vector>
+
+class EchoLoopbackEngine : public EchoEngine
+{
+public:
+    explicit EchoLoopbackEngine(ULONGLONG serviceNs)
+        : m_ServiceNs(serviceNs), m_BusyUntilNs(0)
+    {
+    }
+
+    PCSTR Name()
+    {
+        return "loopback";
+    }
+
+    BOOLEAN Submit(PECHO_IO io);
+
+    ULONG Reap(PECHO_IO* completed, ULONG max, ULONG timeoutMs);
+
+private:
+    struct PENDING {
+        ULONGLONG DueNs;
+        PECHO_IO  Io;
+    };
+
+    ULONGLONG               m_ServiceNs;
+    ULONGLONG               m_BusyUntilNs;  // when the last queued request finishes
+    std::mutex              m_Lock;
+    std::condition_variable m_Completed;
+    std::deque<PENDING>     m_Pending;      // ordered by DueNs
+    std::vector<UCHAR>      m_Data;         // data of the last write
+};
+
+//
+// 󲢰ʱŶ
+//
+BOOLEAN EchoLoopbackEngine::Submit(PECHO_IO io)
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+    ULONGLONG now = EchoNowNs();
+    PENDING pending;
+
+    //
+    // The data moves at submission; only the completion waits for the
+    // request's turn, the same order the sequential queue gives
+    // ύʱֻͣҪȴֵ˳еĴͬ
+    //
+    if (io->Op == EchoOpWrite) {
+        m_Data.assign(io->Buffer, io->Buffer + io->Length);
+        io->Transferred = io->Length;
+    }
+    else {
+        io->Transferred = (m_Data.size() < io->Length) ? (ULONG)m_Data.size() : io->Length;
+        if (io->Transferred != 0) {
+            memcpy(io->Buffer, &m_Data[0], io->Transferred);
+        }
+    }
+    io->Error = ERROR_SUCCESS;
+
+    m_BusyUntilNs = ((m_BusyUntilNs > now) ? m_BusyUntilNs : now) + m_ServiceNs;
+
+    pending.DueNs = m_BusyUntilNs;
+    pending.Io = io;
+    m_Pending.push_back(pending);
+
+    m_Completed.notify_one();
+
+    return TRUE;
+}
+
+//
+// ѵʱ
+//
+ULONG EchoLoopbackEngine::Reap(PECHO_IO* completed, ULONG max, ULONG timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(m_Lock);
+    ULONGLONG deadline = EchoNowNs() + (ULONGLONG)timeoutMs * 1000000;
+    ULONGLONG now;
+    ULONG count = 0;
+
+    if (max > ECHO_REAP_MAX) {
+        max = ECHO_REAP_MAX;
+    }
+
+    for (;;) {
+        now = EchoNowNs();
+
+        while (count < max && !m_Pending.empty() && m_Pending.front().DueNs <= now) {
+            completed[count++] = m_Pending.front().Io;
+            m_Pending.pop_front();
+        }
+
+        if (count != 0 || now >= deadline) {
+            break;
+        }
+
+        //
+        // Sleep until the head request is due or something is submitted
+        // ֱڻµύ
+        //
+        ULONGLONG wakeNs = deadline;
+        if (!m_Pending.empty() && m_Pending.front().DueNs < wakeNs) {
+            wakeNs = m_Pending.front().DueNs;
+        }
+        m_Completed.wait_for(lock, std::chrono::nanoseconds(wakeNs - now));
+    }
+
+    return count;
+}
+
+EchoEngine* EchoLoopbackEngineOpen(ULONGLONG serviceNs)
+{
+    return new (std::nothrow) EchoLoopbackEngine(serviceNs);
+}
@@ -0,0 +1,241 @@
+/*++
+
+Module Name:
+
+    echopace.cpp
+
+Abstract:
+
+    Arrival schedule of an open-loop load.
+    صĵʱ
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#include "echopace.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#define LOG printf
+
+#define PACE_TEST_ARRIVALS  1000000
+
+//
+// xorshift64*
+//
+static ULONGLONG PaceRandom(ULONGLONG* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+VOID EchoPacerInit(
+    OUT PECHO_PACER  pacer,
+    IN  double       ratePerSec,
+    IN  ECHO_ARRIVAL arrival,
+    IN  ULONGLONG    seed,
+    IN  ULONGLONG    startNs
+    )
+{
+    pacer->GapNs = 1e9 / ratePerSec;
+    pacer->Arrival = arrival;
+    pacer->Rng = (seed != 0) ? seed : 0x9E3779B97F4A7C15ULL;
+    pacer->StartNs = startNs;
+    pacer->Count = 0;
+    pacer->OffsetNs = 0;
+}
+
+ULONGLONG EchoPacerNext(IN OUT PECHO_PACER pacer)
+{
+    ULONGLONG next = EchoPacerPeek(pacer);
+    double uniform;
+
+    pacer->Count++;
+
+    if (pacer->Arrival == EchoArrivalPoisson) {
+
+        //
+        // Inverse transform of 53 random bits; 1 - uniform is in (0, 1] so
+        // the log is finite
+        // 53λ任1 - uniformλ(0, 1]
+        //
+        uniform = (PaceRandom(&pacer->Rng) >> 11) * (1.0 / 9007199254740992.0);
+        pacer->OffsetNs += -log(1.0 - uniform) * pacer->GapNs;
+    }
+    else {
+
+        //
+        // From the count rather than by adding gaps, so rounding does not
+        // drift the schedule
+        // ɼۼӼʹʹʱƯ
+        //
+        pacer->OffsetNs = pacer->Count * pacer->GapNs;
+    }
+
+    return next;
+}
+
+BOOLEAN EchoPacerParse(IN PCSTR name, OUT ECHO_ARRIVAL* arrival)
+{
+    if (!_stricmp(name, "fixed")) {
+        *arrival = EchoArrivalFixed;
+        return TRUE;
+    }
+    if (!_stricmp(name, "poisson")) {
+        *arrival = EchoArrivalPoisson;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+PCSTR EchoPacerName(IN ECHO_ARRIVAL arrival)
+{
+    return (arrival == EchoArrivalPoisson) ? "poisson" : "fixed";
+}
+
+//
+// ʱÿΪGapNsȡûۻƯ
+//
+static BOOLEAN PaceTestFixed(double ratePerSec)
+{
+    ECHO_PACER pacer;
+    ULONGLONG startNs = 1000000000;
+    ULONGLONG previous;
+    ULONGLONG next;
+    ULONGLONG gap;
+    double gapNs = 1e9 / ratePerSec;
+    ULONG i;
+
+    EchoPacerInit(&pacer, ratePerSec, EchoArrivalFixed, 1, startNs);
+
+    previous = EchoPacerNext(&pacer);
+    if (previous != startNs) {
+        LOG("Pacer: fixed schedule at %.0f/s starts at %llu, not %llu\n", ratePerSec, previous, startNs);
+        return FALSE;
+    }
+
+    for (i = 1; i < PACE_TEST_ARRIVALS; i++) {
+        next = EchoPacerNext(&pacer);
+        gap = next - previous;
+        if (next < previous || gap < (ULONGLONG)floor(gapNs) || gap > (ULONGLONG)ceil(gapNs)) {
+            LOG("Pacer: fixed gap %u at %.0f/s is %llu ns, expected %.2f\n", i, ratePerSec, gap, gapNs);
+            return FALSE;
+        }
+        previous = next;
+    }
+
+    next = EchoPacerPeek(&pacer);
+    if (next != startNs + (ULONGLONG)(PACE_TEST_ARRIVALS * gapNs)) {
+        LOG("Pacer: fixed schedule at %.0f/s drifted to %llu\n", ratePerSec, next);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+// 鲴ɼľֵϵͳֵı
+//
+static BOOLEAN PaceTestPoisson(double ratePerSec, ULONGLONG seed)
+{
+    ECHO_PACER pacer;
+    ECHO_PACER twin;
+    ULONGLONG previous;
+    ULONGLONG next;
+    double gapNs = 1e9 / ratePerSec;
+    double gap;
+    double sum = 0;
+    double squares = 0;
+    double mean;
+    double cv;
+    double tail;
+    ULONG over = 0;
+    ULONG i;
+
+    EchoPacerInit(&pacer, ratePerSec, EchoArrivalPoisson, seed, 0);
+    EchoPacerInit(&twin, ratePerSec, EchoArrivalPoisson, seed, 0);
+
+    previous = EchoPacerNext(&pacer);
+
+    for (i = 1; i <= PACE_TEST_ARRIVALS; i++) {
+        next = EchoPacerNext(&pacer);
+        if (next < previous) {
+            LOG("Pacer: poisson arrival %u goes back in time\n", i);
+            return FALSE;
+        }
+
+        gap = (double)(next - previous);
+        sum += gap;
+        squares += gap * gap;
+        if (gap > 3 * gapNs) {
+            over++;
+        }
+        previous = next;
+    }
+
+    //
+    // The twin must walk the same schedule
+    // ͬʱ
+    //
+    for (i = 0; i <= PACE_TEST_ARRIVALS; i++) {
+        EchoPacerNext(&twin);
+    }
+    if (EchoPacerPeek(&twin) != EchoPacerPeek(&pacer)) {
+        LOG("Pacer: two pacers seeded with %llu disagree\n", seed);
+        return FALSE;
+    }
+
+    //
+    // Exponential gaps: mean 1/rate, standard deviation equal to the mean,
+    // and e^-3 of them longer than three means. A million samples put the
+    // estimates well within these bounds.
+    // ֲָļֵΪ1/rate׼ھֵֵıΪe^-3
+    // һʹֵԶЩ֮ڡ
+    //
+    mean = sum / PACE_TEST_ARRIVALS;
+    cv = sqrt(squares / PACE_TEST_ARRIVALS - mean * mean) / mean;
+    tail = (double)over / PACE_TEST_ARRIVALS;
+
+    if (fabs(mean / gapNs - 1) > 0.01 || fabs(cv - 1) > 0.01 || fabs(tail - exp(-3.0)) > 0.002) {
+        LOG("Pacer: poisson at %.0f/s has mean gap %.1f ns (expected %.1f), "
+            "coefficient of variation %.4f (1), %.4f beyond three means (%.4f)\n",
+            ratePerSec, mean, gapNs, cv, tail, exp(-3.0));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOLEAN EchoPacerSelfTest(VOID)
+{
+    static const double rates[] = { 1, 3, 1000, 70000, 1000000, 3000000 };
+    ECHO_ARRIVAL arrival;
+    ULONG i;
+    BOOLEAN result = TRUE;
+
+    for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        result = PaceTestFixed(rates[i]) && result;
+        result = PaceTestPoisson(rates[i], i + 1) && result;
+    }
+
+    if (!EchoPacerParse("Poisson", &arrival) || arrival != EchoArrivalPoisson ||
+        !EchoPacerParse("fixed", &arrival) || arrival != EchoArrivalFixed ||
+        EchoPacerParse("uniform", &arrival)) {
+        LOG("Pacer: arrival names do not parse\n");
+        result = FALSE;
+    }
+
+    LOG("Pacer self-test of %d rates: %s\n", (ULONG)(sizeof(rates) / sizeof(rates[0])),
+        result ? "passed" : "FAILED");
+
+    return result;
+}
@@ -0,0 +1,90 @@
+/*++
+
+Module Name:
+
+    echopace.h
+
+Abstract:
+
+    Arrival schedule of an open-loop load: the times at which requests are
+    meant to be sent at a target rate, evenly spaced or as a Poisson
+    process. A closed loop sends the next request only when one completes,
+    so a stall also delays the requests that would have seen it and the
+    percentiles leave it out; an open-loop load keeps to the schedule and
+    measures each request from its scheduled time, so a stall shows up in
+    every request it holds back. The schedule is a pure function of the
+    rate, arrival kind and seed, which lets two pacers with the same seed
+    walk the same schedule, one marking arrivals and one issuing them.
+    صĵʱĿʷļƻʱ䣬ȼΪɹ̡
+    ջֻʱŷһһͣҲƳ˱
+    ٷλб㲻ʱӼƻʱ俪ʼÿͣ
+    赲ÿСʱֻȡʡ﷽ʽӣͬ
+    ͬʱһǵһ
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#pragma once
+
+#include "echoport.h"
+
+typedef enum _ECHO_ARRIVAL {
+    EchoArrivalFixed = 0,       // one request every 1/rate seconds
+    EchoArrivalPoisson          // exponentially distributed gaps, mean 1/rate
+} ECHO_ARRIVAL;
+
+typedef struct _ECHO_PACER {
+    double       GapNs;         // mean time between arrivals
+    ECHO_ARRIVAL Arrival;
+    ULONGLONG    Rng;
+    ULONGLONG    StartNs;
+    ULONGLONG    Count;         // arrivals handed out
+    double       OffsetNs;      // of the next arrival from StartNs
+} ECHO_PACER, *PECHO_PACER;
+
+//
+// Starts a schedule of ratePerSec arrivals a second, the first at startNs
+// ʼÿratePerSecεʱһstartNs
+//
+VOID EchoPacerInit(
+    OUT PECHO_PACER  pacer,
+    IN  double       ratePerSec,
+    IN  ECHO_ARRIVAL arrival,
+    IN  ULONGLONG    seed,
+    IN  ULONGLONG    startNs
+    );
+
+//
+// Scheduled time of the next arrival; advances to the one after
+// һεļƻʱ䣻ǰһ
+//
+ULONGLONG EchoPacerNext(IN OUT PECHO_PACER pacer);
+
+//
+// Scheduled time of the next arrival without advancing
+// һεļƻʱ䣬ǰ
+//
+inline ULONGLONG EchoPacerPeek(IN const ECHO_PACER* pacer)
+{
+    return pacer->StartNs + (ULONGLONG)pacer->OffsetNs;
+}
+
+//
+// "fixed" or "poisson"; FALSE for anything else
+// "fixed""poisson"ֵFALSE
+//
+BOOLEAN EchoPacerParse(IN PCSTR name, OUT ECHO_ARRIVAL* arrival);
+
+PCSTR EchoPacerName(IN ECHO_ARRIVAL arrival);
+
+//
+// Checks the spacing of fixed schedules, the mean, spread and tail of
+// Poisson gaps, and that pacers with one seed agree. FALSE on a failure.
+// ʱļɼľֵɢȺβԼͬһӵĵǷ
+// һ¡ʧʱFALSE
+//
+BOOLEAN EchoPacerSelfTest(VOID);
@@ -0,0 +1,582 @@
+/*++
+
+Module Name:
+
+    echopattern.cpp
+
+Abstract:
+
+    Vectorized fill and check of the write/read test pattern.
+    дģʽУ顣
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#include "echopattern.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define PATTERN_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PATTERN_AVX2_TARGET
+#else
+#define PATTERN_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define PATTERN_NEON
+#include <arm_neon.h>
+#endif
+
+#define LOG printf
+
+#define PATTERN_MEASURE_BYTES   (256ULL * 1024 * 1024)
+#define PATTERN_TEST_MAX        (64 * 1024 + 100)
+#define PATTERN_TEST_ALIGN      64
+
+//
+// λλãmaskΪ0
+//
+static ULONG PatternLowestBit(ULONG mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+
+    _BitScanForward(&index, mask);
+
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+//
+// ֽ䣬汾Ļ׼
+//
+static VOID PatternFillScalar(PUCHAR buffer, ULONG length)
+{
+    ULONG i;
+
+    for (i = 0; i < length; i++) {
+        buffer[i] = (UCHAR)i;
+    }
+}
+
+static ULONG PatternCheckScalar(const UCHAR* buffer, ULONG length)
+{
+    ULONG i;
+
+    for (i = 0; i < length; i++) {
+        if (buffer[i] != (UCHAR)i) {
+            return i;
+        }
+    }
+
+    return length;
+}
+
+//
+// startʼֽУ飬ƫƴӻ
+//
+static ULONG PatternCheckTail(const UCHAR* buffer, ULONG start, ULONG length)
+{
+    ULONG i;
+
+    for (i = start; i < length; i++) {
+        if (buffer[i] != (UCHAR)i) {
+            return i;
+        }
+    }
+
+    return length;
+}
+
+#ifdef PATTERN_X86
+
+//
+// Adding 16 to every byte lane moves the pattern on by 16 bytes; the lanes
+// wrap at 256 just like the pattern does
+// ÿֽͨ16ģʽƽ16ֽڣͨ256ƣģʽһ
+//
+static VOID PatternFillSse2(PUCHAR buffer, ULONG length)
+{
+    __m128i value = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i step = _mm_set1_epi8(16);
+    ULONG i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+        _mm_storeu_si128((__m128i*)(buffer + i), value);
+        value = _mm_add_epi8(value, step);
+    }
+
+    for (; i < length; i++) {
+        buffer[i] = (UCHAR)i;
+    }
+}
+
+static ULONG PatternCheckSse2(const UCHAR* buffer, ULONG length)
+{
+    __m128i value = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i step = _mm_set1_epi8(16);
+    __m128i next1, next2, next3;
+    __m128i equal;
+    ULONG mask;
+    ULONG i = 0;
+
+    //
+    // Four vectors per test while everything matches; the mismatching
+    // vector is then found 16 bytes at a time
+    // ȫһʱÿжĸֲһºٰ16ֽڶλ
+    //
+    for (; i + 64 <= length; i += 64) {
+        next1 = _mm_add_epi8(value, step);
+        next2 = _mm_add_epi8(next1, step);
+        next3 = _mm_add_epi8(next2, step);
+
+        equal = _mm_and_si128(
+                    _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buffer + i)), value),
+                                  _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buffer + i + 16)), next1)),
+                    _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buffer + i + 32)), next2),
+                                  _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buffer + i + 48)), next3)));
+        if (_mm_movemask_epi8(equal) != 0xFFFF) {
+            break;
+        }
+
+        value = _mm_add_epi8(next3, step);
+    }
+
+    for (; i + 16 <= length; i += 16) {
+        mask = (ULONG)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buffer + i)), value));
+        if (mask != 0xFFFF) {
+            return i + PatternLowestBit(~mask);
+        }
+        value = _mm_add_epi8(value, step);
+    }
+
+    return PatternCheckTail(buffer, i, length);
+}
+
+static PATTERN_AVX2_TARGET VOID PatternFillAvx2(PUCHAR buffer, ULONG length)
+{
+    __m256i value = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                     16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+    __m256i step = _mm256_set1_epi8(32);
+    ULONG i = 0;
+
+    for (; i + 32 <= length; i += 32) {
+        _mm256_storeu_si256((__m256i*)(buffer + i), value);
+        value = _mm256_add_epi8(value, step);
+    }
+
+    for (; i < length; i++) {
+        buffer[i] = (UCHAR)i;
+    }
+}
+
+static PATTERN_AVX2_TARGET ULONG PatternCheckAvx2(const UCHAR* buffer, ULONG length)
+{
+    __m256i value = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                     16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+    __m256i step = _mm256_set1_epi8(32);
+    __m256i equal;
+    ULONG mask;
+    ULONG i = 0;
+
+    for (; i + 64 <= length; i += 64) {
+        equal = _mm256_and_si256(
+                    _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(buffer + i)), value),
+                    _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(buffer + i + 32)),
+                                      _mm256_add_epi8(value, step)));
+        if ((ULONG)_mm256_movemask_epi8(equal) != 0xFFFFFFFF) {
+            break;
+        }
+        value = _mm256_add_epi8(value, _mm256_add_epi8(step, step));
+    }
+
+    for (; i + 32 <= length; i += 32) {
+        mask = (ULONG)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(buffer + i)), value));
+        if (mask != 0xFFFFFFFF) {
+            return i + PatternLowestBit(~mask);
+        }
+        value = _mm256_add_epi8(value, step);
+    }
+
+    return PatternCheckTail(buffer, i, length);
+}
+
+//
+// CPUͲϵͳǷ֧AVX2
+//
+static BOOLEAN PatternHasAvx2(VOID)
+{
+#ifdef _MSC_VER
+    int info[4];
+
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return FALSE;
+    }
+
+    //
+    // The OS must save the YMM registers (OSXSAVE, then XCR0 bits 1-2)
+    // ϵͳ뱣YMMĴOSXSAVEȻXCR0ĵ1-2λ
+    //
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6) {
+        return FALSE;
+    }
+
+    __cpuidex(info, 7, 0);
+
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2") ? TRUE : FALSE;
+#endif
+}
+
+#endif // PATTERN_X86
+
+#ifdef PATTERN_NEON
+
+static VOID PatternFillNeon(PUCHAR buffer, ULONG length)
+{
+    static const UCHAR first[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+    uint8x16_t value = vld1q_u8(first);
+    uint8x16_t step = vdupq_n_u8(16);
+    ULONG i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+        vst1q_u8(buffer + i, value);
+        value = vaddq_u8(value, step);
+    }
+
+    for (; i < length; i++) {
+        buffer[i] = (UCHAR)i;
+    }
+}
+
+static ULONG PatternCheckNeon(const UCHAR* buffer, ULONG length)
+{
+    static const UCHAR first[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+    uint8x16_t value = vld1q_u8(first);
+    uint8x16_t step = vdupq_n_u8(16);
+    ULONG i = 0;
+
+    //
+    // NEON has no byte mask; the lowest lane of the compare says whether
+    // all matched, and a miss is located byte by byte
+    // NEONûֽ룻ȽϽСֵʾǷȫһ£һʱֽڶλ
+    //
+    for (; i + 16 <= length; i += 16) {
+        if (vminvq_u8(vceqq_u8(vld1q_u8(buffer + i), value)) != 0xFF) {
+            break;
+        }
+        value = vaddq_u8(value, step);
+    }
+
+    return PatternCheckTail(buffer, i, length);
+}
+
+#endif // PATTERN_NEON
+
+static const ECHO_PATTERN_IMPL PatternImpls[] = {
+    { "scalar", PatternFillScalar, PatternCheckScalar },
+#ifdef PATTERN_X86
+    { "sse2",   PatternFillSse2,   PatternCheckSse2 },
+    { "avx2",   PatternFillAvx2,   PatternCheckAvx2 },
+#endif
+#ifdef PATTERN_NEON
+    { "neon",   PatternFillNeon,   PatternCheckNeon },
+#endif
+};
+
+//
+// CPUеİ汾AVX2ڱ󣬲֧ʱ
+//
+static ULONG PatternImplCount(VOID)
+{
+    ULONG count = sizeof(PatternImpls) / sizeof(PatternImpls[0]);
+
+#ifdef PATTERN_X86
+    if (!PatternHasAvx2()) {
+        count--;
+    }
+#endif
+
+    return count;
+}
+
+//
+// ״ʹʱѡİ汾
+//
+static const ECHO_PATTERN_IMPL* PatternBest(VOID)
+{
+    static const ECHO_PATTERN_IMPL* best = &PatternImpls[PatternImplCount() - 1];
+
+    return best;
+}
+
+const ECHO_PATTERN_IMPL* EchoPatternImpls(OUT PULONG count)
+{
+    *count = PatternImplCount();
+
+    return PatternImpls;
+}
+
+VOID EchoPatternFill(OUT PUCHAR buffer, IN ULONG length)
+{
+    PatternBest()->Fill(buffer, length);
+}
+
+ULONG EchoPatternCheck(IN const UCHAR* buffer, IN ULONG length)
+{
+    return PatternBest()->Check(buffer, length);
+}
+
+PCSTR EchoPatternName(VOID)
+{
+    return PatternBest()->Name;
+}
+
+typedef struct _PATTERN_CACHED {
+    ULONG  Length;
+    PUCHAR Buffer;
+} PATTERN_CACHED;
+
+static std::mutex                  PatternCacheLock;
+static std::vector<PATTERN_CACHED> PatternCache;
+
+const UCHAR* EchoPatternGet(IN ULONG length)
+{
+    std::lock_guard<std::mutex> lock(PatternCacheLock);
+    PATTERN_CACHED cached;
+    size_t i;
+
+    //
+    // Any buffer at least as long holds the pattern as its prefix
+    // κβlengthĻԸģʽΪǰ׺
+    //
+    for (i = 0; i < PatternCache.size(); i++) {
+        if (PatternCache[i].Length >= length) {
+            return PatternCache[i].Buffer;
+        }
+    }
+
+    cached.Length = length;
+    cached.Buffer = (PUCHAR)malloc((length != 0) ? length : 1);
+    if (cached.Buffer == NULL) {
+        LOG("Could not allocate %d byte buffer\n", length);
+        return NULL;
+    }
+
+    EchoPatternFill(cached.Buffer, length);
+    PatternCache.push_back(cached);
+
+    return cached.Buffer;
+}
+
+VOID EchoPatternCacheFree(VOID)
+{
+    std::lock_guard<std::mutex> lock(PatternCacheLock);
+    size_t i;
+
+    for (i = 0; i < PatternCache.size(); i++) {
+        free(PatternCache[i].Buffer);
+    }
+
+    PatternCache.clear();
+}
+
+//
+// ձ汾һ汾ڸȺͶµУ
+//
+static BOOLEAN PatternCrossCheck(
+    const ECHO_PATTERN_IMPL* impl,
+    PUCHAR                   expected,
+    PUCHAR                   actual,
+    ULONG                    length,
+    ULONG                    align,
+    PULONGLONG               cases
+    )
+{
+    PUCHAR buffer = actual + align;
+    ULONG positions[4];
+    ULONG scalar;
+    ULONG vector;
+    ULONG step;
+    ULONG i;
+    ULONG j;
+
+    PatternFillScalar(expected, length);
+
+    //
+    // The guard bytes after the buffer must survive the fill
+    // ֮ıֽ뱣ֲ
+    //
+    memset(actual, 0xA5, PATTERN_TEST_MAX + 2 * PATTERN_TEST_ALIGN);
+    impl->Fill(buffer, length);
+    (*cases)++;
+
+    if (memcmp(buffer, expected, length) != 0 || buffer[length] != 0xA5) {
+        LOG("Pattern: %s fill of %d bytes at offset %d differs\n", impl->Name, length, align);
+        return FALSE;
+    }
+
+    if (impl->Check(buffer, length) != length) {
+        LOG("Pattern: %s check of %d bytes at offset %d reports a mismatch\n", impl->Name, length, align);
+        return FALSE;
+    }
+
+    //
+    // Every position of short buffers, a spread of them in long ones
+    // ̻ÿλãɢλ
+    //
+    step = (length <= 512) ? 1 : length / 97 + 1;
+
+    for (i = 0; i < length; i += step) {
+
+        positions[0] = i;
+        positions[1] = (i + 13 < length) ? i + 13 : i;
+        positions[2] = length - 1;
+        positions[3] = (i + 200 < length) ? i + 200 : length - 1;
+
+        for (j = 0; j < 4; j++) {
+            buffer[positions[j]] ^= (UCHAR)(1 << (j + i % 5));
+        }
+
+        scalar = PatternCheckScalar(buffer, length);
+        vector = impl->Check(buffer, length);
+        (*cases)++;
+
+        for (j = 4; j-- != 0; ) {
+            buffer[positions[j]] = (UCHAR)positions[j];
+        }
+
+        if (scalar != i || vector != scalar) {
+            LOG("Pattern: %s check of %d bytes at offset %d found %d, scalar %d, expected %d\n",
+                impl->Name, length, align, vector, scalar, i);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+BOOLEAN EchoPatternSelfTest(VOID)
+{
+    static const ULONG longLengths[] = { 4096, 4096 + 17, 30 * 1024, 40 * 1024, 64 * 1024 + 99 };
+    const ECHO_PATTERN_IMPL* impls;
+    PUCHAR expected;
+    PUCHAR actual;
+    ULONGLONG cases = 0;
+    ULONG count;
+    ULONG impl;
+    ULONG length;
+    ULONG align;
+    ULONG i;
+    BOOLEAN result = TRUE;
+
+    impls = EchoPatternImpls(&count);
+
+    expected = (PUCHAR)malloc(PATTERN_TEST_MAX);
+    actual = (PUCHAR)malloc(PATTERN_TEST_MAX + 2 * PATTERN_TEST_ALIGN);
+    if (expected == NULL || actual == NULL) {
+        free(expected);
+        free(actual);
+        return FALSE;
+    }
+
+    for (impl = 0; impl < count && result; impl++) {
+
+        for (length = 0; length <= 300 && result; length++) {
+            for (align = 0; align < PATTERN_TEST_ALIGN && result; align += (length < 40) ? 1 : 7) {
+                result = PatternCrossCheck(&impls[impl], expected, actual, length, align, &cases);
+            }
+        }
+
+        for (i = 0; i < sizeof(longLengths) / sizeof(longLengths[0]) && result; i++) {
+            for (align = 0; align < 4 && result; align++) {
+                result = PatternCrossCheck(&impls[impl], expected, actual, longLengths[i], align * 13, &cases);
+            }
+        }
+    }
+
+    free(expected);
+    free(actual);
+
+    LOG("Pattern cross-check of %d versions against scalar: %llu cases, %s\n",
+        count, cases, result ? "all agree" : "FAILED");
+
+    return result;
+}
+
+VOID EchoPatternMeasure(VOID)
+{
+    static const ULONG lengths[] = { 512, 4096, 30 * 1024, 40 * 1024, 1024 * 1024 };
+    const ECHO_PATTERN_IMPL* impls;
+    PUCHAR buffer;
+    ULONGLONG rounds;
+    ULONGLONG round;
+    ULONGLONG start;
+    ULONGLONG fillNs;
+    ULONGLONG checkNs;
+    ULONGLONG found = 0;
+    ULONG count;
+    ULONG impl;
+    ULONG i;
+
+    impls = EchoPatternImpls(&count);
+
+    buffer = (PUCHAR)malloc(lengths[sizeof(lengths) / sizeof(lengths[0]) - 1]);
+    if (buffer == NULL) {
+        return;
+    }
+
+    LOG("Pattern routines, %s selected\n", EchoPatternName());
+    LOG("%8s %9s %12s %12s\n", "version", "bytes", "fill GB/s", "check GB/s");
+
+    for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+
+        rounds = PATTERN_MEASURE_BYTES / lengths[i];
+
+        for (impl = 0; impl < count; impl++) {
+
+            start = EchoNowNs();
+            for (round = 0; round < rounds; round++) {
+                impls[impl].Fill(buffer, lengths[i]);
+            }
+            fillNs = EchoNowNs() - start;
+
+            start = EchoNowNs();
+            for (round = 0; round < rounds; round++) {
+                found += impls[impl].Check(buffer, lengths[i]);
+            }
+            checkNs = EchoNowNs() - start;
+
+            LOG("%8s %9d %12.2f %12.2f\n",
+                impls[impl].Name, lengths[i],
+                (double)PATTERN_MEASURE_BYTES / fillNs,
+                (double)PATTERN_MEASURE_BYTES / checkNs);
+        }
+    }
+
+    free(buffer);
+
+    //
+    // Using the results keeps the checks from being optimized away
+    // ʹýУ鱻Ż
+    //
+    if (found != 0 && found % 7 == 1) {
+        LOG("\n");
+    }
+}
@@ -0,0 +1,82 @@
+/*++
+
+Module Name:
+
+    echopattern.h
+
+Abstract:
+
+    The test pattern of the write/read test: byte i of a buffer holds
+    (UCHAR)i. Filling and checking run 16 or 32 bytes at a time with SSE2,
+    AVX2 or NEON, picked once at run time from what the CPU supports, with
+    a scalar version that every other one must agree with. Because every
+    pattern buffer is a prefix of a longer one, generated buffers are kept
+    and handed out again for any length they cover.
+    дԵģʽĵiֽΪ(UCHAR)iУ鰴CPUֵ֧
+    ʱѡһΣʹSSE2AVX2NEONÿδ1632ֽڣ汾汾
+    ֮һµĻ׼ÿģʽǸǰ׺ɵĻ
+    ᱻ串ǵκγȡ
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#pragma once
+
+#include "echoport.h"
+
+typedef VOID ECHO_PATTERN_FILL(PUCHAR buffer, ULONG length);
+
+//
+// Offset of the first byte that differs from the pattern, length if none
+// һģʽֽͬڵƫƣȫһʱlength
+//
+typedef ULONG ECHO_PATTERN_CHECK(const UCHAR* buffer, ULONG length);
+
+typedef struct _ECHO_PATTERN_IMPL {
+    PCSTR               Name;
+    ECHO_PATTERN_FILL*  Fill;
+    ECHO_PATTERN_CHECK* Check;
+} ECHO_PATTERN_IMPL, *PECHO_PATTERN_IMPL;
+
+//
+// The versions this CPU can run, scalar first and the fastest last
+// CPUеİ汾汾ǰ
+//
+const ECHO_PATTERN_IMPL* EchoPatternImpls(OUT PULONG count);
+
+//
+// Fill and check with the fastest version
+// ʹİ汾У
+//
+VOID EchoPatternFill(OUT PUCHAR buffer, IN ULONG length);
+
+ULONG EchoPatternCheck(IN const UCHAR* buffer, IN ULONG length);
+
+PCSTR EchoPatternName(VOID);
+
+//
+// A pattern buffer of at least length bytes, generated on first use and
+// kept until EchoPatternCacheFree. NULL if it cannot be allocated.
+// lengthֽڵģʽ״ʹʱɲEchoPatternCacheFree
+// ޷ʱNULL
+//
+const UCHAR* EchoPatternGet(IN ULONG length);
+
+VOID EchoPatternCacheFree(VOID);
+
+//
+// Checks every version against the scalar one over lengths, alignments
+// and mismatch positions. FALSE if any disagrees.
+// ڸֳȡͲһλϽÿ汾汾աвһʱFALSE
+//
+BOOLEAN EchoPatternSelfTest(VOID);
+
+//
+// Prints fill and check throughput of every version at the test sizes
+// ӡÿ汾ڲԴСµУ
+//
+VOID EchoPatternMeasure(VOID);
@@ -0,0 +1,460 @@
+/*++
+
+Module Name:
+
+    echopool.cpp
+
+Abstract:
+
+    Worker pool over one EchoEngine.
+    һEchoEngineĹ̳߳ء
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#include "echopool.h"
+#include "echoarena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#define LOG printf
+
+#define POOL_REAP_TIMEOUT_MS    100
+#define POOL_DRAIN_MS           10000
+
+//
+// The pacing thread sleeps only when the next arrival is further off than
+// this, which covers the coarsest default timer (15.6 ms on Windows)
+// һεȴֵԶʱ̲߳ߣֵĬ϶ʱWindowsΪ15.6 ms
+//
+#define POOL_PACE_SPIN_MS       20
+
+typedef struct _POOL_ARRIVAL {
+    ULONGLONG IntendedNs;
+    ECHO_OP   Op;
+    ULONG     Length;
+} POOL_ARRIVAL;
+
+struct _ECHO_POOL {
+    ECHO_POOL_CONFIG         Config;
+    PECHO_IO                 Ios;
+
+    std::mutex               FreeLock;
+    std::vector<PECHO_IO>    FreeList;
+
+    //
+    // Open loop: the arrival pacer is the pacing thread's, the issue pacer
+    // walks the same schedule under FreeLock, so the backlog needs no queue
+    // ߳УFreeLockͬʱ
+    // ˻ѹҪ
+    //
+    ECHO_PACER               ArrivalPacer;
+    ECHO_PACER               IssuePacer;
+    ULONGLONG                Arrivals;      // under FreeLock
+    ULONGLONG                Issued;
+    ULONGLONG                MaxBacklog;
+    std::deque<POOL_ARRIVAL> Backlog;       // External: arrivals not yet issued
+
+    std::atomic<ULONG>       Outstanding;
+    std::atomic<bool>        Draining;
+    std::atomic<bool>        Failed;
+    std::atomic<bool>        Hung;
+    std::atomic<ULONG>       Running;       // workers that have not returned
+
+    std::vector<std::thread> Threads;
+};
+
+//
+// ӿбȡ۲ֱбΪջ̳߳ؿʼſ
+//
+static VOID PoolIssue(PECHO_POOL pool, ULONG worker)
+{
+    POOL_ARRIVAL arrival = {};
+    PECHO_IO io;
+
+    while (!pool->Draining) {
+
+        {
+            std::lock_guard<std::mutex> lock(pool->FreeLock);
+
+            if (pool->FreeList.empty()) {
+                return;
+            }
+
+            //
+            // The controller may have lowered the depth below what is in
+            // flight; the excess drains as it completes
+            // ѽȽ;£Ĳſ
+            //
+            if (pool->Config.Depth != NULL &&
+                pool->Config.Slots - pool->FreeList.size() >= EchoDepthCurrent(pool->Config.Depth)) {
+                return;
+            }
+
+            //
+            // Open loop: only arrivals are issued, oldest first
+            // ֻѵ
+            //
+            if (pool->Config.External) {
+                if (pool->Backlog.empty()) {
+                    return;
+                }
+                arrival = pool->Backlog.front();
+                pool->Backlog.pop_front();
+                pool->Issued++;
+            }
+            else if (pool->Config.Rate != 0) {
+                if (pool->Issued == pool->Arrivals) {
+                    return;
+                }
+                arrival.IntendedNs = EchoPacerNext(&pool->IssuePacer);
+                pool->Issued++;
+            }
+
+            io = pool->FreeList.back();
+            pool->FreeList.pop_back();
+        }
+
+        if (pool->Config.External) {
+            io->Op = arrival.Op;
+            io->Length = arrival.Length;
+        }
+
+        if (!pool->Config.Prepare(pool->Config.Context, worker, io)) {
+            pool->Draining = true;
+        }
+        else {
+            if (pool->Config.Trace != NULL) {
+                EchoTraceRecord(pool->Config.Trace, pool->Config.TraceHandle, io->Op, io->Length);
+            }
+
+            io->Transferred = 0;
+            io->Error = ERROR_SUCCESS;
+            io->IssueNs = EchoNowNs();
+            io->IntendedNs = (pool->Config.Rate != 0 || pool->Config.External) ? arrival.IntendedNs : io->IssueNs;
+
+            //
+            // Count it first so no worker sees the pool idle while it starts
+            // ȼ߳䷢ڼΪ̳߳ѿ
+            //
+            pool->Outstanding++;
+
+            if (pool->Config.Engine->Submit(io)) {
+                continue;
+            }
+
+            LOG("EchoPool: %s failed %d\n", (io->Op == EchoOpRead) ? "Read" : "Write", io->Error);
+            pool->Outstanding--;
+            pool->Failed = true;
+            pool->Draining = true;
+        }
+
+        std::lock_guard<std::mutex> lock(pool->FreeLock);
+        pool->FreeList.push_back(io);
+    }
+}
+
+//
+// ̣߳ȡɡComplete黹۲·
+//
+static VOID PoolWorker(PECHO_POOL pool, ULONG worker)
+{
+    PECHO_IO completed[ECHO_REAP_MAX];
+    ULONGLONG drainDeadline = 0;
+    ECHO_CPU_SET set;
+    ULONG count;
+    ULONG i;
+
+    if (EchoAffinityPick(pool->Config.Affinity, pool->Config.AffinityBase + worker, &set)) {
+        EchoAffinityPin(&set);
+    }
+
+    PoolIssue(pool, worker);
+
+    for (;;) {
+
+        if (pool->Config.Stop != NULL && *pool->Config.Stop) {
+            pool->Draining = true;
+        }
+
+        if (pool->Draining) {
+            if (pool->Outstanding == 0) {
+                break;
+            }
+            if (drainDeadline == 0) {
+                drainDeadline = EchoNowNs() + (ULONGLONG)POOL_DRAIN_MS * 1000000;
+            }
+        }
+
+        count = pool->Config.Engine->Reap(completed, ECHO_REAP_MAX, POOL_REAP_TIMEOUT_MS);
+
+        if (count == 0) {
+            if (drainDeadline != 0 && EchoNowNs() > drainDeadline) {
+                LOG("EchoPool: %d operations did not complete\n", (ULONG)pool->Outstanding);
+                pool->Hung = true;
+                break;
+            }
+            continue;
+        }
+
+        pool->Config.Complete(pool->Config.Context, worker, completed, count);
+
+        {
+            std::lock_guard<std::mutex> lock(pool->FreeLock);
+
+            if (pool->Config.Depth != NULL) {
+                ULONGLONG now = EchoNowNs();
+
+                for (i = 0; i < count; i++) {
+                    EchoDepthRecord(pool->Config.Depth, now - completed[i]->IssueNs);
+                }
+            }
+
+            for (i = 0; i < count; i++) {
+                pool->FreeList.push_back(completed[i]);
+            }
+        }
+
+        pool->Outstanding -= count;
+
+        PoolIssue(pool, worker);
+    }
+
+    pool->Running--;
+}
+
+//
+// slotĻڽڵ㣬߳slot % WorkersĽڵ
+//
+static ULONG PoolSlotNode(PECHO_POOL pool, ULONG slot)
+{
+    ECHO_CPU_SET set;
+
+    if (pool->Config.Workers == 0 ||
+        !EchoAffinityPick(pool->Config.Affinity,
+                          pool->Config.AffinityBase + slot % pool->Config.Workers,
+                          &set)) {
+        return ECHO_NODE_ANY;
+    }
+
+    return EchoAffinitySetNode(&set);
+}
+
+//
+// ۵Ļ黹
+//
+static VOID PoolFreeBuffers(PECHO_POOL pool)
+{
+    ULONG i;
+
+    for (i = 0; i < pool->Config.Slots; i++) {
+        EchoArenaFreeNode((PUCHAR)pool->Ios[i].Buffer, pool->Config.BlockSize, PoolSlotNode(pool, i));
+    }
+}
+
+//
+// ̣߳ʱǵΪ䷢в
+//
+static VOID PoolPace(PECHO_POOL pool)
+{
+    ECHO_CPU_SET set;
+    ULONGLONG dueNs;
+    ULONGLONG now;
+
+    if (EchoAffinityPick(pool->Config.Affinity, pool->Config.AffinityBase + pool->Config.Workers, &set)) {
+        EchoAffinityPin(&set);
+    }
+
+    while (!pool->Draining && (pool->Config.Stop == NULL || !*pool->Config.Stop)) {
+
+        dueNs = EchoPacerPeek(&pool->ArrivalPacer);
+        now = EchoNowNs();
+
+        if (now < dueNs) {
+            if (dueNs - now > (ULONGLONG)POOL_PACE_SPIN_MS * 1000000) {
+                EchoSleepMs(1);
+            }
+            else {
+                std::this_thread::yield();
+            }
+            continue;
+        }
+
+        //
+        // Everything due is marked at once, so a late wakeup shows as
+        // backlog rather than as a slower schedule
+        // һαѵڵĵʹٵĻѱΪѹǱʱ
+        //
+        {
+            std::lock_guard<std::mutex> lock(pool->FreeLock);
+
+            while (EchoPacerPeek(&pool->ArrivalPacer) <= now) {
+                EchoPacerNext(&pool->ArrivalPacer);
+                pool->Arrivals++;
+            }
+            if (pool->Arrivals - pool->Issued > pool->MaxBacklog) {
+                pool->MaxBacklog = pool->Arrivals - pool->Issued;
+            }
+        }
+
+        PoolIssue(pool, pool->Config.Workers);
+    }
+}
+
+PECHO_POOL EchoPoolStart(IN PECHO_POOL_CONFIG config)
+{
+    PECHO_POOL pool;
+    ULONG i;
+
+    pool = new (std::nothrow) _ECHO_POOL();
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->Config = *config;
+    pool->Outstanding = 0;
+    pool->Draining = false;
+    pool->Failed = false;
+    pool->Hung = false;
+    pool->Running = config->Workers;
+
+    pool->Ios = new (std::nothrow) ECHO_IO[config->Slots];
+    if (pool->Ios == NULL) {
+        LOG("EchoPoolStart: Cannot allocate %d slots\n", config->Slots);
+        delete pool;
+        return NULL;
+    }
+
+    ZeroMemory(pool->Ios, config->Slots * sizeof(ECHO_IO));
+
+    //
+    // Buffers come from the arena, so a pool started after another one
+    // stopped reuses its buffers instead of allocating. The slab policy
+    // places them, so zeroing them here does not pull them to this node.
+    // Էһֹ̳̳߳ͣ߳ظ仺·䡣
+    // ĲԾλãڴ㲻̵߳Ľڵϡ
+    //
+    for (i = 0; i < config->Slots; i++) {
+        pool->Ios[i].Buffer = EchoArenaAllocNode(config->BlockSize, PoolSlotNode(pool, i));
+        if (pool->Ios[i].Buffer == NULL) {
+            LOG("EchoPoolStart: Cannot allocate %d slots of %d bytes\n", config->Slots, config->BlockSize);
+            PoolFreeBuffers(pool);
+            delete[] pool->Ios;
+            delete pool;
+            return NULL;
+        }
+        ZeroMemory(pool->Ios[i].Buffer, config->BlockSize);
+    }
+
+    //
+    // Pop order follows slot order, which keeps request numbers readable
+    // ջ˳˳һ£ʹ׶
+    //
+    for (i = config->Slots; i-- != 0; ) {
+        pool->Ios[i].Context = (PVOID)(ULONG_PTR)i;
+        pool->FreeList.push_back(&pool->Ios[i]);
+    }
+
+    pool->Arrivals = 0;
+    pool->Issued = 0;
+    pool->MaxBacklog = 0;
+
+    if (config->Rate != 0) {
+        ULONGLONG startNs = EchoNowNs();
+
+        EchoPacerInit(&pool->ArrivalPacer, config->Rate, config->Arrival, config->Seed, startNs);
+        EchoPacerInit(&pool->IssuePacer, config->Rate, config->Arrival, config->Seed, startNs);
+    }
+
+    for (i = 0; i < config->Workers; i++) {
+        pool->Threads.push_back(std::thread(PoolWorker, pool, i));
+    }
+
+    if (config->Rate != 0) {
+        pool->Threads.push_back(std::thread(PoolPace, pool));
+    }
+
+    return pool;
+}
+
+BOOLEAN EchoPoolIsDone(IN PECHO_POOL pool)
+{
+    return pool->Running == 0;
+}
+
+VOID EchoPoolPacing(IN PECHO_POOL pool, OUT PECHO_POOL_PACING pacing)
+{
+    std::lock_guard<std::mutex> lock(pool->FreeLock);
+
+    pacing->Arrivals = pool->Arrivals;
+    pacing->Issued = pool->Issued;
+    pacing->MaxBacklog = pool->MaxBacklog;
+}
+
+VOID EchoPoolArrive(
+    IN PECHO_POOL pool,
+    IN ULONGLONG  intendedNs,
+    IN ECHO_OP    op,
+    IN ULONG      length
+    )
+{
+    POOL_ARRIVAL arrival;
+
+    arrival.IntendedNs = intendedNs;
+    arrival.Op = op;
+    arrival.Length = length;
+
+    {
+        std::lock_guard<std::mutex> lock(pool->FreeLock);
+
+        pool->Backlog.push_back(arrival);
+        pool->Arrivals++;
+        if (pool->Arrivals - pool->Issued > pool->MaxBacklog) {
+            pool->MaxBacklog = pool->Arrivals - pool->Issued;
+        }
+    }
+
+    PoolIssue(pool, pool->Config.Workers);
+}
+
+VOID EchoPoolStop(IN PECHO_POOL pool)
+{
+    pool->Draining = true;
+}
+
+BOOLEAN EchoPoolWait(IN PECHO_POOL pool)
+{
+    BOOLEAN result;
+    size_t i;
+
+    for (i = 0; i < pool->Threads.size(); i++) {
+        pool->Threads[i].join();
+    }
+
+    result = !pool->Failed && !pool->Hung;
+
+    //
+    // Operations that never completed may still write their buffers, so
+    // a hung pool leaves them allocated
+    // δɵĲԿд仺˹̳߳زͷ
+    //
+    if (!pool->Hung) {
+        PoolFreeBuffers(pool);
+        delete[] pool->Ios;
+    }
+
+    delete pool;
+
+    return result;
+}
@@ -0,0 +1,145 @@
+/*++
+
+Module Name:
+
+    echopool.h
+
+Abstract:
+
+    Worker pool over one EchoEngine. The workers share the engine's
+    completion queue, each dequeuing completions in batches, and re-issue
+    I/O from a shared free list of slots, so the client side is not held
+    to one core however fast the device completes.
+    һEchoEngineĹ̳߳ء̹߳ɶУȡ
+    ɣӹĿвб·I/O豸ɵö죬ͻ˶
+    ᱻһϡ
+
+    With a Rate the pool is open-loop: a pacing thread marks arrivals on a
+    schedule (see echopace.h) and a slot is issued for each arrival as
+    soon as one is free; arrivals waiting for a slot are the backlog. An
+    External pool is open-loop too, but its arrivals come from
+    EchoPoolArrive, for replaying a trace.
+    Rateʱ̳߳Ϊ̰߳ʱechopace.hǵÿ
+    пвʱһۣȴв۵ĵＴΪѹExternal̳߳
+    ͬΪ䵽EchoPoolArriveڻطŸ١
+
+    With a Depth controller only its current depth of the slots is in
+    flight, and every completion's latency is fed back to it (see
+    echodepth.h).
+    Depthʱֻ䵱ǰȸ;ÿɵӳٶ
+    echodepth.h
+
+    With an Affinity each worker is pinned to its processors and the slots
+    are dealt out to the workers' NUMA nodes in turn (see echoaffinity.h).
+    The free list is shared, so a worker on one node still picks up slots
+    of another unless all of them run on one node.
+    Affinityʱÿ̶̱߳䴦ϣ䵽̵߳
+    NUMAڵ㣨echoaffinity.hбǹģ˳ȫ߳
+    λͬһڵ㣬һڵϵĹ߳ԻȡڵĲۡ
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#pragma once
+
+#include "echoaffinity.h"
+#include "echodepth.h"
+#include "echoengine.h"
+#include "echopace.h"
+#include "echotrace.h"
+
+//
+// Fills in Op and Length (at most the slot's BlockSize) of a free slot;
+// an External pool has already set them from the arrival. Returning FALSE
+// stops the pool from issuing; it drains and finishes. worker is Workers
+// when the pacing thread of an open-loop pool, or EchoPoolArrive, calls.
+// дв۵OpLengthBlockSizeExternal̳߳Ѱúá
+// FALSEʱֹ̳߳ͣI/Oſպ̳߳صĵ̻߳
+// EchoPoolArriveʱworkerΪWorkers
+//
+typedef BOOLEAN ECHO_POOL_PREPARE(PVOID context, ULONG worker, PECHO_IO io);
+
+//
+// Called by a worker with a batch of completed operations
+// ɹ߳һɵĲ
+//
+typedef VOID ECHO_POOL_COMPLETE(PVOID context, ULONG worker, PECHO_IO* completed, ULONG count);
+
+typedef struct _ECHO_POOL_CONFIG {
+    EchoEngine*             Engine;
+    ULONG                   Workers;
+    ULONG                   Slots;      // operations in flight
+    ULONG                   BlockSize;  // buffer bytes per slot
+    ECHO_POOL_PREPARE*      Prepare;
+    ECHO_POOL_COMPLETE*     Complete;
+    PVOID                   Context;
+    const volatile BOOLEAN* Stop;       // optional, drains the pool when set
+    double                  Rate;       // open-loop arrivals a second, 0 for a closed loop
+    ECHO_ARRIVAL            Arrival;
+    ULONGLONG               Seed;       // of the arrival schedule
+    BOOLEAN                 External;   // arrivals only from EchoPoolArrive
+    PECHO_TRACE_WRITER      Trace;      // optional, records every operation issued
+    ULONG                   TraceHandle;
+    PECHO_DEPTH_CONTROLLER  Depth;      // optional, keeps its depth of the slots in flight
+    const ECHO_AFFINITY*    Affinity;   // optional, worker i runs on set AffinityBase + i, the pacer after them
+    ULONG                   AffinityBase;
+} ECHO_POOL_CONFIG, *PECHO_POOL_CONFIG;
+
+typedef struct _ECHO_POOL_PACING {
+    ULONGLONG Arrivals;         // scheduled so far
+    ULONGLONG Issued;           // of which sent; the rest are the backlog
+    ULONGLONG MaxBacklog;
+} ECHO_POOL_PACING, *PECHO_POOL_PACING;
+
+typedef struct _ECHO_POOL* PECHO_POOL;
+
+//
+// Starts the workers. Slot i has ECHO_IO::Context set to i and a zeroed
+// buffer of BlockSize bytes from the buffer arena (see echoarena.h), on
+// the node of worker i % Workers. NULL on failure.
+// ̡߳iECHO_IO::ContextΪiΪȡԻ
+// echoarena.hBlockSizeֽڲ㣬λڹ߳i % WorkersĽڵϡ
+// ʧʱNULL
+//
+PECHO_POOL EchoPoolStart(IN PECHO_POOL_CONFIG config);
+
+//
+// TRUE once every worker has returned; EchoPoolWait will not block
+// й̶߳ѷʱΪTRUEʱEchoPoolWait
+//
+BOOLEAN EchoPoolIsDone(IN PECHO_POOL pool);
+
+//
+// Arrivals, issues and backlog of an open-loop pool so far
+// ̳߳صĿǰΪֹĵͻѹ
+//
+VOID EchoPoolPacing(IN PECHO_POOL pool, OUT PECHO_POOL_PACING pacing);
+
+//
+// Adds an arrival to an External pool, due at intendedNs, and issues it if
+// a slot is free
+// External̳߳һintendedNsڵĵпвʱ
+//
+VOID EchoPoolArrive(
+    IN PECHO_POOL pool,
+    IN ULONGLONG  intendedNs,
+    IN ECHO_OP    op,
+    IN ULONG      length
+    );
+
+//
+// Stops issuing and lets the pool drain
+// ֹͣI/O̳߳ſ
+//
+VOID EchoPoolStop(IN PECHO_POOL pool);
+
+//
+// Waits for the workers and frees the pool. FALSE if an operation could
+// not be issued or did not complete.
+// ȴ̲߳ͷ̳߳ءв޷δʱFALSE
+//
+BOOLEAN EchoPoolWait(IN PECHO_POOL pool);
@@ -0,0 +1,136 @@
+/*++
+
+Module Name:
+
+    echoport.h
+
+Abstract:
+
+    The few Windows types and helpers the benchmark modules use, so that
+    the benchmark core and the loopback engine also build on Linux.
+    ׼ģʹõWindowsͺ͸ʹ׼Ժĺͻػ
+    ҲLinuxϱ롣
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#pragma once
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+#else
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef void            VOID;
+typedef void*           PVOID;
+typedef int             BOOL;
+typedef unsigned char   BOOLEAN;
+typedef unsigned char   UCHAR, *PUCHAR;
+typedef uint16_t        USHORT;
+typedef int32_t         LONG;
+typedef uint32_t        ULONG, *PULONG;
+typedef long long       LONGLONG;
+typedef unsigned long long ULONGLONG, *PULONGLONG;
+typedef uintptr_t       ULONG_PTR;
+typedef const char*     PCSTR;
+
+#ifndef TRUE
+#define TRUE    1
+#define FALSE   0
+#endif
+
+#define IN
+#define OUT
+
+#define ERROR_SUCCESS               0
+#define ERROR_NOT_ENOUGH_MEMORY     8
+#define ERROR_INVALID_DATA          13
+#define ERROR_NOT_SUPPORTED         50
+#define ERROR_INVALID_PARAMETER     87
+#define ERROR_OPERATION_ABORTED     995
+#define ERROR_IO_PENDING            997
+
+#define ZeroMemory(p, n)    memset((p), 0, (n))
+#define _stricmp            strcasecmp
+#define _strnicmp           strncasecmp
+
+#endif
+
+//
+// ʱӣλ
+//
+inline ULONGLONG EchoNowNs(VOID)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER now;
+
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&now);
+
+    //
+    // Split the conversion so it cannot overflow on long uptimes
+    // ֻ㣬ⳤʱк
+    //
+    return (ULONGLONG)(now.QuadPart / frequency.QuadPart) * 1000000000ULL +
+           (ULONGLONG)(now.QuadPart % frequency.QuadPart) * 1000000000ULL / frequency.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (ULONGLONG)ts.tv_sec * 1000000000ULL + (ULONGLONG)ts.tv_nsec;
+#endif
+}
+
+//
+// ̵߳CPUʱ䣨û̬ں̬λ
+//
+inline ULONGLONG EchoCpuTimeNs(VOID)
+{
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+        return 0;
+    }
+
+    //
+    // FILETIME counts 100 ns units
+    // FILETIME100Ϊλ
+    //
+    return ((((ULONGLONG)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+            (((ULONGLONG)user.dwHighDateTime << 32) | user.dwLowDateTime)) * 100;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+    return (ULONGLONG)ts.tv_sec * 1000000000ULL + (ULONGLONG)ts.tv_nsec;
+#endif
+}
+
+//
+// ָĺ
+//
+inline VOID EchoSleepMs(ULONG milliseconds)
+{
+#ifdef _WIN32
+    Sleep(milliseconds);
+#else
+    usleep((useconds_t)milliseconds * 1000);
+#endif
+}
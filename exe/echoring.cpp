@@ -0,0 +1,345 @@
+/*++
+
+Module Name:
+
+    echoring.cpp
+
+Abstract:
+
+    Linux stand-in for a ring-based device interface in the style of
+    io_uring. Requests go on a submission ring that a polling device thread
+    consumes, and completions come back on a completion ring that workers
+    drain in batches, with neither direction making a system call while
+    the rings are busy. The device thread sleeps only after the submission
+    ring has stayed empty for a while, and workers sleep only when the
+    completion ring is empty, as with SQPOLL and a completion wait.
+    io_uringĻڻ豸ӿڵLinuxύѯ豸
+    ߳ȡߣɷɻɹ߳ȡæµʱ򶼲ϵͳ
+    á豸ֻ߳ύһʱߣֻ߳ɻΪʱ
+    ߣSQPOLLɵȴͬ
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#ifdef __linux__
+
+#include "echocpu.h"
+#include "echoengine.h"
+
+#include <atomic>
+#include <new>
+#include <thread>
+#include <vector>
+
+#define RING_ENTRIES        4096            // power of two
+#define RING_MASK           (RING_ENTRIES - 1)
+
+//
+// Empty polls of the submission ring before the device thread sleeps
+// 豸֮߳ǰύĿѯ
+//
+#define RING_IDLE_POLLS     2000
+#define RING_IDLE_WAIT_MS   100
+
+//
+// Head and tail on cache lines of their own, as the kernel lays them out
+// ͷβռһУں˵Ĳͬ
+//
+typedef struct _RING {
+    alignas(64) std::atomic<ULONG> Head;    // next entry to consume
+    alignas(64) std::atomic<ULONG> Tail;    // next entry to produce
+    alignas(64) PECHO_IO           Entries[RING_ENTRIES];
+} RING, *PRING;
+
+class EchoRingEngine : public EchoEngine
+{
+public:
+    explicit EchoRingEngine(ULONGLONG serviceNs)
+        : m_ServiceNs(serviceNs), m_DeviceIdle(false), m_Reapers(0), m_Stop(false)
+    {
+        m_Sq.Head = m_Sq.Tail = 0;
+        m_Cq.Head = m_Cq.Tail = 0;
+    }
+
+    ~EchoRingEngine();
+
+    PCSTR Name()
+    {
+        return "ring";
+    }
+
+    VOID Start(VOID)
+    {
+        m_Device = std::thread(&EchoRingEngine::DeviceThread, this);
+    }
+
+    BOOLEAN Submit(PECHO_IO io);
+
+    ULONG Reap(PECHO_IO* completed, ULONG max, ULONG timeoutMs);
+
+private:
+    VOID DeviceThread(VOID);
+
+    VOID Complete(PECHO_IO* batch, ULONG count);
+
+    ULONG Take(PECHO_IO* completed, ULONG max);
+
+    ULONGLONG               m_ServiceNs;
+    RING                    m_Sq;
+    RING                    m_Cq;
+    std::mutex              m_SubmitLock;   // submitters share the submission tail
+    std::mutex              m_Lock;         // for sleeping and waking only
+    std::condition_variable m_DeviceWake;
+    std::condition_variable m_Completed;
+    std::atomic<bool>       m_DeviceIdle;
+    std::atomic<ULONG>      m_Reapers;      // workers waiting on m_Completed
+    std::atomic<bool>       m_Stop;
+    std::thread             m_Device;
+    std::vector<UCHAR>      m_Data;         // data of the last write
+};
+
+EchoRingEngine::~EchoRingEngine()
+{
+    if (m_Device.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_Lock);
+
+            m_Stop = true;
+            m_DeviceWake.notify_one();
+        }
+        m_Device.join();
+    }
+}
+
+//
+// ύ豸߳ʱ份
+//
+BOOLEAN EchoRingEngine::Submit(PECHO_IO io)
+{
+    ULONG tail;
+
+    {
+        std::lock_guard<std::mutex> lock(m_SubmitLock);
+
+        //
+        // A full ring waits for the device rather than failing, since the
+        // caller's queue depth may exceed the ring
+        // ʱȴ豸ʧܣΪߵĶȿܳĴС
+        //
+        tail = m_Sq.Tail.load(std::memory_order_relaxed);
+        while (tail - m_Sq.Head.load(std::memory_order_acquire) == RING_ENTRIES) {
+            std::this_thread::yield();
+        }
+
+        m_Sq.Entries[tail & RING_MASK] = io;
+        m_Sq.Tail.store(tail + 1);
+    }
+
+    //
+    // Both sides use sequentially consistent operations on the tail and
+    // the idle flag, so the device either sees the entry or is woken
+    // ˫βͿб־ʹ˳һµĲ豸ҪôҪô
+    //
+    if (m_DeviceIdle.load()) {
+        std::lock_guard<std::mutex> lock(m_Lock);
+
+        m_DeviceWake.notify_one();
+    }
+
+    return TRUE;
+}
+
+//
+// һɷɻй̵߳ȴʱ份
+//
+VOID EchoRingEngine::Complete(PECHO_IO* batch, ULONG count)
+{
+    ULONG tail = m_Cq.Tail.load(std::memory_order_relaxed);
+    ULONG i;
+
+    for (i = 0; i < count; i++) {
+        while (tail + i - m_Cq.Head.load(std::memory_order_acquire) == RING_ENTRIES) {
+            std::this_thread::yield();
+        }
+        m_Cq.Entries[(tail + i) & RING_MASK] = batch[i];
+    }
+
+    //
+    // One tail update and at most one wakeup per batch
+    // ÿֻһβ໽һ
+    //
+    m_Cq.Tail.store(tail + count);
+
+    if (m_Reapers.load() != 0) {
+        std::lock_guard<std::mutex> lock(m_Lock);
+
+        m_Completed.notify_all();
+    }
+}
+
+//
+// 豸̣߳ѯύδÿʱm_ServiceNs俪˻
+//
+VOID EchoRingEngine::DeviceThread(VOID)
+{
+    EchoCpuHostThread account;
+    PECHO_IO batch[ECHO_REAP_MAX];
+    ULONG count;
+    ULONGLONG busyUntil = 0;
+    ULONGLONG now;
+    struct timespec delay;
+    ULONG idle = 0;
+    ULONG head;
+    ULONG tail;
+
+    while (!m_Stop) {
+
+        head = m_Sq.Head.load(std::memory_order_relaxed);
+        tail = m_Sq.Tail.load(std::memory_order_acquire);
+
+        if (head == tail) {
+            if (++idle < RING_IDLE_POLLS) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_Lock);
+
+            m_DeviceIdle = true;
+            if (m_Sq.Tail.load() == head && !m_Stop) {
+                m_DeviceWake.wait_for(lock, std::chrono::milliseconds(RING_IDLE_WAIT_MS));
+            }
+            m_DeviceIdle = false;
+            idle = 0;
+            continue;
+        }
+
+        idle = 0;
+        count = 0;
+
+        for (; head != tail; head++) {
+            PECHO_IO io = m_Sq.Entries[head & RING_MASK];
+
+            if (io->Op == EchoOpWrite) {
+                m_Data.assign(io->Buffer, io->Buffer + io->Length);
+                io->Transferred = io->Length;
+            }
+            else {
+                io->Transferred = (m_Data.size() < io->Length) ? (ULONG)m_Data.size() : io->Length;
+                if (io->Transferred != 0) {
+                    memcpy(io->Buffer, &m_Data[0], io->Transferred);
+                }
+            }
+            io->Error = ERROR_SUCCESS;
+
+            if (m_ServiceNs != 0) {
+                now = EchoNowNs();
+                busyUntil = ((busyUntil > now) ? busyUntil : now) + m_ServiceNs;
+                while ((now = EchoNowNs()) < busyUntil) {
+                    delay.tv_sec = (time_t)((busyUntil - now) / 1000000000);
+                    delay.tv_nsec = (long)((busyUntil - now) % 1000000000);
+                    nanosleep(&delay, NULL);
+                }
+            }
+
+            //
+            // Completions go out in batches, but a slow device posts each
+            // one as it finishes rather than holding it for the batch; the
+            // entries are consumed first, so the submission slots are free
+            // by the time the workers resubmit
+            // ɰ豸ÿʱǵȴ
+            // ύʹ߳ύʱύѿճ
+            //
+            batch[count++] = io;
+            if (count == ECHO_REAP_MAX || m_ServiceNs != 0 || head + 1 == tail) {
+                m_Sq.Head.store(head + 1, std::memory_order_release);
+                Complete(batch, count);
+                count = 0;
+            }
+        }
+    }
+}
+
+//
+// ɻȡmaxɣ߳CASƽͷ
+//
+ULONG EchoRingEngine::Take(PECHO_IO* completed, ULONG max)
+{
+    ULONG head = m_Cq.Head.load(std::memory_order_acquire);
+    ULONG tail;
+    ULONG count;
+    ULONG i;
+
+    for (;;) {
+        tail = m_Cq.Tail.load(std::memory_order_acquire);
+        count = (tail - head < max) ? tail - head : max;
+        if (count == 0) {
+            return 0;
+        }
+
+        //
+        // Copied before claiming: if another worker claims first the copy
+        // may be stale, and the failed exchange discards it
+        // ȸ죺߳죬Ƶݿѹڣʧʱ
+        //
+        for (i = 0; i < count; i++) {
+            completed[i] = m_Cq.Entries[(head + i) & RING_MASK];
+        }
+
+        if (m_Cq.Head.compare_exchange_weak(head, head + count, std::memory_order_acq_rel)) {
+            return count;
+        }
+    }
+}
+
+//
+// ȡɣɻΪʱȴ
+//
+ULONG EchoRingEngine::Reap(PECHO_IO* completed, ULONG max, ULONG timeoutMs)
+{
+    ULONGLONG deadline = EchoNowNs() + (ULONGLONG)timeoutMs * 1000000;
+    ULONGLONG now;
+    ULONG count;
+
+    if (max > ECHO_REAP_MAX) {
+        max = ECHO_REAP_MAX;
+    }
+
+    for (;;) {
+
+        count = Take(completed, max);
+        if (count != 0) {
+            return count;
+        }
+
+        now = EchoNowNs();
+        if (now >= deadline) {
+            return 0;
+        }
+
+        std::unique_lock<std::mutex> lock(m_Lock);
+
+        m_Reapers++;
+        if (m_Cq.Tail.load() == m_Cq.Head.load()) {
+            m_Completed.wait_for(lock, std::chrono::nanoseconds(deadline - now));
+        }
+        m_Reapers--;
+    }
+}
+
+EchoEngine* EchoRingEngineOpen(ULONGLONG serviceNs)
+{
+    EchoRingEngine* engine = new (std::nothrow) EchoRingEngine(serviceNs);
+
+    if (engine != NULL) {
+        engine->Start();
+    }
+
+    return engine;
+}
+
+#endif
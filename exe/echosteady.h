@@ -0,0 +1,149 @@
+/*++
+
+Module Name:
+
+    echosteady.h
+
+Abstract:
+
+    Steady-state detection and stopping rule of a measurement. The first
+    requests of a run pay for pool growth, the driver's start delay and
+    cold caches, so the run is cut into samples of a fixed length and the
+    warmup lasts until the last Window samples agree: the coefficient of
+    variation of their throughput and of their mean latency is under a
+    bound, and the means of the first and second half of the window differ
+    by no more than twice the relative error asked of the result, which
+    catches a slow ramp the variation alone would let through. Samples
+    before that are discarded. Samples after it are kept as batch means:
+    consecutive samples are summed into batches, and when the batches run
+    out the neighbours are merged and the batch doubles, so memory stays
+    fixed and the batches grow long enough to be nearly independent. The
+    mean throughput and latency are known to within a relative error once
+    the 95% confidence interval over the batches is that narrow on both
+    and consecutive batches are no longer correlated; what correlation
+    remains widens the interval.
+    ֹ̬ͣеҪе̳߳ӳ
+    仺ĿбзΪ̶ȵԤȳWindow
+    һΪֹƽӳٵıϵڽޣҴǰľֵ֮
+    Էֽƾϵ޷ʶĻǰ
+    ˺ֵ棺ۼΪʱڵ
+    ϲȼӱڴ̶㹻ƶ
+    ӳٵ95%䶼խڡʱΪ֪
+    ֵʣԻʹ
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#pragma once
+
+#include "echoport.h"
+
+#define ECHO_STEADY_SAMPLE_MS   100     // length of a sample
+#define ECHO_STEADY_WINDOW      10      // samples that must agree to end the warmup
+#define ECHO_STEADY_BATCHES     64      // batches kept; full, they merge in pairs
+#define ECHO_STEADY_MIN_BATCHES 20      // batches an interval is computed over at least
+
+typedef enum _ECHO_STEADY_PHASE {
+    EchoSteadyWarmup = 0,
+    EchoSteadyMeasuring,
+    EchoSteadyConverged
+} ECHO_STEADY_PHASE;
+
+typedef struct _ECHO_STEADY_CONFIG {
+    double MaxRateCv;           // of the window's throughput, 0.05 for 5%
+    double MaxLatencyCv;        // of the window's mean latency
+    double RelativeError;       // half-width of the 95% intervals over their mean
+} ECHO_STEADY_CONFIG, *PECHO_STEADY_CONFIG;
+
+//
+// A mean and the half-width of its 95% confidence interval
+// ֵ95%İ
+//
+typedef struct _ECHO_STEADY_ESTIMATE {
+    double Mean;
+    double HalfWidth;           // 0 until there are enough batches
+} ECHO_STEADY_ESTIMATE, *PECHO_STEADY_ESTIMATE;
+
+typedef struct _ECHO_STEADY_STATS {
+    ECHO_STEADY_PHASE    Phase;
+    ULONG                WarmupSamples;     // discarded, the window that ended them included
+    ULONGLONG            SteadySamples;     // kept
+    ULONG                Batches;           // complete
+    ULONG                BatchSize;         // samples per batch
+    double               Lag1;              // autocorrelation of consecutive batch throughputs
+    ECHO_STEADY_ESTIMATE Rate;              // operations a second
+    ECHO_STEADY_ESTIMATE LatencyNs;         // mean latency
+} ECHO_STEADY_STATS, *PECHO_STEADY_STATS;
+
+//
+// Operations, their summed latency and the time one sample or batch covers
+// һǵĲӳܺʱ
+//
+typedef struct _ECHO_STEADY_BATCH {
+    ULONGLONG Ops;
+    ULONGLONG LatencyNs;
+    double    Seconds;
+} ECHO_STEADY_BATCH, *PECHO_STEADY_BATCH;
+
+//
+// Not thread-safe: one thread adds the samples
+// ̰߳ȫһ߳
+//
+typedef struct _ECHO_STEADY {
+    ECHO_STEADY_CONFIG Config;
+    ECHO_STEADY_PHASE  Phase;
+    ECHO_STEADY_BATCH  Window[ECHO_STEADY_WINDOW];      // warmup: the last samples, oldest at Seen % Window
+    ULONG              Seen;                            // warmup samples so far
+    ECHO_STEADY_BATCH  Batches[ECHO_STEADY_BATCHES];
+    ULONG              BatchCount;                      // complete
+    ULONG              BatchSize;
+    ECHO_STEADY_BATCH  Current;                         // batch being filled
+    ULONG              CurrentSamples;
+    ULONGLONG          Kept;
+} ECHO_STEADY, *PECHO_STEADY;
+
+VOID EchoSteadyInit(
+    OUT PECHO_STEADY              steady,
+    IN  const ECHO_STEADY_CONFIG* config
+    );
+
+//
+// Adds a sample of ops operations whose latencies sum to latencyNs over
+// seconds and returns the phase after it. The samples up to the first
+// that returns EchoSteadyMeasuring are the warmup; the ones after are kept.
+// һsecondsopsӳܺΪlatencyNs֮
+// ׶ΡֱһEchoSteadyMeasuringΪԤȣ˺
+//
+ECHO_STEADY_PHASE EchoSteadyAdd(
+    IN OUT PECHO_STEADY steady,
+    IN     ULONGLONG    ops,
+    IN     ULONGLONG    latencyNs,
+    IN     double       seconds
+    );
+
+VOID EchoSteadyQuery(
+    IN  const ECHO_STEADY* steady,
+    OUT PECHO_STEADY_STATS stats
+    );
+
+PCSTR EchoSteadyPhaseName(IN ECHO_STEADY_PHASE phase);
+
+//
+// 0.975 quantile of Student's t with df degrees of freedom, rounded down
+// so that intervals come out wide rather than narrow
+// ɶΪdftֲ0.975λɶȡʹƫƫխ
+//
+double EchoSteadyT975(IN double df);
+
+//
+// Checks the statistics and the detector on synthetic runs: a flat run,
+// exponential and linear warmups, a run that never settles, correlated
+// noise, and the coverage of the intervals. FALSE on a failure.
+// ںϳɵϼͳͼƽСָԤȡӲȶС
+// ԼĸʡʧʱFALSE
+//
+BOOLEAN EchoSteadySelfTest(VOID);
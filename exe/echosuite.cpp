@@ -0,0 +1,739 @@
+/*++
+
+Module Name:
+
+    echosuite.cpp
+
+Abstract:
+
+    Benchmark suites, results files and the regression gate (see
+    echosuite.h). A results file is text:
+
+        suite default
+        workload qd1-4k-read -threads 1 -workers 1 -qd 1 -bs 4096 ...
+        run qd1-4k-read 41230.5 161.06 22.1 40.3 61.2 0
+
+    with the full options each workload ran with, then one line per run:
+    IOPS, MB/s, p50, p99 and p99.9 in microseconds, and errors.
+    ׼׼ļͻعŽechosuite.hļΪı
+    ÿʱȻÿһУIOPSMB/s΢Ƶp50
+    p99p99.9Լ
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#include "echosuite.h"
+#include "echoarena.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG printf
+
+#define SUITE_MAX_TOKENS        40
+#define SUITE_LINE              512
+#define SUITE_TEST_BASELINE     "echosuite.selftest.base"
+#define SUITE_TEST_CANDIDATE    "echosuite.selftest.cand"
+
+//
+// The built-in suites: queue depth 1 to 128, 512 bytes to 64 KB, reads,
+// writes and mixes, at most 4 threads so verification fits the shards
+// ׼1128512ֽڵ64 KBֻֻдͻϣ4̣߳
+// ʹУ鲻Ƭ
+//
+static const ECHO_SUITE_WORKLOAD SuiteDefault[] = {
+    { "qd1-4k-read",    "-qd 1 -bs 4096 -read 100" },
+    { "qd1-4k-write",   "-qd 1 -bs 4096 -read 0" },
+    { "qd8-4k-mix",     "-qd 8 -bs 4096 -read 50" },
+    { "qd32-4k-mix",    "-qd 32 -bs 4096 -read 50" },
+    { "qd32-512-mix",   "-qd 32 -bs 512 -read 50" },
+    { "qd32-64k-mix",   "-qd 32 -bs 65536 -read 50" },
+    { "qd128-4k-read",  "-qd 128 -bs 4096 -read 100" },
+    { "4t-qd32-4k-70r", "-threads 4 -qd 32 -bs 4096 -read 70" },
+};
+
+static const ECHO_SUITE_WORKLOAD SuiteQuick[] = {
+    { "qd1-4k-mix",     "-qd 1 -bs 4096 -read 50" },
+    { "qd32-4k-mix",    "-qd 32 -bs 4096 -read 50" },
+    { "qd32-64k-mix",   "-qd 32 -bs 65536 -read 50" },
+};
+
+//
+// The compared metrics and which way is worse
+// Ƚϵָ꣬ԼĸΪ
+//
+typedef enum _SUITE_METRIC {
+    SuiteMetricIops = 0,
+    SuiteMetricP50,
+    SuiteMetricP99,
+    SuiteMetricCount
+} SUITE_METRIC;
+
+static const PCSTR SuiteMetricNames[SuiteMetricCount] = { "IOPS", "p50(us)", "p99(us)" };
+static const BOOLEAN SuiteHigherIsBetter[SuiteMetricCount] = { TRUE, FALSE, FALSE };
+
+typedef struct _SUITE_WORKLOAD_RESULTS {
+    char              Name[ECHO_SUITE_NAME];
+    char              Options[ECHO_SUITE_ARGS];     // every option the workload ran with
+    ULONG             Runs;
+    ECHO_BENCH_RESULT Run[ECHO_SUITE_MAX_RUNS];
+} SUITE_WORKLOAD_RESULTS, *PSUITE_WORKLOAD_RESULTS;
+
+typedef struct _SUITE_RESULTS {
+    char                   Suite[ECHO_SUITE_NAME];
+    ULONG                  Count;
+    SUITE_WORKLOAD_RESULTS Workloads[ECHO_SUITE_MAX_WORKLOADS];
+} SUITE_RESULTS, *PSUITE_RESULTS;
+
+//
+// ļ
+//
+static FILE* SuiteOpen(PCSTR path, PCSTR mode)
+{
+    FILE* file = NULL;
+
+#ifdef _MSC_VER
+    if (fopen_s(&file, path, mode) != 0) {
+        file = NULL;
+    }
+#else
+    file = fopen(path, mode);
+#endif
+
+    if (file == NULL) {
+        LOG("Cannot open %s\n", path);
+    }
+
+    return file;
+}
+
+//
+// ͵ؽһаհײΪmaxʣص
+//
+static ULONG SuiteSplit(char* line, char** tokens, ULONG max)
+{
+    ULONG count = 0;
+
+    for (;;) {
+        while (*line == ' ' || *line == '\t' || *line == '\r' || *line == '\n') {
+            line++;
+        }
+        if (*line == '\0' || *line == '#' || count == max) {
+            return count;
+        }
+
+        tokens[count++] = line;
+
+        while (*line != '\0' && *line != ' ' && *line != '\t' && *line != '\r' && *line != '\n') {
+            line++;
+        }
+        if (*line != '\0') {
+            *line++ = '\0';
+        }
+    }
+}
+
+//
+// һصĲӦõdefaults֮ϣдɹ淶һ
+//
+static BOOLEAN SuiteParseWorkload(
+    const ECHO_SUITE_WORKLOAD*  workload,
+    const ECHO_BENCH_OPTIONS*   defaults,
+    PECHO_BENCH_OPTIONS         options,
+    char*                       canonical,
+    size_t                      size
+    )
+{
+    char args[ECHO_SUITE_ARGS];
+    char* tokens[SUITE_MAX_TOKENS];
+    ULONG count;
+    size_t used;
+
+    snprintf(args, sizeof(args), "%s", workload->Args);
+    count = SuiteSplit(args, tokens, SUITE_MAX_TOKENS);
+
+    *options = *defaults;
+    if (!EchoBenchParseOptions((int)count, tokens, options)) {
+        LOG("Workload %s: bad options \"%s\"\n", workload->Name, workload->Args);
+        return FALSE;
+    }
+
+    //
+    // A suite run is quiet and writes nothing but its results file
+    // ׼в棬ļⲻдκļ
+    //
+    if (options->ScaleWorkers != 0 || options->ReplayPath != NULL || options->RecordPath != NULL ||
+        options->JsonPath != NULL || options->CsvPath != NULL) {
+        LOG("Workload %s: -scale, -replay, -record, -json and -csv are not suite options\n", workload->Name);
+        return FALSE;
+    }
+    options->IntervalSec = 0;
+    options->TraceEvery = 0;
+
+    snprintf(canonical, size, "-threads %d -workers %d -qd %d -bs %d -read %d -time %d -verify %d -rate %d -arrival %s",
+             options->Threads, options->Workers, options->QueueDepth, options->BlockSize,
+             options->ReadPercent, options->DurationSec, options->Verify != 0, options->Rate,
+             EchoPacerName(options->Arrival));
+
+    //
+    // Only adaptive, steady-state and pinned workloads name their target
+    // or placement, so baselines saved before those existed still match
+    // ֻӦ̬͹̶õĸزдĿãʹ֮ǰ
+    // Ȼƥ
+    //
+    if (options->TargetUs != 0) {
+        used = strlen(canonical);
+        snprintf(canonical + used, size - used, " -target %d -control %s",
+                 options->TargetUs, EchoDepthName(options->Control));
+    }
+    if (options->Steady != 0) {
+        used = strlen(canonical);
+        snprintf(canonical + used, size - used, " -steady %g", options->Steady);
+    }
+    if (options->Affinity != NULL) {
+        used = strlen(canonical);
+        snprintf(canonical + used, size - used, " -affinity %s", options->Affinity);
+    }
+
+    return TRUE;
+}
+
+BOOLEAN EchoSuiteLoad(
+    IN  PCSTR       name,
+    OUT PECHO_SUITE suite
+    )
+{
+    const ECHO_SUITE_WORKLOAD* builtin = NULL;
+    char line[SUITE_LINE];
+    char* tokens[SUITE_MAX_TOKENS];
+    ULONG builtinCount = 0;
+    ULONG count;
+    ULONG i;
+    size_t used;
+    FILE* file;
+
+    ZeroMemory(suite, sizeof(*suite));
+    snprintf(suite->Name, sizeof(suite->Name), "%s", name);
+
+    if (!_stricmp(name, "default")) {
+        builtin = SuiteDefault;
+        builtinCount = sizeof(SuiteDefault) / sizeof(SuiteDefault[0]);
+    }
+    else if (!_stricmp(name, "quick")) {
+        builtin = SuiteQuick;
+        builtinCount = sizeof(SuiteQuick) / sizeof(SuiteQuick[0]);
+    }
+
+    if (builtin != NULL) {
+        for (i = 0; i < builtinCount; i++) {
+            suite->Workloads[i] = builtin[i];
+        }
+        suite->Count = builtinCount;
+        return TRUE;
+    }
+
+    file = SuiteOpen(name, "r");
+    if (file == NULL) {
+        return FALSE;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+
+        count = SuiteSplit(line, tokens, SUITE_MAX_TOKENS);
+        if (count == 0) {
+            continue;
+        }
+
+        if (suite->Count == ECHO_SUITE_MAX_WORKLOADS || strlen(tokens[0]) >= ECHO_SUITE_NAME) {
+            LOG("%s: at most %d workloads with names under %d characters\n",
+                name, ECHO_SUITE_MAX_WORKLOADS, ECHO_SUITE_NAME);
+            fclose(file);
+            return FALSE;
+        }
+
+        snprintf(suite->Workloads[suite->Count].Name, ECHO_SUITE_NAME, "%s", tokens[0]);
+
+        //
+        // The options are joined back into one line, as in a built-in suite
+        // ΪһУ׼ͬ
+        //
+        used = 0;
+        for (i = 1; i < count && used < ECHO_SUITE_ARGS; i++) {
+            used += snprintf(suite->Workloads[suite->Count].Args + used, ECHO_SUITE_ARGS - used,
+                             (i > 1) ? " %s" : "%s", tokens[i]);
+        }
+        suite->Count++;
+    }
+
+    fclose(file);
+
+    if (suite->Count == 0) {
+        LOG("%s holds no workloads\n", name);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOLEAN EchoSuiteRun(
+    IN const ECHO_SUITE*         suite,
+    IN const ECHO_BENCH_OPTIONS* defaults,
+    IN ULONG                     repeat,
+    IN ECHO_ENGINE_OPEN*         open,
+    IN PVOID                     context,
+    IN PCSTR                     path
+    )
+{
+    PECHO_BENCH_OPTIONS options;
+    ECHO_BENCH_RESULT run;
+    char (*canonical)[ECHO_SUITE_ARGS];
+    ULONG round;
+    ULONG i;
+    BOOLEAN result = TRUE;
+    FILE* file;
+
+    if (repeat == 0 || repeat > ECHO_SUITE_MAX_RUNS) {
+        LOG("Need 1-%d runs per workload\n", ECHO_SUITE_MAX_RUNS);
+        return FALSE;
+    }
+
+    //
+    // Every workload is checked before anything runs
+    // κθ֮ǰи
+    //
+    options = new ECHO_BENCH_OPTIONS[suite->Count];
+    canonical = new char[suite->Count][ECHO_SUITE_ARGS];
+
+    for (i = 0; i < suite->Count && result; i++) {
+        result = SuiteParseWorkload(&suite->Workloads[i], defaults, &options[i], canonical[i], ECHO_SUITE_ARGS);
+    }
+
+    file = result ? SuiteOpen(path, "w") : NULL;
+    if (file == NULL) {
+        delete[] options;
+        delete[] canonical;
+        return FALSE;
+    }
+
+    fprintf(file, "# echo benchmark results: IOPS, MB/s, p50, p99 and p99.9 in us, errors\n");
+    fprintf(file, "suite %s\n", suite->Name);
+    for (i = 0; i < suite->Count; i++) {
+        fprintf(file, "workload %s %s\n", suite->Workloads[i].Name, canonical[i]);
+    }
+
+    EchoArenaUseLargePages(defaults->LargePages != 0);
+
+    LOG("Suite %s: %d workloads, %d runs each, results to %s\n", suite->Name, suite->Count, repeat, path);
+    LOG("%-16s %5s %11s %9s %9s %9s %7s\n", "workload", "run", "IOPS", "MB/s", "p50(us)", "p99(us)", "errors");
+
+    for (round = 0; round < repeat; round++) {
+        for (i = 0; i < suite->Count; i++) {
+
+            result = EchoBenchMeasure(&options[i], open, context, &run) && result;
+
+            LOG("%-16s %2d/%-2d %11.1f %9.2f %9.1f %9.1f %7llu\n",
+                suite->Workloads[i].Name, round + 1, repeat,
+                run.OpsPerSec, run.MBPerSec, run.P50Us, run.P99Us, run.Errors);
+
+            //
+            // Written as it finishes, so an interrupted suite keeps its runs
+            // ÿнд룬ʹжϵ׼ɵ
+            //
+            fprintf(file, "run %s %.1f %.2f %.1f %.1f %.1f %llu\n",
+                    suite->Workloads[i].Name, run.OpsPerSec, run.MBPerSec,
+                    run.P50Us, run.P99Us, run.P999Us, run.Errors);
+            fflush(file);
+        }
+    }
+
+    if (ferror(file)) {
+        LOG("Cannot write %s\n", path);
+        result = FALSE;
+    }
+    fclose(file);
+
+    delete[] options;
+    delete[] canonical;
+
+    return result;
+}
+
+//
+// ƲҸأaddΪTRUEʱ
+//
+static PSUITE_WORKLOAD_RESULTS SuiteFind(PSUITE_RESULTS results, PCSTR name, BOOLEAN add)
+{
+    ULONG i;
+
+    for (i = 0; i < results->Count; i++) {
+        if (!strcmp(results->Workloads[i].Name, name)) {
+            return &results->Workloads[i];
+        }
+    }
+
+    if (!add || results->Count == ECHO_SUITE_MAX_WORKLOADS || strlen(name) >= ECHO_SUITE_NAME) {
+        return NULL;
+    }
+
+    snprintf(results->Workloads[i].Name, ECHO_SUITE_NAME, "%s", name);
+    results->Count++;
+
+    return &results->Workloads[i];
+}
+
+//
+// ȡļ
+//
+static BOOLEAN SuiteReadResults(PCSTR path, PSUITE_RESULTS results)
+{
+    PSUITE_WORKLOAD_RESULTS workload;
+    PECHO_BENCH_RESULT run;
+    char line[SUITE_LINE];
+    char* tokens[SUITE_MAX_TOKENS];
+    size_t used;
+    ULONG number = 0;
+    ULONG count;
+    ULONG i;
+    BOOLEAN result = TRUE;
+    FILE* file;
+
+    ZeroMemory(results, sizeof(*results));
+
+    file = SuiteOpen(path, "r");
+    if (file == NULL) {
+        return FALSE;
+    }
+
+    while (result && fgets(line, sizeof(line), file) != NULL) {
+
+        number++;
+        count = SuiteSplit(line, tokens, SUITE_MAX_TOKENS);
+        if (count == 0) {
+            continue;
+        }
+
+        if (!strcmp(tokens[0], "suite") && count == 2) {
+            snprintf(results->Suite, sizeof(results->Suite), "%s", tokens[1]);
+        }
+        else if (!strcmp(tokens[0], "workload") && count >= 2 &&
+                 (workload = SuiteFind(results, tokens[1], TRUE)) != NULL) {
+            used = 0;
+            for (i = 2; i < count && used < ECHO_SUITE_ARGS; i++) {
+                used += snprintf(workload->Options + used, ECHO_SUITE_ARGS - used,
+                                 (i > 2) ? " %s" : "%s", tokens[i]);
+            }
+        }
+        else if (!strcmp(tokens[0], "run") && count == 8 &&
+                 (workload = SuiteFind(results, tokens[1], FALSE)) != NULL &&
+                 workload->Runs < ECHO_SUITE_MAX_RUNS) {
+            run = &workload->Run[workload->Runs++];
+            run->OpsPerSec = strtod(tokens[2], NULL);
+            run->MBPerSec = strtod(tokens[3], NULL);
+            run->P50Us = strtod(tokens[4], NULL);
+            run->P99Us = strtod(tokens[5], NULL);
+            run->P999Us = strtod(tokens[6], NULL);
+            run->Errors = strtoull(tokens[7], NULL, 10);
+        }
+        else {
+            LOG("%s line %d is not a suite, workload or run line\n", path, number);
+            result = FALSE;
+        }
+    }
+
+    fclose(file);
+
+    return result;
+}
+
+//
+// һеĳָ
+//
+static double SuiteMetric(const ECHO_BENCH_RESULT* run, ULONG metric)
+{
+    switch (metric) {
+    case SuiteMetricIops:   return run->OpsPerSec;
+    case SuiteMetricP50:    return run->P50Us;
+    default:                return run->P99Us;
+    }
+}
+
+//
+// runsĳָľֵ
+//
+static VOID SuiteMeanVariance(const SUITE_WORKLOAD_RESULTS* workload, ULONG metric, double* mean, double* variance)
+{
+    double sum = 0;
+    double squares = 0;
+    ULONG i;
+
+    for (i = 0; i < workload->Runs; i++) {
+        sum += SuiteMetric(&workload->Run[i], metric);
+    }
+    *mean = sum / workload->Runs;
+
+    for (i = 0; i < workload->Runs; i++) {
+        squares += (SuiteMetric(&workload->Run[i], metric) - *mean) * (SuiteMetric(&workload->Run[i], metric) - *mean);
+    }
+    *variance = (workload->Runs > 1) ? squares / (workload->Runs - 1) : 0;
+}
+
+//
+// Ƚһصһָ꣬ӡһУֻعʱFALSE
+//
+static BOOLEAN SuiteCompareMetric(
+    const SUITE_WORKLOAD_RESULTS* base,
+    const SUITE_WORKLOAD_RESULTS* cand,
+    ULONG                         metric,
+    double                        thresholdPct
+    )
+{
+    double baseMean, baseVar, candMean, candVar;
+    double se, df, half, change, low, high, worse;
+    PCSTR verdict = "";
+
+    SuiteMeanVariance(base, metric, &baseMean, &baseVar);
+    SuiteMeanVariance(cand, metric, &candMean, &candVar);
+
+    if (baseMean == 0) {
+        LOG("%-16s %-8s %11.1f %11.1f %8s\n", base->Name, SuiteMetricNames[metric], baseMean, candMean, "-");
+        return TRUE;
+    }
+
+    //
+    // Welch's interval for the difference of the means, as a percentage
+    // of the baseline; the variances of the two sides need not be equal
+    // ֵ֮Welch䣬Իߵİٷֱȱʾķ
+    //
+    se = sqrt(baseVar / base->Runs + candVar / cand->Runs);
+    if (se != 0) {
+        df = (se * se * se * se) /
+             ((baseVar / base->Runs) * (baseVar / base->Runs) / (base->Runs - 1) +
+              (candVar / cand->Runs) * (candVar / cand->Runs) / (cand->Runs - 1));
+    }
+    else {
+        df = base->Runs + cand->Runs - 2;
+    }
+    half = EchoSteadyT975(df) * se;
+
+    change = (candMean - baseMean) / baseMean * 100;
+    low = (candMean - baseMean - half) / baseMean * 100;
+    high = (candMean - baseMean + half) / baseMean * 100;
+
+    //
+    // worse is the change in the direction that hurts; the interval must
+    // exclude zero on that side and the change must reach the threshold
+    // worseΪı仯ڸòų㣬ұ仯ﵽֵ
+    //
+    worse = SuiteHigherIsBetter[metric] ? -change : change;
+
+    if (SuiteHigherIsBetter[metric] ? (high < 0) : (low > 0)) {
+        if (worse >= thresholdPct) {
+            verdict = "REGRESSED";
+        }
+    }
+    else if (SuiteHigherIsBetter[metric] ? (low > 0) : (high < 0)) {
+        if (-worse >= thresholdPct) {
+            verdict = "improved";
+        }
+    }
+
+    LOG("%-16s %-8s %11.1f %11.1f %+7.1f%% [%+6.1f%%, %+6.1f%%] %s\n",
+        base->Name, SuiteMetricNames[metric], baseMean, candMean, change, low, high, verdict);
+
+    return (verdict[0] != 'R');
+}
+
+BOOLEAN EchoSuiteCompare(
+    IN PCSTR  baseline,
+    IN PCSTR  candidate,
+    IN double thresholdPct
+    )
+{
+    PSUITE_RESULTS base = new SUITE_RESULTS;
+    PSUITE_RESULTS cand = new SUITE_RESULTS;
+    PSUITE_WORKLOAD_RESULTS match;
+    ULONG regressions = 0;
+    ULONG problems = 0;
+    ULONG metric;
+    ULONG i;
+    ULONG j;
+    BOOLEAN result = TRUE;
+
+    if (!SuiteReadResults(baseline, base) || !SuiteReadResults(candidate, cand)) {
+        delete base;
+        delete cand;
+        return FALSE;
+    }
+
+    LOG("Comparing %s against baseline %s: 95%% confidence intervals of the change, "
+        "regressions of %.1f%% or more fail\n", candidate, baseline, thresholdPct);
+    if (strcmp(base->Suite, cand->Suite)) {
+        LOG("Suites differ: %s and %s; comparing the workloads they share\n", base->Suite, cand->Suite);
+    }
+    LOG("%-16s %-8s %11s %11s %8s %18s\n", "workload", "metric", "baseline", "candidate", "change", "95% CI");
+
+    for (i = 0; i < base->Count; i++) {
+
+        match = SuiteFind(cand, base->Workloads[i].Name, FALSE);
+
+        //
+        // A workload that vanished or changed options cannot be compared,
+        // and the gate fails rather than pass it unseen
+        // ʧıĸ޷ȽϣŽʧܶǷ
+        //
+        if (match == NULL || match->Runs == 0) {
+            LOG("%-16s missing from %s\n", base->Workloads[i].Name, candidate);
+            problems++;
+            continue;
+        }
+        if (strcmp(match->Options, base->Workloads[i].Options)) {
+            LOG("%-16s ran with other options:\n    baseline  %s\n    candidate %s\n",
+                base->Workloads[i].Name, base->Workloads[i].Options, match->Options);
+            problems++;
+            continue;
+        }
+        if (base->Workloads[i].Runs == 0) {
+            LOG("%-16s has no runs in %s\n", base->Workloads[i].Name, baseline);
+            problems++;
+            continue;
+        }
+
+        for (j = 0; j < match->Runs; j++) {
+            if (match->Run[j].Errors != 0) {
+                break;
+            }
+        }
+        if (j < match->Runs) {
+            LOG("%-16s run %d had %llu errors\n", match->Name, j + 1, match->Run[j].Errors);
+            problems++;
+            continue;
+        }
+
+        if (base->Workloads[i].Runs < 2 || match->Runs < 2) {
+            LOG("%-16s needs 2 or more runs on each side for an interval; only the change is shown\n",
+                match->Name);
+        }
+
+        for (metric = 0; metric < SuiteMetricCount; metric++) {
+            if (base->Workloads[i].Runs < 2 || match->Runs < 2) {
+                double baseMean, candMean, variance;
+
+                SuiteMeanVariance(&base->Workloads[i], metric, &baseMean, &variance);
+                SuiteMeanVariance(match, metric, &candMean, &variance);
+                LOG("%-16s %-8s %11.1f %11.1f %+7.1f%%\n", match->Name, SuiteMetricNames[metric],
+                    baseMean, candMean, (baseMean != 0) ? (candMean - baseMean) / baseMean * 100 : 0);
+            }
+            else if (!SuiteCompareMetric(&base->Workloads[i], match, metric, thresholdPct)) {
+                regressions++;
+            }
+        }
+    }
+
+    for (i = 0; i < cand->Count; i++) {
+        if (SuiteFind(base, cand->Workloads[i].Name, FALSE) == NULL) {
+            LOG("%-16s is new, not in the baseline\n", cand->Workloads[i].Name);
+        }
+    }
+
+    if (regressions != 0 || problems != 0) {
+        LOG("FAILED: %d regressions, %d workloads that could not be compared\n", regressions, problems);
+        result = FALSE;
+    }
+    else {
+        LOG("No regressions\n");
+    }
+
+    delete base;
+    delete cand;
+
+    return result;
+}
+
+//
+// дϳɽļÿrunsУIOPSԼΪiopsԼ1%ȷ
+//
+static BOOLEAN SuiteTestWrite(PCSTR path, const double* iops, ULONG workloads, ULONG runs, ULONGLONG seed)
+{
+    FILE* file;
+    double noise;
+    ULONG round;
+    ULONG i;
+
+    file = SuiteOpen(path, "w");
+    if (file == NULL) {
+        return FALSE;
+    }
+
+    fprintf(file, "suite selftest\n");
+    for (i = 0; i < workloads; i++) {
+        fprintf(file, "workload w%d -qd %d\n", i, 1 << i);
+    }
+
+    for (round = 0; round < runs; round++) {
+        for (i = 0; i < workloads; i++) {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            noise = ((double)(seed >> 11) / (double)(1ULL << 53) - 0.5) * 0.02;
+            fprintf(file, "run w%d %.1f %.2f %.1f %.1f %.1f 0\n",
+                    i, iops[i] * (1 + noise), iops[i] / 256, 1e6 / iops[i], 2e6 / iops[i], 3e6 / iops[i]);
+        }
+    }
+
+    fclose(file);
+
+    return TRUE;
+}
+
+BOOLEAN EchoSuiteSelfTest(VOID)
+{
+    static const double base[] = { 100000, 50000, 20000 };
+    static const double same[] = { 100000, 50000, 20000 };
+    static const double slower[] = { 100000, 45000, 20000 };    // 10% fewer IOPS, 11% higher latency
+    static const double slight[] = { 99000, 49500, 19800 };     // 1%, below the threshold
+    static const double faster[] = { 120000, 50000, 20000 };
+    BOOLEAN result = TRUE;
+
+    //
+    // The verdicts print as they would in a real comparison
+    // жʵȽʱһӡ
+    //
+    result = SuiteTestWrite(SUITE_TEST_BASELINE, base, 3, 8, 1) && result;
+
+    result = SuiteTestWrite(SUITE_TEST_CANDIDATE, same, 3, 8, 2) &&
+             EchoSuiteCompare(SUITE_TEST_BASELINE, SUITE_TEST_CANDIDATE, 5) && result;
+
+    result = SuiteTestWrite(SUITE_TEST_CANDIDATE, faster, 3, 8, 3) &&
+             EchoSuiteCompare(SUITE_TEST_BASELINE, SUITE_TEST_CANDIDATE, 5) && result;
+
+    result = SuiteTestWrite(SUITE_TEST_CANDIDATE, slight, 3, 8, 4) &&
+             EchoSuiteCompare(SUITE_TEST_BASELINE, SUITE_TEST_CANDIDATE, 5) && result;
+
+    //
+    // The 1% change is significant over 8 runs of 1% noise, so a zero
+    // threshold fails it
+    // 81%1%ı仯ģֵΪʱΪʧ
+    //
+    result = !EchoSuiteCompare(SUITE_TEST_BASELINE, SUITE_TEST_CANDIDATE, 0) && result;
+
+    result = SuiteTestWrite(SUITE_TEST_CANDIDATE, slower, 3, 8, 5) &&
+             !EchoSuiteCompare(SUITE_TEST_BASELINE, SUITE_TEST_CANDIDATE, 5) && result;
+
+    //
+    // A workload missing from the candidate fails the gate
+    // ѡȱٸʱŽʧ
+    //
+    result = SuiteTestWrite(SUITE_TEST_CANDIDATE, same, 2, 8, 6) &&
+             !EchoSuiteCompare(SUITE_TEST_BASELINE, SUITE_TEST_CANDIDATE, 5) && result;
+
+    remove(SUITE_TEST_BASELINE);
+    remove(SUITE_TEST_CANDIDATE);
+
+    LOG("Suite self-test of the regression gate: %s\n", result ? "passed" : "FAILED");
+
+    return result;
+}
@@ -0,0 +1,105 @@
+/*++
+
+Module Name:
+
+    echosuite.h
+
+Abstract:
+
+    Benchmark suites and the regression gate. A suite is a named set of
+    workloads, each a line of load generator options, covering queue
+    depths, sizes and mixes. Running a suite repeats every workload and
+    saves one line per run to a text results file; a saved file is the
+    baseline of later runs. Comparing two results files puts a 95%
+    confidence interval around the change of each workload's IOPS, p50 and
+    p99 (Welch's t over the repetitions) and flags a regression when the
+    interval lies entirely on the worse side and the change is at least
+    the threshold. The comparison needs no device, so it runs on any host
+    against recorded files.
+    ׼׼ͻعŽ׼һĸأÿһи
+    ǲͬĶȡСͶд׼ʱÿظΣÿ
+    ıļбһУļΪ֮еĻߡȽ
+    ļʱΪÿصIOPSp50p99ı仯95%䣨ظʹ
+    Welch t飩ȫڱһұ仯СֵʱΪع顣Ƚ
+    Ҫ豸˿κԼ¼ļС
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#pragma once
+
+#include "echobench.h"
+
+#define ECHO_SUITE_MAX_WORKLOADS    32
+#define ECHO_SUITE_MAX_RUNS         32
+#define ECHO_SUITE_NAME             32
+#define ECHO_SUITE_ARGS             192
+#define ECHO_SUITE_REPEAT           5       // runs per workload unless told otherwise
+#define ECHO_SUITE_THRESHOLD        5       // percent change that counts as a regression
+
+typedef struct _ECHO_SUITE_WORKLOAD {
+    char Name[ECHO_SUITE_NAME];
+    char Args[ECHO_SUITE_ARGS];     // load generator options, as on the command line
+} ECHO_SUITE_WORKLOAD, *PECHO_SUITE_WORKLOAD;
+
+typedef struct _ECHO_SUITE {
+    char                Name[ECHO_SUITE_NAME];
+    ULONG               Count;
+    ECHO_SUITE_WORKLOAD Workloads[ECHO_SUITE_MAX_WORKLOADS];
+} ECHO_SUITE, *PECHO_SUITE;
+
+//
+// Loads the built-in suite of that name ("default" or "quick") or else
+// the suite file at that path: one workload per line, its name followed
+// by its options, with # starting a comment.
+// ظƵ׼"default""quick"ظ·׼ļ
+// ÿһأƺ#ʼע͡
+//
+BOOLEAN EchoSuiteLoad(
+    IN  PCSTR       name,
+    OUT PECHO_SUITE suite
+    );
+
+//
+// Runs every workload of the suite repeat times, each on top of defaults,
+// and writes the runs to path. The repetitions go round the suite rather
+// than finishing one workload first, so slow drift of the machine spreads
+// over every workload. Returns FALSE if a workload is invalid or a run
+// failed.
+// defaults֮Ͻ׼еÿrepeatΣдpathظ
+// ׼һأʹĻƯƷ̯ÿϡ
+// ЧʧʱFALSE
+//
+BOOLEAN EchoSuiteRun(
+    IN const ECHO_SUITE*         suite,
+    IN const ECHO_BENCH_OPTIONS* defaults,
+    IN ULONG                     repeat,
+    IN ECHO_ENGINE_OPEN*         open,
+    IN PVOID                     context,
+    IN PCSTR                     path
+    );
+
+//
+// Compares the results file candidate against the results file baseline
+// and prints a row per workload and metric. Returns FALSE on a
+// regression of at least thresholdPct percent, a failed run, or a
+// baseline workload that is missing or ran with other options.
+// ļcandidateļbaselineȽϣΪÿغָӡһС
+// ֲСthresholdPctٷֱȵĻع顢ʧܡеĸȱʧ
+// ʱFALSE
+//
+BOOLEAN EchoSuiteCompare(
+    IN PCSTR  baseline,
+    IN PCSTR  candidate,
+    IN double thresholdPct
+    );
+
+//
+// Checks the confidence intervals and verdicts on synthetic results files
+// ںϳɵĽļϼж
+//
+BOOLEAN EchoSuiteSelfTest(VOID);
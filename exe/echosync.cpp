@@ -0,0 +1,107 @@
+/*++
+
+Module Name:
+
+    echosync.cpp
+
+Abstract:
+
+    Synchronous device engine: blocking WriteFile and ReadFile on a handle
+    opened without FILE_FLAG_OVERLAPPED. Submit returns once the request
+    has completed, so a thread has one request in flight however deep the
+    queue, and the I/O manager serializes the calls on the handle.
+    ͬ豸棺δʹFILE_FLAG_OVERLAPPED򿪵ľִWriteFile
+    ReadFileSubmitɺŷأ۶жһֻ߳һ
+    ;I/Oᴮлþϵĵá
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#include "echoengine.h"
+
+#include <stdio.h>
+#include <new>
+
+#define LOG printf
+
+class EchoSyncEngine : public EchoEngine
+{
+public:
+    EchoSyncEngine()
+        : m_hDevice(INVALID_HANDLE_VALUE)
+    {
+    }
+
+    ~EchoSyncEngine()
+    {
+        if (m_hDevice != INVALID_HANDLE_VALUE) {
+            CloseHandle(m_hDevice);
+        }
+    }
+
+    PCSTR Name()
+    {
+        return "sync";
+    }
+
+    BOOLEAN Open(PCWSTR devicePath, ULONG shardKey)
+    {
+        m_hDevice = EchoDeviceOpen(devicePath, shardKey, FALSE);
+
+        return (m_hDevice != INVALID_HANDLE_VALUE);
+    }
+
+    BOOLEAN Submit(PECHO_IO io);
+
+    ULONG Reap(PECHO_IO* completed, ULONG max, ULONG timeoutMs)
+    {
+        return m_Ready.Pop(completed, max, timeoutMs);
+    }
+
+private:
+    HANDLE         m_hDevice;
+    EchoReadyQueue m_Ready;
+};
+
+//
+// ɶдȻ佻Reap
+//
+BOOLEAN EchoSyncEngine::Submit(PECHO_IO io)
+{
+    ULONG bytes = 0;
+    BOOL succeeded;
+
+    if (io->Op == EchoOpWrite) {
+        succeeded = WriteFile(m_hDevice, io->Buffer, io->Length, &bytes, NULL);
+    }
+    else {
+        succeeded = ReadFile(m_hDevice, io->Buffer, io->Length, &bytes, NULL);
+    }
+
+    //
+    // The request ran either way; a failure is its completion status
+    // ۳ɰִУʧܼ״̬
+    //
+    io->Transferred = bytes;
+    io->Error = succeeded ? ERROR_SUCCESS : GetLastError();
+
+    m_Ready.Push(io);
+
+    return TRUE;
+}
+
+EchoEngine* EchoSyncEngineOpen(PCWSTR devicePath, ULONG shardKey)
+{
+    EchoSyncEngine* engine = new (std::nothrow) EchoSyncEngine();
+
+    if (engine != NULL && !engine->Open(devicePath, shardKey)) {
+        delete engine;
+        engine = NULL;
+    }
+
+    return engine;
+}
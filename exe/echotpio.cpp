@@ -0,0 +1,175 @@
+/*++
+
+Module Name:
+
+    echotpio.cpp
+
+Abstract:
+
+    Thread-pool device engine: overlapped reads and writes on the echo
+    device bound to the system thread pool with CreateThreadpoolIo. The
+    pool runs a callback per completion, which hands it to the workers
+    reaping the engine; the comparison therefore includes that hand-off.
+    ̳߳豸棺ڻ豸ִصдCreateThreadpoolIo
+    󶨵ϵͳ̳߳ء̳߳Ϊÿһλصص佻ȡɵĹ
+    ̣߳˱ȽϽһνӡ
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#include "echoengine.h"
+
+#include <stdio.h>
+#include <new>
+
+#define LOG printf
+
+static_assert(sizeof(OVERLAPPED) <= sizeof(((PECHO_IO)0)->EnginePrivate),
+              "OVERLAPPED must fit in ECHO_IO::EnginePrivate");
+
+class EchoThreadpoolEngine : public EchoEngine
+{
+public:
+    EchoThreadpoolEngine()
+        : m_hDevice(INVALID_HANDLE_VALUE), m_Io(NULL)
+    {
+    }
+
+    ~EchoThreadpoolEngine();
+
+    PCSTR Name()
+    {
+        return "threadpool";
+    }
+
+    BOOLEAN Open(PCWSTR devicePath, ULONG shardKey);
+
+    BOOLEAN Submit(PECHO_IO io);
+
+    ULONG Reap(PECHO_IO* completed, ULONG max, ULONG timeoutMs)
+    {
+        return m_Ready.Pop(completed, max, timeoutMs);
+    }
+
+private:
+    static VOID CALLBACK Completion(
+        PTP_CALLBACK_INSTANCE instance,
+        PVOID                 context,
+        PVOID                 overlapped,
+        ULONG                 ioResult,
+        ULONG_PTR             bytes,
+        PTP_IO                tpIo
+        );
+
+    HANDLE         m_hDevice;
+    PTP_IO         m_Io;
+    EchoReadyQueue m_Ready;
+};
+
+EchoThreadpoolEngine::~EchoThreadpoolEngine()
+{
+    //
+    // Closing the handle ends the outstanding requests; their callbacks
+    // must have run before the engine goes away
+    // رվδɵصͷ֮ǰ
+    //
+    if (m_hDevice != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_hDevice);
+    }
+    if (m_Io != NULL) {
+        WaitForThreadpoolIoCallbacks(m_Io, FALSE);
+        CloseThreadpoolIo(m_Io);
+    }
+}
+
+//
+// صʽ豸󶨵̳߳
+//
+BOOLEAN EchoThreadpoolEngine::Open(PCWSTR devicePath, ULONG shardKey)
+{
+    m_hDevice = EchoDeviceOpen(devicePath, shardKey, TRUE);
+    if (m_hDevice == INVALID_HANDLE_VALUE) {
+        return FALSE;
+    }
+
+    m_Io = CreateThreadpoolIo(m_hDevice, Completion, this, NULL);
+    if (m_Io == NULL) {
+        LOG("EchoThreadpoolEngine: CreateThreadpoolIo failed %d\n", GetLastError());
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+// ̳߳ػص¼Reap
+//
+VOID CALLBACK EchoThreadpoolEngine::Completion(
+    PTP_CALLBACK_INSTANCE instance,
+    PVOID                 context,
+    PVOID                 overlapped,
+    ULONG                 ioResult,
+    ULONG_PTR             bytes,
+    PTP_IO                tpIo
+    )
+{
+    EchoThreadpoolEngine* engine = (EchoThreadpoolEngine*)context;
+    PECHO_IO io = CONTAINING_RECORD(overlapped, ECHO_IO, EnginePrivate);
+
+    UNREFERENCED_PARAMETER(instance);
+    UNREFERENCED_PARAMETER(tpIo);
+
+    io->Transferred = (ULONG)bytes;
+    io->Error = ioResult;
+
+    engine->m_Ready.Push(io);
+}
+
+//
+// صдÿ֮ǰStartThreadpoolIo
+//
+BOOLEAN EchoThreadpoolEngine::Submit(PECHO_IO io)
+{
+    LPOVERLAPPED ov = (LPOVERLAPPED)io->EnginePrivate;
+    BOOL started;
+
+    ZeroMemory(ov, sizeof(*ov));
+
+    StartThreadpoolIo(m_Io);
+
+    if (io->Op == EchoOpWrite) {
+        started = WriteFile(m_hDevice, io->Buffer, io->Length, NULL, ov);
+    }
+    else {
+        started = ReadFile(m_hDevice, io->Buffer, io->Length, NULL, ov);
+    }
+
+    //
+    // A request that failed to start queues no callback, and the pool
+    // must be told so
+    // δܷ󲻻Ŷӻص֪̳߳
+    //
+    if (!started && GetLastError() != ERROR_IO_PENDING) {
+        io->Error = GetLastError();
+        CancelThreadpoolIo(m_Io);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+EchoEngine* EchoThreadpoolEngineOpen(PCWSTR devicePath, ULONG shardKey)
+{
+    EchoThreadpoolEngine* engine = new (std::nothrow) EchoThreadpoolEngine();
+
+    if (engine != NULL && !engine->Open(devicePath, shardKey)) {
+        delete engine;
+        engine = NULL;
+    }
+
+    return engine;
+}
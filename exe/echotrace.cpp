@@ -0,0 +1,530 @@
+/*++
+
+Module Name:
+
+    echotrace.cpp
+
+Abstract:
+
+    Binary traces of echo I/O.
+    I/OĶƸ١
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#include "echotrace.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define LOG printf
+
+#define TRACE_WRITE_BUFFER      (1024 * 1024)
+
+//
+// Bytes mapped at a time; a multiple of the allocation granularity
+// (64 KB on Windows) and of the record size
+// ÿӳֽǷȣWindowsΪ64 KBͼ¼Сı
+//
+#define TRACE_WINDOW_SIZE       ((size_t)64 * 1024 * 1024)
+#define TRACE_TEST_WINDOW_SIZE  ((size_t)64 * 1024)
+
+#define TRACE_TEST_THREADS      4
+#define TRACE_TEST_RECORDS      50000
+#define TRACE_TEST_PATH         "echotrace.selftest"
+
+struct _ECHO_TRACE_WRITER {
+    std::mutex        Lock;
+    FILE*             File;
+    ECHO_TRACE_HEADER Header;
+    ULONGLONG         LastNs;
+    BOOLEAN           Failed;
+};
+
+struct _ECHO_TRACE_READER {
+#ifdef _WIN32
+    HANDLE            File;
+    HANDLE            Mapping;
+#else
+    int               File;
+#endif
+    ULONGLONG         FileSize;
+    size_t            WindowSize;
+    ECHO_TRACE_HEADER Header;
+    ULONGLONG         Next;         // index of the next record
+    PUCHAR            View;
+    ULONGLONG         ViewOffset;
+    size_t            ViewSize;
+};
+
+//
+// ʼһոٵͷ
+//
+static VOID TraceInitHeader(PECHO_TRACE_HEADER header)
+{
+    ZeroMemory(header, sizeof(*header));
+    header->Magic = ECHO_TRACE_MAGIC;
+    header->Version = ECHO_TRACE_VERSION;
+    header->RecordSize = sizeof(ECHO_TRACE_RECORD);
+}
+
+PECHO_TRACE_WRITER EchoTraceCreate(IN PCSTR path)
+{
+    PECHO_TRACE_WRITER writer;
+
+    writer = new (std::nothrow) _ECHO_TRACE_WRITER();
+    if (writer == NULL) {
+        return NULL;
+    }
+
+#ifdef _MSC_VER
+    if (fopen_s(&writer->File, path, "wb") != 0) {
+        writer->File = NULL;
+    }
+#else
+    writer->File = fopen(path, "wb");
+#endif
+
+    if (writer->File == NULL) {
+        LOG("Cannot open %s for writing\n", path);
+        delete writer;
+        return NULL;
+    }
+
+    setvbuf(writer->File, NULL, _IOFBF, TRACE_WRITE_BUFFER);
+
+    //
+    // Records stays 0 until the trace is closed, which tells a reader
+    // to count the records itself
+    // رո֮ǰRecordsΪ0Ը֪ȡͳƼ¼
+    //
+    TraceInitHeader(&writer->Header);
+    writer->LastNs = 0;
+    writer->Failed = (fwrite(&writer->Header, sizeof(writer->Header), 1, writer->File) != 1);
+
+    return writer;
+}
+
+VOID EchoTraceRecord(
+    IN PECHO_TRACE_WRITER writer,
+    IN ULONG              handle,
+    IN ECHO_OP            op,
+    IN ULONG              length
+    )
+{
+    ECHO_TRACE_RECORD record;
+    ULONGLONG now;
+
+    std::lock_guard<std::mutex> lock(writer->Lock);
+
+    //
+    // Stamped under the lock so that gaps are never negative
+    // ȡʱʹΪ
+    //
+    now = EchoNowNs();
+
+    record.GapNs = (writer->Header.Records != 0) ? now - writer->LastNs : 0;
+    record.Length = length;
+    record.Handle = (USHORT)handle;
+    record.Op = (UCHAR)op;
+    record.Reserved = 0;
+
+    if (fwrite(&record, sizeof(record), 1, writer->File) != 1) {
+        writer->Failed = TRUE;
+        return;
+    }
+
+    writer->LastNs = now;
+    writer->Header.Records++;
+    writer->Header.DurationNs += record.GapNs;
+    if (handle + 1 > writer->Header.Handles) {
+        writer->Header.Handles = handle + 1;
+    }
+    if (length > writer->Header.MaxLength) {
+        writer->Header.MaxLength = length;
+    }
+}
+
+BOOLEAN EchoTraceClose(IN PECHO_TRACE_WRITER writer)
+{
+    BOOLEAN result = !writer->Failed;
+
+    if (fseek(writer->File, 0, SEEK_SET) != 0 ||
+        fwrite(&writer->Header, sizeof(writer->Header), 1, writer->File) != 1) {
+        result = FALSE;
+    }
+    if (fclose(writer->File) != 0) {
+        result = FALSE;
+    }
+
+    if (!result) {
+        LOG("EchoTrace: Writing the trace failed\n");
+    }
+
+    delete writer;
+
+    return result;
+}
+
+//
+// ǰڵӳ
+//
+static VOID TraceUnmap(PECHO_TRACE_READER reader)
+{
+    if (reader->View == NULL) {
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(reader->View);
+#else
+    munmap(reader->View, reader->ViewSize);
+#endif
+
+    reader->View = NULL;
+}
+
+//
+// ӳoffsetĴ
+//
+static BOOLEAN TraceMap(PECHO_TRACE_READER reader, ULONGLONG offset)
+{
+    TraceUnmap(reader);
+
+    reader->ViewOffset = offset - offset % reader->WindowSize;
+    reader->ViewSize = (size_t)((reader->FileSize - reader->ViewOffset < reader->WindowSize) ?
+                                reader->FileSize - reader->ViewOffset : reader->WindowSize);
+
+#ifdef _WIN32
+    reader->View = (PUCHAR)MapViewOfFile(reader->Mapping,
+                                         FILE_MAP_READ,
+                                         (DWORD)(reader->ViewOffset >> 32),
+                                         (DWORD)reader->ViewOffset,
+                                         reader->ViewSize);
+    if (reader->View == NULL) {
+        LOG("EchoTrace: MapViewOfFile failed %d\n", GetLastError());
+        return FALSE;
+    }
+#else
+    PVOID view = mmap(NULL, reader->ViewSize, PROT_READ, MAP_PRIVATE, reader->File, (off_t)reader->ViewOffset);
+
+    if (view == MAP_FAILED) {
+        LOG("EchoTrace: mmap failed\n");
+        return FALSE;
+    }
+
+    reader->View = (PUCHAR)view;
+
+    //
+    // Read ahead and drop behind, the whole trace is read once in order
+    // Ԥʱٰ˳ֻһ
+    //
+    madvise(reader->View, reader->ViewSize, MADV_SEQUENTIAL);
+#endif
+
+    return TRUE;
+}
+
+//
+// 򿪲ӳļڴСΪwindowSize
+//
+static PECHO_TRACE_READER TraceOpen(PCSTR path, size_t windowSize)
+{
+    PECHO_TRACE_READER reader;
+    ECHO_TRACE_RECORD record;
+    ULONGLONG records;
+
+    reader = new (std::nothrow) _ECHO_TRACE_READER();
+    if (reader == NULL) {
+        return NULL;
+    }
+
+    reader->WindowSize = windowSize;
+
+#ifdef _WIN32
+    LARGE_INTEGER size;
+
+    reader->Mapping = NULL;
+    reader->File = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                               FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (reader->File == INVALID_HANDLE_VALUE || !GetFileSizeEx(reader->File, &size)) {
+        LOG("Cannot open %s error %d\n", path, GetLastError());
+        goto Failed;
+    }
+    reader->FileSize = size.QuadPart;
+#else
+    struct stat status;
+
+    reader->File = open(path, O_RDONLY);
+    if (reader->File < 0 || fstat(reader->File, &status) != 0) {
+        LOG("Cannot open %s\n", path);
+        goto Failed;
+    }
+    reader->FileSize = status.st_size;
+#endif
+
+    if (reader->FileSize < sizeof(ECHO_TRACE_HEADER)) {
+        LOG("%s is not an echo trace\n", path);
+        goto Failed;
+    }
+
+#ifdef _WIN32
+    reader->Mapping = CreateFileMappingA(reader->File, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (reader->Mapping == NULL) {
+        LOG("Cannot map %s error %d\n", path, GetLastError());
+        goto Failed;
+    }
+#endif
+
+    if (!TraceMap(reader, 0)) {
+        goto Failed;
+    }
+
+    memcpy(&reader->Header, reader->View, sizeof(reader->Header));
+
+    if (reader->Header.Magic != ECHO_TRACE_MAGIC ||
+        reader->Header.Version != ECHO_TRACE_VERSION ||
+        reader->Header.RecordSize != sizeof(ECHO_TRACE_RECORD)) {
+        LOG("%s is not a version %d echo trace\n", path, ECHO_TRACE_VERSION);
+        goto Failed;
+    }
+
+    records = (reader->FileSize - sizeof(ECHO_TRACE_HEADER)) / sizeof(ECHO_TRACE_RECORD);
+
+    if (reader->Header.Records != 0) {
+        if (reader->Header.Records < records) {
+            records = reader->Header.Records;
+        }
+        reader->Header.Records = records;
+        return reader;
+    }
+
+    //
+    // The writer did not get to close the trace: one pass over it fills
+    // in what the header would have said
+    // дδܹرո٣һԲȫͷӦ
+    //
+    LOG("%s was not closed, reading %llu records\n", path, records);
+
+    reader->Header.Records = records;
+    reader->Header.DurationNs = 0;
+    reader->Header.Handles = 0;
+    reader->Header.MaxLength = 0;
+
+    while (EchoTraceNext(reader, &record)) {
+        reader->Header.DurationNs += record.GapNs;
+        if (record.Handle + 1U > reader->Header.Handles) {
+            reader->Header.Handles = record.Handle + 1U;
+        }
+        if (record.Length > reader->Header.MaxLength) {
+            reader->Header.MaxLength = record.Length;
+        }
+    }
+
+    reader->Next = 0;
+
+    return reader;
+
+Failed:
+
+    EchoTraceDelete(reader);
+
+    return NULL;
+}
+
+PECHO_TRACE_READER EchoTraceOpen(IN PCSTR path)
+{
+    return TraceOpen(path, TRACE_WINDOW_SIZE);
+}
+
+const ECHO_TRACE_HEADER* EchoTraceHeader(IN PECHO_TRACE_READER reader)
+{
+    return &reader->Header;
+}
+
+BOOLEAN EchoTraceNext(IN PECHO_TRACE_READER reader, OUT PECHO_TRACE_RECORD record)
+{
+    ULONGLONG offset;
+
+    if (reader->Next >= reader->Header.Records) {
+        return FALSE;
+    }
+
+    //
+    // Records never straddle windows: both the header and the window
+    // size are multiples of the record size
+    // ¼ԽڣͷʹڴСǼ¼Сı
+    //
+    offset = sizeof(ECHO_TRACE_HEADER) + reader->Next * sizeof(ECHO_TRACE_RECORD);
+
+    if (reader->View == NULL ||
+        offset < reader->ViewOffset ||
+        offset + sizeof(ECHO_TRACE_RECORD) > reader->ViewOffset + reader->ViewSize) {
+        if (!TraceMap(reader, offset)) {
+            return FALSE;
+        }
+    }
+
+    memcpy(record, reader->View + (size_t)(offset - reader->ViewOffset), sizeof(*record));
+    reader->Next++;
+
+    return TRUE;
+}
+
+VOID EchoTraceDelete(IN PECHO_TRACE_READER reader)
+{
+    if (reader == NULL) {
+        return;
+    }
+
+    TraceUnmap(reader);
+
+#ifdef _WIN32
+    if (reader->Mapping != NULL) {
+        CloseHandle(reader->Mapping);
+    }
+    if (reader->File != INVALID_HANDLE_VALUE) {
+        CloseHandle(reader->File);
+    }
+#else
+    if (reader->File >= 0) {
+        close(reader->File);
+    }
+#endif
+
+    delete reader;
+}
+
+//
+// Բ̣߳˳¼ɾƳĳ
+//
+static VOID TraceTestWriter(PECHO_TRACE_WRITER writer, ULONG handle)
+{
+    ULONG i;
+
+    for (i = 0; i < TRACE_TEST_RECORDS; i++) {
+        EchoTraceRecord(writer, handle, (i % 2) ? EchoOpRead : EchoOpWrite, handle * 100000 + i + 1);
+    }
+}
+
+//
+// СڶԲ٣ÿļ¼˳ͷ
+//
+static BOOLEAN TraceTestRead(PCSTR label)
+{
+    PECHO_TRACE_READER reader;
+    ECHO_TRACE_RECORD record;
+    ULONG next[TRACE_TEST_THREADS] = {};
+    ULONGLONG duration = 0;
+    ULONGLONG count = 0;
+    BOOLEAN result = TRUE;
+
+    reader = TraceOpen(TRACE_TEST_PATH, TRACE_TEST_WINDOW_SIZE);
+    if (reader == NULL) {
+        return FALSE;
+    }
+
+    while (EchoTraceNext(reader, &record)) {
+        ULONG handle = record.Handle;
+
+        if (handle >= TRACE_TEST_THREADS ||
+            record.Length != handle * 100000 + next[handle] + 1 ||
+            record.Op != ((next[handle] % 2) ? EchoOpRead : EchoOpWrite)) {
+            LOG("Trace: %s record %llu is handle %d, %d bytes, op %d\n",
+                label, count, handle, record.Length, record.Op);
+            result = FALSE;
+            break;
+        }
+
+        next[handle]++;
+        duration += record.GapNs;
+        count++;
+    }
+
+    if (result &&
+        (count != (ULONGLONG)TRACE_TEST_THREADS * TRACE_TEST_RECORDS ||
+         reader->Header.Records != count ||
+         reader->Header.DurationNs != duration ||
+         reader->Header.Handles != TRACE_TEST_THREADS ||
+         reader->Header.MaxLength != (TRACE_TEST_THREADS - 1) * 100000 + TRACE_TEST_RECORDS)) {
+        LOG("Trace: %s read %llu records over %llu ns; header says %llu over %llu ns, "
+            "%d handles, %d bytes at most\n",
+            label, count, duration, reader->Header.Records, reader->Header.DurationNs,
+            reader->Header.Handles, reader->Header.MaxLength);
+        result = FALSE;
+    }
+
+    EchoTraceDelete(reader);
+
+    return result;
+}
+
+BOOLEAN EchoTraceSelfTest(VOID)
+{
+    std::vector<std::thread> threads;
+    PECHO_TRACE_WRITER writer;
+    ULONGLONG unclosed = 0;
+    FILE* file = NULL;
+    ULONG i;
+    BOOLEAN result;
+
+    writer = EchoTraceCreate(TRACE_TEST_PATH);
+    if (writer == NULL) {
+        return FALSE;
+    }
+
+    for (i = 0; i < TRACE_TEST_THREADS; i++) {
+        threads.push_back(std::thread(TraceTestWriter, writer, i));
+    }
+    for (i = 0; i < TRACE_TEST_THREADS; i++) {
+        threads[i].join();
+    }
+
+    result = EchoTraceClose(writer) && TraceTestRead("closed trace");
+
+    //
+    // Clear Records as a writer that never closed would have left it
+    // δرյдRecords
+    //
+#ifdef _MSC_VER
+    if (fopen_s(&file, TRACE_TEST_PATH, "r+b") != 0) {
+        file = NULL;
+    }
+#else
+    file = fopen(TRACE_TEST_PATH, "r+b");
+#endif
+
+    if (file == NULL ||
+        fseek(file, offsetof(ECHO_TRACE_HEADER, Records), SEEK_SET) != 0 ||
+        fwrite(&unclosed, sizeof(unclosed), 1, file) != 1) {
+        LOG("Trace: Cannot rewrite %s\n", TRACE_TEST_PATH);
+        result = FALSE;
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+
+    result = result && TraceTestRead("unclosed trace");
+
+    remove(TRACE_TEST_PATH);
+
+    LOG("Trace self-test of %d records from %d threads: %s\n",
+        TRACE_TEST_THREADS * TRACE_TEST_RECORDS, TRACE_TEST_THREADS, result ? "passed" : "FAILED");
+
+    return result;
+}
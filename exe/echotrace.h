@@ -0,0 +1,106 @@
+/*++
+
+Module Name:
+
+    echotrace.h
+
+Abstract:
+
+    Binary traces of echo I/O. A trace is a 32-byte header followed by one
+    16-byte record per operation: the gap since the previous operation in
+    nanoseconds, the length, the operation and the client handle it was
+    issued on. Records are written in issue order by any number of threads
+    and read back in that order through a sliding memory-mapped window, so
+    a trace of any size replays without being loaded into memory.
+    I/OĶƸ١32ֽڵͷÿһ16ֽڵļ¼ɣ
+    һļ룩ȡԼĿͻ˾¼
+    ̰߳˳д룬ͨڴӳ䴰ڰ˳أ
+    СĸٶԻطŶڴ档
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#pragma once
+
+#include "echoengine.h"
+
+#define ECHO_TRACE_MAGIC    0x52544345      // 'ECTR'
+#define ECHO_TRACE_VERSION  1
+
+//
+// Little-endian on disk, as laid out here
+// ΪС򣬲ͬ
+//
+typedef struct _ECHO_TRACE_HEADER {
+    ULONG     Magic;
+    USHORT    Version;
+    USHORT    RecordSize;       // sizeof(ECHO_TRACE_RECORD)
+    ULONGLONG Records;          // 0 if the writer did not close the trace
+    ULONGLONG DurationNs;       // sum of the gaps
+    ULONG     Handles;          // highest handle plus one
+    ULONG     MaxLength;
+} ECHO_TRACE_HEADER, *PECHO_TRACE_HEADER;
+
+typedef struct _ECHO_TRACE_RECORD {
+    ULONGLONG GapNs;            // since the previous record
+    ULONG     Length;
+    USHORT    Handle;           // replayed on a handle of its own, pinned to this shard
+    UCHAR     Op;               // ECHO_OP
+    UCHAR     Reserved;
+} ECHO_TRACE_RECORD, *PECHO_TRACE_RECORD;
+
+typedef struct _ECHO_TRACE_WRITER* PECHO_TRACE_WRITER;
+typedef struct _ECHO_TRACE_READER* PECHO_TRACE_READER;
+
+//
+// Creates or truncates path for recording. NULL on failure.
+// ضpathڼ¼ʧʱNULL
+//
+PECHO_TRACE_WRITER EchoTraceCreate(IN PCSTR path);
+
+//
+// Appends an operation issued now; safe to call from any thread
+// ׷һ˿̷Ĳɴκ̵߳
+//
+VOID EchoTraceRecord(
+    IN PECHO_TRACE_WRITER writer,
+    IN ULONG              handle,
+    IN ECHO_OP            op,
+    IN ULONG              length
+    );
+
+//
+// Completes the header and closes the file. FALSE if a write failed.
+// ȫͷرļдʧʱFALSE
+//
+BOOLEAN EchoTraceClose(IN PECHO_TRACE_WRITER writer);
+
+//
+// Maps the start of a trace and checks its header. A trace the writer did
+// not close is read up to its last whole record. NULL on failure.
+// ӳٵĿͷͷδرյĸٶһ¼Ϊֹ
+// ʧʱNULL
+//
+PECHO_TRACE_READER EchoTraceOpen(IN PCSTR path);
+
+const ECHO_TRACE_HEADER* EchoTraceHeader(IN PECHO_TRACE_READER reader);
+
+//
+// The next record, moving the mapped window as needed. FALSE at the end
+// or if the window cannot be mapped.
+// һ¼Ҫʱƶӳ䴰ڡĩβ޷ӳ䴰ʱFALSE
+//
+BOOLEAN EchoTraceNext(IN PECHO_TRACE_READER reader, OUT PECHO_TRACE_RECORD record);
+
+VOID EchoTraceDelete(IN PECHO_TRACE_READER reader);
+
+//
+// Records a trace spanning many windows from several threads and reads it
+// back, checking every record. FALSE on a mismatch.
+// Ӷ̼߳¼һԽڵĸٲأÿ¼һʱFALSE
+//
+BOOLEAN EchoTraceSelfTest(VOID);
@@ -0,0 +1,599 @@
+/*++
+
+Module Name:
+
+    echoverify.cpp
+
+Abstract:
+
+    Sequence-tagged payloads for asynchronous reads and writes.
+    кűǵ첽дء
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#include "echoverify.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <new>
+#include <thread>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define VERIFY_SSE2
+#elif defined(_M_ARM64) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VERIFY_NEON
+#endif
+
+#define LOG printf
+
+//
+// Consecutive body words differ by this odd constant, so every byte of a
+// word changes from one word to the next
+// ʹÿֽڶ֮仯
+//
+#define VERIFY_STEP         0x9E3779B97F4A7C15ULL
+
+#define VERIFY_RING_MIN     16384
+#define VERIFY_LOG_MAX      10          // anomalies logged per ledger
+#define VERIFY_BUSY         (~0ULL)     // ring entry being changed
+
+#define VERIFY_COST_BYTES   (256ULL * 1024 * 1024)
+
+typedef struct _LEDGER_ENTRY {
+    std::atomic<ULONGLONG> Sequence;    // VERIFY_BUSY while held
+    std::atomic<ULONGLONG> IssueNs;
+    std::atomic<ULONGLONG> CompleteNs;  // 0 while in flight or failed
+} LEDGER_ENTRY, *PLEDGER_ENTRY;
+
+struct _ECHO_LEDGER {
+    ULONG                  Stream;
+    ULONGLONG              RingMask;
+    PLEDGER_ENTRY          Ring;        // indexed by sequence
+    std::atomic<ULONGLONG> NextSequence;
+    std::atomic<ULONGLONG> CompletedIssueNs;
+    std::atomic<ULONGLONG> ObservedIssueNs;
+    std::atomic<ULONG>     Logged;
+};
+
+//
+// 64λϺsplitmix64սᲽ裩
+//
+static ULONGLONG VerifyMix(ULONGLONG value)
+{
+    value ^= value >> 30;
+    value *= 0xBF58476D1CE4E5B9ULL;
+    value ^= value >> 27;
+    value *= 0x94D049BB133111EBULL;
+    value ^= value >> 31;
+
+    return value;
+}
+
+static ULONGLONG VerifyHeaderChecksum(const ECHO_PAYLOAD_HEADER* header)
+{
+    ULONGLONG sum;
+
+    sum = VerifyMix(header->Magic | ((ULONGLONG)header->Length << 32));
+    sum = VerifyMix(sum ^ header->Sequence);
+    sum = VerifyMix(sum ^ (header->Stream | ((ULONGLONG)header->WriterId << 32)));
+
+    return sum;
+}
+
+static ULONGLONG VerifyBodySeed(ULONG stream, ULONGLONG sequence)
+{
+    return VerifyMix(sequence ^ ((ULONGLONG)stream << 48));
+}
+
+//
+// ԭӵؽtargetߵvalue
+//
+static VOID VerifyRaise(std::atomic<ULONGLONG>& target, ULONGLONG value)
+{
+    ULONGLONG current = target.load();
+
+    while (current < value && !target.compare_exchange_weak(current, value)) {
+    }
+}
+
+//
+// Takes the ring entry while it holds the given sequence; any sequence
+// when expected is VERIFY_BUSY. Returns FALSE if the entry moved on.
+// The write that reuses an entry and a late completion of the write it
+// replaces would otherwise mix their times.
+// ڻĿикʱռexpectedΪVERIFY_BUSYʱкšĿѱ
+// ʱFALSEĿд뱻滻дĳٵɻ˴˵ʱ䡣
+//
+static BOOLEAN VerifyLockEntry(PLEDGER_ENTRY entry, ULONGLONG expected)
+{
+    ULONGLONG sequence;
+
+    for (;;) {
+        sequence = entry->Sequence;
+
+        if (sequence != VERIFY_BUSY) {
+            if (expected != VERIFY_BUSY && sequence != expected) {
+                return FALSE;
+            }
+            if (entry->Sequence.compare_exchange_weak(sequence, VERIFY_BUSY)) {
+                return TRUE;
+            }
+        }
+
+        std::this_thread::yield();
+    }
+}
+
+//
+// 壺iΪseed + i * VERIFY_STEP
+//
+static VOID VerifyFillBody(PUCHAR body, size_t length, ULONGLONG seed)
+{
+    ULONGLONG word;
+    size_t i = 0;
+
+#if defined(VERIFY_SSE2)
+    __m128i value = _mm_set_epi64x((long long)(seed + VERIFY_STEP), (long long)seed);
+    __m128i step = _mm_set1_epi64x((long long)(2 * VERIFY_STEP));
+
+    for (; i + 16 <= length; i += 16) {
+        _mm_storeu_si128((__m128i*)(body + i), value);
+        value = _mm_add_epi64(value, step);
+    }
+#elif defined(VERIFY_NEON)
+    uint64x2_t value = vcombine_u64(vcreate_u64(seed), vcreate_u64(seed + VERIFY_STEP));
+    uint64x2_t step = vdupq_n_u64(2 * VERIFY_STEP);
+
+    for (; i + 16 <= length; i += 16) {
+        vst1q_u8(body + i, vreinterpretq_u8_u64(value));
+        value = vaddq_u64(value, step);
+    }
+#endif
+
+    word = seed + (i / 8) * VERIFY_STEP;
+
+    for (; i + 8 <= length; i += 8) {
+        memcpy(body + i, &word, 8);
+        word += VERIFY_STEP;
+    }
+
+    //
+    // A tail shorter than a word takes the leading bytes of the next word
+    // һֵβȡһֵǰֽ
+    //
+    memcpy(body + i, &word, length - i);
+}
+
+//
+// ɵһʱTRUE
+//
+static BOOLEAN VerifyCheckBody(const UCHAR* body, size_t length, ULONGLONG seed)
+{
+    ULONGLONG word;
+    ULONGLONG actual;
+    ULONGLONG diff = 0;
+    size_t i = 0;
+
+#if defined(VERIFY_SSE2)
+    __m128i value = _mm_set_epi64x((long long)(seed + VERIFY_STEP), (long long)seed);
+    __m128i step = _mm_set1_epi64x((long long)(2 * VERIFY_STEP));
+    __m128i bits = _mm_setzero_si128();
+
+    //
+    // OR the differences together and test once at the end, so the loop
+    // has no branch besides its own
+    // 찴λۻͳһжϣѭгûз֧
+    //
+    for (; i + 16 <= length; i += 16) {
+        bits = _mm_or_si128(bits, _mm_xor_si128(_mm_loadu_si128((const __m128i*)(body + i)), value));
+        value = _mm_add_epi64(value, step);
+    }
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(bits, _mm_setzero_si128())) != 0xFFFF) {
+        return FALSE;
+    }
+#elif defined(VERIFY_NEON)
+    uint64x2_t value = vcombine_u64(vcreate_u64(seed), vcreate_u64(seed + VERIFY_STEP));
+    uint64x2_t step = vdupq_n_u64(2 * VERIFY_STEP);
+    uint64x2_t bits = vdupq_n_u64(0);
+
+    for (; i + 16 <= length; i += 16) {
+        bits = vorrq_u64(bits, veorq_u64(vreinterpretq_u64_u8(vld1q_u8(body + i)), value));
+        value = vaddq_u64(value, step);
+    }
+
+    diff = vgetq_lane_u64(bits, 0) | vgetq_lane_u64(bits, 1);
+#endif
+
+    word = seed + (i / 8) * VERIFY_STEP;
+
+    for (; i + 8 <= length; i += 8) {
+        memcpy(&actual, body + i, 8);
+        diff |= actual ^ word;
+        word += VERIFY_STEP;
+    }
+
+    actual = word;
+    memcpy(&actual, body + i, length - i);
+    diff |= actual ^ word;
+
+    return diff == 0;
+}
+
+//
+// һһֽڵƫƣ־
+//
+static size_t VerifyFirstMismatch(const UCHAR* body, size_t length, ULONGLONG seed)
+{
+    ULONGLONG word = seed;
+    UCHAR expected[8];
+    size_t i;
+    size_t j;
+
+    for (i = 0; i < length; i += 8) {
+        memcpy(expected, &word, 8);
+        for (j = 0; j < 8 && i + j < length; j++) {
+            if (body[i + j] != expected[j]) {
+                return i + j;
+            }
+        }
+        word += VERIFY_STEP;
+    }
+
+    return length;
+}
+
+static VOID VerifyFill(PUCHAR buffer, ULONG length, ULONG stream, ULONGLONG sequence, ULONG writerId)
+{
+    ECHO_PAYLOAD_HEADER header;
+
+    header.Magic = ECHO_PAYLOAD_MAGIC;
+    header.Length = length;
+    header.Sequence = sequence;
+    header.Stream = stream;
+    header.WriterId = writerId;
+    header.Checksum = VerifyHeaderChecksum(&header);
+
+    memcpy(buffer, &header, sizeof(header));
+
+    VerifyFillBody(buffer + sizeof(header), length - sizeof(header), VerifyBodySeed(stream, sequence));
+}
+
+//
+// ÿ˱¼VERIFY_LOG_MAX쳣
+//
+static BOOLEAN VerifyShouldLog(PECHO_LEDGER ledger)
+{
+    return ledger->Logged++ < VERIFY_LOG_MAX;
+}
+
+PECHO_LEDGER EchoLedgerCreate(IN ULONG stream, IN ULONG maxWrites)
+{
+    PECHO_LEDGER ledger;
+    ULONGLONG size = VERIFY_RING_MIN;
+    ULONGLONG i;
+
+    //
+    // A sequence that has left the ring is older than every write in
+    // flight by a wide margin
+    // 뿪кԶԶ;д
+    //
+    while (size < (ULONGLONG)maxWrites * 16) {
+        size *= 2;
+    }
+
+    ledger = new (std::nothrow) _ECHO_LEDGER();
+    if (ledger == NULL) {
+        return NULL;
+    }
+
+    ledger->Ring = new (std::nothrow) LEDGER_ENTRY[size];
+    if (ledger->Ring == NULL) {
+        LOG("EchoLedgerCreate: Cannot allocate %d entries\n", (ULONG)size);
+        delete ledger;
+        return NULL;
+    }
+
+    for (i = 0; i < size; i++) {
+        ledger->Ring[i].Sequence = 0;
+        ledger->Ring[i].IssueNs = 0;
+        ledger->Ring[i].CompleteNs = 0;
+    }
+
+    ledger->Stream = stream;
+    ledger->RingMask = size - 1;
+    ledger->NextSequence = 1;
+    ledger->CompletedIssueNs = 0;
+    ledger->ObservedIssueNs = 0;
+    ledger->Logged = 0;
+
+    return ledger;
+}
+
+VOID EchoLedgerDelete(IN PECHO_LEDGER ledger)
+{
+    if (ledger != NULL) {
+        delete[] ledger->Ring;
+        delete ledger;
+    }
+}
+
+VOID EchoVerifyPrepareWrite(
+    IN  PECHO_LEDGER    ledger,
+    OUT PECHO_VERIFY_OP op,
+    IN  ULONG           writerId,
+    OUT PUCHAR          buffer,
+    IN  ULONG           length
+    )
+{
+    PLEDGER_ENTRY entry;
+    ULONGLONG sequence;
+
+    sequence = ledger->NextSequence++;
+    entry = &ledger->Ring[sequence & ledger->RingMask];
+
+    //
+    // Readers compare Sequence before and after reading the times, so it
+    // stays busy while they change
+    // ڶȡʱǰȽSequence޸ڼ䱣Ϊæ
+    //
+    VerifyLockEntry(entry, VERIFY_BUSY);
+    entry->CompleteNs = 0;
+    entry->IssueNs = EchoNowNs();
+    entry->Sequence = sequence;
+
+    VerifyFill(buffer, length, ledger->Stream, sequence, writerId);
+
+    op->Sequence = sequence;
+    op->InFlight = TRUE;
+}
+
+VOID EchoVerifyPrepareRead(
+    IN  PECHO_LEDGER    ledger,
+    OUT PECHO_VERIFY_OP op
+    )
+{
+    op->CompletedFloorNs = ledger->CompletedIssueNs;
+    op->ObservedFloorNs = ledger->ObservedIssueNs;
+    op->InFlight = TRUE;
+}
+
+VOID EchoVerifyComplete(
+    IN     PECHO_LEDGER        ledger,
+    IN OUT PECHO_VERIFY_OP     op,
+    IN     PECHO_IO            io,
+    IN OUT PECHO_VERIFY_COUNTS counts
+    )
+{
+    ECHO_PAYLOAD_HEADER header;
+    PLEDGER_ENTRY entry;
+    ULONGLONG sequence;
+    ULONGLONG issueNs;
+    ULONGLONG completeNs;
+    ULONGLONG now;
+
+    if (!op->InFlight) {
+        counts->Duplicated++;
+        if (VerifyShouldLog(ledger)) {
+            LOG("Verify: stream %d %s completed twice\n",
+                ledger->Stream, (io->Op == EchoOpRead) ? "read" : "write");
+        }
+        return;
+    }
+
+    op->InFlight = FALSE;
+
+    if (io->Error != ERROR_SUCCESS) {
+        return;
+    }
+
+    if (io->Op == EchoOpWrite) {
+        now = EchoNowNs();
+        entry = &ledger->Ring[op->Sequence & ledger->RingMask];
+
+        //
+        // A write slower than a whole ring of newer ones is not recorded
+        // д뻹д벻¼
+        //
+        if (VerifyLockEntry(entry, op->Sequence)) {
+            if (entry->CompleteNs != 0) {
+                counts->Duplicated++;
+            }
+            else {
+                entry->CompleteNs = now;
+                VerifyRaise(ledger->CompletedIssueNs, entry->IssueNs);
+            }
+            entry->Sequence = op->Sequence;
+        }
+        return;
+    }
+
+    if (io->Transferred == 0) {
+        counts->Empty++;
+        return;
+    }
+
+    //
+    // Self-consistency: header, length and body
+    // һԣͷ
+    //
+    if (io->Transferred < sizeof(header)) {
+        counts->Torn++;
+        if (VerifyShouldLog(ledger)) {
+            LOG("Verify: stream %d read %d bytes, too short for a header\n", ledger->Stream, io->Transferred);
+        }
+        return;
+    }
+
+    memcpy(&header, io->Buffer, sizeof(header));
+
+    if (header.Magic != ECHO_PAYLOAD_MAGIC || header.Checksum != VerifyHeaderChecksum(&header)) {
+        counts->Torn++;
+        if (VerifyShouldLog(ledger)) {
+            LOG("Verify: stream %d read %d bytes with a bad header\n", ledger->Stream, io->Transferred);
+        }
+        return;
+    }
+
+    if (header.Stream != ledger->Stream) {
+        counts->Crossed++;
+        if (VerifyShouldLog(ledger)) {
+            LOG("Verify: stream %d read write %llu of stream %d\n",
+                ledger->Stream, header.Sequence, header.Stream);
+        }
+        return;
+    }
+
+    if (header.Length != io->Transferred ||
+        !VerifyCheckBody(io->Buffer + sizeof(header), header.Length - sizeof(header),
+                         VerifyBodySeed(header.Stream, header.Sequence))) {
+        counts->Torn++;
+        if (VerifyShouldLog(ledger)) {
+            LOG("Verify: stream %d write %llu of writer %d torn: %d of %d bytes, first mismatch at %d\n",
+                ledger->Stream, header.Sequence, header.WriterId, io->Transferred, header.Length,
+                (ULONG)(sizeof(header) + VerifyFirstMismatch(io->Buffer + sizeof(header),
+                    ((header.Length < io->Transferred) ? header.Length : io->Transferred) - sizeof(header),
+                    VerifyBodySeed(header.Stream, header.Sequence))));
+        }
+        return;
+    }
+
+    //
+    // Ordering against the ledger
+    // ˱˳
+    //
+    entry = &ledger->Ring[header.Sequence & ledger->RingMask];
+
+    sequence = entry->Sequence;
+    issueNs = entry->IssueNs;
+    completeNs = entry->CompleteNs;
+
+    if (entry->Sequence != sequence || sequence > header.Sequence) {
+
+        //
+        // Replaced in the ring, so its times are gone. A write stalled
+        // between prepare and submit can legitimately be the last one in
+        // after thousands of later sequences, so only its payload counts.
+        // ڻб滻ʱѲ֪׼ύ֮ͣٵдԺ
+        // ǧк֮ŵֻ为ء
+        //
+        counts->Verified++;
+        return;
+    }
+
+    if (sequence < header.Sequence) {
+
+        //
+        // A write that was never issued
+        // δд
+        //
+        counts->Torn++;
+        if (VerifyShouldLog(ledger)) {
+            LOG("Verify: stream %d read write %llu before it was issued\n", ledger->Stream, header.Sequence);
+        }
+        return;
+    }
+
+    if (completeNs != 0 && completeNs < op->CompletedFloorNs) {
+        counts->Lost++;
+        if (VerifyShouldLog(ledger)) {
+            LOG("Verify: stream %d read stale write %llu, a newer completed write was lost\n",
+                ledger->Stream, header.Sequence);
+        }
+        return;
+    }
+
+    if (completeNs != 0 && completeNs < op->ObservedFloorNs) {
+        counts->Reordered++;
+        if (VerifyShouldLog(ledger)) {
+            LOG("Verify: stream %d read write %llu after a newer write was read\n",
+                ledger->Stream, header.Sequence);
+        }
+        return;
+    }
+
+    VerifyRaise(ledger->ObservedIssueNs, issueNs);
+
+    counts->Verified++;
+}
+
+VOID EchoVerifyAddCounts(
+    IN OUT PECHO_VERIFY_COUNTS       into,
+    IN     const ECHO_VERIFY_COUNTS* from
+    )
+{
+    into->Verified += from->Verified;
+    into->Empty += from->Empty;
+    into->Torn += from->Torn;
+    into->Lost += from->Lost;
+    into->Reordered += from->Reordered;
+    into->Duplicated += from->Duplicated;
+    into->Crossed += from->Crossed;
+}
+
+ULONGLONG EchoVerifyFailures(IN const ECHO_VERIFY_COUNTS* counts)
+{
+    return counts->Torn + counts->Lost + counts->Reordered + counts->Duplicated + counts->Crossed;
+}
+
+VOID EchoVerifyMeasureCost(IN ULONG length)
+{
+    PUCHAR buffer;
+    ULONGLONG rounds;
+    ULONGLONG round;
+    ULONGLONG start;
+    ULONGLONG fillNs;
+    ULONGLONG checkNs;
+    ULONGLONG bad = 0;
+    double gigabytes;
+
+    if (length < ECHO_PAYLOAD_MIN_LENGTH) {
+        return;
+    }
+
+    buffer = (PUCHAR)malloc(length);
+    if (buffer == NULL) {
+        return;
+    }
+
+    rounds = VERIFY_COST_BYTES / length + 1;
+    gigabytes = (double)rounds * length / 1e9;
+
+    start = EchoNowNs();
+    for (round = 0; round < rounds; round++) {
+        VerifyFill(buffer, length, 0, round + 1, 0);
+    }
+    fillNs = EchoNowNs() - start;
+
+    //
+    // Checks the same buffer over and over; what is measured is the
+    // compare, not the memory it came from
+    // УͬһǱȽϱԵڴ
+    //
+    start = EchoNowNs();
+    for (round = 0; round < rounds; round++) {
+        if (!VerifyCheckBody(buffer + sizeof(ECHO_PAYLOAD_HEADER), length - sizeof(ECHO_PAYLOAD_HEADER),
+                             VerifyBodySeed(0, rounds))) {
+            bad++;
+        }
+    }
+    checkNs = EchoNowNs() - start;
+
+    free(buffer);
+
+    if (bad != 0) {
+        LOG("Verify: self-check failed\n");
+    }
+
+    LOG("Payload cost at %d bytes: generate %.1f ms/GB, check %.1f ms/GB\n",
+        length, fillNs / 1e6 / gigabytes, checkNs / 1e6 / gigabytes);
+}
@@ -0,0 +1,141 @@
+/*++
+
+Module Name:
+
+    echoverify.h
+
+Abstract:
+
+    Sequence-tagged payloads for asynchronous reads and writes. Every write
+    carries a header (sequence number, length, stream, writer id and a
+    checksum of those fields) followed by a body generated from the
+    sequence number, and every read is checked as it completes.
+
+    A shard of the echo device behaves as a single register: a read returns
+    the last write it processed. A ledger per stream records when each
+    write was issued and completed, which is enough to flag a read that
+    cannot be explained by any order the device could have used:
+
+        torn        the header, the length or the body does not match
+        lost        a newer write had completed before the read was issued
+                    (it was issued after the returned write completed)
+        reordered   an earlier read already returned a newer write
+        duplicated  an operation completed twice
+        crossed     the payload belongs to another stream (shard)
+
+    Time stamps are taken before submission and after reaping, so a
+    correct device never trips these checks.
+
+    кűǵ첽дءÿдЯһͷкšȡдID
+    ԼЩֶεУͣкɵ壬ÿζȡʱУ顣
+
+    豸һƬΪĴȡһд롣ÿ
+    ˱¼ÿдķʱ䣬Աκ豸˳޷͵Ķȡ
+    ˺ѡʧظԼʱύǰȡغȡȷ豸
+    ᴥЩ顣
+
+Environment:
+
+    user mode only
+    ûģʽ
+
+--*/
+
+#pragma once
+
+#include "echoengine.h"
+
+#define ECHO_PAYLOAD_MAGIC  0x4F484345      // 'ECHO'
+
+typedef struct _ECHO_PAYLOAD_HEADER {
+    ULONG     Magic;
+    ULONG     Length;           // bytes written, header included
+    ULONGLONG Sequence;         // 1, 2, 3 ... per stream
+    ULONG     Stream;
+    ULONG     WriterId;
+    ULONGLONG Checksum;         // of the fields above
+} ECHO_PAYLOAD_HEADER, *PECHO_PAYLOAD_HEADER;
+
+typedef struct _ECHO_VERIFY_COUNTS {
+    ULONGLONG Verified;         // reads whose payload passed every check
+    ULONGLONG Empty;            // reads before any write reached the shard
+    ULONGLONG Torn;
+    ULONGLONG Lost;
+    ULONGLONG Reordered;
+    ULONGLONG Duplicated;
+    ULONGLONG Crossed;
+} ECHO_VERIFY_COUNTS, *PECHO_VERIFY_COUNTS;
+
+//
+// Per-slot state between prepare and complete, owned by the caller
+// ׼֮ÿ״̬ɵ߳
+//
+typedef struct _ECHO_VERIFY_OP {
+    ULONGLONG Sequence;         // write: payload sequence
+    ULONGLONG CompletedFloorNs; // read: newest issue time of a completed write
+    ULONGLONG ObservedFloorNs;  // read: newest issue time a read returned
+    BOOLEAN   InFlight;
+} ECHO_VERIFY_OP, *PECHO_VERIFY_OP;
+
+typedef struct _ECHO_LEDGER* PECHO_LEDGER;
+
+//
+// Creates the ledger of one stream. maxWrites bounds the writes in flight
+// at once on the stream.
+// һ˱maxWritesΪͬʱ;дޡ
+//
+PECHO_LEDGER EchoLedgerCreate(IN ULONG stream, IN ULONG maxWrites);
+
+VOID EchoLedgerDelete(IN PECHO_LEDGER ledger);
+
+//
+// Smallest write that can carry a payload
+// ЯصСд
+//
+#define ECHO_PAYLOAD_MIN_LENGTH  sizeof(ECHO_PAYLOAD_HEADER)
+
+//
+// Assigns the next sequence number and fills buffer with its payload
+// һкŲ为buffer
+//
+VOID EchoVerifyPrepareWrite(
+    IN  PECHO_LEDGER    ledger,
+    OUT PECHO_VERIFY_OP op,
+    IN  ULONG           writerId,
+    OUT PUCHAR          buffer,
+    IN  ULONG           length
+    );
+
+VOID EchoVerifyPrepareRead(
+    IN  PECHO_LEDGER    ledger,
+    OUT PECHO_VERIFY_OP op
+    );
+
+//
+// Records a completed write or checks a completed read
+// ¼ɵд룬УɵĶȡ
+//
+VOID EchoVerifyComplete(
+    IN     PECHO_LEDGER        ledger,
+    IN OUT PECHO_VERIFY_OP     op,
+    IN     PECHO_IO            io,
+    IN OUT PECHO_VERIFY_COUNTS counts
+    );
+
+VOID EchoVerifyAddCounts(
+    IN OUT PECHO_VERIFY_COUNTS       into,
+    IN     const ECHO_VERIFY_COUNTS* from
+    );
+
+//
+// Torn + lost + reordered + duplicated + crossed
+// ˺ѡʧظ봮֮
+//
+ULONGLONG EchoVerifyFailures(IN const ECHO_VERIFY_COUNTS* counts);
+
+//
+// Measures payload generation and checking at the given size and prints
+// the cost per GB
+// СУ飬ӡÿGBĿ
+//
+VOID EchoVerifyMeasureCost(IN ULONG length);
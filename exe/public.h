@@ -32,3 +32,135 @@ DEFINE_GUID (GUID_DEVINTERFACE_ECHO,
     0xcdc35b6e, 0xbe4, 0x4936, 0xbf, 0x5f, 0x55, 0x37, 0x38, 0xa, 0x7c, 0x1a);
 // {CDC35B6E-0BE4-4936-BF5F-5537380A7C1A}
 
+
+//
+// I/O control codes understood by the driver.
+// ֵ֧I/O롣
+//
+#define IOCTL_CODE_TEST \
+    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x800, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// Returns an ECHO_STATS snapshot in the output buffer
+// зECHO_STATS
+#define IOCTL_ECHO_GET_STATS \
+    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x801, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// Clears the statistics kept by the driver
+// 򱣴ͳϢ
+#define IOCTL_ECHO_RESET_STATS \
+    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x802, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// Sets the shard key (a ULONG in the input buffer) of the file handle. Reads
+// and writes on the handle go to shard (key % ShardCount).
+// ļķƬ뻺еULONGþϵĶдƬ(key % ShardCount)
+#define IOCTL_ECHO_SET_SHARD_KEY \
+    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x803, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+#define ECHO_MAX_SHARDS  16
+
+// Returns the ECHO_TUNING parameters in use in the output buffer
+// зʹõECHO_TUNING
+#define IOCTL_ECHO_GET_TUNING \
+    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x804, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// Applies the ECHO_TUNING parameters in the input buffer to every shard
+// 뻺еECHO_TUNINGӦõÿƬ
+#define IOCTL_ECHO_SET_TUNING \
+    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x805, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// Traced echo: the input buffer is an ECHO_TRACED_HEADER followed by Length
+// payload bytes, which replace the echo buffer of the file's shard like a
+// write. The output buffer receives the header, with the stamps of every
+// stage the request went through, followed by the payload.
+// ٻԣ뻺ECHO_TRACED_HEADERLengthֽڵĸأд
+// һ滻ļڷƬĻԻմ󾭹ÿ׶
+// ʱͷء
+#define IOCTL_ECHO_TRACED \
+    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x806, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+//
+// Queue tuning parameters. Defaults come from the device's registry key.
+// еŲĬֵ豸ע
+//
+typedef struct _ECHO_TUNING {
+    ULONG TimerPeriodMs;    // time between timer ticks
+    ULONG MaxWriteLength;   // largest write accepted, in bytes
+    ULONG PoolTag;          // tag of the echo buffers
+    ULONG StartDelayMs;     // delay before the first tick after start
+    ULONG ShardCount;       // read-only on a live device
+} ECHO_TUNING, *PECHO_TUNING;
+
+//
+// Requests are serviced in one of two lanes. Control requests (IOCTLs) go to
+// a parallel queue and never wait behind bulk reads and writes.
+// ֮ͨһдIOCTL벢жУԶд֮
+//
+typedef enum _ECHO_LANE {
+    EchoLaneControl = 0,
+    EchoLaneBulk,
+    EchoLaneCount
+} ECHO_LANE;
+
+//
+// Latency histogram buckets: bucket n counts requests that took
+// [2^(n-1), 2^n) microseconds, bucket 0 counts those under 1 us.
+// ӳֱͼͰͰnͳƺʱ[2^(n-1), 2^n)΢֮Ͱ0ͳС1΢
+//
+#define ECHO_LATENCY_BUCKETS  32
+
+typedef struct _ECHO_LANE_STATS {
+    ULONGLONG Requests;         // completed requests
+    ULONGLONG TotalLatencyUs;   // sum of arrival-to-completion times
+    ULONGLONG MaxLatencyUs;
+    ULONG     Histogram[ECHO_LATENCY_BUCKETS];
+} ECHO_LANE_STATS, *PECHO_LANE_STATS;
+
+typedef struct _ECHO_STATS {
+    ECHO_LANE_STATS Lanes[EchoLaneCount];
+
+    // Number of independent echo shards
+    // ԷƬ
+    ULONG     ShardCount;
+
+    // Power transitions (suspend/resume cycles) and the cost of the last one
+    // Դת/ָڣһεĺʱ
+    ULONG     PowerTransitions;
+    ULONGLONG LastSuspendUs;    // time spent in the suspend callback
+    ULONGLONG LastResumeUs;     // restart until the first timer tick
+
+    // CPU the driver host process spent since the statistics were reset,
+    // which covers every device the host serves
+    // ͳ̵CPUǸ豸
+    ULONGLONG HostUserUs;
+    ULONGLONG HostKernelUs;
+    ULONGLONG HostCycles;       // 0 where the system does not count them
+} ECHO_STATS, *PECHO_STATS;
+
+//
+// Stages a traced request goes through inside the driver, in order
+// ξĽ׶
+//
+typedef enum _ECHO_STAGE {
+    EchoStageArrival = 0,   // reached the driver, before queueing
+    EchoStageDispatch,      // presented by the shard queue
+    EchoStageCopied,        // payload copied into the echo buffer
+    EchoStagePark,          // parked for the timer
+    EchoStagePickup,        // picked up by the timer tick
+    EchoStageComplete,      // handed back to the framework
+    EchoStageCount
+} ECHO_STAGE;
+
+//
+// Header of IOCTL_ECHO_TRACED. The client fills in RequestId and Length;
+// the driver returns them unchanged with Frequency and Stamps filled in.
+// Stamps are performance counter values, comparable with the client's own.
+// IOCTL_ECHO_TRACEDͷͻдRequestIdLengthԭǣ
+// дFrequencyStampsʱֵܼͻԼֵȽϡ
+//
+typedef struct _ECHO_TRACED_HEADER {
+    ULONGLONG RequestId;    // chosen by the client
+    ULONG     Length;       // payload bytes after the header
+    ULONG     Reserved;
+    LONGLONG  Frequency;    // performance counter ticks per second
+    LONGLONG  Stamps[EchoStageCount];
+} ECHO_TRACED_HEADER, *PECHO_TRACED_HEADER;
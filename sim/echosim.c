@@ -0,0 +1,1068 @@
+/*
+
+Module Name:
+
+    echosim.c
+
+Abstract:
+
+    Drives the unmodified echo driver (device.c, queue.c) on the host
+    framework simulator. Each run adds the device, powers it up, opens one
+    file per client and lets every client alternate writes and reads
+    (optionally mixed with control requests, traced echoes, cancellations,
+    power cycles and retuning) until it has issued its operations, then
+    removes the device.
+    Runs are reproducible from their seed; a range of seeds explores
+    different interleavings of the same workload.
+    ģδ޸ĵĻdevice.cqueue.cÿ
+    豸Ϊϵ硢Ϊÿͻ˴һļÿͻ˽дͶȡ
+    ɻϿ󡢸ٻԡȡԴںµţֱȫȻƳ豸ÿ
+    ֣һӷΧ̽ͬһصĲͬ˳
+
+    Build (no Windows headers needed):
+    루Windowsͷļ
+
+        cc -std=gnu99 -O2 -I sim/include -I exe -I driver/AutoSync \
+           driver/AutoSync/device.c driver/AutoSync/queue.c \
+           sim/wdfsim.c sim/echosim.c -o echosim
+
+Environment:
+
+    host simulator only
+    ģ
+
+*/
+
+#include <stdlib.h>
+#include <signal.h>
+#include "driver.h"
+#include "wdfsim.h"
+
+#define SIM_NS_PER_MS           1000000ULL
+#define SIM_MAX_CLIENTS         256
+#define SIM_DEFAULT_TIMER_MS    TIMER_PERIOD
+#define SIM_COUNT(a)            (sizeof(a) / sizeof((a)[0]))
+
+typedef enum _SIM_OP {
+    SimOpWrite,
+    SimOpRead,
+    SimOpControl,
+    SimOpTraced,
+    SimOpCount
+} SIM_OP;
+
+static PCSTR SimOpNames[SimOpCount] = { "write", "read", "control", "traced" };
+
+// Cells of the -sweep table
+// -sweepĵԪ
+static const ULONG SimSweepShards[] = { 1, 2, 4, 8, 16 };
+static const ULONG SimSweepClients[] = { 1, 2, 4, 8, 16, 32, 64 };
+
+typedef struct _SIM_OPTIONS {
+    ULONGLONG Seed;
+    ULONG     Runs;
+    ULONG     Clients;
+    ULONG     Ops;
+    ULONG     MaxSize;
+    ULONG     Processors;
+    ULONG     Shards;           // 0 = driver default
+    ULONG     TimerMs;          // 0 = driver default
+    ULONG     StartDelayMs;     // (ULONG)-1 = driver default
+    ULONG     SuspendEveryMs;   // 0 = no power cycles
+    ULONG     SuspendForMs;
+    ULONG     CancelPercent;
+    ULONG     ControlPercent;
+    ULONG     TracedPercent;
+    ULONG     RetuneEveryMs;    // 0 = no retuning
+    BOOLEAN   Sweep;            // shard x client throughput sweep
+    BOOLEAN   Verbose;
+} SIM_OPTIONS;
+
+typedef struct _SIM_CLIENT {
+    ULONG         Index;
+    WDFFILEOBJECT File;
+    ULONG         OpsIssued;
+    SIM_OP        NextBulk;
+    SIM_OP        PendingOp;
+    ULONG         PendingId;
+    ULONGLONG     SubmitTime;
+    ULONG         Sequence;         // pattern of the last write
+    size_t        WriteLength;
+    PUCHAR        WriteBuffer;
+    PUCHAR        ReadBuffer;
+    PUCHAR        TracedInput;      // header and payload of a traced echo
+    PUCHAR        TracedOutput;
+    ECHO_STATS    Stats;
+    BOOLEAN       Done;
+} SIM_CLIENT, *PSIM_CLIENT;
+
+typedef struct _SIM_LATENCIES {
+    ULONGLONG* Samples;
+    ULONG      Count;
+    ULONG      Capacity;
+} SIM_LATENCIES;
+
+static SIM_OPTIONS Options = {
+    1,          // Seed
+    1,          // Runs
+    4,          // Clients
+    200,        // Ops
+    512,        // MaxSize
+    4,          // Processors
+    0,          // Shards
+    0,          // TimerMs
+    (ULONG)-1,  // StartDelayMs
+    0,          // SuspendEveryMs
+    10,         // SuspendForMs
+    0,          // CancelPercent
+    0,          // ControlPercent
+    0,          // TracedPercent
+    0,          // RetuneEveryMs
+    FALSE,      // Sweep
+    FALSE       // Verbose
+};
+
+static struct {
+    ULONGLONG       Seed;
+    ULONGLONG       StartTime;
+    ULONGLONG       ElapsedNs;
+    SIM_CLIENT      Clients[SIM_MAX_CLIENTS];
+    ULONG           ClientsDone;
+    ULONG           ShardCount;
+    ULONG           TimerMs;
+    BOOLEAN         Verify;
+    BOOLEAN         PowerCycling;
+    ULONG           PowerCycles;
+    BOOLEAN         Retuning;
+    BOOLEAN         RetuneBusy;
+    ULONG           Retunes;
+    ULONG           RetuneRequests;     // tuning IOCTLs, accounted in the control lane
+    ECHO_TUNING     RetuneOld;
+    ECHO_TUNING     RetuneNew;
+    ECHO_TUNING     RetuneRead;
+    ULONG           Cancelled;
+    ULONG           Failures;
+    ULONGLONG       LastProgress;
+    ULONGLONG       Completed[SimOpCount];
+    SIM_LATENCIES   Latencies[SimOpCount];
+} Run;
+
+static VOID SimClientNext(PVOID context, NTSTATUS status, ULONG_PTR information);
+
+static VOID SimCheckFail(PSIM_CLIENT client, PCSTR format, ...)
+{
+    va_list args;
+
+    Run.Failures++;
+    if (client != NULL) {
+        fprintf(stderr, "echosim: seed %llu client %u: ", (unsigned long long)Run.Seed, client->Index);
+    }
+    else {
+        fprintf(stderr, "echosim: seed %llu: ", (unsigned long long)Run.Seed);
+    }
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+static VOID SimOnAbort(int signal)
+{
+    UNREFERENCED_PARAMETER(signal);
+    fprintf(stderr, "echosim: aborted, reproduce with -seed %llu\n", (unsigned long long)Run.Seed);
+}
+
+static UCHAR SimPattern(ULONG client, ULONG sequence, size_t offset)
+{
+    return (UCHAR)(sequence * 31 + client * 7 + offset);
+}
+
+static VOID SimLatencyAdd(SIM_LATENCIES* latencies, ULONGLONG ns)
+{
+    if (latencies->Count == latencies->Capacity) {
+        latencies->Capacity = latencies->Capacity ? latencies->Capacity * 2 : 1024;
+        latencies->Samples = (ULONGLONG*)realloc(latencies->Samples,
+                                                 latencies->Capacity * sizeof(ULONGLONG));
+        if (latencies->Samples == NULL) {
+            fprintf(stderr, "echosim: out of memory\n");
+            exit(2);
+        }
+    }
+    latencies->Samples[latencies->Count++] = ns;
+}
+
+static int SimCompareUlonglong(const void* a, const void* b)
+{
+    ULONGLONG x = *(const ULONGLONG*)a;
+    ULONGLONG y = *(const ULONGLONG*)b;
+
+    return (x > y) - (x < y);
+}
+
+static double SimPercentileMs(SIM_LATENCIES* latencies, ULONG percent)
+{
+    ULONG index;
+
+    if (latencies->Count == 0) {
+        return 0.0;
+    }
+    index = (ULONG)(((ULONGLONG)latencies->Count * percent + 99) / 100);
+    if (index != 0) {
+        index--;
+    }
+    return (double)latencies->Samples[index] / (double)SIM_NS_PER_MS;
+}
+
+/*
+Function:
+    SimCheckTraced
+    ٻ
+
+Routine Description:
+
+    Checks a completed traced echo: the header comes back with the client's
+    request id and length, the payload is echoed, and the stage stamps are
+    in order and lie between submission and completion.
+    ɵĸٻԣͷؿͻ˵IDͳȣرԣ׶
+    ʱλύ֮䡣
+
+Arguments:
+
+    client - The client.
+             ͻ
+    information - Bytes returned.
+                  صֽ
+
+Return Value:
+
+    VOID
+*/
+static VOID SimCheckTraced(PSIM_CLIENT client, ULONG_PTR information)
+{
+    PECHO_TRACED_HEADER header = (PECHO_TRACED_HEADER)client->TracedOutput;
+    PUCHAR payload = client->TracedOutput + sizeof(ECHO_TRACED_HEADER);
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER now;
+    LONGLONG submitted;
+    size_t i;
+
+    if (information != sizeof(ECHO_TRACED_HEADER) + client->WriteLength) {
+        SimCheckFail(client, "traced echo returned %lu bytes, expected %lu",
+                     (unsigned long)information,
+                     (unsigned long)(sizeof(ECHO_TRACED_HEADER) + client->WriteLength));
+        return;
+    }
+    if (header->RequestId != ((ULONGLONG)client->Index << 32 | client->Sequence) ||
+        header->Length != client->WriteLength) {
+        SimCheckFail(client, "traced echo returned id %llx length %u",
+                     (unsigned long long)header->RequestId, header->Length);
+    }
+    for (i = 0; i < client->WriteLength; i++) {
+        if (payload[i] != SimPattern(client->Index, client->Sequence, i)) {
+            SimCheckFail(client, "traced echo payload differs at offset %lu", (unsigned long)i);
+            break;
+        }
+    }
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&now);
+    submitted = (LONGLONG)(client->SubmitTime / (1000000000ULL / frequency.QuadPart));
+    if (header->Frequency != frequency.QuadPart) {
+        SimCheckFail(client, "traced echo frequency %lld", (long long)header->Frequency);
+    }
+    if (header->Stamps[EchoStageArrival] < submitted ||
+        header->Stamps[EchoStageComplete] > now.QuadPart) {
+        SimCheckFail(client, "traced echo stamps outside the request's lifetime");
+    }
+    for (i = 1; i < EchoStageCount; i++) {
+        if (header->Stamps[i] < header->Stamps[i - 1]) {
+            SimCheckFail(client, "traced echo stage %lu stamped before stage %lu",
+                         (unsigned long)i, (unsigned long)(i - 1));
+            break;
+        }
+    }
+}
+
+/*
+Function:
+    SimClientComplete
+    ͻ
+
+Routine Description:
+
+    Completion routine of every client request. Checks the result against
+    what the driver must return, records the latency in virtual time and
+    starts the client's next operation.
+    ÿͻ̡뷵صݼʱ
+    ¼ӳ٣ͻ˵һ
+
+    Data is only checked when every client has a shard of its own and no
+    request is cancelled, because only then the echo buffer of the shard
+    is known to hold the client's last write.
+    ÿͻ˶ԼķƬûȡʱżݣΪֻ
+    ȷƬĻԻǸÿͻ˵һд롣
+
+Arguments:
+
+    context - The client.
+              ͻ
+    status - Completion status.
+             ״̬
+    information - Bytes transferred.
+                  ֽ
+
+Return Value:
+
+    VOID
+*/
+static VOID SimClientComplete(PVOID context, NTSTATUS status, ULONG_PTR information)
+{
+    PSIM_CLIENT client = (PSIM_CLIENT)context;
+    SIM_OP op = client->PendingOp;
+    size_t i;
+
+    client->PendingId = 0;
+    Run.LastProgress = SimNow();
+    Run.Completed[op]++;
+    SimLatencyAdd(&Run.Latencies[op], SimNow() - client->SubmitTime);
+
+    if (status == STATUS_CANCELLED) {
+        Run.Cancelled++;
+    }
+    else if (!NT_SUCCESS(status)) {
+        SimCheckFail(client, "%s failed 0x%x", SimOpNames[op], status);
+    }
+    else if (op == SimOpWrite) {
+        if (information != client->WriteLength) {
+            SimCheckFail(client, "write of %lu bytes returned %lu",
+                         (unsigned long)client->WriteLength, (unsigned long)information);
+        }
+    }
+    else if (op == SimOpRead && Run.Verify) {
+        if (information != client->WriteLength) {
+            SimCheckFail(client, "read returned %lu bytes, expected %lu",
+                         (unsigned long)information, (unsigned long)client->WriteLength);
+        }
+        for (i = 0; i < information && i < client->WriteLength; i++) {
+            if (client->ReadBuffer[i] != SimPattern(client->Index, client->Sequence, i)) {
+                SimCheckFail(client, "read data differs from the last write at offset %lu",
+                             (unsigned long)i);
+                break;
+            }
+        }
+    }
+    else if (op == SimOpControl && information != sizeof(ECHO_STATS)) {
+        SimCheckFail(client, "IOCTL_ECHO_GET_STATS returned %lu bytes", (unsigned long)information);
+    }
+    else if (op == SimOpTraced) {
+        SimCheckTraced(client, information);
+    }
+
+    SimClientNext(client, STATUS_SUCCESS, 0);
+}
+
+static VOID SimCancelRequest(PVOID context, NTSTATUS status, ULONG_PTR information)
+{
+    UNREFERENCED_PARAMETER(status);
+    UNREFERENCED_PARAMETER(information);
+
+    SimCancel((ULONG)(ULONG_PTR)context);
+}
+
+/*
+Function:
+    SimClientNext
+    ͻһ
+
+Routine Description:
+
+    Issues the client's next request: a control request with probability
+    ControlPercent, otherwise the next write or read. A write is sent as a
+    traced echo with probability TracedPercent. Each request may get a
+    cancellation scheduled at a random point within two timer periods.
+    ͻ˵һControlPercentĸʷ󣬷򷢳һ
+    дȡдTracedPercentĸΪٻԷÿ󶼿
+    ʱڵʱ㱻ȡ
+
+Arguments:
+
+    context - The client.
+              ͻ
+
+Return Value:
+
+    VOID
+*/
+static VOID SimClientNext(PVOID context, NTSTATUS status, ULONG_PTR information)
+{
+    PSIM_CLIENT client = (PSIM_CLIENT)context;
+    SIM_IO io;
+    PECHO_TRACED_HEADER header;
+    size_t i;
+
+    UNREFERENCED_PARAMETER(status);
+    UNREFERENCED_PARAMETER(information);
+
+    if (client->OpsIssued == Options.Ops) {
+        client->Done = TRUE;
+        Run.ClientsDone++;
+        return;
+    }
+    client->OpsIssued++;
+
+    RtlZeroMemory(&io, sizeof(io));
+    io.File = client->File;
+    io.Completion = SimClientComplete;
+    io.Context = client;
+
+    if (Options.ControlPercent != 0 && SimRandom() % 100 < Options.ControlPercent) {
+        client->PendingOp = SimOpControl;
+        io.Type = WdfRequestTypeDeviceIoControl;
+        io.IoControlCode = IOCTL_ECHO_GET_STATS;
+        io.OutputBuffer = &client->Stats;
+        io.OutputLength = sizeof(client->Stats);
+    }
+    else if (client->NextBulk == SimOpWrite) {
+        client->PendingOp = SimOpWrite;
+        client->NextBulk = SimOpRead;
+        client->Sequence++;
+        client->WriteLength = 1 + (size_t)(SimRandom() % Options.MaxSize);
+        for (i = 0; i < client->WriteLength; i++) {
+            client->WriteBuffer[i] = SimPattern(client->Index, client->Sequence, i);
+        }
+        io.Type = WdfRequestTypeWrite;
+        io.Buffer = client->WriteBuffer;
+        io.Length = client->WriteLength;
+
+        if (Options.TracedPercent != 0 && SimRandom() % 100 < Options.TracedPercent) {
+            client->PendingOp = SimOpTraced;
+            header = (PECHO_TRACED_HEADER)client->TracedInput;
+            RtlZeroMemory(header, sizeof(ECHO_TRACED_HEADER));
+            header->RequestId = (ULONGLONG)client->Index << 32 | client->Sequence;
+            header->Length = (ULONG)client->WriteLength;
+            memcpy(header + 1, client->WriteBuffer, client->WriteLength);
+            memset(client->TracedOutput, 0, sizeof(ECHO_TRACED_HEADER) + client->WriteLength);
+            io.Type = WdfRequestTypeDeviceIoControl;
+            io.Buffer = NULL;
+            io.Length = 0;
+            io.IoControlCode = IOCTL_ECHO_TRACED;
+            io.InputBuffer = client->TracedInput;
+            io.InputLength = sizeof(ECHO_TRACED_HEADER) + client->WriteLength;
+            io.OutputBuffer = client->TracedOutput;
+            io.OutputLength = sizeof(ECHO_TRACED_HEADER) + client->WriteLength;
+        }
+    }
+    else {
+        client->PendingOp = SimOpRead;
+        client->NextBulk = SimOpWrite;
+        memset(client->ReadBuffer, 0, client->WriteLength);
+        io.Type = WdfRequestTypeRead;
+        io.Buffer = client->ReadBuffer;
+        io.Length = client->WriteLength;
+    }
+
+    client->SubmitTime = SimNow();
+    client->PendingId = SimSubmit(&io);
+
+    if (client->PendingId != 0 && Options.CancelPercent != 0 &&
+        SimRandom() % 100 < Options.CancelPercent) {
+        // whole milliseconds, so cancellations can race timer ticks
+        SimSchedule((SimRandom() % (2 * Run.TimerMs + 1)) * SIM_NS_PER_MS,
+                    SimCancelRequest, (PVOID)(ULONG_PTR)client->PendingId);
+    }
+}
+
+/*
+Function:
+    SimPowerCycle
+    Դ
+
+Routine Description:
+
+    Runs one half of a power cycle: context (PVOID)1 powers the device up,
+    anything else powers it down. Every other power-down is moved to the
+    instant of the next timer tick, so the suspend and a tick that has
+    already fired are run in either order; a tick that loses the race
+    must leave the parked request alone and must not re-arm.
+    ִеԴڵһ룺contextΪ(PVOID)1ʱΪ豸ϵ磬Ϊϵ硣ÿһ
+    ϵ类Ƶһμʱʱ̣˹Ѿļʱһ˳У
+    ʧܵĴ벻פҲʱ
+
+Arguments:
+
+    context - (PVOID)1 to power up, NULL to power down, (PVOID)2 to power
+              down on a timer tick.
+              (PVOID)1Ϊϵ磬NULLΪϵ磬(PVOID)2Ϊڼʱʱϵ
+
+Return Value:
+
+    VOID
+*/
+static VOID SimPowerCycle(PVOID context, NTSTATUS status, ULONG_PTR information)
+{
+    ULONGLONG due;
+
+    UNREFERENCED_PARAMETER(status);
+    UNREFERENCED_PARAMETER(information);
+
+    if (context == NULL && Run.PowerCycling && SimDeviceIsPowered() && SimRandom() % 2 == 0) {
+        due = SimTimerNextDue();
+        if (due != (ULONGLONG)-1 && due >= SimNow()) {
+            SimSchedule(due - SimNow(), SimPowerCycle, (PVOID)2);
+            return;
+        }
+    }
+
+    if (context == (PVOID)1) {
+        // power-up half of the cycle
+        if (!SimDeviceIsPowered()) {
+            SimDevicePowerUp();
+        }
+        if (Run.PowerCycling) {
+            SimSchedule(Options.SuspendEveryMs * SIM_NS_PER_MS, SimPowerCycle, NULL);
+        }
+        return;
+    }
+    if (!Run.PowerCycling || !SimDeviceIsPowered()) {
+        return;
+    }
+    Run.PowerCycles++;
+    SimDevicePowerDown();
+    SimSchedule(Options.SuspendForMs * SIM_NS_PER_MS, SimPowerCycle, (PVOID)1);
+}
+
+// ύһIOCTLʱµŵһ
+static VOID SimRetuneSubmit(ULONG ioControlCode, PECHO_TUNING tuning, ULONG_PTR step);
+
+/*
+Function:
+    SimRetune
+    µ
+
+Routine Description:
+
+    Runs one step of a retune under load. Step 0 reads the tuning in use;
+    step 1 sends IOCTL_ECHO_SET_TUNING with a new timer period and maximum
+    write length, or on every other retune with a value out of bounds;
+    step 2 reads the tuning back and step 3 checks that it is the new one,
+    or the old one when the driver rejected the change. The new maximum
+    write length is never below the largest write, so every request must
+    still complete and verify.
+    ִиµŵһ0ȡʹõĵŲ1ʹµ
+    ʱںд볤ȵIOCTL_ECHO_SET_TUNINGÿһͳΧ
+    ֵ2¶ȡŲ3Ϊ²ܾʱ
+    Ϊɲµд볤ȴӲд룬ÿԱɲ
+    ͨУ顣
+
+Arguments:
+
+    context - Step to run, NULL for step 0.
+              ҪִеĲ裬NULLʾ0
+
+    status - Completion status of the previous step's request.
+             һ״̬
+
+    information - Bytes returned by the previous step's request.
+                  һ󷵻صֽ
+
+Return Value:
+
+    VOID
+*/
+static VOID SimRetune(PVOID context, NTSTATUS status, ULONG_PTR information)
+{
+    ULONG_PTR step = (ULONG_PTR)context;
+    BOOLEAN valid = (Run.Retunes % 2 == 0);
+    PECHO_TUNING expected;
+
+    if (step == 0) {
+        if (!Run.Retuning) {
+            return;
+        }
+        Run.RetuneBusy = TRUE;
+        SimRetuneSubmit(IOCTL_ECHO_GET_TUNING, &Run.RetuneOld, 1);
+        return;
+    }
+
+    Run.RetuneRequests++;
+
+    if (step == 1) {
+        if (!NT_SUCCESS(status) || information != sizeof(ECHO_TUNING)) {
+            SimCheckFail(NULL, "retune: IOCTL_ECHO_GET_TUNING failed 0x%x", status);
+            Run.RetuneBusy = FALSE;
+            return;
+        }
+        Run.RetuneNew = Run.RetuneOld;
+        if (valid) {
+            Run.RetuneNew.TimerPeriodMs = min(1 + SimRandom() % (2 * Run.TimerMs), MAX_TIMER_PERIOD);
+            Run.RetuneNew.MaxWriteLength = Options.MaxSize + SimRandom() % (3 * Options.MaxSize + 1);
+        }
+        else {
+            switch ((Run.Retunes / 2) % 4) {
+            case 0:  Run.RetuneNew.TimerPeriodMs = 0; break;
+            case 1:  Run.RetuneNew.TimerPeriodMs = MAX_TIMER_PERIOD + 1; break;
+            case 2:  Run.RetuneNew.MaxWriteLength = 0; break;
+            default: Run.RetuneNew.MaxWriteLength = MAX_WRITE_LENGTH_CAP + 1; break;
+            }
+        }
+        SimRetuneSubmit(IOCTL_ECHO_SET_TUNING, &Run.RetuneNew, 2);
+        return;
+    }
+
+    if (step == 2) {
+        if (valid && !NT_SUCCESS(status)) {
+            SimCheckFail(NULL, "retune: timer period %u, max write %u rejected 0x%x",
+                         Run.RetuneNew.TimerPeriodMs, Run.RetuneNew.MaxWriteLength, status);
+        }
+        else if (!valid && status != STATUS_INVALID_PARAMETER) {
+            SimCheckFail(NULL, "retune: timer period %u, max write %u returned 0x%x, expected 0x%x",
+                         Run.RetuneNew.TimerPeriodMs, Run.RetuneNew.MaxWriteLength,
+                         status, STATUS_INVALID_PARAMETER);
+        }
+        RtlZeroMemory(&Run.RetuneRead, sizeof(Run.RetuneRead));
+        SimRetuneSubmit(IOCTL_ECHO_GET_TUNING, &Run.RetuneRead, 3);
+        return;
+    }
+
+    expected = valid ? &Run.RetuneNew : &Run.RetuneOld;
+    if (!NT_SUCCESS(status) || information != sizeof(ECHO_TUNING)) {
+        SimCheckFail(NULL, "retune: IOCTL_ECHO_GET_TUNING failed 0x%x", status);
+    }
+    else if (Run.RetuneRead.TimerPeriodMs != expected->TimerPeriodMs ||
+             Run.RetuneRead.MaxWriteLength != expected->MaxWriteLength ||
+             Run.RetuneRead.PoolTag != expected->PoolTag ||
+             Run.RetuneRead.StartDelayMs != expected->StartDelayMs) {
+        SimCheckFail(NULL, "retune: driver uses timer period %u, max write %u after %s "
+                     "timer period %u, max write %u",
+                     Run.RetuneRead.TimerPeriodMs, Run.RetuneRead.MaxWriteLength,
+                     valid ? "setting" : "rejecting",
+                     Run.RetuneNew.TimerPeriodMs, Run.RetuneNew.MaxWriteLength);
+    }
+    Run.Retunes++;
+    Run.RetuneBusy = FALSE;
+    if (Run.Retuning) {
+        SimSchedule(Options.RetuneEveryMs * SIM_NS_PER_MS, SimRetune, NULL);
+    }
+}
+
+static VOID SimRetuneSubmit(ULONG ioControlCode, PECHO_TUNING tuning, ULONG_PTR step)
+{
+    SIM_IO io;
+
+    RtlZeroMemory(&io, sizeof(io));
+    io.Type = WdfRequestTypeDeviceIoControl;
+    io.File = Run.Clients[0].File;
+    io.IoControlCode = ioControlCode;
+    if (ioControlCode == IOCTL_ECHO_SET_TUNING) {
+        io.InputBuffer = tuning;
+        io.InputLength = sizeof(ECHO_TUNING);
+    }
+    else {
+        io.OutputBuffer = tuning;
+        io.OutputLength = sizeof(ECHO_TUNING);
+    }
+    io.Completion = SimRetune;
+    io.Context = (PVOID)step;
+    SimSubmit(&io);
+}
+
+static VOID SimStatsComplete(PVOID context, NTSTATUS status, ULONG_PTR information)
+{
+    *(NTSTATUS*)context = NT_SUCCESS(status) && information == sizeof(ECHO_STATS) ?
+                          STATUS_SUCCESS : STATUS_UNSUCCESSFUL;
+}
+
+/*
+Function:
+    SimCheckDriverStats
+    ͳϢ
+
+Routine Description:
+
+    Reads the driver's statistics and checks that every completed read,
+    write, traced echo and control request, including the retune requests,
+    was accounted in its lane. Only meaningful
+    without cancellation, since requests cancelled in a queue are completed
+    by the framework and never reach the driver's accounting.
+    ȡͳϢÿɵĶдͿͨ
+    ͳơûȡʱ壬Ϊڶбȡɿɣ
+    Զͳơ
+
+Arguments:
+
+    client - Client whose file is used for the request.
+             ʹļĿͻ
+
+Return Value:
+
+    VOID
+*/
+static VOID SimCheckDriverStats(PSIM_CLIENT client)
+{
+    SIM_IO io;
+    ECHO_STATS stats;
+    NTSTATUS status = STATUS_PENDING;
+    ULONGLONG bulk = Run.Completed[SimOpWrite] + Run.Completed[SimOpRead] +
+                     Run.Completed[SimOpTraced];
+
+    RtlZeroMemory(&io, sizeof(io));
+    io.Type = WdfRequestTypeDeviceIoControl;
+    io.File = client->File;
+    io.IoControlCode = IOCTL_ECHO_GET_STATS;
+    io.OutputBuffer = &stats;
+    io.OutputLength = sizeof(stats);
+    io.Completion = SimStatsComplete;
+    io.Context = &status;
+    SimSubmit(&io);
+    while (status == STATUS_PENDING && SimStep()) {
+    }
+
+    if (status != STATUS_SUCCESS) {
+        SimCheckFail(client, "final IOCTL_ECHO_GET_STATS failed");
+        return;
+    }
+    if (stats.ShardCount != Run.ShardCount) {
+        SimCheckFail(client, "driver reports %u shards, expected %u", stats.ShardCount, Run.ShardCount);
+    }
+    if (stats.Lanes[EchoLaneBulk].Requests != bulk) {
+        SimCheckFail(client, "bulk lane accounted %llu requests, %llu completed",
+                     (unsigned long long)stats.Lanes[EchoLaneBulk].Requests,
+                     (unsigned long long)bulk);
+    }
+    if (stats.Lanes[EchoLaneControl].Requests != Run.Completed[SimOpControl] + Run.RetuneRequests) {
+        SimCheckFail(client, "control lane accounted %llu requests, %llu completed",
+                     (unsigned long long)stats.Lanes[EchoLaneControl].Requests,
+                     (unsigned long long)(Run.Completed[SimOpControl] + Run.RetuneRequests));
+    }
+    if (stats.PowerTransitions != Run.PowerCycles) {
+        SimCheckFail(client, "driver counted %u power transitions, %u were made",
+                     stats.PowerTransitions, Run.PowerCycles);
+    }
+}
+
+/*
+Function:
+    SimRunSeed
+    һ
+
+Routine Description:
+
+    Runs the workload once with the given seed.
+    ʹøһθء
+
+Arguments:
+
+    seed - Seed of the scheduler and the workload.
+           ͸ص
+
+Return Value:
+
+    ULONG - Number of framework rule violations and failed checks.
+            ܹΥͼʧܵĴ
+*/
+static ULONG SimRunSeed(ULONGLONG seed)
+{
+    SIM_CONFIG config;
+    WDFDEVICE device;
+    NTSTATUS status;
+    PSIM_CLIENT client;
+    ULONGLONG stallNs;
+    ULONG errors;
+    ULONG i;
+
+    for (i = 0; i < SimOpCount; i++) {
+        free(Run.Latencies[i].Samples);
+    }
+    for (i = 0; i < SIM_MAX_CLIENTS; i++) {
+        free(Run.Clients[i].WriteBuffer);
+        free(Run.Clients[i].ReadBuffer);
+        free(Run.Clients[i].TracedInput);
+        free(Run.Clients[i].TracedOutput);
+    }
+    RtlZeroMemory(&Run, sizeof(Run));
+    Run.Seed = seed;
+
+    RtlZeroMemory(&config, sizeof(config));
+    config.Seed = seed;
+    config.Processors = Options.Processors;
+    config.Verbose = Options.Verbose;
+    SimInitialize(&config);
+    Run.StartTime = Run.LastProgress = SimNow();
+
+    if (Options.Shards != 0) {
+        SimRegistrySetULong(L"ShardCount", Options.Shards);
+    }
+    if (Options.TimerMs != 0) {
+        SimRegistrySetULong(L"TimerPeriod", Options.TimerMs);
+    }
+    if (Options.StartDelayMs != (ULONG)-1) {
+        SimRegistrySetULong(L"StartDelay", Options.StartDelayMs);
+    }
+    Run.TimerMs = Options.TimerMs ? Options.TimerMs : SIM_DEFAULT_TIMER_MS;
+    Run.ShardCount = Options.Shards ? Options.Shards : min(Options.Processors, ECHO_MAX_SHARDS);
+    if (Run.ShardCount == 0) {
+        Run.ShardCount = 1;
+    }
+    Run.Verify = (Options.Clients <= Run.ShardCount && Options.CancelPercent == 0);
+
+    status = SimDeviceAdd(EchoDeviceCreate, &device);
+    if (!NT_SUCCESS(status)) {
+        fprintf(stderr, "echosim: EchoDeviceCreate failed 0x%x\n", status);
+        SimShutdown();
+        return SimErrors() + 1;
+    }
+    SimDevicePowerUp();
+
+    for (i = 0; i < Options.Clients; i++) {
+        client = &Run.Clients[i];
+        client->Index = i;
+        client->NextBulk = SimOpWrite;
+        client->WriteBuffer = (PUCHAR)malloc(Options.MaxSize);
+        client->ReadBuffer = (PUCHAR)malloc(Options.MaxSize);
+        client->TracedInput = (PUCHAR)malloc(sizeof(ECHO_TRACED_HEADER) + Options.MaxSize);
+        client->TracedOutput = (PUCHAR)malloc(sizeof(ECHO_TRACED_HEADER) + Options.MaxSize);
+        client->File = SimFileOpen();
+        if (client->File == NULL || client->WriteBuffer == NULL || client->ReadBuffer == NULL ||
+            client->TracedInput == NULL || client->TracedOutput == NULL) {
+            SimCheckFail(client, "cannot open the device");
+            SimShutdown();
+            return SimErrors() + Run.Failures;
+        }
+        SimSchedule(0, SimClientNext, client);
+    }
+    if (Options.SuspendEveryMs != 0) {
+        Run.PowerCycling = TRUE;
+        SimSchedule(Options.SuspendEveryMs * SIM_NS_PER_MS, SimPowerCycle, NULL);
+    }
+    if (Options.RetuneEveryMs != 0) {
+        Run.Retuning = TRUE;
+        SimSchedule(Options.RetuneEveryMs * SIM_NS_PER_MS, SimRetune, NULL);
+    }
+
+    //
+    // The timers re-arm forever, so a request that is never completed
+    // shows up as a run that stops making progress
+    // ʱԶ˴δɵΪвнչ
+    //
+    stallNs = max(60 * 1000ULL, 50ULL * (Run.TimerMs + Options.SuspendForMs)) * SIM_NS_PER_MS;
+    while (Run.ClientsDone < Options.Clients) {
+        if (!SimStep() || SimNow() - Run.LastProgress > stallNs) {
+            break;
+        }
+    }
+    if (Run.ClientsDone < Options.Clients) {
+        for (i = 0; i < Options.Clients; i++) {
+            if (!Run.Clients[i].Done) {
+                SimCheckFail(&Run.Clients[i], "stalled, %s request %u never completed",
+                             SimOpNames[Run.Clients[i].PendingOp], Run.Clients[i].PendingId);
+            }
+        }
+    }
+    else {
+        Run.PowerCycling = FALSE;
+        if (!SimDeviceIsPowered()) {
+            SimDevicePowerUp();
+        }
+        Run.Retuning = FALSE;
+        while (Run.RetuneBusy && SimStep()) {
+        }
+        if (Options.CancelPercent == 0) {
+            SimCheckDriverStats(&Run.Clients[0]);
+        }
+    }
+
+    Run.ElapsedNs = SimNow() - Run.StartTime;
+    SimDeviceRemove();
+    SimShutdown();
+    errors = SimErrors() + Run.Failures;
+    if (Options.Sweep) {
+        return errors;
+    }
+
+    printf("seed %llu: %u clients, %u shards, %llu requests, %u cancelled, %u power cycles, "
+           "%u retunes, %.3f s virtual, %u errors\n",
+           (unsigned long long)seed, Options.Clients, Run.ShardCount,
+           (unsigned long long)(Run.Completed[SimOpWrite] + Run.Completed[SimOpRead] +
+                                Run.Completed[SimOpControl] + Run.Completed[SimOpTraced]),
+           Run.Cancelled, Run.PowerCycles, Run.Retunes, (double)Run.ElapsedNs / 1e9, errors);
+    return errors;
+}
+
+static VOID SimPrintLatencies(VOID)
+{
+    SIM_LATENCIES* latencies;
+    ULONG i;
+
+    for (i = 0; i < SimOpCount; i++) {
+        latencies = &Run.Latencies[i];
+        if (latencies->Count == 0) {
+            continue;
+        }
+        qsort(latencies->Samples, latencies->Count, sizeof(ULONGLONG), SimCompareUlonglong);
+        printf("  %-8s n %-8u p50 %10.3f ms  p99 %10.3f ms  max %10.3f ms\n",
+               SimOpNames[i], latencies->Count,
+               SimPercentileMs(latencies, 50), SimPercentileMs(latencies, 99),
+               SimPercentileMs(latencies, 100));
+    }
+}
+
+/*
+Function:
+    SimSweep
+    Ƭͻɨ
+
+Routine Description:
+
+    Runs the workload for every combination of 1 to 16 shards and 1 to 64
+    clients, each with the configured seeds, and prints the requests
+    completed per virtual second of each cell. The simulator runs one
+    callback at a time, so the table shows how the shards stop requests
+    from waiting behind each other, not how many cores they use; the
+    -Scale mode of echoapp measures that on a real device.
+    116Ƭ164ͻ˵ÿиأÿʹõӣ
+    ӡÿԪÿɵģÿֻһص˱ʾ
+    ǷƬαȴʹ˶ٺģechoapp-Scaleģʽ
+    ʵ豸ϲߡ
+
+Arguments:
+
+    VOID
+
+Return Value:
+
+    ULONG - Number of runs that failed.
+            ʧܵд
+*/
+static ULONG SimSweep(VOID)
+{
+    ULONGLONG requests;
+    ULONGLONG elapsedNs;
+    ULONG failedRuns = 0;
+    ULONG s, c, i;
+
+    printf("requests per virtual second, timer %u ms, %u ops per client, %u run(s) per cell\n",
+           Options.TimerMs ? Options.TimerMs : SIM_DEFAULT_TIMER_MS, Options.Ops, Options.Runs);
+    printf("shards\\clients");
+    for (c = 0; c < SIM_COUNT(SimSweepClients); c++) {
+        printf(" %9u", SimSweepClients[c]);
+    }
+    printf("\n");
+
+    for (s = 0; s < SIM_COUNT(SimSweepShards); s++) {
+        printf("%14u", SimSweepShards[s]);
+        for (c = 0; c < SIM_COUNT(SimSweepClients); c++) {
+            Options.Shards = SimSweepShards[s];
+            Options.Clients = SimSweepClients[c];
+            requests = 0;
+            elapsedNs = 0;
+            for (i = 0; i < Options.Runs; i++) {
+                if (SimRunSeed(Options.Seed + i) != 0) {
+                    failedRuns++;
+                }
+                requests += Run.Completed[SimOpWrite] + Run.Completed[SimOpRead] +
+                            Run.Completed[SimOpControl] + Run.Completed[SimOpTraced];
+                elapsedNs += Run.ElapsedNs;
+            }
+            printf(" %9.0f", elapsedNs ? (double)requests * 1e9 / (double)elapsedNs : 0.0);
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+    return failedRuns;
+}
+
+static VOID SimUsage(VOID)
+{
+    printf("Usage: echosim [options]\n"
+           "  -seed n          first seed (1)\n"
+           "  -runs n          number of consecutive seeds to run (1)\n"
+           "  -clients n       concurrent clients, one file each (4)\n"
+           "  -ops n           requests per client (200)\n"
+           "  -size n          largest write, in bytes (512)\n"
+           "  -cpus n          processors reported to the driver (4)\n"
+           "  -shards n        ShardCount registry value\n"
+           "  -timer ms        TimerPeriod registry value\n"
+           "  -startdelay ms   StartDelay registry value\n"
+           "  -suspend ms      power down every ms of virtual time\n"
+           "  -suspendfor ms   time spent powered down (10)\n"
+           "  -cancel pct      percent of requests cancelled at a random time\n"
+           "  -control pct     percent of requests that are IOCTL_ECHO_GET_STATS\n"
+           "  -traced pct      percent of writes sent as IOCTL_ECHO_TRACED\n"
+           "  -retune ms       change the timer period and largest write every ms\n"
+           "  -sweep           requests per second for 1-16 shards by 1-64 clients\n"
+           "  -v               print the driver's debug output\n");
+}
+
+int __cdecl main(int argc, char* argv[])
+{
+    ULONG failedRuns = 0;
+    ULONG errors;
+    ULONG i;
+
+    for (i = 1; i < (ULONG)argc; i++) {
+        PCSTR option = argv[i];
+        PCSTR value = (i + 1 < (ULONG)argc) ? argv[i + 1] : NULL;
+
+        if (strcmp(option, "-v") == 0) {
+            Options.Verbose = TRUE;
+            continue;
+        }
+        if (strcmp(option, "-sweep") == 0) {
+            Options.Sweep = TRUE;
+            continue;
+        }
+        if (value == NULL) {
+            SimUsage();
+            return 1;
+        }
+        i++;
+        if (strcmp(option, "-seed") == 0)            Options.Seed = strtoull(value, NULL, 0);
+        else if (strcmp(option, "-runs") == 0)       Options.Runs = strtoul(value, NULL, 0);
+        else if (strcmp(option, "-clients") == 0)    Options.Clients = strtoul(value, NULL, 0);
+        else if (strcmp(option, "-ops") == 0)        Options.Ops = strtoul(value, NULL, 0);
+        else if (strcmp(option, "-size") == 0)       Options.MaxSize = strtoul(value, NULL, 0);
+        else if (strcmp(option, "-cpus") == 0)       Options.Processors = strtoul(value, NULL, 0);
+        else if (strcmp(option, "-shards") == 0)     Options.Shards = strtoul(value, NULL, 0);
+        else if (strcmp(option, "-timer") == 0)      Options.TimerMs = strtoul(value, NULL, 0);
+        else if (strcmp(option, "-startdelay") == 0) Options.StartDelayMs = strtoul(value, NULL, 0);
+        else if (strcmp(option, "-suspend") == 0)    Options.SuspendEveryMs = strtoul(value, NULL, 0);
+        else if (strcmp(option, "-suspendfor") == 0) Options.SuspendForMs = strtoul(value, NULL, 0);
+        else if (strcmp(option, "-cancel") == 0)     Options.CancelPercent = strtoul(value, NULL, 0);
+        else if (strcmp(option, "-control") == 0)    Options.ControlPercent = strtoul(value, NULL, 0);
+        else if (strcmp(option, "-traced") == 0)     Options.TracedPercent = strtoul(value, NULL, 0);
+        else if (strcmp(option, "-retune") == 0)     Options.RetuneEveryMs = strtoul(value, NULL, 0);
+        else {
+            SimUsage();
+            return 1;
+        }
+    }
+    if (Options.Clients == 0 || Options.Clients > SIM_MAX_CLIENTS ||
+        Options.MaxSize == 0 || Options.MaxSize > MAX_WRITE_LENGTH ||
+        Options.Shards > ECHO_MAX_SHARDS || Options.Runs == 0) {
+        SimUsage();
+        return 1;
+    }
+
+    signal(SIGABRT, SimOnAbort);
+
+    if (Options.Sweep) {
+        failedRuns = SimSweep();
+        printf("\n%u of %u run(s) failed\n", failedRuns,
+               Options.Runs * (ULONG)(SIM_COUNT(SimSweepShards) * SIM_COUNT(SimSweepClients)));
+        return failedRuns != 0 ? 1 : 0;
+    }
+
+    for (i = 0; i < Options.Runs; i++) {
+        errors = SimRunSeed(Options.Seed + i);
+        if (errors != 0) {
+            failedRuns++;
+        }
+    }
+    if (Options.Runs == 1) {
+        SimPrintLatencies();
+    }
+    printf("\n");
+    SimPrintCallbackTimes(stdout);
+    printf("\n%u of %u run(s) failed\n", failedRuns, Options.Runs);
+    return failedRuns != 0 ? 1 : 0;
+}
@@ -0,0 +1,212 @@
+/*
+
+Module Name:
+
+    windows.h
+
+Abstract:
+
+    Host stand-in for the subset of the Windows headers used by the echo
+    driver, so that device.c and queue.c build unmodified with a C99
+    compiler on Linux. Time is virtual and owned by the simulator.
+    WindowsͷļӼʹdevice.cqueue.c޸
+    LinuxC99롣ʱģģƿء
+
+Environment:
+
+    host simulator only
+    ģ
+
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#include <assert.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Basic types
+// 
+//
+typedef void                VOID, *PVOID;
+typedef char                CHAR, *PCHAR;
+typedef unsigned char       UCHAR, *PUCHAR;
+typedef int16_t             SHORT;
+typedef uint16_t            USHORT, *PUSHORT;
+typedef int32_t             LONG, *PLONG;
+typedef uint32_t            ULONG, *PULONG;
+typedef int64_t             LONGLONG, *PLONGLONG;
+typedef uint64_t            ULONGLONG, *PULONGLONG;
+typedef uint64_t            ULONG64, *PULONG64;
+typedef uintptr_t           ULONG_PTR, *PULONG_PTR;
+typedef intptr_t            LONG_PTR;
+typedef uintptr_t           SIZE_T;
+typedef uint32_t            DWORD;
+typedef int                 BOOL;
+typedef UCHAR               BOOLEAN, *PBOOLEAN;
+typedef wchar_t             WCHAR, *PWCHAR, *PWCH, *PWSTR;
+typedef const wchar_t*      PCWSTR;
+typedef const char*         PCSTR;
+typedef LONG                NTSTATUS;
+typedef ULONG               ACCESS_MASK;
+typedef void*               HANDLE;
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        LONG  HighPart;
+    } u;
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef struct _UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PWCH   Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+typedef const UNICODE_STRING* PCUNICODE_STRING;
+
+#define DECLARE_CONST_UNICODE_STRING(_var, _string) \
+    const UNICODE_STRING _var = { sizeof(_string) - sizeof(WCHAR), sizeof(_string), (PWCH)_string }
+
+typedef struct _GUID {
+    ULONG  Data1;
+    USHORT Data2;
+    USHORT Data3;
+    UCHAR  Data4[8];
+} GUID, *LPGUID;
+typedef const GUID* LPCGUID;
+
+//
+// Every translation unit gets its own copy, which is what DECLSPEC_SELECTANY
+// achieves on Windows.
+// ÿ뵥ԪԼĸWindowsDECLSPEC_SELECTANYЧͬ
+//
+#define DEFINE_GUID(name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+    static const GUID name __attribute__((unused)) = \
+        { l, w1, w2, { b1, b2, b3, b4, b5, b6, b7, b8 } }
+
+#define TRUE    1
+#define FALSE   0
+#define UNICODE_NULL ((WCHAR)0)
+
+#define IN
+#define OUT
+#define OPTIONAL
+#define __cdecl
+#define _Analysis_assume_(expr)
+#define _In_
+#define _Out_
+#define _Inout_
+#define _In_reads_bytes_(size)
+#define _Out_writes_(size)
+#define _Out_writes_bytes_(size)
+
+#define UNREFERENCED_PARAMETER(p)   ((void)(p))
+#define PAGED_CODE()
+
+// ASSERT is enforced so the simulator catches broken invariants
+// ASSERTᱻǿִУԱģƻĲ
+#define ASSERT(exp)                 assert(exp)
+
+#ifndef min
+#define min(a, b)   (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b)   (((a) > (b)) ? (a) : (b))
+#endif
+
+#define RtlZeroMemory(dst, len)         memset((dst), 0, (len))
+#define RtlCopyMemory(dst, src, len)    memcpy((dst), (src), (len))
+#define ZeroMemory                      RtlZeroMemory
+#define _vsnprintf                      vsnprintf
+
+//
+// Status codes
+// ״̬
+//
+#define NT_SUCCESS(status)              (((NTSTATUS)(status)) >= 0)
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_TIMEOUT                  ((NTSTATUS)0x00000102L)
+#define STATUS_PENDING                  ((NTSTATUS)0x00000103L)
+#define STATUS_BUFFER_OVERFLOW          ((NTSTATUS)0x80000005L)
+#define STATUS_UNSUCCESSFUL             ((NTSTATUS)0xC0000001L)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define STATUS_INVALID_DEVICE_REQUEST   ((NTSTATUS)0xC0000010L)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define STATUS_BUFFER_TOO_SMALL         ((NTSTATUS)0xC0000023L)
+#define STATUS_OBJECT_NAME_NOT_FOUND    ((NTSTATUS)0xC0000034L)
+#define STATUS_INVALID_DEVICE_STATE     ((NTSTATUS)0xC0000184L)
+#define STATUS_CANCELLED                ((NTSTATUS)0xC0000120L)
+
+//
+// I/O control codes
+// I/O
+//
+#define FILE_DEVICE_UNKNOWN     0x00000022
+#define METHOD_BUFFERED         0
+#define FILE_ANY_ACCESS         0
+#define CTL_CODE(DeviceType, Function, Method, Access) \
+    (((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+
+#define KEY_READ                0x20019
+
+typedef enum _POOL_TYPE {
+    NonPagedPool,
+    PagedPool,
+    NonPagedPoolNx = 512
+} POOL_TYPE;
+
+//
+// System services, backed by the simulator
+// ϵͳģṩ
+//
+typedef struct _SYSTEM_INFO {
+    DWORD dwNumberOfProcessors;
+    DWORD dwPageSize;
+} SYSTEM_INFO, *LPSYSTEM_INFO;
+
+VOID GetSystemInfo(LPSYSTEM_INFO systemInfo);
+
+BOOL QueryPerformanceCounter(PLARGE_INTEGER performanceCount);
+
+BOOL QueryPerformanceFrequency(PLARGE_INTEGER frequency);
+
+//
+// Process CPU accounting reports the simulator's own CPU time, which is
+// real rather than virtual; there is no cycle counter
+// CPUͳƱģCPUʱ䣬ʵʱʱ䣻ûڼ
+//
+typedef struct _FILETIME {
+    DWORD dwLowDateTime;
+    DWORD dwHighDateTime;
+} FILETIME, *PFILETIME, *LPFILETIME;
+
+HANDLE GetCurrentProcess(VOID);
+
+BOOL GetProcessTimes(HANDLE process, LPFILETIME creationTime, LPFILETIME exitTime,
+                     LPFILETIME kernelTime, LPFILETIME userTime);
+
+BOOL QueryProcessCycleTime(HANDLE process, PULONG64 cycleTime);
+
+VOID OutputDebugStringA(PCSTR outputString);
+
+VOID DebugBreak(VOID);
+
+#define InterlockedIncrement(p)         __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(p)         __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchange(p, v)       __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd(p, v)    __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,2358 @@
+/*
+
+Module Name:
+
+    wdfsim.c
+
+Abstract:
+
+    Deterministic host implementation of the framework subset declared in
+    include/wdf.h. Nothing runs concurrently: the scheduler repeatedly
+    collects every action that could happen now (a queue presenting its
+    next request, a due timer, a pending cancel routine, a client event),
+    lets the seeded generator pick one and runs it to completion. When
+    nothing can run, virtual time jumps to the next timer or client event.
+    Each framework callback is invoked with the presentation lock the real
+    framework would hold, timed on the host clock and checked against the
+    rules the framework's verifier enforces.
+    include/wdf.hĿӼȷʵ֡ûκζУ
+    ռ˿ܷ̿жгһ󡢵ڵļʱ
+    еȡ̡ͻ¼ɴӵѡһɡ
+    ûпеĶʱʱһʱͻ¼ÿܻص
+    ʵܻеĳµãʱӼʱִ֤е
+    м顣
+
+Environment:
+
+    host simulator only
+    ģ
+
+*/
+
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "wdfsim.h"
+
+#define SIM_OBJECT_MAGIC    0x4f4d4953
+#define SIM_MAX_QUEUES      64
+#define SIM_MAX_TIMERS      64
+#define SIM_MAX_REGISTRY    32
+#define SIM_ZOMBIE_RING     1024
+#define SIM_PERF_FREQUENCY  10000000
+#define SIM_FILL_PATTERN    0xCD
+#define SIM_BOOT_TIME_NS    1000000000ULL   // performance counter is never 0
+
+typedef enum _SIM_OBJECT_TYPE {
+    SimObjectDriver,
+    SimObjectDevice,
+    SimObjectQueue,
+    SimObjectRequest,
+    SimObjectMemory,
+    SimObjectTimer,
+    SimObjectFile,
+    SimObjectKey,
+    SimObjectSpinLock,
+    SimObjectWaitLock,
+    SimObjectTypeCount
+} SIM_OBJECT_TYPE;
+
+static PCSTR SimObjectTypeNames[SimObjectTypeCount] = {
+    "driver", "device", "queue", "request", "memory",
+    "timer", "file", "key", "spinlock", "waitlock"
+};
+
+typedef enum _SIM_REQUEST_STATE {
+    SimRequestArrived,      // in caller context, not yet queued
+    SimRequestQueued,       // waiting in a queue
+    SimRequestPresented,    // owned by the driver
+    SimRequestCompleted
+} SIM_REQUEST_STATE;
+
+typedef struct _SIM_OBJECT SIM_OBJECT, *PSIM_OBJECT;
+
+struct _SIM_OBJECT {
+    ULONG                           Magic;
+    SIM_OBJECT_TYPE                 Type;
+    PSIM_OBJECT                     Parent;
+    PSIM_OBJECT                     Children;
+    PSIM_OBJECT                     Sibling;
+    PCWDF_OBJECT_CONTEXT_TYPE_INFO  ContextType;
+    PVOID                           Context;
+    PFN_WDF_OBJECT_CONTEXT_CLEANUP  EvtCleanup;
+    PFN_WDF_OBJECT_CONTEXT_DESTROY  EvtDestroy;
+
+    //
+    // Locking: SyncLock is the presentation lock held around callbacks of
+    // this object; LockDepth counts acquisitions of this object as a lock.
+    // SyncLockǴ˶ĻصΧеĳLockDepthͳƴ˶ΪȡĴ
+    //
+    PSIM_OBJECT                     SyncLock;
+    ULONG                           LockDepth;
+
+    // Queue
+    WDF_IO_QUEUE_CONFIG             QueueConfig;
+    PSIM_OBJECT                     Head;
+    PSIM_OBJECT                     Tail;
+    ULONG                           Queued;
+    ULONG                           Presented;
+    ULONG                           PresentLimit;
+    BOOLEAN                         DriverStopped;
+    BOOLEAN                         PowerManaged;
+    PFN_WDF_IO_QUEUE_STATE          StopComplete;
+    WDFCONTEXT                      StopContext;
+
+    // Request
+    ULONG                           Id;
+    WDF_REQUEST_TYPE                RequestType;
+    SIM_REQUEST_STATE               State;
+    PSIM_OBJECT                     Queue;
+    PSIM_OBJECT                     File;
+    PSIM_OBJECT                     Next;
+    PSIM_OBJECT                     LiveNext;
+    PSIM_OBJECT                     LivePrev;
+    PVOID                           Buffer;
+    size_t                          Length;
+    ULONG                           IoControlCode;
+    PUCHAR                          SystemBuffer;
+    size_t                          InputLength;
+    size_t                          OutputLength;
+    PVOID                           OutputBuffer;
+    NTSTATUS                        Status;
+    ULONG_PTR                       Information;
+    PFN_WDF_REQUEST_CANCEL          CancelRoutine;
+    BOOLEAN                         Cancelable;
+    BOOLEAN                         CancelRequested;
+    BOOLEAN                         CancelPending;
+    BOOLEAN                         InCancel;
+    BOOLEAN                         StopAcked;
+    PSIM_OBJECT                     InputMemory;
+    PSIM_OBJECT                     OutputMemory;
+    SIM_ROUTINE*                    Completion;
+    PVOID                           CompletionContext;
+
+    // Memory
+    PVOID                           MemoryBuffer;
+    size_t                          MemorySize;
+    BOOLEAN                         External;
+    ULONG                           PoolTag;
+
+    // Timer
+    WDF_TIMER_CONFIG                TimerConfig;
+    BOOLEAN                         Armed;
+    BOOLEAN                         InCallback;
+    ULONGLONG                       Due;
+};
+
+struct _WDFDEVICE_INIT {
+    WDF_PNPPOWER_EVENT_CALLBACKS    Pnp;
+    WDF_OBJECT_ATTRIBUTES           RequestAttributes;
+    BOOLEAN                         HasRequestAttributes;
+    PFN_WDF_IO_IN_CALLER_CONTEXT    InCallerContext;
+    WDF_FILEOBJECT_CONFIG           FileConfig;
+    WDF_OBJECT_ATTRIBUTES           FileAttributes;
+    BOOLEAN                         HasFileAttributes;
+};
+
+typedef struct _SIM_EVENT {
+    ULONGLONG       Time;
+    ULONGLONG       Sequence;
+    SIM_ROUTINE*    Routine;
+    PVOID           Context;
+    NTSTATUS        Status;
+    ULONG_PTR       Information;
+} SIM_EVENT, *PSIM_EVENT;
+
+typedef enum _SIM_ACTION_TYPE {
+    SimActionDispatch,
+    SimActionTimer,
+    SimActionCancel,
+    SimActionEvent
+} SIM_ACTION_TYPE;
+
+typedef struct _SIM_ACTION {
+    SIM_ACTION_TYPE Type;
+    PSIM_OBJECT     Target;
+} SIM_ACTION, *PSIM_ACTION;
+
+typedef struct _SIM_REGISTRY_VALUE {
+    WCHAR   Name[64];
+    ULONG   Value;
+} SIM_REGISTRY_VALUE;
+
+static struct {
+    SIM_CONFIG          Config;
+    ULONGLONG           Now;
+    ULONGLONG           Rng;
+    ULONGLONG           Sequence;
+    ULONG               NextRequestId;
+    ULONG               Errors;
+    WDFDRIVER           Driver;
+    WDFDEVICE           Device;
+    WDFDEVICE_INIT      Init;
+    BOOLEAN             Powered;
+    BOOLEAN             Started;
+    PSIM_OBJECT         Queues[SIM_MAX_QUEUES];
+    ULONG               QueueCount;
+    PSIM_OBJECT         DefaultQueue;
+    PSIM_OBJECT         Dispatch[WdfRequestTypeMax];
+    PSIM_OBJECT         Timers[SIM_MAX_TIMERS];
+    ULONG               TimerCount;
+    PSIM_OBJECT         Live;
+    ULONG               LiveCount;
+    PSIM_OBJECT         Zombies[SIM_ZOMBIE_RING];
+    ULONG               ZombieNext;
+    PSIM_EVENT          Events;
+    ULONG               EventCount;
+    ULONG               EventCapacity;
+    SIM_REGISTRY_VALUE  Registry[SIM_MAX_REGISTRY];
+    ULONG               RegistryCount;
+    ULONG               LocksHeld;
+    ULONG               SpinLocksHeld;
+    PSIM_OBJECT         RunningTimer;
+    PSIM_ACTION         Actions;
+    ULONG               ActionCapacity;
+} Sim;
+
+//
+// Host time spent in each driver callback, kept across runs
+// ÿصѵʱ䣬б
+//
+typedef enum _SIM_CALLBACK_ID {
+    SimCbDeviceAdd,
+    SimCbSelfManagedIoInit,
+    SimCbSelfManagedIoRestart,
+    SimCbSelfManagedIoSuspend,
+    SimCbFileCreate,
+    SimCbInCallerContext,
+    SimCbIoDefault,
+    SimCbIoRead,
+    SimCbIoWrite,
+    SimCbIoDeviceControl,
+    SimCbIoStop,
+    SimCbRequestCancel,
+    SimCbTimer,
+    SimCbQueueState,
+    SimCbCleanup,
+    SimCbDestroy,
+    SimCbCount
+} SIM_CALLBACK_ID;
+
+static struct {
+    PCSTR     Name;
+    ULONGLONG Count;
+    ULONGLONG TotalNs;
+    ULONGLONG MaxNs;
+} SimCallbacks[SimCbCount] = {
+    { .Name = "EvtDriverDeviceAdd" },
+    { .Name = "EvtDeviceSelfManagedIoInit" },
+    { .Name = "EvtDeviceSelfManagedIoRestart" },
+    { .Name = "EvtDeviceSelfManagedIoSuspend" },
+    { .Name = "EvtDeviceFileCreate" },
+    { .Name = "EvtIoInCallerContext" },
+    { .Name = "EvtIoDefault" },
+    { .Name = "EvtIoRead" },
+    { .Name = "EvtIoWrite" },
+    { .Name = "EvtIoDeviceControl" },
+    { .Name = "EvtIoStop" },
+    { .Name = "EvtRequestCancel" },
+    { .Name = "EvtTimerFunc" },
+    { .Name = "EvtIoQueueState" },
+    { .Name = "EvtCleanupCallback" },
+    { .Name = "EvtDestroyCallback" },
+};
+
+static ULONGLONG SimHostNs(VOID)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ULONGLONG)ts.tv_sec * 1000000000ULL + (ULONGLONG)ts.tv_nsec;
+}
+
+static VOID SimFail(PCSTR format, ...)
+{
+    va_list args;
+
+    Sim.Errors++;
+    fprintf(stderr, "echosim: error at %llu.%06llu ms: ",
+            (unsigned long long)(Sim.Now / 1000000),
+            (unsigned long long)(Sim.Now % 1000000));
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+static VOID SimLockEnter(PSIM_OBJECT lock)
+{
+    if (lock != NULL) {
+        lock->LockDepth++;
+    }
+}
+
+static VOID SimLockLeave(PSIM_OBJECT lock)
+{
+    if (lock != NULL) {
+        lock->LockDepth--;
+    }
+}
+
+static VOID SimAccount(SIM_CALLBACK_ID id, ULONGLONG elapsedNs, ULONG locksBefore)
+{
+    SimCallbacks[id].Count++;
+    SimCallbacks[id].TotalNs += elapsedNs;
+    if (elapsedNs > SimCallbacks[id].MaxNs) {
+        SimCallbacks[id].MaxNs = elapsedNs;
+    }
+    if (Sim.LocksHeld != locksBefore) {
+        SimFail("%s returned with %d lock(s) still held",
+                SimCallbacks[id].Name, (int)(Sim.LocksHeld - locksBefore));
+        Sim.LocksHeld = locksBefore;
+    }
+}
+
+//
+// Runs one driver callback under the given presentation lock
+// ڸĳһص
+//
+#define SIM_CALLBACK(_id, _lock, _call)                             \
+    do {                                                            \
+        PSIM_OBJECT _simLock = (_lock);                             \
+        ULONG _simLocks = Sim.LocksHeld;                            \
+        ULONGLONG _simStart;                                        \
+        SimLockEnter(_simLock);                                     \
+        _simStart = SimHostNs();                                    \
+        _call;                                                      \
+        SimAccount((_id), SimHostNs() - _simStart, _simLocks);      \
+        SimLockLeave(_simLock);                                     \
+    } while (0)
+
+ULONGLONG SimRandom(VOID)
+{
+    // xorshift64*
+    Sim.Rng ^= Sim.Rng >> 12;
+    Sim.Rng ^= Sim.Rng << 25;
+    Sim.Rng ^= Sim.Rng >> 27;
+    return Sim.Rng * 0x2545F4914F6CDD1DULL;
+}
+
+ULONGLONG SimNow(VOID)
+{
+    return Sim.Now;
+}
+
+ULONG SimErrors(VOID)
+{
+    return Sim.Errors;
+}
+
+/*
+Function:
+    SimCheck
+    
+
+Routine Description:
+
+    Validates a handle passed in by the driver.
+    ֤ľ
+
+Arguments:
+
+    object - Handle to check.
+             Ҫľ
+    type - Expected object type.
+           ԤڵĶ
+    caller - Name of the framework function, for the error message.
+             ܺƣڴϢ
+
+Return Value:
+
+    BOOLEAN - TRUE if the handle is valid.
+              ЧΪTRUE
+*/
+static BOOLEAN SimCheck(PSIM_OBJECT object, SIM_OBJECT_TYPE type, PCSTR caller)
+{
+    if (object == NULL || object->Magic != SIM_OBJECT_MAGIC) {
+        SimFail("%s: invalid or deleted handle %p", caller, (PVOID)object);
+        return FALSE;
+    }
+    if (object->Type != type) {
+        SimFail("%s: handle %p is a %s, expected a %s", caller, (PVOID)object,
+                SimObjectTypeNames[object->Type], SimObjectTypeNames[type]);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static BOOLEAN SimCheckOwned(PSIM_OBJECT request, PCSTR caller)
+{
+    if (!SimCheck(request, SimObjectRequest, caller)) {
+        return FALSE;
+    }
+    if (request->State == SimRequestCompleted) {
+        SimFail("%s: request %u used after completion", caller, request->Id);
+        return FALSE;
+    }
+    if (request->State == SimRequestQueued) {
+        SimFail("%s: request %u is not owned by the driver", caller, request->Id);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+//
+// Objects
+// 
+//
+static PSIM_OBJECT SimObjectCreate(
+    SIM_OBJECT_TYPE        type,
+    PWDF_OBJECT_ATTRIBUTES attributes,
+    PSIM_OBJECT            defaultParent
+)
+{
+    PSIM_OBJECT object = (PSIM_OBJECT)calloc(1, sizeof(SIM_OBJECT));
+    PSIM_OBJECT parent = defaultParent;
+    size_t contextSize;
+
+    if (object == NULL) {
+        return NULL;
+    }
+    object->Magic = SIM_OBJECT_MAGIC;
+    object->Type = type;
+
+    if (attributes != NULL) {
+        if (attributes->ParentObject != NULL) {
+            parent = (PSIM_OBJECT)attributes->ParentObject;
+        }
+        object->EvtCleanup = attributes->EvtCleanupCallback;
+        object->EvtDestroy = attributes->EvtDestroyCallback;
+        if (attributes->ContextTypeInfo != NULL) {
+            contextSize = max(attributes->ContextTypeInfo->ContextSize,
+                              attributes->ContextSizeOverride);
+            object->ContextType = attributes->ContextTypeInfo;
+            object->Context = calloc(1, contextSize);
+        }
+    }
+
+    if (parent != NULL) {
+        object->Parent = parent;
+        object->Sibling = parent->Children;
+        parent->Children = object;
+    }
+    return object;
+}
+
+static VOID SimObjectFree(PSIM_OBJECT object)
+{
+    PSIM_OBJECT* link;
+    ULONG i;
+
+    while (object->Children != NULL) {
+        SimObjectFree(object->Children);
+    }
+
+    if (object->EvtCleanup != NULL) {
+        SIM_CALLBACK(SimCbCleanup, NULL, object->EvtCleanup(object));
+    }
+    if (object->EvtDestroy != NULL) {
+        SIM_CALLBACK(SimCbDestroy, NULL, object->EvtDestroy(object));
+    }
+
+    if (object->Parent != NULL) {
+        for (link = &object->Parent->Children; *link != NULL; link = &(*link)->Sibling) {
+            if (*link == object) {
+                *link = object->Sibling;
+                break;
+            }
+        }
+    }
+
+    switch (object->Type) {
+    case SimObjectQueue:
+        for (i = 0; i < Sim.QueueCount; i++) {
+            if (Sim.Queues[i] == object) {
+                Sim.Queues[i] = Sim.Queues[--Sim.QueueCount];
+                break;
+            }
+        }
+        for (i = 0; i < WdfRequestTypeMax; i++) {
+            if (Sim.Dispatch[i] == object) {
+                Sim.Dispatch[i] = NULL;
+            }
+        }
+        if (Sim.DefaultQueue == object) {
+            Sim.DefaultQueue = NULL;
+        }
+        break;
+    case SimObjectTimer:
+        for (i = 0; i < Sim.TimerCount; i++) {
+            if (Sim.Timers[i] == object) {
+                Sim.Timers[i] = Sim.Timers[--Sim.TimerCount];
+                break;
+            }
+        }
+        break;
+    case SimObjectMemory:
+        if (!object->External) {
+            free(object->MemoryBuffer);
+        }
+        break;
+    case SimObjectRequest:
+        free(object->SystemBuffer);
+        break;
+    default:
+        break;
+    }
+
+    free(object->Context);
+    object->Magic = 0;
+    free(object);
+}
+
+PVOID SimObjectGetTypedContext(WDFOBJECT handle, PCWDF_OBJECT_CONTEXT_TYPE_INFO typeInfo)
+{
+    PSIM_OBJECT object = (PSIM_OBJECT)handle;
+
+    if (object == NULL || object->Magic != SIM_OBJECT_MAGIC) {
+        SimFail("context %s requested from an invalid handle %p",
+                typeInfo->ContextName, handle);
+        abort();
+    }
+    if (object->ContextType == NULL ||
+        strcmp(object->ContextType->ContextName, typeInfo->ContextName) != 0) {
+        SimFail("%s has no %s context", SimObjectTypeNames[object->Type],
+                typeInfo->ContextName);
+        abort();
+    }
+    return object->Context;
+}
+
+VOID WdfObjectDelete(WDFOBJECT handle)
+{
+    PSIM_OBJECT object = (PSIM_OBJECT)handle;
+
+    if (object == NULL || object->Magic != SIM_OBJECT_MAGIC) {
+        SimFail("WdfObjectDelete: invalid or deleted handle %p", handle);
+        return;
+    }
+    if (object->Type == SimObjectRequest || object->Type == SimObjectDevice ||
+        object->Type == SimObjectDriver || object->Type == SimObjectFile) {
+        SimFail("WdfObjectDelete: a %s cannot be deleted by the driver",
+                SimObjectTypeNames[object->Type]);
+        return;
+    }
+    if (object->Type == SimObjectMemory && object->External) {
+        SimFail("WdfObjectDelete: request memory cannot be deleted by the driver");
+        return;
+    }
+    SimObjectFree(object);
+}
+
+VOID WdfObjectAcquireLock(WDFOBJECT handle)
+{
+    PSIM_OBJECT object = (PSIM_OBJECT)handle;
+
+    if (object == NULL || object->Magic != SIM_OBJECT_MAGIC ||
+        (object->Type != SimObjectQueue && object->Type != SimObjectDevice)) {
+        SimFail("WdfObjectAcquireLock: invalid handle %p", handle);
+        return;
+    }
+    if (object->SyncLock != object) {
+        SimFail("WdfObjectAcquireLock: %s has no synchronization scope of its own",
+                SimObjectTypeNames[object->Type]);
+    }
+    if (object->LockDepth != 0) {
+        SimFail("WdfObjectAcquireLock: deadlock, the caller already holds the %s lock",
+                SimObjectTypeNames[object->Type]);
+    }
+    object->LockDepth++;
+    Sim.LocksHeld++;
+}
+
+VOID WdfObjectReleaseLock(WDFOBJECT handle)
+{
+    PSIM_OBJECT object = (PSIM_OBJECT)handle;
+
+    if (object == NULL || object->Magic != SIM_OBJECT_MAGIC || object->LockDepth == 0) {
+        SimFail("WdfObjectReleaseLock: lock %p is not held", handle);
+        return;
+    }
+    object->LockDepth--;
+    Sim.LocksHeld--;
+}
+
+VOID WdfVerifierDbgBreakPoint(VOID)
+{
+    SimFail("WdfVerifierDbgBreakPoint");
+}
+
+//
+// System services
+// ϵͳ
+//
+VOID GetSystemInfo(LPSYSTEM_INFO systemInfo)
+{
+    systemInfo->dwNumberOfProcessors = Sim.Config.Processors;
+    systemInfo->dwPageSize = 4096;
+}
+
+BOOL QueryPerformanceCounter(PLARGE_INTEGER performanceCount)
+{
+    performanceCount->QuadPart = (LONGLONG)(Sim.Now / (1000000000ULL / SIM_PERF_FREQUENCY));
+    return TRUE;
+}
+
+BOOL QueryPerformanceFrequency(PLARGE_INTEGER frequency)
+{
+    frequency->QuadPart = SIM_PERF_FREQUENCY;
+    return TRUE;
+}
+
+HANDLE GetCurrentProcess(VOID)
+{
+    return (HANDLE)(LONG_PTR)-1;
+}
+
+//
+// timevalΪ100ΪλFILETIME
+//
+static VOID SimFileTime(const struct timeval* time, LPFILETIME fileTime)
+{
+    ULONGLONG units = (ULONGLONG)time->tv_sec * 10000000ULL + (ULONGLONG)time->tv_usec * 10;
+
+    fileTime->dwLowDateTime = (DWORD)units;
+    fileTime->dwHighDateTime = (DWORD)(units >> 32);
+}
+
+BOOL GetProcessTimes(HANDLE process, LPFILETIME creationTime, LPFILETIME exitTime,
+                     LPFILETIME kernelTime, LPFILETIME userTime)
+{
+    struct rusage usage;
+
+    UNREFERENCED_PARAMETER(process);
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return FALSE;
+    }
+
+    memset(creationTime, 0, sizeof(*creationTime));
+    memset(exitTime, 0, sizeof(*exitTime));
+    SimFileTime(&usage.ru_stime, kernelTime);
+    SimFileTime(&usage.ru_utime, userTime);
+
+    return TRUE;
+}
+
+BOOL QueryProcessCycleTime(HANDLE process, PULONG64 cycleTime)
+{
+    UNREFERENCED_PARAMETER(process);
+
+    *cycleTime = 0;
+
+    return FALSE;
+}
+
+VOID OutputDebugStringA(PCSTR outputString)
+{
+    if (Sim.Config.Verbose) {
+        printf("%12.3f ms  %s", (double)Sim.Now / 1e6, outputString);
+    }
+}
+
+VOID DebugBreak(VOID)
+{
+    SimFail("DebugBreak");
+}
+
+//
+// Client events, a binary heap ordered by time then submission order
+// ͻ¼ʱٰύ˳еĶ
+//
+static BOOLEAN SimEventBefore(PSIM_EVENT a, PSIM_EVENT b)
+{
+    return a->Time < b->Time || (a->Time == b->Time && a->Sequence < b->Sequence);
+}
+
+static VOID SimEventPush(ULONGLONG time, SIM_ROUTINE* routine, PVOID context,
+                         NTSTATUS status, ULONG_PTR information)
+{
+    SIM_EVENT event;
+    ULONG i;
+
+    if (Sim.EventCount == Sim.EventCapacity) {
+        Sim.EventCapacity = Sim.EventCapacity ? Sim.EventCapacity * 2 : 256;
+        Sim.Events = (PSIM_EVENT)realloc(Sim.Events, Sim.EventCapacity * sizeof(SIM_EVENT));
+        if (Sim.Events == NULL) {
+            fprintf(stderr, "echosim: out of memory\n");
+            exit(2);
+        }
+    }
+    event.Time = time;
+    event.Sequence = Sim.Sequence++;
+    event.Routine = routine;
+    event.Context = context;
+    event.Status = status;
+    event.Information = information;
+
+    i = Sim.EventCount++;
+    while (i > 0 && SimEventBefore(&event, &Sim.Events[(i - 1) / 2])) {
+        Sim.Events[i] = Sim.Events[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    Sim.Events[i] = event;
+}
+
+static SIM_EVENT SimEventPop(VOID)
+{
+    SIM_EVENT top = Sim.Events[0];
+    SIM_EVENT last = Sim.Events[--Sim.EventCount];
+    ULONG i = 0;
+    ULONG child;
+
+    for (;;) {
+        child = i * 2 + 1;
+        if (child >= Sim.EventCount) {
+            break;
+        }
+        if (child + 1 < Sim.EventCount &&
+            SimEventBefore(&Sim.Events[child + 1], &Sim.Events[child])) {
+            child++;
+        }
+        if (!SimEventBefore(&Sim.Events[child], &last)) {
+            break;
+        }
+        Sim.Events[i] = Sim.Events[child];
+        i = child;
+    }
+    if (Sim.EventCount != 0) {
+        Sim.Events[i] = last;
+    }
+    return top;
+}
+
+VOID SimSchedule(ULONGLONG delayNs, SIM_ROUTINE* routine, PVOID context)
+{
+    SimEventPush(Sim.Now + delayNs, routine, context, STATUS_SUCCESS, 0);
+}
+
+//
+// Requests
+// 
+//
+static PSIM_OBJECT SimRequestCreate(WDF_REQUEST_TYPE type, PSIM_OBJECT file)
+{
+    PSIM_OBJECT request;
+
+    request = SimObjectCreate(SimObjectRequest,
+                              Sim.Init.HasRequestAttributes ? &Sim.Init.RequestAttributes : NULL,
+                              NULL);
+    if (request == NULL) {
+        return NULL;
+    }
+    request->Id = ++Sim.NextRequestId;
+    request->RequestType = type;
+    request->File = file;
+    request->State = SimRequestArrived;
+    request->Status = STATUS_PENDING;
+
+    request->LiveNext = Sim.Live;
+    if (Sim.Live != NULL) {
+        Sim.Live->LivePrev = request;
+    }
+    Sim.Live = request;
+    Sim.LiveCount++;
+    return request;
+}
+
+static PSIM_OBJECT SimRequestFind(ULONG id)
+{
+    PSIM_OBJECT request;
+
+    for (request = Sim.Live; request != NULL; request = request->LiveNext) {
+        if (request->Id == id) {
+            return request;
+        }
+    }
+    return NULL;
+}
+
+//
+// Completed requests stay allocated for a while so that a late use of
+// the handle is reported instead of touching freed memory
+// ɵᱣһʱ䣬Ա㱨ԾӳʹãǷͷŵڴ
+//
+static VOID SimRequestRetire(PSIM_OBJECT request)
+{
+    if (request->LivePrev != NULL) {
+        request->LivePrev->LiveNext = request->LiveNext;
+    }
+    else {
+        Sim.Live = request->LiveNext;
+    }
+    if (request->LiveNext != NULL) {
+        request->LiveNext->LivePrev = request->LivePrev;
+    }
+    request->LiveNext = request->LivePrev = NULL;
+    Sim.LiveCount--;
+
+    if (Sim.Zombies[Sim.ZombieNext] != NULL) {
+        SimObjectFree(Sim.Zombies[Sim.ZombieNext]);
+    }
+    Sim.Zombies[Sim.ZombieNext] = request;
+    Sim.ZombieNext = (Sim.ZombieNext + 1) % SIM_ZOMBIE_RING;
+}
+
+static VOID SimQueueUnlink(PSIM_OBJECT queue, PSIM_OBJECT request)
+{
+    PSIM_OBJECT previous = NULL;
+    PSIM_OBJECT current;
+
+    for (current = queue->Head; current != NULL; previous = current, current = current->Next) {
+        if (current == request) {
+            if (previous != NULL) {
+                previous->Next = current->Next;
+            }
+            else {
+                queue->Head = current->Next;
+            }
+            if (queue->Tail == current) {
+                queue->Tail = previous;
+            }
+            queue->Queued--;
+            break;
+        }
+    }
+    request->Next = NULL;
+}
+
+static VOID SimQueueReleasePresented(PSIM_OBJECT queue)
+{
+    queue->Presented--;
+    if (queue->Presented == 0 && queue->StopComplete != NULL) {
+        PFN_WDF_IO_QUEUE_STATE stopComplete = queue->StopComplete;
+        queue->StopComplete = NULL;
+        SIM_CALLBACK(SimCbQueueState, NULL, stopComplete(queue, queue->StopContext));
+    }
+}
+
+static VOID SimRequestComplete(PSIM_OBJECT request, NTSTATUS status, ULONG_PTR information)
+{
+    if (request->Cancelable) {
+        SimFail("request %u completed while still cancelable", request->Id);
+        request->Cancelable = FALSE;
+    }
+    if (request->CancelPending && !request->InCancel) {
+        SimFail("request %u completed although its cancel routine is pending", request->Id);
+    }
+    request->CancelPending = FALSE;
+
+    if (request->RequestType == WdfRequestTypeRead && information > request->Length) {
+        SimFail("request %u: information %lu exceeds read length %lu", request->Id,
+                (unsigned long)information, (unsigned long)request->Length);
+    }
+    if (request->RequestType == WdfRequestTypeDeviceIoControl) {
+        if (information > request->OutputLength) {
+            SimFail("request %u: information %lu exceeds output length %lu", request->Id,
+                    (unsigned long)information, (unsigned long)request->OutputLength);
+            information = request->OutputLength;
+        }
+        if (request->OutputBuffer != NULL && information != 0) {
+            memcpy(request->OutputBuffer, request->SystemBuffer, information);
+        }
+    }
+
+    if (request->State == SimRequestQueued) {
+        SimQueueUnlink(request->Queue, request);
+    }
+    request->State = SimRequestCompleted;
+    request->Status = status;
+    request->Information = information;
+
+    if (request->Completion != NULL) {
+        SimEventPush(Sim.Now, request->Completion, request->CompletionContext,
+                     status, information);
+    }
+    SimRequestRetire(request);
+}
+
+/*
+Function:
+    SimQueueInsert
+    
+
+Routine Description:
+
+    Adds a request to a queue the way the framework does: zero-length
+    reads and writes are completed right away unless the queue accepts
+    them, and a request whose cancellation was already requested is
+    cancelled instead of being queued.
+    ܵķʽУǶнܣ㳤ȵĶдɣ
+    ȡᱻȡŶӡ
+
+Arguments:
+
+    queue - Destination queue.
+            Ŀ
+    request - Request to add.
+              Ҫӵ
+    atHead - TRUE to requeue in front of the waiting requests.
+             ΪTRUEʱڵȴǰ
+
+Return Value:
+
+    VOID
+*/
+static VOID SimQueueInsert(PSIM_OBJECT queue, PSIM_OBJECT request, BOOLEAN atHead)
+{
+    request->Queue = queue;
+
+    if ((request->RequestType == WdfRequestTypeRead ||
+         request->RequestType == WdfRequestTypeWrite) &&
+        request->Length == 0 && !queue->QueueConfig.AllowZeroLengthRequests) {
+        SimRequestComplete(request, STATUS_SUCCESS, 0);
+        return;
+    }
+    if (request->CancelRequested) {
+        SimRequestComplete(request, STATUS_CANCELLED, 0);
+        return;
+    }
+
+    request->State = SimRequestQueued;
+    if (atHead) {
+        request->Next = queue->Head;
+        queue->Head = request;
+        if (queue->Tail == NULL) {
+            queue->Tail = request;
+        }
+    }
+    else {
+        request->Next = NULL;
+        if (queue->Tail != NULL) {
+            queue->Tail->Next = request;
+        }
+        else {
+            queue->Head = request;
+        }
+        queue->Tail = request;
+    }
+    queue->Queued++;
+}
+
+static BOOLEAN SimQueueCanDispatch(PSIM_OBJECT queue)
+{
+    return queue->Head != NULL &&
+           !queue->DriverStopped &&
+           (Sim.Powered || !queue->PowerManaged) &&
+           queue->Presented < queue->PresentLimit;
+}
+
+static VOID SimQueueDispatch(PSIM_OBJECT queue)
+{
+    PSIM_OBJECT request = queue->Head;
+    PWDF_IO_QUEUE_CONFIG config = &queue->QueueConfig;
+
+    queue->Head = request->Next;
+    if (queue->Head == NULL) {
+        queue->Tail = NULL;
+    }
+    request->Next = NULL;
+    queue->Queued--;
+    request->State = SimRequestPresented;
+    queue->Presented++;
+
+    switch (request->RequestType) {
+    case WdfRequestTypeRead:
+        if (config->EvtIoRead != NULL) {
+            SIM_CALLBACK(SimCbIoRead, queue->SyncLock,
+                         config->EvtIoRead(queue, request, request->Length));
+            return;
+        }
+        break;
+    case WdfRequestTypeWrite:
+        if (config->EvtIoWrite != NULL) {
+            SIM_CALLBACK(SimCbIoWrite, queue->SyncLock,
+                         config->EvtIoWrite(queue, request, request->Length));
+            return;
+        }
+        break;
+    case WdfRequestTypeDeviceIoControl:
+        if (config->EvtIoDeviceControl != NULL) {
+            SIM_CALLBACK(SimCbIoDeviceControl, queue->SyncLock,
+                         config->EvtIoDeviceControl(queue, request, request->OutputLength,
+                                                    request->InputLength,
+                                                    request->IoControlCode));
+            return;
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (config->EvtIoDefault != NULL) {
+        SIM_CALLBACK(SimCbIoDefault, queue->SyncLock, config->EvtIoDefault(queue, request));
+        return;
+    }
+    SimRequestComplete(request, STATUS_INVALID_DEVICE_REQUEST, 0);
+    SimQueueReleasePresented(queue);
+}
+
+static VOID SimRunCancel(PSIM_OBJECT request)
+{
+    PFN_WDF_REQUEST_CANCEL routine = request->CancelRoutine;
+
+    request->CancelPending = FALSE;
+    request->Cancelable = FALSE;
+    request->InCancel = TRUE;
+    SIM_CALLBACK(SimCbRequestCancel, request->Queue ? request->Queue->SyncLock : NULL,
+                 routine(request));
+    request->InCancel = FALSE;
+}
+
+static VOID SimRunTimer(PSIM_OBJECT timer)
+{
+    timer->Armed = FALSE;
+    timer->InCallback = TRUE;
+    Sim.RunningTimer = timer;
+    SIM_CALLBACK(SimCbTimer,
+                 timer->TimerConfig.AutomaticSerialization ? timer->SyncLock : NULL,
+                 timer->TimerConfig.EvtTimerFunc(timer));
+    Sim.RunningTimer = NULL;
+    timer->InCallback = FALSE;
+    if (timer->TimerConfig.Period != 0 && !timer->Armed && timer->Magic == SIM_OBJECT_MAGIC) {
+        timer->Armed = TRUE;
+        timer->Due = Sim.Now + (ULONGLONG)timer->TimerConfig.Period * 1000000ULL;
+    }
+}
+
+VOID WdfRequestComplete(WDFREQUEST request, NTSTATUS status)
+{
+    if (!SimCheckOwned(request, "WdfRequestComplete")) {
+        return;
+    }
+    WdfRequestCompleteWithInformation(request, status, request->Information);
+}
+
+VOID WdfRequestCompleteWithInformation(WDFREQUEST request, NTSTATUS status, ULONG_PTR information)
+{
+    PSIM_OBJECT queue;
+    BOOLEAN presented;
+
+    if (!SimCheckOwned(request, "WdfRequestCompleteWithInformation")) {
+        return;
+    }
+    queue = request->Queue;
+    presented = (request->State == SimRequestPresented && queue != NULL);
+    if (Sim.RunningTimer != NULL && !Sim.Powered && request->StopAcked) {
+        SimFail("request %u completed by a timer tick while the device is suspended", request->Id);
+    }
+    SimRequestComplete(request, status, information);
+    if (presented) {
+        SimQueueReleasePresented(queue);
+    }
+}
+
+VOID WdfRequestSetInformation(WDFREQUEST request, ULONG_PTR information)
+{
+    if (SimCheckOwned(request, "WdfRequestSetInformation")) {
+        request->Information = information;
+    }
+}
+
+ULONG_PTR WdfRequestGetInformation(WDFREQUEST request)
+{
+    if (!SimCheckOwned(request, "WdfRequestGetInformation")) {
+        return 0;
+    }
+    return request->Information;
+}
+
+VOID WdfRequestGetParameters(WDFREQUEST request, PWDF_REQUEST_PARAMETERS parameters)
+{
+    if (!SimCheckOwned(request, "WdfRequestGetParameters")) {
+        return;
+    }
+    parameters->Type = request->RequestType;
+    switch (request->RequestType) {
+    case WdfRequestTypeRead:
+        parameters->Parameters.Read.Length = request->Length;
+        break;
+    case WdfRequestTypeWrite:
+        parameters->Parameters.Write.Length = request->Length;
+        break;
+    case WdfRequestTypeDeviceIoControl:
+        parameters->Parameters.DeviceIoControl.OutputBufferLength = request->OutputLength;
+        parameters->Parameters.DeviceIoControl.InputBufferLength = request->InputLength;
+        parameters->Parameters.DeviceIoControl.IoControlCode = request->IoControlCode;
+        break;
+    default:
+        break;
+    }
+}
+
+WDFQUEUE WdfRequestGetIoQueue(WDFREQUEST request)
+{
+    if (!SimCheckOwned(request, "WdfRequestGetIoQueue")) {
+        return NULL;
+    }
+    return request->Queue;
+}
+
+WDFFILEOBJECT WdfRequestGetFileObject(WDFREQUEST request)
+{
+    if (!SimCheckOwned(request, "WdfRequestGetFileObject")) {
+        return NULL;
+    }
+    return request->File;
+}
+
+/*
+Function:
+    SimRequestBuffer
+    ȡ󻺳
+
+Routine Description:
+
+    Returns the input or output buffer of a request. Device control
+    requests share one system buffer for both directions, as
+    METHOD_BUFFERED does.
+    豸һϵͳ
+    METHOD_BUFFEREDͬ
+
+Arguments:
+
+    request - Request owned by the driver.
+              ӵе
+    output - TRUE for the output buffer.
+             ΪTRUEʱ
+    buffer - Receives the buffer.
+             ջ
+    length - Receives its length.
+             䳤
+
+Return Value:
+
+    NTSTATUS
+*/
+static NTSTATUS SimRequestBuffer(PSIM_OBJECT request, BOOLEAN output, PVOID* buffer, size_t* length)
+{
+    switch (request->RequestType) {
+    case WdfRequestTypeRead:
+        if (!output) {
+            return STATUS_INVALID_DEVICE_REQUEST;
+        }
+        *buffer = request->Buffer;
+        *length = request->Length;
+        break;
+    case WdfRequestTypeWrite:
+        if (output) {
+            return STATUS_INVALID_DEVICE_REQUEST;
+        }
+        *buffer = request->Buffer;
+        *length = request->Length;
+        break;
+    case WdfRequestTypeDeviceIoControl:
+        *buffer = request->SystemBuffer;
+        *length = output ? request->OutputLength : request->InputLength;
+        break;
+    default:
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    if (*length == 0) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS SimRequestMemory(PSIM_OBJECT request, BOOLEAN output, WDFMEMORY* memory, PCSTR caller)
+{
+    PSIM_OBJECT* cached = output ? &request->OutputMemory : &request->InputMemory;
+    PVOID buffer;
+    size_t length;
+    NTSTATUS status;
+
+    if (!SimCheckOwned(request, caller)) {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    status = SimRequestBuffer(request, output, &buffer, &length);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+    if (*cached == NULL) {
+        *cached = SimObjectCreate(SimObjectMemory, NULL, request);
+        if (*cached == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        (*cached)->MemoryBuffer = buffer;
+        (*cached)->MemorySize = length;
+        (*cached)->External = TRUE;
+    }
+    *memory = *cached;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRequestRetrieveInputMemory(WDFREQUEST request, WDFMEMORY* memory)
+{
+    return SimRequestMemory(request, FALSE, memory, "WdfRequestRetrieveInputMemory");
+}
+
+NTSTATUS WdfRequestRetrieveOutputMemory(WDFREQUEST request, WDFMEMORY* memory)
+{
+    return SimRequestMemory(request, TRUE, memory, "WdfRequestRetrieveOutputMemory");
+}
+
+static NTSTATUS SimRetrieveBuffer(PSIM_OBJECT request, BOOLEAN output, size_t minimum,
+                                  PVOID* buffer, size_t* length, PCSTR caller)
+{
+    PVOID data;
+    size_t size;
+    NTSTATUS status;
+
+    if (!SimCheckOwned(request, caller)) {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    status = SimRequestBuffer(request, output, &data, &size);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+    if (size < minimum) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+    *buffer = data;
+    if (length != NULL) {
+        *length = size;
+    }
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRequestRetrieveInputBuffer(WDFREQUEST request, size_t minimumRequiredLength,
+                                       PVOID* buffer, size_t* length)
+{
+    return SimRetrieveBuffer(request, FALSE, minimumRequiredLength, buffer, length,
+                             "WdfRequestRetrieveInputBuffer");
+}
+
+NTSTATUS WdfRequestRetrieveOutputBuffer(WDFREQUEST request, size_t minimumRequiredSize,
+                                        PVOID* buffer, size_t* length)
+{
+    return SimRetrieveBuffer(request, TRUE, minimumRequiredSize, buffer, length,
+                             "WdfRequestRetrieveOutputBuffer");
+}
+
+VOID WdfRequestMarkCancelable(WDFREQUEST request, PFN_WDF_REQUEST_CANCEL evtRequestCancel)
+{
+    if (!SimCheckOwned(request, "WdfRequestMarkCancelable")) {
+        return;
+    }
+    if (request->Cancelable) {
+        SimFail("WdfRequestMarkCancelable: request %u is already cancelable", request->Id);
+        return;
+    }
+    request->CancelRoutine = evtRequestCancel;
+    request->Cancelable = TRUE;
+
+    //
+    // An already cancelled request runs its cancel routine before
+    // WdfRequestMarkCancelable returns, under the caller's lock
+    // ȡWdfRequestMarkCancelable֮ǰڵߵȡ
+    //
+    if (request->CancelRequested) {
+        SimRunCancel(request);
+    }
+}
+
+NTSTATUS WdfRequestUnmarkCancelable(WDFREQUEST request)
+{
+    if (!SimCheckOwned(request, "WdfRequestUnmarkCancelable")) {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    if (!request->Cancelable) {
+        SimFail("WdfRequestUnmarkCancelable: request %u is not cancelable", request->Id);
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    request->Cancelable = FALSE;
+    if (request->CancelPending) {
+        return STATUS_CANCELLED;
+    }
+    return STATUS_SUCCESS;
+}
+
+VOID WdfRequestStopAcknowledge(WDFREQUEST request, BOOLEAN requeue)
+{
+    PSIM_OBJECT queue;
+
+    if (!SimCheckOwned(request, "WdfRequestStopAcknowledge")) {
+        return;
+    }
+    request->StopAcked = TRUE;
+    if (!requeue) {
+        return;
+    }
+    if (request->Cancelable) {
+        SimFail("WdfRequestStopAcknowledge: request %u requeued while cancelable", request->Id);
+        request->Cancelable = FALSE;
+    }
+    queue = request->Queue;
+    SimQueueInsert(queue, request, TRUE);
+    SimQueueReleasePresented(queue);
+}
+
+NTSTATUS WdfRequestForwardToIoQueue(WDFREQUEST request, WDFQUEUE destinationQueue)
+{
+    PSIM_OBJECT source;
+
+    if (!SimCheckOwned(request, "WdfRequestForwardToIoQueue") ||
+        !SimCheck(destinationQueue, SimObjectQueue, "WdfRequestForwardToIoQueue")) {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    source = request->Queue;
+    if (source == NULL || request->State != SimRequestPresented) {
+        SimFail("WdfRequestForwardToIoQueue: request %u was not presented by a queue",
+                request->Id);
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    if (source == destinationQueue) {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    if (request->Cancelable) {
+        SimFail("WdfRequestForwardToIoQueue: request %u is still cancelable", request->Id);
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    SimQueueInsert(destinationQueue, request, FALSE);
+    SimQueueReleasePresented(source);
+    return STATUS_SUCCESS;
+}
+
+//
+// Memory
+// ڴ
+//
+NTSTATUS WdfMemoryCreate(PWDF_OBJECT_ATTRIBUTES attributes, POOL_TYPE poolType, ULONG poolTag,
+                         size_t bufferSize, WDFMEMORY* memory, PVOID* buffer)
+{
+    PSIM_OBJECT object;
+
+    UNREFERENCED_PARAMETER(poolType);
+
+    if (bufferSize == 0 || poolTag == 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    object = SimObjectCreate(SimObjectMemory, attributes, Sim.Driver);
+    if (object == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    object->MemoryBuffer = malloc(bufferSize);
+    if (object->MemoryBuffer == NULL) {
+        SimObjectFree(object);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    // Uninitialized pool is not zero
+    memset(object->MemoryBuffer, SIM_FILL_PATTERN, bufferSize);
+    object->MemorySize = bufferSize;
+    object->PoolTag = poolTag;
+
+    *memory = object;
+    if (buffer != NULL) {
+        *buffer = object->MemoryBuffer;
+    }
+    return STATUS_SUCCESS;
+}
+
+PVOID WdfMemoryGetBuffer(WDFMEMORY memory, size_t* bufferSize)
+{
+    if (!SimCheck(memory, SimObjectMemory, "WdfMemoryGetBuffer")) {
+        return NULL;
+    }
+    if (bufferSize != NULL) {
+        *bufferSize = memory->MemorySize;
+    }
+    return memory->MemoryBuffer;
+}
+
+NTSTATUS WdfMemoryCopyFromBuffer(WDFMEMORY destinationMemory, size_t destinationOffset,
+                                 PVOID buffer, size_t numBytesToCopyFrom)
+{
+    if (!SimCheck(destinationMemory, SimObjectMemory, "WdfMemoryCopyFromBuffer")) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (destinationOffset + numBytesToCopyFrom > destinationMemory->MemorySize) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+    memcpy((PUCHAR)destinationMemory->MemoryBuffer + destinationOffset, buffer, numBytesToCopyFrom);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfMemoryCopyToBuffer(WDFMEMORY sourceMemory, size_t sourceOffset,
+                               PVOID buffer, size_t numBytesToCopyTo)
+{
+    if (!SimCheck(sourceMemory, SimObjectMemory, "WdfMemoryCopyToBuffer")) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (sourceOffset + numBytesToCopyTo > sourceMemory->MemorySize) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+    memcpy(buffer, (PUCHAR)sourceMemory->MemoryBuffer + sourceOffset, numBytesToCopyTo);
+    return STATUS_SUCCESS;
+}
+
+//
+// Queues
+// 
+//
+NTSTATUS WdfIoQueueCreate(WDFDEVICE device, PWDF_IO_QUEUE_CONFIG config,
+                          PWDF_OBJECT_ATTRIBUTES queueAttributes, WDFQUEUE* queue)
+{
+    PSIM_OBJECT object;
+    WDF_SYNCHRONIZATION_SCOPE scope = WdfSynchronizationScopeInheritFromParent;
+
+    if (!SimCheck(device, SimObjectDevice, "WdfIoQueueCreate")) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (config->DefaultQueue && Sim.DefaultQueue != NULL) {
+        SimFail("WdfIoQueueCreate: the device already has a default queue");
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+    if (config->DispatchType == WdfIoQueueDispatchInvalid ||
+        config->DispatchType >= WdfIoQueueDispatchMax) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (Sim.QueueCount == SIM_MAX_QUEUES) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    object = SimObjectCreate(SimObjectQueue, queueAttributes, device);
+    if (object == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    if (object->Parent != device) {
+        SimFail("WdfIoQueueCreate: a queue must be parented to its device");
+    }
+    object->QueueConfig = *config;
+    object->PowerManaged = (config->PowerManaged != WdfFalse);
+    switch (config->DispatchType) {
+    case WdfIoQueueDispatchSequential:
+        object->PresentLimit = 1;
+        break;
+    case WdfIoQueueDispatchParallel:
+        object->PresentLimit = config->Settings.Parallel.NumberOfPresentedRequests;
+        if (object->PresentLimit == 0) {
+            object->PresentLimit = (ULONG)-1;
+        }
+        break;
+    default:
+        object->PresentLimit = 0;
+        break;
+    }
+
+    if (queueAttributes != NULL) {
+        scope = queueAttributes->SynchronizationScope;
+    }
+    switch (scope) {
+    case WdfSynchronizationScopeQueue:
+        object->SyncLock = object;
+        break;
+    case WdfSynchronizationScopeNone:
+        object->SyncLock = NULL;
+        break;
+    default:
+        object->SyncLock = device->SyncLock;
+        break;
+    }
+
+    Sim.Queues[Sim.QueueCount++] = object;
+    if (config->DefaultQueue) {
+        Sim.DefaultQueue = object;
+    }
+    *queue = object;
+    return STATUS_SUCCESS;
+}
+
+WDFDEVICE WdfIoQueueGetDevice(WDFQUEUE queue)
+{
+    if (!SimCheck(queue, SimObjectQueue, "WdfIoQueueGetDevice")) {
+        return NULL;
+    }
+    return queue->Parent;
+}
+
+VOID WdfIoQueueStart(WDFQUEUE queue)
+{
+    if (SimCheck(queue, SimObjectQueue, "WdfIoQueueStart")) {
+        queue->DriverStopped = FALSE;
+    }
+}
+
+VOID WdfIoQueueStop(WDFQUEUE queue, PFN_WDF_IO_QUEUE_STATE stopComplete, WDFCONTEXT context)
+{
+    if (!SimCheck(queue, SimObjectQueue, "WdfIoQueueStop")) {
+        return;
+    }
+    queue->DriverStopped = TRUE;
+    if (stopComplete == NULL) {
+        return;
+    }
+    if (queue->Presented == 0) {
+        SIM_CALLBACK(SimCbQueueState, NULL, stopComplete(queue, context));
+        return;
+    }
+    queue->StopComplete = stopComplete;
+    queue->StopContext = context;
+}
+
+VOID WdfIoQueueStopSynchronously(WDFQUEUE queue)
+{
+    if (!SimCheck(queue, SimObjectQueue, "WdfIoQueueStopSynchronously")) {
+        return;
+    }
+    queue->DriverStopped = TRUE;
+    if (queue->Presented != 0) {
+        SimFail("WdfIoQueueStopSynchronously: would block on %u request(s) owned by the driver",
+                queue->Presented);
+    }
+}
+
+//
+// Timers
+// ʱ
+//
+NTSTATUS WdfTimerCreate(PWDF_TIMER_CONFIG config, PWDF_OBJECT_ATTRIBUTES attributes, WDFTIMER* timer)
+{
+    PSIM_OBJECT object;
+    PSIM_OBJECT parent;
+
+    if (attributes == NULL || attributes->ParentObject == NULL) {
+        SimFail("WdfTimerCreate: a timer needs a parent object");
+        return STATUS_INVALID_PARAMETER;
+    }
+    parent = (PSIM_OBJECT)attributes->ParentObject;
+    if (parent->Type != SimObjectQueue && parent->Type != SimObjectDevice) {
+        SimFail("WdfTimerCreate: a timer must be parented to a device or a queue");
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (Sim.TimerCount == SIM_MAX_TIMERS) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    object = SimObjectCreate(SimObjectTimer, attributes, NULL);
+    if (object == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    object->TimerConfig = *config;
+    object->SyncLock = parent->SyncLock;
+    if (config->AutomaticSerialization && object->SyncLock == NULL) {
+        SimFail("WdfTimerCreate: automatic serialization without a parent synchronization scope");
+    }
+    Sim.Timers[Sim.TimerCount++] = object;
+    *timer = object;
+    return STATUS_SUCCESS;
+}
+
+BOOLEAN WdfTimerStart(WDFTIMER timer, LONGLONG dueTime)
+{
+    BOOLEAN wasArmed;
+
+    if (!SimCheck(timer, SimObjectTimer, "WdfTimerStart")) {
+        return FALSE;
+    }
+    if (timer == Sim.RunningTimer && !Sim.Powered &&
+        timer->Parent->Type == SimObjectQueue && timer->Parent->PowerManaged) {
+        SimFail("WdfTimerStart: timer re-armed by its callback while the device is suspended");
+    }
+    wasArmed = timer->Armed;
+    timer->Armed = TRUE;
+    if (dueTime < 0) {
+        timer->Due = Sim.Now + (ULONGLONG)(-dueTime) * 100;
+    }
+    else {
+        timer->Due = max(Sim.Now, (ULONGLONG)dueTime * 100);
+    }
+    return wasArmed;
+}
+
+BOOLEAN WdfTimerStop(WDFTIMER timer, BOOLEAN wait)
+{
+    BOOLEAN wasArmed;
+
+    if (!SimCheck(timer, SimObjectTimer, "WdfTimerStop")) {
+        return FALSE;
+    }
+    if (wait && timer->InCallback) {
+        SimFail("WdfTimerStop: waiting for the timer from its own callback deadlocks");
+    }
+    if (wait && timer->SyncLock != NULL && timer->SyncLock->LockDepth != 0) {
+        SimFail("WdfTimerStop: waiting while holding the timer's synchronization lock deadlocks");
+    }
+
+    //
+    // A tick that is due has already fired and its callback is waiting for
+    // the synchronization lock; stopping without waiting cannot recall it
+    // ѵڵһδѾصڵȴͬȴֹͣ޷
+    //
+    if (!wait && timer->Armed && timer->Due <= Sim.Now && !timer->InCallback) {
+        return FALSE;
+    }
+    wasArmed = timer->Armed;
+    timer->Armed = FALSE;
+    return wasArmed;
+}
+
+WDFOBJECT WdfTimerGetParentObject(WDFTIMER timer)
+{
+    if (!SimCheck(timer, SimObjectTimer, "WdfTimerGetParentObject")) {
+        return NULL;
+    }
+    return timer->Parent;
+}
+
+//
+// Locks
+// 
+//
+NTSTATUS WdfSpinLockCreate(PWDF_OBJECT_ATTRIBUTES spinLockAttributes, WDFSPINLOCK* spinLock)
+{
+    *spinLock = SimObjectCreate(SimObjectSpinLock, spinLockAttributes, Sim.Driver);
+    return (*spinLock != NULL) ? STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
+}
+
+VOID WdfSpinLockAcquire(WDFSPINLOCK spinLock)
+{
+    if (!SimCheck(spinLock, SimObjectSpinLock, "WdfSpinLockAcquire")) {
+        return;
+    }
+    if (spinLock->LockDepth != 0) {
+        SimFail("WdfSpinLockAcquire: deadlock, the spin lock is already held");
+    }
+    spinLock->LockDepth++;
+    Sim.SpinLocksHeld++;
+    Sim.LocksHeld++;
+}
+
+VOID WdfSpinLockRelease(WDFSPINLOCK spinLock)
+{
+    if (!SimCheck(spinLock, SimObjectSpinLock, "WdfSpinLockRelease")) {
+        return;
+    }
+    if (spinLock->LockDepth == 0) {
+        SimFail("WdfSpinLockRelease: the spin lock is not held");
+        return;
+    }
+    spinLock->LockDepth--;
+    Sim.SpinLocksHeld--;
+    Sim.LocksHeld--;
+}
+
+NTSTATUS WdfWaitLockCreate(PWDF_OBJECT_ATTRIBUTES lockAttributes, WDFWAITLOCK* lock)
+{
+    *lock = SimObjectCreate(SimObjectWaitLock, lockAttributes, Sim.Driver);
+    return (*lock != NULL) ? STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
+}
+
+NTSTATUS WdfWaitLockAcquire(WDFWAITLOCK lock, PLONGLONG timeout)
+{
+    if (!SimCheck(lock, SimObjectWaitLock, "WdfWaitLockAcquire")) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (Sim.SpinLocksHeld != 0) {
+        SimFail("WdfWaitLockAcquire: waiting while a spin lock is held");
+    }
+    if (lock->LockDepth != 0) {
+        if (timeout != NULL && *timeout == 0) {
+            return STATUS_TIMEOUT;
+        }
+        SimFail("WdfWaitLockAcquire: deadlock, the wait lock is already held");
+    }
+    lock->LockDepth++;
+    Sim.LocksHeld++;
+    return STATUS_SUCCESS;
+}
+
+VOID WdfWaitLockRelease(WDFWAITLOCK lock)
+{
+    if (!SimCheck(lock, SimObjectWaitLock, "WdfWaitLockRelease")) {
+        return;
+    }
+    if (lock->LockDepth == 0) {
+        SimFail("WdfWaitLockRelease: the wait lock is not held");
+        return;
+    }
+    lock->LockDepth--;
+    Sim.LocksHeld--;
+}
+
+//
+// Registry
+// ע
+//
+VOID SimRegistrySetULong(PCWSTR name, ULONG value)
+{
+    ULONG i;
+
+    for (i = 0; i < Sim.RegistryCount; i++) {
+        if (wcscmp(Sim.Registry[i].Name, name) == 0) {
+            Sim.Registry[i].Value = value;
+            return;
+        }
+    }
+    if (Sim.RegistryCount < SIM_MAX_REGISTRY) {
+        wcsncpy(Sim.Registry[Sim.RegistryCount].Name, name, 63);
+        Sim.Registry[Sim.RegistryCount].Value = value;
+        Sim.RegistryCount++;
+    }
+}
+
+NTSTATUS WdfDeviceOpenRegistryKey(WDFDEVICE device, ULONG deviceInstanceKeyType,
+                                  ACCESS_MASK desiredAccess,
+                                  PWDF_OBJECT_ATTRIBUTES keyAttributes, WDFKEY* key)
+{
+    UNREFERENCED_PARAMETER(desiredAccess);
+
+    if (!SimCheck(device, SimObjectDevice, "WdfDeviceOpenRegistryKey")) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (deviceInstanceKeyType != PLUGPLAY_REGKEY_DEVICE) {
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+    *key = SimObjectCreate(SimObjectKey, keyAttributes, device);
+    return (*key != NULL) ? STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
+}
+
+NTSTATUS WdfRegistryQueryULong(WDFKEY key, PCUNICODE_STRING valueName, PULONG value)
+{
+    size_t length = valueName->Length / sizeof(WCHAR);
+    ULONG i;
+
+    if (!SimCheck(key, SimObjectKey, "WdfRegistryQueryULong")) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    for (i = 0; i < Sim.RegistryCount; i++) {
+        if (wcslen(Sim.Registry[i].Name) == length &&
+            wcsncmp(Sim.Registry[i].Name, valueName->Buffer, length) == 0) {
+            *value = Sim.Registry[i].Value;
+            return STATUS_SUCCESS;
+        }
+    }
+    return STATUS_OBJECT_NAME_NOT_FOUND;
+}
+
+VOID WdfRegistryClose(WDFKEY key)
+{
+    if (SimCheck(key, SimObjectKey, "WdfRegistryClose")) {
+        SimObjectFree(key);
+    }
+}
+
+//
+// Devices
+// 豸
+//
+VOID WdfDeviceInitSetPnpPowerEventCallbacks(PWDFDEVICE_INIT deviceInit,
+                                            PWDF_PNPPOWER_EVENT_CALLBACKS pnpPowerEventCallbacks)
+{
+    deviceInit->Pnp = *pnpPowerEventCallbacks;
+}
+
+VOID WdfDeviceInitSetRequestAttributes(PWDFDEVICE_INIT deviceInit,
+                                       PWDF_OBJECT_ATTRIBUTES requestAttributes)
+{
+    deviceInit->RequestAttributes = *requestAttributes;
+    deviceInit->HasRequestAttributes = TRUE;
+}
+
+VOID WdfDeviceInitSetIoInCallerContextCallback(PWDFDEVICE_INIT deviceInit,
+                                               PFN_WDF_IO_IN_CALLER_CONTEXT evtIoInCallerContext)
+{
+    deviceInit->InCallerContext = evtIoInCallerContext;
+}
+
+VOID WdfDeviceInitSetFileObjectConfig(PWDFDEVICE_INIT deviceInit,
+                                      PWDF_FILEOBJECT_CONFIG fileObjectConfig,
+                                      PWDF_OBJECT_ATTRIBUTES fileObjectAttributes)
+{
+    deviceInit->FileConfig = *fileObjectConfig;
+    if (fileObjectAttributes != NULL) {
+        deviceInit->FileAttributes = *fileObjectAttributes;
+        deviceInit->HasFileAttributes = TRUE;
+    }
+}
+
+NTSTATUS WdfDeviceCreate(PWDFDEVICE_INIT* deviceInit, PWDF_OBJECT_ATTRIBUTES deviceAttributes,
+                         WDFDEVICE* device)
+{
+    PSIM_OBJECT object;
+
+    if (*deviceInit != &Sim.Init || Sim.Device != NULL) {
+        SimFail("WdfDeviceCreate: invalid device init");
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+    object = SimObjectCreate(SimObjectDevice, deviceAttributes, Sim.Driver);
+    if (object == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    if (deviceAttributes != NULL &&
+        deviceAttributes->SynchronizationScope == WdfSynchronizationScopeDevice) {
+        object->SyncLock = object;
+    }
+    Sim.Device = object;
+    *deviceInit = NULL;
+    *device = object;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfDeviceCreateDeviceInterface(WDFDEVICE device, const GUID* interfaceClassGUID,
+                                        PCUNICODE_STRING referenceString)
+{
+    UNREFERENCED_PARAMETER(interfaceClassGUID);
+    UNREFERENCED_PARAMETER(referenceString);
+
+    return SimCheck(device, SimObjectDevice, "WdfDeviceCreateDeviceInterface") ?
+           STATUS_SUCCESS : STATUS_INVALID_PARAMETER;
+}
+
+WDFQUEUE WdfDeviceGetDefaultQueue(WDFDEVICE device)
+{
+    if (!SimCheck(device, SimObjectDevice, "WdfDeviceGetDefaultQueue")) {
+        return NULL;
+    }
+    return Sim.DefaultQueue;
+}
+
+NTSTATUS WdfDeviceConfigureRequestDispatching(WDFDEVICE device, WDFQUEUE queue,
+                                              WDF_REQUEST_TYPE requestType)
+{
+    if (!SimCheck(device, SimObjectDevice, "WdfDeviceConfigureRequestDispatching") ||
+        !SimCheck(queue, SimObjectQueue, "WdfDeviceConfigureRequestDispatching")) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (requestType >= WdfRequestTypeMax || Sim.Dispatch[requestType] != NULL) {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    Sim.Dispatch[requestType] = queue;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfDeviceEnqueueRequest(WDFDEVICE device, WDFREQUEST request)
+{
+    PSIM_OBJECT queue;
+
+    if (!SimCheck(device, SimObjectDevice, "WdfDeviceEnqueueRequest") ||
+        !SimCheckOwned(request, "WdfDeviceEnqueueRequest")) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (request->State != SimRequestArrived) {
+        SimFail("WdfDeviceEnqueueRequest: request %u is not in the caller's context", request->Id);
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    queue = Sim.Dispatch[request->RequestType];
+    if (queue == NULL) {
+        queue = Sim.DefaultQueue;
+    }
+    if (queue == NULL) {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    SimQueueInsert(queue, request, FALSE);
+    return STATUS_SUCCESS;
+}
+
+//
+// Simulator control
+// ģ
+//
+VOID SimInitialize(PSIM_CONFIG config)
+{
+    RtlZeroMemory(&Sim, sizeof(Sim));
+    Sim.Config = *config;
+    Sim.Now = SIM_BOOT_TIME_NS;
+    if (Sim.Config.Processors == 0) {
+        Sim.Config.Processors = 1;
+    }
+
+    // splitmix64 spreads small seeds over the whole state
+    Sim.Rng = config->Seed + 0x9E3779B97F4A7C15ULL;
+    Sim.Rng = (Sim.Rng ^ (Sim.Rng >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    Sim.Rng = (Sim.Rng ^ (Sim.Rng >> 27)) * 0x94D049BB133111EBULL;
+    Sim.Rng ^= Sim.Rng >> 31;
+    if (Sim.Rng == 0) {
+        Sim.Rng = 1;
+    }
+
+    Sim.Driver = SimObjectCreate(SimObjectDriver, NULL, NULL);
+    Sim.Init.FileConfig.FileObjectClass = WdfFileObjectNotRequired;
+}
+
+VOID SimShutdown(VOID)
+{
+    ULONG i;
+
+    if (Sim.Device != NULL) {
+        SimDeviceRemove();
+    }
+    for (i = 0; i < SIM_ZOMBIE_RING; i++) {
+        if (Sim.Zombies[i] != NULL) {
+            SimObjectFree(Sim.Zombies[i]);
+        }
+    }
+    if (Sim.Driver != NULL) {
+        SimObjectFree(Sim.Driver);
+    }
+    free(Sim.Events);
+    free(Sim.Actions);
+    Sim.Events = NULL;
+    Sim.Actions = NULL;
+    Sim.Driver = NULL;
+}
+
+NTSTATUS SimDeviceAdd(SIM_DEVICE_CREATE* create, WDFDEVICE* device)
+{
+    PWDFDEVICE_INIT deviceInit = &Sim.Init;
+    NTSTATUS status;
+
+    SIM_CALLBACK(SimCbDeviceAdd, NULL, status = create(deviceInit));
+    if (!NT_SUCCESS(status) && Sim.Device != NULL) {
+        SimObjectFree(Sim.Device);
+        Sim.Device = NULL;
+    }
+    *device = Sim.Device;
+    return status;
+}
+
+BOOLEAN SimDeviceIsPowered(VOID)
+{
+    return Sim.Powered;
+}
+
+//
+// 絽ڵʱʱ䣬ûΪ(ULONGLONG)-1
+//
+ULONGLONG SimTimerNextDue(VOID)
+{
+    ULONGLONG next = (ULONGLONG)-1;
+    ULONG i;
+
+    for (i = 0; i < Sim.TimerCount; i++) {
+        if (Sim.Timers[i]->Armed && Sim.Timers[i]->Due < next) {
+            next = Sim.Timers[i]->Due;
+        }
+    }
+    return next;
+}
+
+NTSTATUS SimDevicePowerUp(VOID)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PSIM_OBJECT request;
+
+    if (Sim.Device == NULL || Sim.Powered) {
+        SimFail("SimDevicePowerUp: the device is not powered down");
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+    for (request = Sim.Live; request != NULL; request = request->LiveNext) {
+        request->StopAcked = FALSE;
+    }
+    Sim.Powered = TRUE;
+    if (!Sim.Started) {
+        Sim.Started = TRUE;
+        if (Sim.Init.Pnp.EvtDeviceSelfManagedIoInit != NULL) {
+            SIM_CALLBACK(SimCbSelfManagedIoInit, NULL,
+                         status = Sim.Init.Pnp.EvtDeviceSelfManagedIoInit(Sim.Device));
+        }
+    }
+    else if (Sim.Init.Pnp.EvtDeviceSelfManagedIoRestart != NULL) {
+        SIM_CALLBACK(SimCbSelfManagedIoRestart, NULL,
+                     status = Sim.Init.Pnp.EvtDeviceSelfManagedIoRestart(Sim.Device));
+    }
+    if (!NT_SUCCESS(status)) {
+        SimFail("power-up callback failed 0x%x", status);
+    }
+    return status;
+}
+
+/*
+Function:
+    SimDeviceStopIo
+    ֹͣӵеI/O
+
+Routine Description:
+
+    Calls EvtIoStop for every request the driver owns in a queue that is
+    being stopped. On suspend the framework cannot leave D0 until each
+    of them is completed or acknowledged, so a request left in neither
+    state is reported as a hung power transition.
+    ֹͣĶӵеÿEvtIoStopʱÿ
+    ɻȷ֮ǰ޷뿪D0߶ǵ󱻱ΪĵԴת
+
+Arguments:
+
+    action - WdfRequestStopActionSuspend or WdfRequestStopActionPurge.
+             WdfRequestStopActionSuspendWdfRequestStopActionPurge
+
+Return Value:
+
+    VOID
+*/
+static VOID SimDeviceStopIo(ULONG action)
+{
+    PULONG ids;
+    ULONG count = 0;
+    ULONG i;
+    PSIM_OBJECT request;
+    PSIM_OBJECT queue;
+    ULONG flags;
+
+    ids = (PULONG)calloc(Sim.LiveCount + 1, sizeof(ULONG));
+    if (ids == NULL) {
+        return;
+    }
+    for (request = Sim.Live; request != NULL; request = request->LiveNext) {
+        if (request->State == SimRequestPresented && request->Queue != NULL &&
+            (request->Queue->PowerManaged || action == WdfRequestStopActionPurge)) {
+            ids[count++] = request->Id;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        request = SimRequestFind(ids[i]);
+        if (request == NULL || request->State != SimRequestPresented) {
+            continue;
+        }
+        queue = request->Queue;
+        if (queue->QueueConfig.EvtIoStop == NULL) {
+            if (action == WdfRequestStopActionSuspend) {
+                SimFail("power-down blocked: queue without EvtIoStop owns request %u",
+                        request->Id);
+            }
+            continue;
+        }
+        flags = action | (request->Cancelable ? WdfRequestStopRequestCancelable : 0);
+        request->StopAcked = FALSE;
+        SIM_CALLBACK(SimCbIoStop, queue->SyncLock,
+                     queue->QueueConfig.EvtIoStop(queue, request, flags));
+        if (action == WdfRequestStopActionSuspend &&
+            request->State == SimRequestPresented && !request->StopAcked) {
+            SimFail("power-down blocked: request %u neither completed nor acknowledged",
+                    request->Id);
+        }
+    }
+    free(ids);
+}
+
+VOID SimDevicePowerDown(VOID)
+{
+    if (Sim.Device == NULL || !Sim.Powered) {
+        SimFail("SimDevicePowerDown: the device is not powered up");
+        return;
+    }
+    if (Sim.Init.Pnp.EvtDeviceSelfManagedIoSuspend != NULL) {
+        NTSTATUS status;
+        SIM_CALLBACK(SimCbSelfManagedIoSuspend, NULL,
+                     status = Sim.Init.Pnp.EvtDeviceSelfManagedIoSuspend(Sim.Device));
+        if (!NT_SUCCESS(status)) {
+            SimFail("EvtDeviceSelfManagedIoSuspend failed 0x%x", status);
+        }
+    }
+    Sim.Powered = FALSE;
+    SimDeviceStopIo(WdfRequestStopActionSuspend);
+}
+
+/*
+Function:
+    SimDeviceRemove
+    Ƴ豸
+
+Routine Description:
+
+    Surprise-removes the device: powers it down, purges every queue,
+    runs the cancel routines still pending and deletes the device with
+    all its children. Requests still not completed afterwards, and echo
+    buffers still allocated, are reported as leaks.
+    Ƴ豸Ϊϵ磬ÿУԴȡ̣ɾ豸
+    Ӷ󡣴˺δɵԼѷĻԻΪй©
+
+Arguments:
+
+Return Value:
+
+    VOID
+*/
+VOID SimDeviceRemove(VOID)
+{
+    PSIM_OBJECT request;
+    PSIM_OBJECT child;
+    ULONG i;
+    ULONG leaked = 0;
+    size_t leakedBytes = 0;
+
+    if (Sim.Device == NULL) {
+        return;
+    }
+    if (Sim.Powered) {
+        SimDevicePowerDown();
+    }
+    SimDeviceStopIo(WdfRequestStopActionPurge);
+
+    for (i = 0; i < Sim.QueueCount; i++) {
+        while (Sim.Queues[i]->Head != NULL) {
+            SimRequestComplete(Sim.Queues[i]->Head, STATUS_CANCELLED, 0);
+        }
+    }
+    for (request = Sim.Live; request != NULL; ) {
+        PSIM_OBJECT next = request->LiveNext;
+        if (request->CancelPending) {
+            SimRunCancel(request);
+        }
+        request = next;
+    }
+    while ((request = Sim.Live) != NULL) {
+        SimFail("request %u still owned by the driver after removal", request->Id);
+        request->Cancelable = FALSE;
+        request->CancelPending = FALSE;
+        SimRequestComplete(request, STATUS_CANCELLED, 0);
+    }
+
+    SimObjectFree(Sim.Device);
+    Sim.Device = NULL;
+    Sim.Powered = FALSE;
+
+    for (child = Sim.Driver->Children; child != NULL; child = child->Sibling) {
+        if (child->Type == SimObjectMemory) {
+            leaked++;
+            leakedBytes += child->MemorySize;
+        }
+    }
+    if (leaked != 0) {
+        SimFail("%u memory object(s), %lu bytes, leaked after removal",
+                leaked, (unsigned long)leakedBytes);
+    }
+}
+
+WDFFILEOBJECT SimFileOpen(VOID)
+{
+    PSIM_OBJECT file;
+    PSIM_OBJECT request;
+    NTSTATUS status;
+
+    if (Sim.Device == NULL) {
+        return NULL;
+    }
+    file = SimObjectCreate(SimObjectFile,
+                           Sim.Init.HasFileAttributes ? &Sim.Init.FileAttributes : NULL,
+                           Sim.Device);
+    request = SimRequestCreate(WdfRequestTypeCreate, file);
+    if (file == NULL || request == NULL) {
+        return NULL;
+    }
+    request->State = SimRequestPresented;
+
+    if (Sim.Init.FileConfig.EvtDeviceFileCreate != NULL) {
+        SIM_CALLBACK(SimCbFileCreate, Sim.Device->SyncLock,
+                     Sim.Init.FileConfig.EvtDeviceFileCreate(Sim.Device, request, file));
+    }
+    else {
+        SimRequestComplete(request, STATUS_SUCCESS, 0);
+    }
+    if (request->State != SimRequestCompleted) {
+        SimFail("create request %u was not completed", request->Id);
+        return NULL;
+    }
+    status = request->Status;
+    if (!NT_SUCCESS(status)) {
+        SimObjectFree(file);
+        return NULL;
+    }
+    return file;
+}
+
+ULONG SimSubmit(PSIM_IO io)
+{
+    PSIM_OBJECT request;
+    ULONG id;
+
+    if (Sim.Device == NULL) {
+        return 0;
+    }
+    request = SimRequestCreate(io->Type, io->File);
+    if (request == NULL) {
+        return 0;
+    }
+    request->Buffer = io->Buffer;
+    request->Length = io->Length;
+    request->Completion = io->Completion;
+    request->CompletionContext = io->Context;
+    if (io->Type == WdfRequestTypeDeviceIoControl) {
+        request->IoControlCode = io->IoControlCode;
+        request->InputLength = io->InputLength;
+        request->OutputLength = io->OutputLength;
+        request->OutputBuffer = io->OutputBuffer;
+        request->SystemBuffer = (PUCHAR)calloc(1, max(io->InputLength, io->OutputLength) + 1);
+        if (io->InputLength != 0) {
+            memcpy(request->SystemBuffer, io->InputBuffer, io->InputLength);
+        }
+    }
+    id = request->Id;
+
+    if (Sim.Init.InCallerContext != NULL) {
+        SIM_CALLBACK(SimCbInCallerContext, NULL, Sim.Init.InCallerContext(Sim.Device, request));
+        if (request->State == SimRequestArrived) {
+            SimFail("EvtIoInCallerContext neither queued nor completed request %u", id);
+        }
+    }
+    else if (!NT_SUCCESS(WdfDeviceEnqueueRequest(Sim.Device, request))) {
+        SimRequestComplete(request, STATUS_INVALID_DEVICE_REQUEST, 0);
+    }
+    return id;
+}
+
+BOOLEAN SimCancel(ULONG requestId)
+{
+    PSIM_OBJECT request = SimRequestFind(requestId);
+
+    if (request == NULL || request->CancelRequested) {
+        return FALSE;
+    }
+    request->CancelRequested = TRUE;
+    if (request->State == SimRequestQueued) {
+        SimRequestComplete(request, STATUS_CANCELLED, 0);
+    }
+    else if (request->Cancelable) {
+        request->CancelPending = TRUE;
+    }
+    return TRUE;
+}
+
+/*
+Function:
+    SimStepUntil
+    ִһ
+
+Routine Description:
+
+    Runs the next action. Every action that could happen at the current
+    virtual time is a candidate and one is chosen at random, which is
+    how the simulator explores interleavings the real framework allows.
+    һǰʱܷÿǺѡѡһ
+    ģԴ̽ʵĽ˳
+
+Arguments:
+
+    limit - Virtual time not to move past.
+            ʱ
+
+Return Value:
+
+    BOOLEAN - FALSE if nothing is left to run before the limit.
+              ֮ǰûпеĶΪFALSE
+*/
+static BOOLEAN SimStepUntil(ULONGLONG limit)
+{
+    PSIM_OBJECT request;
+    SIM_ACTION action;
+    SIM_EVENT event;
+    ULONGLONG next;
+    ULONG count;
+    ULONG needed;
+    ULONG i;
+
+    for (;;) {
+        needed = Sim.QueueCount + Sim.TimerCount + Sim.LiveCount + 1;
+        if (needed > Sim.ActionCapacity) {
+            Sim.ActionCapacity = needed * 2;
+            Sim.Actions = (PSIM_ACTION)realloc(Sim.Actions, Sim.ActionCapacity * sizeof(SIM_ACTION));
+            if (Sim.Actions == NULL) {
+                fprintf(stderr, "echosim: out of memory\n");
+                exit(2);
+            }
+        }
+
+        count = 0;
+        for (i = 0; i < Sim.QueueCount; i++) {
+            if (SimQueueCanDispatch(Sim.Queues[i])) {
+                Sim.Actions[count].Type = SimActionDispatch;
+                Sim.Actions[count++].Target = Sim.Queues[i];
+            }
+        }
+        for (i = 0; i < Sim.TimerCount; i++) {
+            if (Sim.Timers[i]->Armed && Sim.Timers[i]->Due <= Sim.Now) {
+                Sim.Actions[count].Type = SimActionTimer;
+                Sim.Actions[count++].Target = Sim.Timers[i];
+            }
+        }
+        for (request = Sim.Live; request != NULL; request = request->LiveNext) {
+            if (request->CancelPending) {
+                Sim.Actions[count].Type = SimActionCancel;
+                Sim.Actions[count++].Target = request;
+            }
+        }
+        if (Sim.EventCount != 0 && Sim.Events[0].Time <= Sim.Now) {
+            Sim.Actions[count].Type = SimActionEvent;
+            Sim.Actions[count++].Target = NULL;
+        }
+
+        if (count != 0) {
+            break;
+        }
+
+        next = (ULONGLONG)-1;
+        if (Sim.EventCount != 0) {
+            next = Sim.Events[0].Time;
+        }
+        for (i = 0; i < Sim.TimerCount; i++) {
+            if (Sim.Timers[i]->Armed && Sim.Timers[i]->Due < next) {
+                next = Sim.Timers[i]->Due;
+            }
+        }
+        if (next == (ULONGLONG)-1 || next > limit) {
+            return FALSE;
+        }
+        Sim.Now = next;
+    }
+
+    action = Sim.Actions[SimRandom() % count];
+    switch (action.Type) {
+    case SimActionDispatch:
+        SimQueueDispatch(action.Target);
+        break;
+    case SimActionTimer:
+        SimRunTimer(action.Target);
+        break;
+    case SimActionCancel:
+        SimRunCancel(action.Target);
+        break;
+    case SimActionEvent:
+        event = SimEventPop();
+        event.Routine(event.Context, event.Status, event.Information);
+        break;
+    }
+    return TRUE;
+}
+
+BOOLEAN SimStep(VOID)
+{
+    return SimStepUntil((ULONGLONG)-1);
+}
+
+ULONGLONG SimRun(ULONGLONG untilNs)
+{
+    ULONGLONG steps = 0;
+
+    while (SimStepUntil(untilNs)) {
+        steps++;
+    }
+    if (Sim.Now < untilNs) {
+        Sim.Now = untilNs;
+    }
+    return steps;
+}
+
+VOID SimPrintCallbackTimes(FILE* out)
+{
+    ULONG i;
+
+    fprintf(out, "%-32s %12s %12s %12s\n", "callback (host time)", "calls", "avg ns", "max ns");
+    for (i = 0; i < SimCbCount; i++) {
+        if (SimCallbacks[i].Count == 0) {
+            continue;
+        }
+        fprintf(out, "%-32s %12llu %12llu %12llu\n", SimCallbacks[i].Name,
+                (unsigned long long)SimCallbacks[i].Count,
+                (unsigned long long)(SimCallbacks[i].TotalNs / SimCallbacks[i].Count),
+                (unsigned long long)SimCallbacks[i].MaxNs);
+    }
+}
@@ -0,0 +1,105 @@
+/*
+
+Module Name:
+
+    wdfsim.h
+
+Abstract:
+
+    Control interface of the host framework simulator. The harness adds
+    the device, powers it up and down, opens files, submits and cancels
+    requests and advances virtual time; the simulator runs the driver
+    callbacks one at a time, choosing among everything that could run
+    next with a seeded generator, so a seed reproduces a schedule exactly.
+    Framework rules the echo driver relies on are checked as it runs and
+    every violation is counted as an error.
+    ģĿƽӿڡԳ豸ΪϵͶϵ硢ļ
+    ύȡƽʱ䣻ģһһصôӵ
+    пе¼ѡһһӿԾȷһεȡ
+    Ŀܹʱ飬ÿΥΪһ
+
+Environment:
+
+    host simulator only
+    ģ
+
+*/
+
+#pragma once
+
+#include <windows.h>
+#include <wdf.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _SIM_CONFIG {
+    ULONGLONG Seed;
+    ULONG     Processors;
+    BOOLEAN   Verbose;
+} SIM_CONFIG, *PSIM_CONFIG;
+
+//
+// Routine run for a scheduled client event or a request completion
+// ΪѵȵĿͻ¼е
+//
+typedef VOID SIM_ROUTINE(PVOID context, NTSTATUS status, ULONG_PTR information);
+
+typedef struct _SIM_IO {
+    WDF_REQUEST_TYPE Type;
+    WDFFILEOBJECT    File;
+    PVOID            Buffer;            // read/write data
+    size_t           Length;
+    ULONG            IoControlCode;
+    PVOID            InputBuffer;       // device control
+    size_t           InputLength;
+    PVOID            OutputBuffer;
+    size_t           OutputLength;
+    SIM_ROUTINE*     Completion;
+    PVOID            Context;
+} SIM_IO, *PSIM_IO;
+
+typedef NTSTATUS SIM_DEVICE_CREATE(PWDFDEVICE_INIT deviceInit);
+
+VOID SimInitialize(PSIM_CONFIG config);
+
+VOID SimShutdown(VOID);
+
+VOID SimRegistrySetULong(PCWSTR name, ULONG value);
+
+NTSTATUS SimDeviceAdd(SIM_DEVICE_CREATE* create, WDFDEVICE* device);
+
+NTSTATUS SimDevicePowerUp(VOID);
+
+VOID SimDevicePowerDown(VOID);
+
+VOID SimDeviceRemove(VOID);
+
+BOOLEAN SimDeviceIsPowered(VOID);
+
+ULONGLONG SimTimerNextDue(VOID);
+
+WDFFILEOBJECT SimFileOpen(VOID);
+
+ULONG SimSubmit(PSIM_IO io);
+
+BOOLEAN SimCancel(ULONG requestId);
+
+VOID SimSchedule(ULONGLONG delayNs, SIM_ROUTINE* routine, PVOID context);
+
+BOOLEAN SimStep(VOID);
+
+ULONGLONG SimRun(ULONGLONG untilNs);
+
+ULONGLONG SimNow(VOID);
+
+ULONGLONG SimRandom(VOID);
+
+ULONG SimErrors(VOID);
+
+VOID SimPrintCallbackTimes(FILE* out);
+
+#ifdef __cplusplus
+}
+#endif